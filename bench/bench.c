@@ -0,0 +1,617 @@
+/**
+ * Micro benchmark of hash_map, flat_hash_map and bp_tree.
+ *
+ * Build from repository root with all sources of src directory:
+ *
+ *     cc -O2 -DNDEBUG -Iinclude -pthread $(ls src/[a-z]*.c) bench/bench.c -o bench_run -lm
+ *
+ * Output of two commits can be compared line by line to catch regressions, for example
+ * ./bench_run -n 1000000 > bench_output.txt.
+ *
+ * Each run (container, distribution, size, degree) is executed in forked process, so peak RSS
+ * belongs to one run and runs do not share allocator state. Keys are generated from seed, so same
+ * arguments give same workload. Every operation is printed as one JSON object per line:
+ *
+ *     {"container":"bp_tree","distribution":"zipf","size":1000000,"degree":64,"seed":1,"op":"lookup",
+ *      "ops":1000000,"seconds":0.41,"ops_per_sec":2439024.4,"p50_ns":310,"p99_ns":1290,"peak_rss_kb":81234}
+ *
+ * Options (lists are separated by comma):
+ *
+ *     -c containers    hash_map,flat_hash_map,bp_tree
+ *     -d distributions sequential,uniform,zipf,clustered
+ *     -n sizes         1000,100000,1000000 (up to 100000000)
+ *     -g degrees       16,64,256 (bp_tree only)
+ *     -s seed          1
+ *     -m samples       maximal count of timed operations for percentiles, 1048576
+ */
+#include <getopt.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bp_tree.h>
+#include <flat_hash_map.h>
+#include <hash_map.h>
+
+/**
+ * Count of keys visited by one scan operation.
+ */
+#define BENCH_SCAN_LENGTH 100
+
+/**
+ * Count of consecutive keys in one cluster of clustered distribution.
+ */
+#define BENCH_CLUSTER_LENGTH 64
+
+/**
+ * Skew of zipf distribution (same as in YCSB).
+ */
+#define BENCH_ZIPF_THETA 0.99
+
+/**
+ * Key of all containers, both cores are in one node so workload is same for all containers.
+ */
+struct bench_node
+{
+    struct hash_map_node hash_core;
+    struct bp_tree_node tree_core;
+    long long key;
+};
+
+/**
+ * Generator of keys of one distribution.
+ */
+struct bench_generator
+{
+    const char *distribution;
+    unsigned long long state;
+    long long size;
+    long long next;
+
+    /** First key of current cluster of clustered distribution */
+    long long base;
+
+    /** Constants of zipf distribution */
+    double zeta;
+    double alpha;
+    double eta;
+};
+
+/**
+ * Parameters of one run.
+ */
+struct bench_run
+{
+    const char *container;
+    const char *distribution;
+    long long size;
+    int degree;
+    unsigned long long seed;
+    long long max_samples;
+};
+
+/**
+ * Container under benchmark, operations return 1 if key was found (or replaced).
+ */
+struct bench_container
+{
+    struct hash_map hash_map;
+    struct flat_hash_map flat_hash_map;
+    struct bp_tree bp_tree;
+    const char *name;
+};
+
+/**
+ * One timed phase of run.
+ */
+struct bench_phase
+{
+    const char *op;
+    long long ops;
+    double seconds;
+    long long *samples;
+    long long sample_count;
+};
+
+static unsigned long long bench_random(unsigned long long *state)
+{
+    /* xorshift64* */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static unsigned long long bench_mix(unsigned long long value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+static long long bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+static void bench_generator_init(struct bench_generator *generator,
+                                 const char *distribution,
+                                 long long size,
+                                 unsigned long long seed)
+{
+    generator->distribution = distribution;
+    generator->state = bench_mix(seed) | 1;
+    generator->size = size;
+    generator->next = 0;
+    generator->base = 0;
+    generator->zeta = 0;
+
+    if (strcmp(distribution, "zipf") == 0)
+    {
+        /* Gray et al., "Quickly generating billion-record synthetic databases" */
+        double zeta_2 = 1 + pow(0.5, BENCH_ZIPF_THETA);
+
+        for (long long i = 1; i <= size; i++)
+        {
+            generator->zeta += 1 / pow((double)i, BENCH_ZIPF_THETA);
+        }
+
+        generator->alpha = 1 / (1 - BENCH_ZIPF_THETA);
+        generator->eta = (1 - pow(2.0 / size, 1 - BENCH_ZIPF_THETA)) / (1 - zeta_2 / generator->zeta);
+    }
+}
+
+/**
+ * Next key of distribution. Keys are non-negative and fit in 62 bits.
+ */
+static long long bench_generator_next(struct bench_generator *generator)
+{
+    unsigned long long random = bench_random(&generator->state);
+
+    if (strcmp(generator->distribution, "sequential") == 0)
+    {
+        return generator->next++;
+    }
+
+    if (strcmp(generator->distribution, "uniform") == 0)
+    {
+        return (long long)(random >> 2);
+    }
+
+    if (strcmp(generator->distribution, "zipf") == 0)
+    {
+        /* Rank is scrambled, so hot keys are spread over key space */
+        double u = (double)(random >> 11) / (double)(1ull << 53);
+        double uz = u * generator->zeta;
+        long long rank = 0;
+
+        if (uz >= 1.0)
+        {
+            rank = uz < 1 + pow(0.5, BENCH_ZIPF_THETA)
+                       ? 1
+                       : (long long)(generator->size * pow(generator->eta * u - generator->eta + 1, generator->alpha));
+        }
+
+        rank = rank < generator->size ? rank : generator->size - 1;
+        return (long long)(bench_mix((unsigned long long)rank) >> 2);
+    }
+
+    /* Clustered: runs of consecutive keys at random places */
+    long long offset = generator->next++ % BENCH_CLUSTER_LENGTH;
+
+    if (offset == 0)
+    {
+        generator->base = (long long)((random >> 2) & ~(unsigned long long)(BENCH_CLUSTER_LENGTH - 1));
+    }
+
+    return generator->base + offset;
+}
+
+static int bench_hash(struct hash_map_node *node)
+{
+    return (int)(bench_mix((unsigned long long)((struct bench_node *)node)->key) & 0x7fffffff);
+}
+
+static int bench_hash_cmp(struct hash_map_node *first, struct hash_map_node *second)
+{
+    long long first_key = ((struct bench_node *)first)->key;
+    long long second_key = ((struct bench_node *)second)->key;
+    return first_key < second_key ? -1 : first_key > second_key ? 1 : 0;
+}
+
+static struct bench_node *bench_tree_node(struct bp_tree_node *node)
+{
+    return (struct bench_node *)((char *)node - offsetof(struct bench_node, tree_core));
+}
+
+static int bench_tree_cmp(struct bp_tree_node *first, struct bp_tree_node *second)
+{
+    long long first_key = bench_tree_node(first)->key;
+    long long second_key = bench_tree_node(second)->key;
+    return first_key < second_key ? -1 : first_key > second_key ? 1 : 0;
+}
+
+static long long bench_tree_prefix(struct bp_tree_node *node)
+{
+    return bench_tree_node(node)->key;
+}
+
+static void bench_free_hash_node(struct hash_map_node *node)
+{
+    (void)node;
+}
+
+static void bench_container_init(struct bench_container *container, const char *name, int degree)
+{
+    container->name = name;
+
+    if (strcmp(name, "hash_map") == 0)
+    {
+        hash_map_init(&container->hash_map, bench_hash_cmp, bench_hash);
+    }
+    else if (strcmp(name, "flat_hash_map") == 0)
+    {
+        flat_hash_map_init(&container->flat_hash_map, bench_hash_cmp, bench_hash);
+    }
+    else
+    {
+        bp_tree_init(&container->bp_tree, degree, bench_tree_cmp);
+        bp_tree_set_key_mode(&container->bp_tree, BP_TREE_KEY_INT64, bench_tree_prefix);
+    }
+}
+
+static int bench_insert(struct bench_container *container, struct bench_node *node)
+{
+    if (strcmp(container->name, "hash_map") == 0)
+    {
+        return hash_map_insert(&container->hash_map, &node->hash_core) != NULL;
+    }
+
+    if (strcmp(container->name, "flat_hash_map") == 0)
+    {
+        return flat_hash_map_insert(&container->flat_hash_map, &node->hash_core) != NULL;
+    }
+
+    return bp_tree_insert(&container->bp_tree, &node->tree_core) != NULL;
+}
+
+static int bench_lookup(struct bench_container *container, struct bench_node *key)
+{
+    if (strcmp(container->name, "hash_map") == 0)
+    {
+        return hash_map_find(&container->hash_map, &key->hash_core) != NULL;
+    }
+
+    if (strcmp(container->name, "flat_hash_map") == 0)
+    {
+        return flat_hash_map_find(&container->flat_hash_map, &key->hash_core) != NULL;
+    }
+
+    return bp_tree_lookup(&container->bp_tree, &key->tree_core) != NULL;
+}
+
+static int bench_delete(struct bench_container *container, struct bench_node *key)
+{
+    if (strcmp(container->name, "hash_map") == 0)
+    {
+        return hash_map_delete(&container->hash_map, &key->hash_core) != NULL;
+    }
+
+    if (strcmp(container->name, "flat_hash_map") == 0)
+    {
+        return flat_hash_map_delete(&container->flat_hash_map, &key->hash_core) != NULL;
+    }
+
+    return bp_tree_delete(&container->bp_tree, &key->tree_core) != NULL;
+}
+
+/**
+ * Visit BENCH_SCAN_LENGTH keys from key in ascending order, returns count of visited keys.
+ */
+static int bench_scan(struct bench_container *container, struct bench_node *key)
+{
+    struct bp_tree_cursor cursor;
+    int count = 0;
+
+    for (struct bp_tree_node *node = bp_tree_cursor_seek(&cursor, &container->bp_tree, &key->tree_core);
+         node != NULL && count < BENCH_SCAN_LENGTH;
+         node = bp_tree_cursor_next(&cursor))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+static void bench_container_free(struct bench_container *container)
+{
+    /* Nodes belong to run, containers only release their memory */
+    if (strcmp(container->name, "hash_map") == 0)
+    {
+        hash_map_free(&container->hash_map, bench_free_hash_node);
+    }
+    else if (strcmp(container->name, "flat_hash_map") == 0)
+    {
+        flat_hash_map_free(&container->flat_hash_map, bench_free_hash_node);
+    }
+    else
+    {
+        bp_tree_free(&container->bp_tree, NULL);
+    }
+}
+
+static int bench_compare_samples(const void *first, const void *second)
+{
+    long long first_sample = *(const long long *)first;
+    long long second_sample = *(const long long *)second;
+    return first_sample < second_sample ? -1 : first_sample > second_sample ? 1 : 0;
+}
+
+static long long bench_percentile(struct bench_phase *phase, double percentile)
+{
+    if (phase->sample_count == 0)
+    {
+        return 0;
+    }
+
+    long long index = (long long)(percentile * (double)(phase->sample_count - 1) + 0.5);
+    return phase->samples[index];
+}
+
+static void bench_report(struct bench_run *run, struct bench_phase *phase)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    qsort(phase->samples, (size_t)phase->sample_count, sizeof(long long), bench_compare_samples);
+
+    printf("{\"container\":\"%s\",\"distribution\":\"%s\",\"size\":%lld,\"degree\":%d,\"seed\":%llu,"
+           "\"op\":\"%s\",\"ops\":%lld,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+           "\"p50_ns\":%lld,\"p99_ns\":%lld,\"peak_rss_kb\":%ld}\n",
+           run->container,
+           run->distribution,
+           run->size,
+           strcmp(run->container, "bp_tree") == 0 ? run->degree : 0,
+           run->seed,
+           phase->op,
+           phase->ops,
+           phase->seconds,
+           phase->seconds > 0 ? (double)phase->ops / phase->seconds : 0.0,
+           bench_percentile(phase, 0.50),
+           bench_percentile(phase, 0.99),
+           usage.ru_maxrss);
+    fflush(stdout);
+}
+
+/**
+ * Run one operation over each key. Every stride-th operation is timed alone for percentiles,
+ * throughput is measured over whole phase.
+ */
+static void bench_phase_run(struct bench_run *run,
+                            struct bench_phase *phase,
+                            struct bench_container *container,
+                            struct bench_node *keys,
+                            long long ops,
+                            int (*operation)(struct bench_container *container, struct bench_node *node))
+{
+    long long stride = ops / run->max_samples + 1;
+    volatile long long found = 0;
+    phase->ops = ops;
+    phase->sample_count = 0;
+
+    long long start = bench_now();
+
+    for (long long i = 0; i < ops; i++)
+    {
+        if (i % stride == 0)
+        {
+            long long op_start = bench_now();
+            found += operation(container, &keys[i]);
+            phase->samples[phase->sample_count++] = bench_now() - op_start;
+        }
+        else
+        {
+            found += operation(container, &keys[i]);
+        }
+    }
+
+    phase->seconds = (double)(bench_now() - start) / 1e9;
+    bench_report(run, phase);
+}
+
+static int bench_run(struct bench_run *run)
+{
+    struct bench_container container;
+    struct bench_generator generator;
+    struct bench_phase phase;
+    long long size = run->size;
+
+    struct bench_node *nodes = (struct bench_node *)malloc((size_t)size * sizeof(struct bench_node));
+    struct bench_node *probes = (struct bench_node *)malloc((size_t)size * sizeof(struct bench_node));
+    phase.samples = (long long *)malloc((size_t)(run->max_samples + 1) * sizeof(long long));
+
+    if (nodes == NULL || probes == NULL || phase.samples == NULL)
+    {
+        fprintf(stderr, "bench: can not allocate %lld keys\n", size);
+        return -1;
+    }
+
+    bench_generator_init(&generator, run->distribution, size, run->seed);
+
+    for (long long i = 0; i < size; i++)
+    {
+        nodes[i].key = bench_generator_next(&generator);
+    }
+
+    /* Zipf probes are second stream of distribution (hot keys are hit often), others are random inserted keys */
+    int zipf = strcmp(run->distribution, "zipf") == 0;
+    unsigned long long state = bench_mix(run->seed + 1) | 1;
+    bench_generator_init(&generator, run->distribution, zipf ? size : 0, run->seed + 1);
+
+    for (long long i = 0; i < size; i++)
+    {
+        probes[i].key = zipf ? bench_generator_next(&generator) : nodes[bench_random(&state) % (unsigned long long)size].key;
+    }
+
+    bench_container_init(&container, run->container, run->degree);
+
+    phase.op = "insert";
+    bench_phase_run(run, &phase, &container, nodes, size, bench_insert);
+
+    phase.op = "lookup";
+    bench_phase_run(run, &phase, &container, probes, size, bench_lookup);
+
+    if (strcmp(run->container, "bp_tree") == 0)
+    {
+        phase.op = "scan";
+        bench_phase_run(run, &phase, &container, probes, size / BENCH_SCAN_LENGTH + 1, bench_scan);
+    }
+
+    phase.op = "delete";
+    bench_phase_run(run, &phase, &container, nodes, size, bench_delete);
+
+    bench_container_free(&container);
+    free(phase.samples);
+    free(probes);
+    free(nodes);
+    return 0;
+}
+
+/**
+ * Split comma separated list in place, returns count of items.
+ */
+static int bench_split(char *list, char **items, int capacity)
+{
+    int count = 0;
+
+    for (char *item = strtok(list, ","); item != NULL && count < capacity; item = strtok(NULL, ","))
+    {
+        items[count++] = item;
+    }
+
+    return count;
+}
+
+static int bench_known(const char *value, const char *const *known)
+{
+    for (int i = 0; known[i] != NULL; i++)
+    {
+        if (strcmp(value, known[i]) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const known_containers[] = {"hash_map", "flat_hash_map", "bp_tree", NULL};
+    static const char *const known_distributions[] = {"sequential", "uniform", "zipf", "clustered", NULL};
+    char container_list[256] = "hash_map,flat_hash_map,bp_tree";
+    char distribution_list[256] = "sequential,uniform,zipf,clustered";
+    char size_list[256] = "1000,100000,1000000";
+    char degree_list[256] = "16,64,256";
+    struct bench_run run;
+    run.seed = 1;
+    run.max_samples = 1 << 20;
+
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:n:g:s:m:")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            snprintf(container_list, sizeof(container_list), "%s", optarg);
+            break;
+        case 'd':
+            snprintf(distribution_list, sizeof(distribution_list), "%s", optarg);
+            break;
+        case 'n':
+            snprintf(size_list, sizeof(size_list), "%s", optarg);
+            break;
+        case 'g':
+            snprintf(degree_list, sizeof(degree_list), "%s", optarg);
+            break;
+        case 's':
+            run.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            run.max_samples = atoll(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c containers] [-d distributions] [-n sizes] [-g degrees] [-s seed] [-m samples]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    char *containers[8];
+    char *distributions[8];
+    char *sizes[32];
+    char *degrees[32];
+    int container_count = bench_split(container_list, containers, 8);
+    int distribution_count = bench_split(distribution_list, distributions, 8);
+    int size_count = bench_split(size_list, sizes, 32);
+    int degree_count = bench_split(degree_list, degrees, 32);
+    int failed = 0;
+
+    for (int c = 0; c < container_count; c++)
+    {
+        for (int d = 0; d < distribution_count; d++)
+        {
+            if (!bench_known(containers[c], known_containers) || !bench_known(distributions[d], known_distributions))
+            {
+                fprintf(stderr, "bench: unknown container %s or distribution %s\n", containers[c], distributions[d]);
+                return 2;
+            }
+
+            for (int n = 0; n < size_count; n++)
+            {
+                /* Degree matters only for tree */
+                for (int g = 0; g < (strcmp(containers[c], "bp_tree") == 0 ? degree_count : 1); g++)
+                {
+                    run.container = containers[c];
+                    run.distribution = distributions[d];
+                    run.size = atoll(sizes[n]);
+                    run.degree = atoi(degrees[g]);
+
+                    if (run.size <= 0 || run.size > 100000000 || run.degree < 4 || run.max_samples <= 0)
+                    {
+                        fprintf(stderr, "bench: size must be in [1, 100000000], degree at least 4\n");
+                        return 2;
+                    }
+
+                    /* Each run in own process, so peak RSS and allocator state are not shared */
+                    pid_t child = fork();
+
+                    if (child == 0)
+                    {
+                        exit(bench_run(&run) == 0 ? 0 : 1);
+                    }
+
+                    int status = 0;
+
+                    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    {
+                        fprintf(stderr, "bench: run %s/%s/%lld/%d failed\n", run.container, run.distribution, run.size, run.degree);
+                        failed = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    return failed;
+}
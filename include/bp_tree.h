@@ -1,7 +1,25 @@
 #pragma once
 
+#include <pthread.h>
 #include <stdlib.h>
 
+#include <epoch.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Nodes are aligned to cache line and their size is multiple of cache line.
+ */
+#define BP_TREE_CACHE_LINE 64
+
+/**
+ * Count of nodes allocated by slab at once.
+ */
+#define BP_TREE_SLAB_CHUNK_NODES 64
+
 /**
  * Basic node for item. You must derivative this struct for insert.
  *
@@ -18,6 +36,27 @@ struct bp_tree_node
 {
 };
 
+/**
+ * Storage of keys in nodes.
+ */
+enum bp_tree_key_mode
+{
+    /** Nodes store pointers to keys, keys are compared by comparator */
+    BP_TREE_KEY_POINTER,
+
+    /** Nodes also store 64-bit integer key inline, comparator is not called */
+    BP_TREE_KEY_INT64,
+
+    /** Nodes also store 64-bit order preserving key prefix inline, comparator is called only for equal prefixes */
+    BP_TREE_KEY_PREFIX,
+
+    /**
+     * Same as BP_TREE_KEY_PREFIX for binary keys, but inner nodes skip common prefix of their
+     * separators and store next 64 bits of each separator inline, see bp_tree_set_key_bytes
+     */
+    BP_TREE_KEY_BYTES,
+};
+
 /**
  * Inner node of B+ tree.
  */
@@ -32,6 +71,18 @@ struct bp_tree_struct_node
     struct bp_tree_struct_node *right;
     struct bp_tree_struct_node *parent;
     struct bp_tree_node **keys;
+
+    /** Inline keys (or key prefixes) for keys, NULL in BP_TREE_KEY_POINTER mode */
+    long long *prefixes;
+
+    /** Length of common prefix of separators in BP_TREE_KEY_BYTES mode, -1 if keys were changed */
+    int skip;
+
+    /** Count of keys in subtree of non leaf node, count of leaf is its size */
+    int count;
+
+    /** Optimistic lock in concurrent mode: lock and obsolete bits, counter of changes */
+    unsigned long long version;
 };
 
 struct bp_tree_non_leaf_node
@@ -43,13 +94,129 @@ struct bp_tree_non_leaf_node
 struct bp_tree_leaf_node
 {
     struct bp_tree_struct_node core;
-    int index;
+};
+
+/**
+ * Allocator of same size node blocks. Blocks are carved from chunks and freed
+ * blocks are recycled, chunks are released only with tree.
+ */
+struct bp_tree_slab
+{
+    /** Size of one block (node with keys, inline keys and children) */
+    size_t block_size;
+
+    /** Freed blocks linked by parent field */
+    struct bp_tree_struct_node *free_list;
+
+    /** Allocated chunks, first cache line of chunk links next chunk */
+    void *chunks;
+
+    /** Not used part of last chunk */
+    char *cursor;
+    char *limit;
+
+    /** Count of allocated chunks */
+    int chunk_count;
+
+    /** Count of nodes in use */
+    int node_count;
+
+    /** Count of freed nodes ready for reuse */
+    int free_count;
 };
 
 struct bp_tree_batch
 {
     struct bp_tree_node **nodes;
     int size;
+
+    /** Error of write in result batch: 0 or BP_TREE_ERROR_WAL, not read from input batch */
+    int error;
+};
+
+/**
+ * Flags of bp_tree_set_stats.
+ */
+#define BP_TREE_STATS_ON 1
+#define BP_TREE_STATS_HARDWARE 2
+
+/**
+ * Count of buckets of node fill histograms, bucket of node is size * buckets / (degree + 1).
+ */
+#define BP_TREE_STATS_FILL_BUCKETS 8
+
+/**
+ * Cost of one kind of operation, summed over operations.
+ */
+struct bp_tree_op_stats
+{
+    long long count;
+
+    /** Calls of comparator (inline keys are compared without it) */
+    long long comparisons;
+
+    /** Nodes visited by descents, restarts of optimistic lookups are included */
+    long long nodes;
+
+    /** Count of operations measured by hardware counters, cycles and misses are summed over them */
+    long long measured;
+    long long cycles;
+    long long cache_misses;
+};
+
+/**
+ * Snapshot of tree cost, see bp_tree_get_stats.
+ */
+struct bp_tree_stats
+{
+    /** Single key operations, batch operations are not measured */
+    struct bp_tree_op_stats lookups;
+    struct bp_tree_op_stats inserts;
+    struct bp_tree_op_stats deletes;
+
+    /** Hardware counters are measured (perf_event_open is available) */
+    int hardware;
+
+    int size;
+    int height;
+    int leaf_count;
+    int non_leaf_count;
+
+    /** Count of nodes by fill */
+    int leaf_fill[BP_TREE_STATS_FILL_BUCKETS];
+    int non_leaf_fill[BP_TREE_STATS_FILL_BUCKETS];
+
+    /** Copies of structural counters of tree */
+    int split_leaf;
+    int split_non_leaf;
+    int rebalance_right_leaf;
+    int rebalance_right_non_leaf;
+    int rebalance_left_leaf;
+    int rebalance_left_non_leaf;
+    int merge_left_leaf;
+    int merge_left_non_leaf;
+    int merge_right_leaf;
+    int merge_right_non_leaf;
+};
+
+struct bp_tree;
+
+struct bp_tree_wal;
+
+struct bp_tree_reclaim;
+
+/**
+ * Position of key in leaf. Cursor moves along leaf links, so it is valid
+ * until tree is modified.
+ */
+struct bp_tree_cursor
+{
+    struct bp_tree *tree;
+
+    /** Leaf of current key, NULL if cursor is out of keys */
+    struct bp_tree_struct_node *leaf;
+
+    int index;
 };
 
 struct bp_tree
@@ -59,6 +226,14 @@ struct bp_tree
     int size;
     int (*comparator)(struct bp_tree_node *, struct bp_tree_node *);
 
+    enum bp_tree_key_mode key_mode;
+
+    /** Returns inline key (or key prefix) for key */
+    long long (*key_prefix)(struct bp_tree_node *);
+
+    /** Returns binary key in BP_TREE_KEY_BYTES mode */
+    const void *(*key_bytes)(struct bp_tree_node *key, size_t *size);
+
     int split_leaf;
     int split_non_leaf;
 
@@ -73,33 +248,242 @@ struct bp_tree
 
     int merge_right_leaf;
     int merge_right_non_leaf;
+
+    struct bp_tree_slab leaf_slab;
+    struct bp_tree_slab non_leaf_slab;
+
+    /** Lookups run concurrently with writers, see bp_tree_set_concurrent */
+    int concurrent;
+
+    /** Serializes writers in concurrent mode */
+    pthread_mutex_t writer_lock;
+
+    /** Nodes locked by current write, they are unlocked when write ends */
+    struct bp_tree_struct_node **touched;
+    int touched_size;
+    int touched_capacity;
+
+    /** Domain for freed nodes and keys, see bp_tree_set_epoch */
+    struct epoch *domain;
+
+    /** Nodes freed by current write, they are retired to domain when write ends */
+    struct bp_tree_struct_node *retiring;
+
+    /** Retired groups of nodes which are not released yet, created by first retire */
+    struct bp_tree_reclaim *reclaim;
+
+    /** Redo log of changes, see bp_tree_set_wal */
+    struct bp_tree_wal *wal;
+
+    /** Counters of operations if instrumentation is enabled, see bp_tree_set_stats */
+    struct bp_tree_stats *stats;
 };
 
 /**
  * Init B+ tree and add first leaf node - root.
- * Degree must be more or equals 4.
+ * Degree must be more or equals 4. Returns -1 if root can not be allocated.
  */
 int bp_tree_init(struct bp_tree *tree, int degree, int (*bp_tree_key_comparator)(struct bp_tree_node *, struct bp_tree_node *));
 
+/**
+ * Store keys inline in nodes, so descent compares node memory only.
+ *
+ * For BP_TREE_KEY_INT64 key_prefix returns key itself. For BP_TREE_KEY_PREFIX key_prefix
+ * returns order preserving prefix of key (if first < second, prefix of first <= prefix of second),
+ * for example bp_tree_bytes_prefix for fixed-length binary keys.
+ *
+ * BP_TREE_KEY_BYTES mode is set by bp_tree_set_key_bytes.
+ *
+ * Tree must be empty, otherwise returns -1.
+ */
+int bp_tree_set_key_mode(struct bp_tree *tree,
+                         enum bp_tree_key_mode mode,
+                         long long (*key_prefix)(struct bp_tree_node *));
+
+/**
+ * Use BP_TREE_KEY_BYTES mode for keys ordered as binary strings returned by key_bytes
+ * (memcmp order, shorter key is less than its extension). Tree must be empty, otherwise returns -1.
+ *
+ * Leaves store first 64 bits of each key inline as in BP_TREE_KEY_PREFIX mode. Separators of inner
+ * node share prefix with length skip (all keys which reach node between its first and last
+ * separators share it), so inner node stores 64 bits of separators after skip. Descent compares
+ * skip bytes of searched key with first separator once per node, then only inline keys, and calls
+ * comparator only for equal inline keys. Long keys with common prefixes (paths, URLs, composite
+ * keys) are compared by bytes where they differ.
+ */
+int bp_tree_set_key_bytes(struct bp_tree *tree, const void *(*key_bytes)(struct bp_tree_node *key, size_t *size));
+
+/**
+ * Enable (or disable) concurrent mode. Tree must be empty, otherwise returns -1.
+ *
+ * In concurrent mode bp_tree_lookup may be called from many threads at once with one writer:
+ * lookups do not take locks, they descend optimistically and check versions of nodes, restarting
+ * if writer changed node. Writers (insert, delete, batches, bulk load) are serialized by mutex and
+ * lock only nodes which they change. Range functions, min/max and batch lookup take writer mutex.
+ * Cursors and bp_tree_for_each are not synchronized.
+ *
+ * Writer (also in BP_TREE_KEY_BYTES mode, where changed inner nodes are encoded when write ends)
+ * reserves memory to lock all nodes it may change (and for nodes it may create, also in other
+ * modes) before it changes tree. If memory can not be allocated, tree is not changed:
+ * bp_tree_try_insert and bp_tree_try_delete return BP_TREE_ERROR_MEMORY, batches return NULL
+ * and clear and bulk load return -1.
+ *
+ * Lookup may read key which is being deleted, so deleted or replaced keys must not be freed
+ * while lookups may run, use bp_tree_set_epoch to retire them.
+ */
+int bp_tree_set_concurrent(struct bp_tree *tree, int concurrent);
+
+/**
+ * Use epoch domain for memory reclamation (or stop using it if domain is NULL).
+ * Tree must be empty, otherwise returns -1.
+ *
+ * Nodes freed by merges are retired to domain and reused only when no pinned thread
+ * may read them. Threads which call bp_tree_lookup must be pinned in domain (between epoch_enter
+ * and epoch_exit), found key is valid until epoch_exit. Keys returned by delete and insert
+ * (replaced) must be freed by epoch_retire.
+ *
+ * bp_tree_free and bp_tree_set_key_mode wait until retired nodes are released, so they must
+ * not be called while threads are pinned.
+ */
+int bp_tree_set_epoch(struct bp_tree *tree, struct epoch *domain);
+
+/**
+ * Enable instrumentation of lookup, insert and delete (flags BP_TREE_STATS_ON and optionally
+ * BP_TREE_STATS_HARDWARE) or disable it (flags 0). Counters start from zero. Must not be called
+ * while other threads use tree.
+ *
+ * Each operation counts comparator calls and visited nodes in thread local counters and adds them
+ * to tree once. With BP_TREE_STATS_HARDWARE each thread opens perf events (cycles and cache misses
+ * of user space) on first measured operation and reads them before and after operation; where
+ * perf_event_open is not available (not Linux, perf_event_paranoid, containers), only software
+ * counters are collected. Disabled instrumentation costs one branch per operation and per node.
+ */
+int bp_tree_set_stats(struct bp_tree *tree, int flags);
+
+/**
+ * Fill snapshot of operation counters (zero if instrumentation is disabled), height, fill
+ * histograms of nodes and structural counters. Nodes are visited under writer mutex.
+ */
+int bp_tree_get_stats(struct bp_tree *tree, struct bp_tree_stats *stats);
+
+/**
+ * Append changes to redo log (or stop logging if wal is NULL).
+ *
+ * Insert, delete and batch variants append entry for each changed key while they hold tree and
+ * return after entries are durable. Concurrent writers share fsync by group commit, so they should
+ * run in concurrent mode. If log can not be written, changes are still applied (and wal->failed is
+ * set), but each write reports it: bp_tree_try_insert and bp_tree_try_delete return
+ * BP_TREE_ERROR_WAL, batches set error of result and clear returns BP_TREE_ERROR_WAL. Bulk load
+ * is not logged, tree should be written by bp_tree_snapshot_write after it.
+ *
+ * Log must not be changed while writers run.
+ */
+int bp_tree_set_wal(struct bp_tree *tree, struct bp_tree_wal *wal);
+
+/**
+ * Order preserving prefix of binary key compared by memcmp.
+ */
+static inline long long bp_tree_bytes_prefix(const void *bytes, size_t size)
+{
+    const unsigned char *data = (const unsigned char *)bytes;
+    unsigned long long prefix = 0;
+
+    for (size_t i = 0; i < sizeof(prefix); i++)
+    {
+        prefix = (prefix << 8) | (i < size ? data[i] : 0);
+    }
+
+    return (long long)(prefix ^ 0x8000000000000000ull);
+}
+
 /**
  * Find key which equals lookup key. If key not found returns NULL.
  */
 struct bp_tree_node *bp_tree_lookup(struct bp_tree *tree, struct bp_tree_node *key);
 
+/**
+ * Find key by raw key without key node. Compare returns -1, 0 or 1 if key is less, equals
+ * or greater than key of node and must order keys as comparator of tree.
+ *
+ * Lookup does not allocate and does not change tree. Keys are compared only by compare,
+ * so inline keys are not used in BP_TREE_KEY_INT64, BP_TREE_KEY_PREFIX and BP_TREE_KEY_BYTES modes.
+ */
+struct bp_tree_node *bp_tree_lookup_key(struct bp_tree *tree,
+                                        const void *key,
+                                        int (*compare)(const void *key, struct bp_tree_node *node));
+
 /**
  * Insert key which equals insert key.
  *
  * If key not found returns NULL, otherwise returns previous key (replaced with inserted key).
+ * Failure is not reported (NULL is returned and key is not inserted), use bp_tree_try_insert
+ * in concurrent and BP_TREE_KEY_BYTES modes.
  */
 struct bp_tree_node *bp_tree_insert(struct bp_tree *tree, struct bp_tree_node *key);
 
 /**
  * Delete key which equals delete key.
  *
- * If key not found returns NULL, otherwise returns previous key.
+ * If key not found returns NULL, otherwise returns previous key. Failure is not reported (NULL is
+ * returned and key stays in tree), use bp_tree_try_delete in concurrent and BP_TREE_KEY_BYTES modes.
  */
 struct bp_tree_node *bp_tree_delete(struct bp_tree *tree, struct bp_tree_node *key);
 
+/**
+ * Error of bp_tree_try_insert and bp_tree_try_delete: memory to lock changed nodes (or for new
+ * nodes) can not be allocated, tree is not changed.
+ */
+#define BP_TREE_ERROR_MEMORY -1
+
+/**
+ * Error of writes: change is applied to tree, but it could not be made durable in log.
+ */
+#define BP_TREE_ERROR_WAL -2
+
+/**
+ * Insert key as bp_tree_insert and report failure. Previous key (or NULL) is stored to previous.
+ * Returns 0, BP_TREE_ERROR_MEMORY (then key is not inserted and previous is NULL) or
+ * BP_TREE_ERROR_WAL.
+ */
+int bp_tree_try_insert(struct bp_tree *tree, struct bp_tree_node *key, struct bp_tree_node **previous);
+
+/**
+ * Delete key as bp_tree_delete and report failure. Deleted key (or NULL) is stored to deleted.
+ * Returns 0, BP_TREE_ERROR_MEMORY (then key stays in tree and deleted is NULL) or
+ * BP_TREE_ERROR_WAL.
+ */
+int bp_tree_try_delete(struct bp_tree *tree, struct bp_tree_node *key, struct bp_tree_node **deleted);
+
+/**
+ * Build tree from keys sorted in ascending order (without duplicates) bottom-up in linear time,
+ * without splits. Nodes are filled to fill_factor (0 < fill_factor <= 1) of degree, but not less
+ * than half of degree, so next inserts do not split each node.
+ *
+ * Tree must be empty. If tree is not empty, fill_factor is out of range or keys are not sorted
+ * returns -1 and tree stays empty (keys are not freed).
+ */
+int bp_tree_bulk_load(struct bp_tree *tree, struct bp_tree_node **keys, int size, float fill_factor);
+
+/**
+ * Same as bp_tree_bulk_load, but keys are returned by next callback until it returns NULL,
+ * so sorted input is not copied to memory.
+ */
+int bp_tree_bulk_load_iterator(struct bp_tree *tree,
+                               struct bp_tree_node *(*next)(void *context),
+                               void *context,
+                               float fill_factor);
+
+/**
+ * Find key with index in ascending order (0 is minimal key) by counts of subtrees in O(log n).
+ * If index is out of [0, size) returns NULL.
+ */
+struct bp_tree_node *bp_tree_select(struct bp_tree *tree, int index);
+
+/**
+ * Count of keys which are less than key in O(log n). If key is in tree, it is index of key for bp_tree_select.
+ */
+int bp_tree_rank(struct bp_tree *tree, struct bp_tree_node *key);
+
 /**
  * Find minimal key in B+ tree. If tree size = 0 returns NULL.
  */
@@ -121,30 +505,115 @@ struct bp_tree_leaf_node *bp_tree_min_leaf(struct bp_tree *tree);
 struct bp_tree_leaf_node *bp_tree_max_leaf(struct bp_tree *tree);
 
 /**
- * Find collection of keys.
+ * Batch operations sort keys (batch itself is not changed), descend once for each group of keys
+ * which fall into same leaf and apply whole group to leaf in one pass, so leaf is split or merged
+ * at most once per batch. If batch contains equal keys, they are applied in batch order.
+ *
+ * Result contains keys in ascending order and must be freed (with nodes array) by caller.
+ * If memory allocation fails returns NULL. Error of result is set by log failure, see bp_tree_set_wal.
+ */
+
+/**
+ * Insert collection of keys. Result contains previous keys which were replaced.
  */
 struct bp_tree_batch *bp_tree_insert_batch(struct bp_tree *tree, struct bp_tree_batch *node);
 
 /**
- * Insert collection of keys.
+ * Find collection of keys. Result contains found keys.
  */
 struct bp_tree_batch *bp_tree_lookup_batch(struct bp_tree *tree, struct bp_tree_batch *node);
 
 /**
- * Delete collection of keys.
+ * Delete collection of keys. Result contains deleted keys.
  */
 struct bp_tree_batch *bp_tree_delete_batch(struct bp_tree *tree, struct bp_tree_batch *node);
 
+/**
+ * Set cursor to minimal key. Returns key or NULL if tree is empty.
+ */
+struct bp_tree_node *bp_tree_cursor_first(struct bp_tree_cursor *cursor, struct bp_tree *tree);
+
+/**
+ * Set cursor to maximal key. Returns key or NULL if tree is empty.
+ */
+struct bp_tree_node *bp_tree_cursor_last(struct bp_tree_cursor *cursor, struct bp_tree *tree);
+
+/**
+ * Set cursor to first key which is more or equals key (lower bound) by one descent.
+ * Returns found key or NULL if all keys are less than key.
+ */
+struct bp_tree_node *bp_tree_cursor_seek(struct bp_tree_cursor *cursor, struct bp_tree *tree, struct bp_tree_node *key);
+
+/**
+ * Key under cursor or NULL if cursor is out of keys.
+ */
+struct bp_tree_node *bp_tree_cursor_key(struct bp_tree_cursor *cursor);
+
+/**
+ * Move cursor to next key. Returns key or NULL if there is no next key.
+ */
+struct bp_tree_node *bp_tree_cursor_next(struct bp_tree_cursor *cursor);
+
+/**
+ * Move cursor to previous key. Returns key or NULL if there is no previous key.
+ */
+struct bp_tree_node *bp_tree_cursor_prev(struct bp_tree_cursor *cursor);
+
+/**
+ * Call callback for each key in [low, high) in ascending order. If low is NULL range starts from
+ * minimal key, if high is NULL range ends with maximal key. Scan stops if callback returns not 0.
+ *
+ * Returns count of keys passed to callback.
+ */
+int bp_tree_range(struct bp_tree *tree,
+                  struct bp_tree_node *low,
+                  struct bp_tree_node *high,
+                  int (*callback)(struct bp_tree_node *key, void *context),
+                  void *context);
+
+/**
+ * Count of keys in [low, high), NULL bounds are same as in bp_tree_range.
+ * Count is difference of ranks of bounds, so keys and leaves are not visited.
+ */
+int bp_tree_range_count(struct bp_tree *tree, struct bp_tree_node *low, struct bp_tree_node *high);
+
 /**
  * B+ debug print.
  */
 void bp_tree_print(struct bp_tree *tree, void (*print_node)(struct bp_tree_node *));
 
 /**
- * Free allocated memory. Before delete all items.
+ * Free allocated memory. Keys are passed to free_callback (if it is not NULL) in one pass
+ * over leaves, nodes are released with their slabs, so tree is freed in O(n) without rebalancing.
  */
 int bp_tree_free(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *));
 
-#define bp_tree_for_each(___tree, ___node, ___type)                                                                                                   \
-    for (struct bp_tree_leaf_node *___leaf = bp_tree_min_leaf((___tree)); ___leaf != NULL; ___leaf = (struct bp_tree_leaf_node *)___leaf->core.right) \
-        for (___type *___node = (___type *)___leaf->core.keys[___leaf->index = 0]; ___leaf->index < ___leaf->core.size; ___node = (___type *)___leaf->core.keys[++___leaf->index])
+/**
+ * Same as bp_tree_free, but keys and nodes are freed by background thread. Tree is left freed
+ * at once and may be initialized again. If thread is not NULL, background thread is joinable
+ * and stored to it, otherwise it is detached. Nodes retired to epoch domain are released by
+ * background thread too, so it does not block caller, but domain must not be freed until it ends.
+ *
+ * If thread can not be created, tree is freed by calling thread and -1 is returned.
+ */
+int bp_tree_free_async(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *), pthread_t *thread);
+
+/**
+ * Remove all keys and keep tree for reuse, keys are passed to free_callback (if it is not NULL).
+ * Nodes are returned to slabs of tree (or retired to epoch domain), so their memory is reused by
+ * next inserts. If tree has log, delete entry is appended for each key, returns BP_TREE_ERROR_WAL
+ * if they can not be made durable (or -1 if memory to lock nodes can not be allocated).
+ */
+int bp_tree_clear(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *));
+
+/**
+ * Iterate keys in ascending order. Position is kept in cursor on caller stack, so iteration
+ * does not write to tree and many threads may iterate same tree at once.
+ */
+#define bp_tree_for_each(___tree, ___node, ___type)                                                                                 \
+    for (struct bp_tree_cursor ___cursor = {(___tree), NULL, 0}, *___once = &___cursor; ___once != NULL; ___once = NULL)               \
+        for (___type *___node = (___type *)bp_tree_cursor_first(&___cursor, (___tree)); ___node != NULL; ___node = (___type *)bp_tree_cursor_next(&___cursor))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,954 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <bp_tree.h>
+
+namespace strlib
+{
+
+/**
+ * Ordered map over C B+ tree with std::map like interface.
+ *
+ * Items are allocated by allocator as nodes which derive struct bp_tree_node, so tree stores
+ * pointers to them and references to items are stable until items are erased. Leaf and inner
+ * nodes of tree are allocated by C core from its slabs, allocator is used for items and struct
+ * bp_tree itself.
+ *
+ * C core calls comparator by function pointer without context, so Compare must be stateless:
+ * instance is created for each call. Lookups (find, lower_bound, upper_bound, count) do not call
+ * C core, they descend tree by inlined Compare and support heterogeneous keys if
+ * Compare::is_transparent is defined. Compare must not throw, exceptions can not pass C core.
+ *
+ * For example:
+ *
+ * strlib::bptree<std::string, int, std::less<>> tree;
+ * tree.emplace("first", 1);
+ * tree.find(std::string_view("first"))->second == 1;
+ *
+ * Iterators are bidirectional and are valid until tree is modified, erase returns next iterator.
+ * Moved from tree is empty.
+ */
+template <class K, class V, class Compare = std::less<K>, class Allocator = std::allocator<std::pair<const K, V>>>
+class bptree
+{
+    static_assert(std::is_empty<Compare>::value && std::is_default_constructible<Compare>::value,
+                  "Compare is called by C core without context, it must be stateless");
+
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+    using pointer = typename std::allocator_traits<Allocator>::pointer;
+    using const_pointer = typename std::allocator_traits<Allocator>::const_pointer;
+
+    /** Degree of tree if it is not passed to constructor */
+    static constexpr int default_degree = 64;
+
+  private:
+    struct node : bp_tree_node
+    {
+        template <class... Args>
+        explicit node(Args &&...args) : value(std::forward<Args>(args)...)
+        {
+        }
+
+        value_type value;
+    };
+
+    using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+    using node_traits = std::allocator_traits<node_allocator>;
+    using tree_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<struct bp_tree>;
+    using tree_traits = std::allocator_traits<tree_allocator>;
+    using key_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<bp_tree_node *>;
+
+    static_assert(std::is_same<typename node_traits::pointer, node *>::value,
+                  "C core stores raw pointers, allocator must not use fancy pointers");
+
+    template <bool Const>
+    class iterator_base
+    {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = typename bptree::value_type;
+        using difference_type = typename bptree::difference_type;
+        using reference = typename std::conditional<Const, const value_type &, value_type &>::type;
+        using pointer = typename std::conditional<Const, const value_type *, value_type *>::type;
+
+        iterator_base() : cursor_{nullptr, nullptr, 0}
+        {
+        }
+
+        /** Iterator converts to const iterator */
+        template <bool Other, class = typename std::enable_if<Const && !Other>::type>
+        iterator_base(const iterator_base<Other> &other) : cursor_(other.cursor_)
+        {
+        }
+
+        reference operator*() const
+        {
+            return static_cast<node *>(cursor_.leaf->keys[cursor_.index])->value;
+        }
+
+        pointer operator->() const
+        {
+            return &**this;
+        }
+
+        iterator_base &operator++()
+        {
+            bp_tree_cursor_next(&cursor_);
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        /** End iterator moves to last item */
+        iterator_base &operator--()
+        {
+            if (cursor_.leaf == nullptr)
+            {
+                bp_tree_cursor_last(&cursor_, cursor_.tree);
+            }
+            else
+            {
+                bp_tree_cursor_prev(&cursor_);
+            }
+
+            return *this;
+        }
+
+        iterator_base operator--(int)
+        {
+            iterator_base previous = *this;
+            --*this;
+            return previous;
+        }
+
+        template <bool Other>
+        bool operator==(const iterator_base<Other> &other) const
+        {
+            return cursor_.leaf == other.cursor_.leaf && (cursor_.leaf == nullptr || cursor_.index == other.cursor_.index);
+        }
+
+        template <bool Other>
+        bool operator!=(const iterator_base<Other> &other) const
+        {
+            return !(*this == other);
+        }
+
+      private:
+        friend class bptree;
+
+        template <bool Other>
+        friend class iterator_base;
+
+        explicit iterator_base(const bp_tree_cursor &cursor) : cursor_(cursor)
+        {
+        }
+
+        bp_tree_cursor cursor_;
+    };
+
+  public:
+    using iterator = iterator_base<false>;
+    using const_iterator = iterator_base<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    bptree() noexcept(std::is_nothrow_default_constructible<node_allocator>::value) : bptree(default_degree)
+    {
+    }
+
+    /**
+     * Degree must be more or equals 4. Tree is allocated by first insert.
+     */
+    explicit bptree(int degree, const Allocator &allocator = Allocator()) noexcept
+        : tree_(nullptr), degree_(degree), allocator_(allocator)
+    {
+    }
+
+    explicit bptree(const Allocator &allocator) noexcept : bptree(default_degree, allocator)
+    {
+    }
+
+    bptree(std::initializer_list<value_type> items, int degree = default_degree, const Allocator &allocator = Allocator())
+        : bptree(degree, allocator)
+    {
+        insert(items.begin(), items.end());
+    }
+
+    /** Copy is bulk loaded from sorted items of other */
+    bptree(const bptree &other)
+        : tree_(nullptr),
+          degree_(other.degree_),
+          allocator_(node_traits::select_on_container_copy_construction(other.allocator_))
+    {
+        copy_from(other);
+    }
+
+    bptree(const bptree &other, const Allocator &allocator) : tree_(nullptr), degree_(other.degree_), allocator_(allocator)
+    {
+        copy_from(other);
+    }
+
+    bptree(bptree &&other) noexcept : tree_(other.tree_), degree_(other.degree_), allocator_(std::move(other.allocator_))
+    {
+        other.tree_ = nullptr;
+    }
+
+    ~bptree()
+    {
+        release();
+    }
+
+    bptree &operator=(const bptree &other)
+    {
+        if (this != &other)
+        {
+            release();
+
+            if (node_traits::propagate_on_container_copy_assignment::value)
+            {
+                allocator_ = other.allocator_;
+            }
+
+            degree_ = other.degree_;
+            copy_from(other);
+        }
+
+        return *this;
+    }
+
+    /** Nodes are moved with tree if allocators are equal or allocator propagates, otherwise items are moved */
+    bptree &operator=(bptree &&other) noexcept(node_traits::propagate_on_container_move_assignment::value)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        release();
+        degree_ = other.degree_;
+
+        if (node_traits::propagate_on_container_move_assignment::value || allocator_ == other.allocator_)
+        {
+            if (node_traits::propagate_on_container_move_assignment::value)
+            {
+                allocator_ = std::move(other.allocator_);
+            }
+
+            tree_ = other.tree_;
+            other.tree_ = nullptr;
+        }
+        else
+        {
+            for (auto &item : other)
+            {
+                try_emplace(item.first, std::move(item.second));
+            }
+
+            other.clear();
+        }
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(allocator_);
+    }
+
+    key_compare key_comp() const
+    {
+        return key_compare();
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(first_cursor());
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(first_cursor());
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(end_cursor());
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(end_cursor());
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    reverse_iterator rbegin() noexcept
+    {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() noexcept
+    {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    size_type size() const noexcept
+    {
+        return tree_ != nullptr ? tree_->size : 0;
+    }
+
+    size_type max_size() const noexcept
+    {
+        return std::numeric_limits<int>::max();
+    }
+
+    /** Destroy all items, inner nodes are kept by slabs of tree for next inserts */
+    void clear() noexcept
+    {
+        if (tree_ != nullptr)
+        {
+            destroy_items();
+            bp_tree_clear(tree_, nullptr);
+        }
+    }
+
+    std::pair<iterator, bool> insert(const value_type &item)
+    {
+        return try_emplace(item.first, item.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&item)
+    {
+        return emplace(std::move(item));
+    }
+
+    template <class InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        for (; first != last; ++first)
+        {
+            emplace(*first);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> items)
+    {
+        insert(items.begin(), items.end());
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&mapped)
+    {
+        return assign(try_emplace(key, std::forward<M>(mapped)), std::forward<M>(mapped));
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&mapped)
+    {
+        return assign(try_emplace(std::move(key), std::forward<M>(mapped)), std::forward<M>(mapped));
+    }
+
+    /** Item is constructed before lookup, it is destroyed if tree contains its key */
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&...args)
+    {
+        node *created = create_node(std::forward<Args>(args)...);
+        iterator found = find(created->value.first);
+
+        if (found != end())
+        {
+            destroy_node(created);
+            return {found, false};
+        }
+
+        return {link_node(created), true};
+    }
+
+    /** Item is constructed only if tree does not contain key */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args)
+    {
+        iterator found = find(key);
+
+        if (found != end())
+        {
+            return {found, false};
+        }
+
+        return {link_node(create_node(std::piecewise_construct,
+                                      std::forward_as_tuple(key),
+                                      std::forward_as_tuple(std::forward<Args>(args)...))),
+                true};
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        iterator found = find(key);
+
+        if (found != end())
+        {
+            return {found, false};
+        }
+
+        return {link_node(create_node(std::piecewise_construct,
+                                      std::forward_as_tuple(std::move(key)),
+                                      std::forward_as_tuple(std::forward<Args>(args)...))),
+                true};
+    }
+
+    /** Return iterator to item after erased one */
+    iterator erase(const_iterator position)
+    {
+        node *erased = static_cast<node *>(position.cursor_.leaf->keys[position.cursor_.index]);
+        bp_tree_cursor cursor = position.cursor_;
+        node *next = static_cast<node *>(bp_tree_cursor_next(&cursor));
+
+        bp_tree_delete(tree_, erased);
+        destroy_node(erased);
+
+        /* Delete may merge leaves, so next item is found again */
+        return next != nullptr ? find(next->value.first) : end();
+    }
+
+    iterator erase(iterator position)
+    {
+        return erase(const_iterator(position));
+    }
+
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        if (last == end())
+        {
+            while (first != end())
+            {
+                first = erase(first);
+            }
+
+            return end();
+        }
+
+        /* Last is invalidated by erase, so it is kept as key */
+        const K &last_key = last->first;
+
+        while (first != end() && key_less(first->first, last_key))
+        {
+            first = erase(first);
+        }
+
+        return iterator(first.cursor_);
+    }
+
+    size_type erase(const K &key)
+    {
+        return erase_key(key);
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    size_type erase(const Kx &key)
+    {
+        return erase_key(key);
+    }
+
+    void swap(bptree &other) noexcept
+    {
+        using std::swap;
+
+        if (node_traits::propagate_on_container_swap::value)
+        {
+            swap(allocator_, other.allocator_);
+        }
+
+        swap(tree_, other.tree_);
+        swap(degree_, other.degree_);
+    }
+
+    V &operator[](const K &key)
+    {
+        return try_emplace(key).first->second;
+    }
+
+    V &operator[](K &&key)
+    {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    V &at(const K &key)
+    {
+        return at_key(*this, key);
+    }
+
+    const V &at(const K &key) const
+    {
+        return at_key(*this, key);
+    }
+
+    iterator find(const K &key)
+    {
+        return iterator(find_cursor(key));
+    }
+
+    const_iterator find(const K &key) const
+    {
+        return const_iterator(find_cursor(key));
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    iterator find(const Kx &key)
+    {
+        return iterator(find_cursor(key));
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(const Kx &key) const
+    {
+        return const_iterator(find_cursor(key));
+    }
+
+    size_type count(const K &key) const
+    {
+        return find_cursor(key).leaf != nullptr;
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    size_type count(const Kx &key) const
+    {
+        return find_cursor(key).leaf != nullptr;
+    }
+
+    bool contains(const K &key) const
+    {
+        return find_cursor(key).leaf != nullptr;
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    bool contains(const Kx &key) const
+    {
+        return find_cursor(key).leaf != nullptr;
+    }
+
+    iterator lower_bound(const K &key)
+    {
+        return iterator(bound_cursor<false>(key));
+    }
+
+    const_iterator lower_bound(const K &key) const
+    {
+        return const_iterator(bound_cursor<false>(key));
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    iterator lower_bound(const Kx &key)
+    {
+        return iterator(bound_cursor<false>(key));
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    const_iterator lower_bound(const Kx &key) const
+    {
+        return const_iterator(bound_cursor<false>(key));
+    }
+
+    iterator upper_bound(const K &key)
+    {
+        return iterator(bound_cursor<true>(key));
+    }
+
+    const_iterator upper_bound(const K &key) const
+    {
+        return const_iterator(bound_cursor<true>(key));
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    iterator upper_bound(const Kx &key)
+    {
+        return iterator(bound_cursor<true>(key));
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    const_iterator upper_bound(const Kx &key) const
+    {
+        return const_iterator(bound_cursor<true>(key));
+    }
+
+    std::pair<iterator, iterator> equal_range(const K &key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const K &key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const Kx &key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template <class Kx, class C = Compare, class = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const Kx &key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    /** Underlying C tree for generic functions (range, rank, select), NULL if tree is empty and not allocated */
+    struct bp_tree *native() noexcept
+    {
+        return tree_;
+    }
+
+  private:
+    static const K &node_key(bp_tree_node *key)
+    {
+        return static_cast<node *>(key)->value.first;
+    }
+
+    template <class First, class Second>
+    static bool key_less(const First &first, const Second &second)
+    {
+        return Compare()(first, second);
+    }
+
+    /** Comparator of C core */
+    static int compare_nodes(bp_tree_node *first, bp_tree_node *second)
+    {
+        const K &first_key = node_key(first);
+        const K &second_key = node_key(second);
+        return key_less(first_key, second_key) ? -1 : key_less(second_key, first_key) ? 1 : 0;
+    }
+
+    /**
+     * Count of keys less (or less or equal if Upper) than key, branch-free as bp_tree_search.
+     */
+    template <bool Upper, class Kx>
+    static int search(struct bp_tree_struct_node *current, const Kx &key)
+    {
+        bp_tree_node **keys = current->keys;
+        int base = 0;
+        int size = current->size;
+
+        if (size == 0)
+        {
+            return 0;
+        }
+
+        while (size > 1)
+        {
+            int half = size / 2;
+            base = before<Upper>(keys[base + half], key) ? base + half : base;
+            size -= half;
+        }
+
+        return base + before<Upper>(keys[base], key);
+    }
+
+    template <bool Upper, class Kx>
+    static bool before(bp_tree_node *stored, const Kx &key)
+    {
+        return Upper ? !key_less(key, node_key(stored)) : key_less(node_key(stored), key);
+    }
+
+    /** Leaf which contains key if tree contains it, tree must be allocated */
+    template <class Kx>
+    struct bp_tree_struct_node *find_leaf(const Kx &key) const
+    {
+        struct bp_tree_struct_node *current = tree_->root;
+
+        while (!current->leaf)
+        {
+            current = reinterpret_cast<struct bp_tree_non_leaf_node *>(current)->children[search<true>(current, key)];
+        }
+
+        return current;
+    }
+
+    template <class Kx>
+    bp_tree_cursor find_cursor(const Kx &key) const
+    {
+        if (tree_ == nullptr)
+        {
+            return end_cursor();
+        }
+
+        struct bp_tree_struct_node *leaf = find_leaf(key);
+        int position = search<false>(leaf, key);
+
+        if (position < leaf->size && !key_less(key, node_key(leaf->keys[position])))
+        {
+            return bp_tree_cursor{tree_, leaf, position};
+        }
+
+        return end_cursor();
+    }
+
+    /** Cursor of first key not less (or greater if Upper) than key */
+    template <bool Upper, class Kx>
+    bp_tree_cursor bound_cursor(const Kx &key) const
+    {
+        if (tree_ == nullptr)
+        {
+            return end_cursor();
+        }
+
+        struct bp_tree_struct_node *leaf = find_leaf(key);
+        int position = search<Upper>(leaf, key);
+
+        /* First greater key may be first key of right leaf */
+        if (position >= leaf->size)
+        {
+            leaf = leaf->right;
+            position = 0;
+        }
+
+        return bp_tree_cursor{tree_, leaf, position};
+    }
+
+    bp_tree_cursor first_cursor() const
+    {
+        bp_tree_cursor cursor = end_cursor();
+
+        if (tree_ != nullptr)
+        {
+            bp_tree_cursor_first(&cursor, tree_);
+        }
+
+        return cursor;
+    }
+
+    bp_tree_cursor end_cursor() const
+    {
+        return bp_tree_cursor{tree_, nullptr, 0};
+    }
+
+    template <class Tree>
+    static auto at_key(Tree &tree, const K &key) -> decltype((tree.find(key)->second))
+    {
+        auto found = tree.find(key);
+
+        if (found == tree.end())
+        {
+            throw std::out_of_range("strlib::bptree::at");
+        }
+
+        return found->second;
+    }
+
+    /** Mapped is moved by try_emplace only if it inserted item, otherwise it is assigned */
+    template <class M>
+    static std::pair<iterator, bool> assign(std::pair<iterator, bool> result, M &&mapped)
+    {
+        if (!result.second)
+        {
+            result.first->second = std::forward<M>(mapped);
+        }
+
+        return result;
+    }
+
+    template <class Kx>
+    size_type erase_key(const Kx &key)
+    {
+        bp_tree_cursor cursor = find_cursor(key);
+
+        if (cursor.leaf == nullptr)
+        {
+            return 0;
+        }
+
+        node *erased = static_cast<node *>(cursor.leaf->keys[cursor.index]);
+        bp_tree_delete(tree_, erased);
+        destroy_node(erased);
+        return 1;
+    }
+
+    void allocate_tree()
+    {
+        tree_allocator allocator(allocator_);
+        struct bp_tree *tree = tree_traits::allocate(allocator, 1);
+
+        if (bp_tree_init(tree, degree_, compare_nodes) != 0)
+        {
+            tree_traits::deallocate(allocator, tree, 1);
+            throw std::bad_alloc();
+        }
+
+        tree_ = tree;
+    }
+
+    template <class... Args>
+    node *create_node(Args &&...args)
+    {
+        node *created = node_traits::allocate(allocator_, 1);
+
+        try
+        {
+            node_traits::construct(allocator_, created, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            node_traits::deallocate(allocator_, created, 1);
+            throw;
+        }
+
+        return created;
+    }
+
+    void destroy_node(node *destroyed) noexcept
+    {
+        node_traits::destroy(allocator_, destroyed);
+        node_traits::deallocate(allocator_, destroyed, 1);
+    }
+
+    /** Insert node whose key is not in tree and return its iterator */
+    iterator link_node(node *linked)
+    {
+        if (tree_ == nullptr)
+        {
+            try
+            {
+                allocate_tree();
+            }
+            catch (...)
+            {
+                destroy_node(linked);
+                throw;
+            }
+        }
+
+        bp_tree_node *previous;
+
+        if (bp_tree_try_insert(tree_, linked, &previous) == BP_TREE_ERROR_MEMORY)
+        {
+            destroy_node(linked);
+            throw std::bad_alloc();
+        }
+
+        return find(linked->value.first);
+    }
+
+    /** Destroy items, keys of tree are not read after it */
+    void destroy_items() noexcept
+    {
+        bp_tree_cursor cursor;
+        bp_tree_node *current = bp_tree_cursor_first(&cursor, tree_);
+
+        while (current != nullptr)
+        {
+            bp_tree_node *next = bp_tree_cursor_next(&cursor);
+            destroy_node(static_cast<node *>(current));
+            current = next;
+        }
+    }
+
+    void release() noexcept
+    {
+        if (tree_ != nullptr)
+        {
+            tree_allocator allocator(allocator_);
+            destroy_items();
+            bp_tree_free(tree_, nullptr);
+            tree_traits::deallocate(allocator, tree_, 1);
+            tree_ = nullptr;
+        }
+    }
+
+    void copy_from(const bptree &other)
+    {
+        if (other.empty())
+        {
+            return;
+        }
+
+        std::vector<bp_tree_node *, key_allocator> keys{key_allocator(allocator_)};
+        keys.reserve(other.size());
+
+        try
+        {
+            for (const auto &item : other)
+            {
+                keys.push_back(create_node(item));
+            }
+
+            allocate_tree();
+
+            /* Failed bulk load leaves tree empty, keys stay owned here */
+            if (bp_tree_bulk_load(tree_, keys.data(), static_cast<int>(keys.size()), 0.7f) != 0)
+            {
+                release();
+                throw std::bad_alloc();
+            }
+        }
+        catch (...)
+        {
+            for (bp_tree_node *key : keys)
+            {
+                destroy_node(static_cast<node *>(key));
+            }
+
+            throw;
+        }
+    }
+
+    struct bp_tree *tree_;
+    int degree_;
+    node_allocator allocator_;
+};
+
+template <class K, class V, class Compare, class Allocator>
+void swap(bptree<K, V, Compare, Allocator> &first, bptree<K, V, Compare, Allocator> &second) noexcept
+{
+    first.swap(second);
+}
+
+} // namespace strlib
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <buffer_pool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Size of node page.
+ */
+#define BP_TREE_DISK_PAGE_SIZE 4096
+
+/**
+ * First bytes of tree file ("!BPTDSK1").
+ */
+#define BP_TREE_DISK_MAGIC 0x314b534454504221ull
+
+/**
+ * Minimal count of buffer pool pages, writer pins up to three pages at once.
+ */
+#define BP_TREE_DISK_MIN_POOL_PAGES 8
+
+/**
+ * Max count of levels.
+ */
+#define BP_TREE_DISK_MAX_HEIGHT 32
+
+/**
+ * Page 0 of tree file.
+ */
+struct bp_tree_disk_header
+{
+    unsigned long long magic;
+    unsigned int page_size;
+    unsigned int record_size;
+
+    /** Count of records */
+    unsigned long long size;
+
+    unsigned long long root;
+
+    /** Count of levels, 1 if root is leaf */
+    unsigned int height;
+
+    /** Max count of records in leaf and separators in inner page */
+    unsigned int leaf_capacity;
+    unsigned int inner_capacity;
+
+    /** Count of pages in file */
+    unsigned long long page_count;
+
+    /** First free page, free pages are linked by their right field */
+    unsigned long long free_list;
+};
+
+/**
+ * B+ tree of fixed-size records stored in file. Nodes are pages referenced by page numbers
+ * and resolved through bounded buffer pool, so tree may be much larger than memory while hot
+ * inner pages stay cached.
+ *
+ * Records are copied to and from pages, record of node is record itself (key with value).
+ * Leaf which becomes empty is removed from tree, nodes are not merged otherwise.
+ */
+struct bp_tree_disk
+{
+    struct buffer_pool pool;
+    struct bp_tree_disk_header header;
+
+    /** Comparator for records */
+    int (*comparator)(const void *first, const void *second);
+
+    /** Records and children of node which is split */
+    char *scratch;
+};
+
+/**
+ * Open tree file (or create empty tree in new file) with buffer pool of pool_pages pages.
+ * If file is not tree with same record size or pool is too small returns -1.
+ */
+int bp_tree_disk_open(struct bp_tree_disk *tree,
+                      const char *path,
+                      size_t record_size,
+                      int pool_pages,
+                      int (*comparator)(const void *first, const void *second));
+
+/**
+ * Find record which equals key and copy it to record.
+ * Returns 1 if record is found, 0 if not found and -1 on IO error.
+ */
+int bp_tree_disk_lookup(struct bp_tree_disk *tree, const void *key, void *record);
+
+/**
+ * Insert record. If tree contains equal record, it is replaced and copied to previous (if not NULL).
+ * Returns 1 if record is replaced, 0 if inserted and -1 on IO error.
+ */
+int bp_tree_disk_insert(struct bp_tree_disk *tree, const void *record, void *previous);
+
+/**
+ * Delete record which equals key and copy it to previous (if not NULL).
+ * Returns 1 if record is deleted, 0 if not found and -1 on IO error.
+ */
+int bp_tree_disk_delete(struct bp_tree_disk *tree, const void *key, void *previous);
+
+/**
+ * Call callback for each record in [low, high) in ascending order, same as bp_tree_range.
+ * Returns count of records passed to callback or -1 on IO error.
+ */
+int bp_tree_disk_range(struct bp_tree_disk *tree,
+                       const void *low,
+                       const void *high,
+                       int (*callback)(const void *record, void *context),
+                       void *context);
+
+/**
+ * Write header and dirty pages and sync file.
+ */
+int bp_tree_disk_flush(struct bp_tree_disk *tree);
+
+/**
+ * Flush tree and close file.
+ */
+int bp_tree_disk_close(struct bp_tree_disk *tree);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <bp_tree.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Size of snapshot page. Leaves and inner nodes are stored as fixed-size pages,
+ * so page number is enough to find node in mapped file.
+ */
+#define BP_TREE_SNAPSHOT_PAGE_SIZE 4096
+
+/**
+ * First bytes of snapshot file ("BPTSNAP1").
+ */
+#define BP_TREE_SNAPSHOT_MAGIC 0x31504e5354504221ull
+
+/**
+ * Stored in header by writer, reader rejects file written with other byte order.
+ */
+#define BP_TREE_SNAPSHOT_BYTE_ORDER 0x01020304u
+
+/**
+ * Page 0 of snapshot file.
+ */
+struct bp_tree_snapshot_header
+{
+    unsigned long long magic;
+    unsigned int byte_order;
+    unsigned int page_size;
+
+    /** Size of encoded key */
+    unsigned long long record_size;
+
+    /** Count of keys */
+    unsigned long long size;
+
+    unsigned long long page_count;
+
+    /** Page of root, 0 if snapshot is empty */
+    unsigned long long root;
+
+    /** Page of leaf with minimal keys, 0 if snapshot is empty */
+    unsigned long long first_leaf;
+
+    /** Count of levels, 1 if root is leaf */
+    unsigned int height;
+
+    /** Max count of records in leaf and separators in inner page */
+    unsigned int leaf_capacity;
+    unsigned int inner_capacity;
+};
+
+/**
+ * Read-only tree mapped from snapshot file. Pages are used in place, file is not parsed.
+ *
+ * Snapshot file is written sequentially: leaves first, then inner levels bottom-up and header
+ * page last, so partially written file is never valid.
+ */
+struct bp_tree_snapshot
+{
+    const struct bp_tree_snapshot_header *header;
+
+    /** Mapped file */
+    const char *base;
+    size_t length;
+
+    /** Comparator for encoded keys */
+    int (*comparator)(const void *first, const void *second);
+};
+
+/**
+ * Write keys of tree to snapshot file. Each key is written by encode callback to record_size bytes,
+ * encoded keys must be ordered by snapshot comparator same as keys are ordered by tree comparator.
+ *
+ * File is written to path with ".tmp" suffix and renamed over path, so snapshot opened from
+ * path before stays valid and crash while writing leaves previous snapshot at path.
+ *
+ * Tree must not be changed while it is written. If file can not be written or record_size is
+ * too big for page returns -1.
+ */
+int bp_tree_snapshot_write(struct bp_tree *tree,
+                           const char *path,
+                           size_t record_size,
+                           void (*encode)(struct bp_tree_node *key, void *record));
+
+/**
+ * Map snapshot file read-only. If file is not valid snapshot returns -1: only header is checked,
+ * capacities of pages must match record size and levels and size must fit to page count.
+ */
+int bp_tree_snapshot_open(struct bp_tree_snapshot *snapshot,
+                          const char *path,
+                          int (*comparator)(const void *first, const void *second));
+
+/**
+ * Find encoded key which equals record. If key not found returns NULL.
+ * Returned pointer is valid until snapshot is closed.
+ */
+const void *bp_tree_snapshot_lookup(struct bp_tree_snapshot *snapshot, const void *record);
+
+/**
+ * Call callback for each encoded key in [low, high) in ascending order, same as bp_tree_range.
+ *
+ * Returns count of keys passed to callback.
+ */
+int bp_tree_snapshot_range(struct bp_tree_snapshot *snapshot,
+                           const void *low,
+                           const void *high,
+                           int (*callback)(const void *record, void *context),
+                           void *context);
+
+/**
+ * Unmap snapshot file.
+ */
+void bp_tree_snapshot_close(struct bp_tree_snapshot *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <bp_tree.h>
+
+/**
+ * Define B+ tree functions specialized for key type, compare is inlined into descent.
+ *
+ * Key type must contain struct bp_tree_node member. Compare is
+ * int compare(const type *first, const type *second) and returns -1, 0 or 1, it should be
+ * static inline function.
+ *
+ * For example:
+ *
+ * BP_TREE_SPECIALIZE(int_tree, struct test_node, core, test_node_cmp)
+ *
+ * defines:
+ *
+ * int int_tree_init(struct bp_tree *tree, int degree) - init tree with generated comparator
+ * type *int_tree_insert(struct bp_tree *tree, type *key) - bp_tree_insert
+ * type *int_tree_delete(struct bp_tree *tree, type *key) - bp_tree_delete
+ * type *int_tree_lookup(struct bp_tree *tree, const type *key) - specialized lookup
+ * type *int_tree_seek(struct bp_tree_cursor *cursor, struct bp_tree *tree, const type *key) -
+ *     specialized bp_tree_cursor_seek
+ *
+ * Tree is same struct bp_tree, so generic functions (range, batches, cursors) may be used with it.
+ * Writes use generic code with generated comparator, their cost is dominated by changes of nodes.
+ * Lookup and seek descend without function pointer calls in BP_TREE_KEY_POINTER mode; in
+ * concurrent mode, with inline keys or with stats they call generic functions, which already
+ * compare inline keys without comparator or must check versions of nodes.
+ */
+#define BP_TREE_SPECIALIZE(name, type, member, compare)                                                         \
+    static inline type *name##_item(struct bp_tree_node *node)                                                  \
+    {                                                                                                           \
+        return node != NULL ? (type *)((char *)node - offsetof(type, member)) : NULL;                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int name##_compare_nodes(struct bp_tree_node *first, struct bp_tree_node *second)             \
+    {                                                                                                           \
+        return compare(name##_item(first), name##_item(second));                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int name##_init(struct bp_tree *tree, int degree)                                             \
+    {                                                                                                           \
+        return bp_tree_init(tree, degree, name##_compare_nodes);                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_insert(struct bp_tree *tree, type *key)                                          \
+    {                                                                                                           \
+        return name##_item(bp_tree_insert(tree, &key->member));                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_delete(struct bp_tree *tree, type *key)                                          \
+    {                                                                                                           \
+        return name##_item(bp_tree_delete(tree, &key->member));                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    /* Count of keys less (or less or equal if upper) than key, branch-free as bp_tree_search */                \
+    static inline int name##_search(struct bp_tree_struct_node *node, const type *key, int upper)               \
+    {                                                                                                           \
+        struct bp_tree_node **keys = node->keys;                                                                \
+        int base = 0;                                                                                           \
+        int size = node->size;                                                                                  \
+                                                                                                                \
+        if (size == 0)                                                                                          \
+        {                                                                                                       \
+            return 0;                                                                                           \
+        }                                                                                                       \
+                                                                                                                \
+        while (size > 1)                                                                                        \
+        {                                                                                                       \
+            int half = size / 2;                                                                                \
+            int cmp = compare(name##_item(keys[base + half]), key);                                             \
+            base = (cmp < 0 || (upper && cmp == 0)) ? base + half : base;                                       \
+            size -= half;                                                                                       \
+        }                                                                                                       \
+                                                                                                                \
+        int cmp = compare(name##_item(keys[base]), key);                                                        \
+        return base + (cmp < 0 || (upper && cmp == 0));                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline struct bp_tree_struct_node *name##_leaf(struct bp_tree *tree, const type *key)                \
+    {                                                                                                           \
+        struct bp_tree_struct_node *current = tree->root;                                                       \
+                                                                                                                \
+        while (!current->leaf)                                                                                  \
+        {                                                                                                       \
+            current = ((struct bp_tree_non_leaf_node *)current)->children[name##_search(current, key, 1)];      \
+        }                                                                                                       \
+                                                                                                                \
+        return current;                                                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int name##_specialized(struct bp_tree *tree)                                                  \
+    {                                                                                                           \
+        return !tree->concurrent && tree->key_mode == BP_TREE_KEY_POINTER && tree->stats == NULL;               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_lookup(struct bp_tree *tree, const type *key)                                    \
+    {                                                                                                           \
+        if (!name##_specialized(tree))                                                                          \
+        {                                                                                                       \
+            return name##_item(bp_tree_lookup(tree, (struct bp_tree_node *)&key->member));                      \
+        }                                                                                                       \
+                                                                                                                \
+        struct bp_tree_struct_node *leaf = name##_leaf(tree, key);                                              \
+        int position = name##_search(leaf, key, 0);                                                             \
+                                                                                                                \
+        if (position < leaf->size && compare(name##_item(leaf->keys[position]), key) == 0)                      \
+        {                                                                                                       \
+            return name##_item(leaf->keys[position]);                                                           \
+        }                                                                                                       \
+                                                                                                                \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_seek(struct bp_tree_cursor *cursor, struct bp_tree *tree, const type *key)       \
+    {                                                                                                           \
+        if (!name##_specialized(tree))                                                                          \
+        {                                                                                                       \
+            return name##_item(bp_tree_cursor_seek(cursor, tree, (struct bp_tree_node *)&key->member));         \
+        }                                                                                                       \
+                                                                                                                \
+        struct bp_tree_struct_node *leaf = name##_leaf(tree, key);                                              \
+        int position = name##_search(leaf, key, 0);                                                             \
+                                                                                                                \
+        /* First greater key may be first key of right leaf */                                                  \
+        if (position >= leaf->size)                                                                             \
+        {                                                                                                       \
+            leaf = leaf->right;                                                                                 \
+            position = 0;                                                                                       \
+        }                                                                                                       \
+                                                                                                                \
+        cursor->tree = tree;                                                                                    \
+        cursor->leaf = leaf;                                                                                    \
+        cursor->index = position;                                                                               \
+        return leaf != NULL ? name##_item(leaf->keys[position]) : NULL;                                         \
+    }
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <bp_tree.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * First bytes of log file ("BPTWAL01").
+ */
+#define BP_TREE_WAL_MAGIC 0x31304c4157545042ull
+
+/**
+ * Types of log entries.
+ */
+#define BP_TREE_WAL_INSERT 1
+#define BP_TREE_WAL_DELETE 2
+
+/**
+ * Start of log file.
+ */
+struct bp_tree_wal_header
+{
+    unsigned long long magic;
+    unsigned long long record_size;
+};
+
+/**
+ * Header of log entry, encoded key follows it.
+ */
+struct bp_tree_wal_entry
+{
+    unsigned int type;
+
+    /** Checksum of type and record, entry with wrong checksum ends log (torn write) */
+    unsigned int checksum;
+};
+
+/**
+ * Redo log of tree changes with group commit.
+ *
+ * Writer appends entry to memory buffer while it holds tree, then waits until entry is durable.
+ * First waiting writer becomes leader: it takes whole buffer, writes it and calls fdatasync,
+ * while next writers append to other buffer. When leader finishes, all writers whose entries
+ * were written are woken up and next leader takes their buffer, so one fsync commits all writes
+ * which came during previous fsync.
+ */
+struct bp_tree_wal
+{
+    int fd;
+
+    /** Size of encoded key */
+    size_t record_size;
+
+    /** Encodes key to record_size bytes */
+    void (*encode)(struct bp_tree_node *key, void *record);
+
+    pthread_mutex_t lock;
+
+    /** Signaled when leader finishes write */
+    pthread_cond_t written;
+
+    /** Entries appended after last write */
+    char *buffer;
+    size_t buffer_size;
+    size_t buffer_capacity;
+
+    /** Entries written by leader */
+    char *spare;
+    size_t spare_capacity;
+
+    /** Sequence number of last appended entry and of last durable entry */
+    unsigned long long appended;
+    unsigned long long durable;
+
+    /** Leader writes spare buffer */
+    int syncing;
+
+    /** Write or sync failed, nothing is committed after that */
+    int failed;
+
+    /** Count of fsync calls */
+    long long syncs;
+};
+
+/**
+ * Open (or create) log file for appending. Existing log must be replayed before it is opened,
+ * replay cuts torn tail of log. If file is not log for same record size returns -1.
+ */
+int bp_tree_wal_open(struct bp_tree_wal *wal,
+                     const char *path,
+                     size_t record_size,
+                     void (*encode)(struct bp_tree_node *key, void *record));
+
+/**
+ * Append entry for key. Returns sequence number of entry.
+ */
+unsigned long long bp_tree_wal_append(struct bp_tree_wal *wal, int type, struct bp_tree_node *key);
+
+/**
+ * Wait until entry with sequence number (and all entries before it) is durable.
+ * Returns -1 if log can not be written.
+ */
+int bp_tree_wal_commit(struct bp_tree_wal *wal, unsigned long long sequence);
+
+/**
+ * Remove all entries, for example after tree is written by bp_tree_snapshot_write.
+ * Writers must be stopped from snapshot start till truncate.
+ *
+ * Replay of entries is idempotent (each key ends with its last change), so if process stops
+ * between snapshot and truncate, replay of old log over new snapshot gives same tree. Snapshot is
+ * renamed into place when it is complete, so if process stops while snapshot is written, previous
+ * snapshot and whole log are replayed and torn temporary file is ignored.
+ */
+int bp_tree_wal_truncate(struct bp_tree_wal *wal);
+
+/**
+ * Commit appended entries and close log file.
+ */
+int bp_tree_wal_close(struct bp_tree_wal *wal);
+
+/**
+ * Rebuild tree from snapshot and log. Tree must be empty and must not have log.
+ *
+ * Keys of snapshot (if snapshot_path is not NULL and file exists) are bulk loaded, then entries
+ * of log (if file exists) are applied in order. Keys are created from records by decode, replaced
+ * and deleted keys are passed to free_callback. Log is cut after last valid entry.
+ *
+ * Returns count of applied entries or -1 if snapshot or log is not valid.
+ */
+int bp_tree_wal_replay(struct bp_tree *tree,
+                       const char *snapshot_path,
+                       const char *wal_path,
+                       size_t record_size,
+                       struct bp_tree_node *(*decode)(const void *record),
+                       void (*free_callback)(struct bp_tree_node *key));
+
+#ifdef __cplusplus
+}
+#endif
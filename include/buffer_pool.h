@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <flat_hash_map.h>
+#include <hash_map.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Cached page of file.
+ */
+struct buffer_pool_frame
+{
+    /** Frames of cached pages are indexed by page number */
+    struct hash_map_node core;
+
+    unsigned long long page;
+
+    /** Count of users of page, pinned page is not evicted */
+    int pins;
+
+    /** Page was changed and must be written before eviction */
+    int dirty;
+
+    /** Page was used since clock hand passed it */
+    int referenced;
+
+    /** Frame contains page */
+    int used;
+
+    char *data;
+};
+
+/**
+ * Bounded cache of file pages with clock eviction.
+ *
+ * Page is pinned while it is used and unpinned after use, unpinned pages are evicted by clock:
+ * hand skips pinned frames and clears reference bit of used ones, first frame without reference
+ * bit is reused. Dirty pages are written by pwrite on eviction and by buffer_pool_flush.
+ */
+struct buffer_pool
+{
+    int fd;
+    size_t page_size;
+
+    /** Count of frames */
+    int capacity;
+
+    struct buffer_pool_frame *frames;
+
+    /** Page number to frame */
+    struct flat_hash_map index;
+
+    /** Next frame checked by clock */
+    int hand;
+
+    long long hits;
+    long long misses;
+    long long writes;
+};
+
+/**
+ * Open (or create) file and allocate capacity frames of page_size bytes.
+ */
+int buffer_pool_init(struct buffer_pool *pool, const char *path, size_t page_size, int capacity);
+
+/**
+ * Pin page, read it from file if it is not cached. Page after end of file is filled by zeroes.
+ * If all frames are pinned or file can not be read returns NULL.
+ */
+void *buffer_pool_pin(struct buffer_pool *pool, unsigned long long page);
+
+/**
+ * Unpin page, dirty page is written before eviction.
+ */
+void buffer_pool_unpin(struct buffer_pool *pool, unsigned long long page, int dirty);
+
+/**
+ * Write all dirty pages and sync file. If write fails returns -1.
+ */
+int buffer_pool_flush(struct buffer_pool *pool);
+
+/**
+ * Flush pages, close file and free frames. Pages must be unpinned.
+ */
+int buffer_pool_free(struct buffer_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
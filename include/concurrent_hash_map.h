@@ -0,0 +1,105 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <epoch.h>
+#include <hash_map.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Count of writer locks. Bucket is protected by lock with index hash & (stripes - 1),
+ * so buckets which are split or merged by resize are always protected by same lock.
+ */
+#define CONCURRENT_HASH_MAP_STRIPES 64
+
+/**
+ * Initial (and minimal) count of buckets, at least count of stripes.
+ */
+#define CONCURRENT_HASH_MAP_MIN_CAPACITY 64
+
+/**
+ * Bucket table, replaced as whole by resize.
+ */
+struct concurrent_hash_map_table
+{
+    int capacity;
+    struct hash_map_node *buckets[];
+};
+
+/**
+ * Lock striped hash map for struct hash_map_node items with lock-free readers.
+ *
+ * Chains are sorted by hash and then by comparator as in struct hash_map. Writers lock stripe
+ * of bucket and publish chain links by atomic stores, so readers traverse chains without locks.
+ * Resize locks all stripes and relinks items to new table, readers which miss item during
+ * resize retry.
+ *
+ * Old tables are retired to epoch domain. Find must be called by thread pinned in domain
+ * (between epoch_enter and epoch_exit) and returned item is valid until epoch_exit.
+ * Items returned by insert (replaced) and delete may be read by concurrent finds, so they must
+ * be freed by epoch_retire instead of free.
+ */
+struct concurrent_hash_map
+{
+    /** Current size of hash map */
+    int size;
+
+    /** Items hash function, must return non-negative value */
+    int (*hash_function)(struct hash_map_node *node);
+
+    /** Comparator for items */
+    int (*comparator)(struct hash_map_node *first, struct hash_map_node *second);
+
+    struct concurrent_hash_map_table *table;
+
+    /** Odd while resize relinks items */
+    unsigned long long resize_version;
+
+    float max_load_factor;
+    float min_load_factor;
+
+    /** Domain for retired tables */
+    struct epoch *domain;
+
+    pthread_mutex_t stripes[CONCURRENT_HASH_MAP_STRIPES];
+};
+
+/**
+ * Fill struct concurrent_hash_map by pointer.
+ */
+int concurrent_hash_map_init(
+    struct concurrent_hash_map *map,
+    int (*comparator)(struct hash_map_node *a, struct hash_map_node *b),
+    int (*hash_function)(struct hash_map_node *node),
+    struct epoch *domain);
+
+/**
+ * Insert node to hash map. If map contains node with same key,
+ * return previous item, otherwise return NULL.
+ */
+struct hash_map_node *concurrent_hash_map_insert(struct concurrent_hash_map *map, struct hash_map_node *node);
+
+/**
+ * Find item by key. Calling thread must be pinned in epoch domain of map.
+ */
+struct hash_map_node *concurrent_hash_map_find(struct concurrent_hash_map *map, struct hash_map_node *node);
+
+/**
+ * Delete item by key. Return deleted item. If item not found, return NULL.
+ */
+struct hash_map_node *concurrent_hash_map_delete(struct concurrent_hash_map *map, struct hash_map_node *node);
+
+/**
+ * Free allocated memory. Before delete all items with free_callback.
+ * Map must not be used by other threads.
+ */
+void concurrent_hash_map_free(struct concurrent_hash_map *map, void (*free_callback)(struct hash_map_node *));
+
+#ifdef __cplusplus
+}
+#endif
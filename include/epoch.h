@@ -0,0 +1,156 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Count of retired pointers after which epoch_retire tries to reclaim memory.
+ */
+#define EPOCH_RECLAIM_THRESHOLD 64
+
+/**
+ * Pointer which is removed from shared structure, but may be still read by pinned threads.
+ */
+struct epoch_retired
+{
+    void *pointer;
+    void (*free_callback)(void *pointer);
+
+    /** Global epoch when pointer was retired */
+    unsigned long long epoch;
+
+    struct epoch_retired *next;
+};
+
+struct epoch;
+
+/**
+ * Thread record, owned by caller (usually on thread stack or in thread local storage).
+ */
+struct epoch_thread
+{
+    struct epoch *domain;
+
+    /** Observed global epoch shifted by one bit, low bit is set while thread is pinned */
+    unsigned long long local;
+
+    struct epoch_thread *next;
+
+    /** Pointers retired by this thread, they are freed by thread itself without domain lock */
+    struct epoch_retired *retired;
+    int retired_count;
+};
+
+/**
+ * Epoch based memory reclamation domain.
+ *
+ * Readers pin epoch (epoch_enter) while they read shared structure and unpin it (epoch_exit)
+ * when they do not hold pointers to it anymore. Writers unlink pointer from structure and pass
+ * it to epoch_retire, pointer is freed when all threads which were pinned at that moment
+ * are unpinned.
+ *
+ * For example:
+ *
+ * struct epoch_thread thread;
+ * epoch_register(&domain, &thread);
+ *
+ * epoch_enter(&thread);
+ * node = concurrent_hash_map_find(map, &key);
+ * ... use node ...
+ * epoch_exit(&thread);
+ *
+ * epoch_unregister(&thread);
+ */
+struct epoch
+{
+    /** Global epoch, it is advanced when all pinned threads observed it */
+    unsigned long long global;
+
+    /** Protects threads list and retired list */
+    pthread_mutex_t lock;
+
+    struct epoch_thread *threads;
+
+    /** Pointers retired by not registered threads and left by unregistered threads */
+    struct epoch_retired *retired;
+    int retired_count;
+
+    /** Count of freed pointers */
+    long long reclaimed;
+
+    /** Background thread which reclaims domain list each drain_interval milliseconds */
+    pthread_t drain_thread;
+    pthread_cond_t drain_cond;
+    int drain_interval;
+    int draining;
+};
+
+/**
+ * Fill struct epoch by pointer.
+ */
+int epoch_init(struct epoch *domain);
+
+/**
+ * Add thread to domain. Thread must be registered before epoch_enter.
+ */
+int epoch_register(struct epoch *domain, struct epoch_thread *thread);
+
+/**
+ * Remove thread from domain. Thread must not be pinned.
+ * Pointers retired by thread and not freed yet are moved to domain list.
+ */
+void epoch_unregister(struct epoch_thread *thread);
+
+/**
+ * Pin current global epoch, pointers read from shared structures are valid until epoch_exit.
+ */
+void epoch_enter(struct epoch_thread *thread);
+
+/**
+ * Unpin epoch.
+ */
+void epoch_exit(struct epoch_thread *thread);
+
+/**
+ * Free pointer by free_callback when no thread may read it.
+ * If memory allocation fails returns -1 and pointer is not retired.
+ */
+int epoch_retire(struct epoch *domain, void *pointer, void (*free_callback)(void *pointer));
+
+/**
+ * Same as epoch_retire, but pointer is added to list of registered thread without domain lock.
+ * Each EPOCH_RECLAIM_THRESHOLD retires thread frees its pointers which are not readable anymore.
+ */
+int epoch_thread_retire(struct epoch_thread *thread, void *pointer, void (*free_callback)(void *pointer));
+
+/**
+ * Advance global epoch if it is possible and free retired pointers of domain list which are
+ * not readable anymore. Returns count of freed pointers.
+ */
+int epoch_reclaim(struct epoch *domain);
+
+/**
+ * Start background thread which calls epoch_reclaim each interval milliseconds, so retired
+ * pointers are freed even if writers stop retiring. Returns -1 if thread is already started
+ * or can not be created.
+ */
+int epoch_start_drain(struct epoch *domain, int interval);
+
+/**
+ * Stop background thread and wait for it.
+ */
+void epoch_stop_drain(struct epoch *domain);
+
+/**
+ * Stop background thread, free all retired pointers and release domain. Threads must be unregistered.
+ */
+void epoch_free(struct epoch *domain);
+
+#ifdef __cplusplus
+}
+#endif
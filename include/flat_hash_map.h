@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <hash_map.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Initial (and minimal) count of slots. Capacity is always power of two.
+ */
+#define FLAT_HASH_MAP_MIN_CAPACITY 32
+
+/**
+ * Open addressing hash map (swiss table) for struct hash_map_node items.
+ *
+ * Slots are split into groups, each slot has one control byte with state
+ * (empty, deleted) or 7 bits of item hash. Lookup compares whole group of
+ * control bytes by one SIMD instruction and calls comparator only for
+ * slots with same hash bits and same cached full hash, so most lookups touch
+ * one or two cache lines.
+ *
+ * Item must be derivative of struct hash_map_node (next field is not used),
+ * insert/find/delete have same semantics as hash_map functions.
+ */
+struct flat_hash_map
+{
+    /** Current size of hash map */
+    int size;
+
+    /** Items hash function, must return non-negative value */
+    int (*hash_function)(struct hash_map_node *node);
+
+    /** Comparator for items */
+    int (*comparator)(struct hash_map_node *first, struct hash_map_node *second);
+
+    /** Control byte for each slot */
+    signed char *control;
+
+    /** Items */
+    struct hash_map_node **slots;
+
+    int capacity;
+
+    /** Count of empty slots which may be filled before rehash */
+    int growth_left;
+
+    /** Count of comparator calls skipped by insert and delete because cached hashes differ */
+    long long skipped_comparisons;
+};
+
+/**
+ * Fill struct flat_hash_map by pointer.
+ */
+int flat_hash_map_init(
+    struct flat_hash_map *map,
+    int (*comparator)(struct hash_map_node *a, struct hash_map_node *b),
+    int (*hash_function)(struct hash_map_node *node));
+
+/**
+ * Insert node to hash map. If map contains node with same key,
+ * return previous item, otherwise return NULL.
+ */
+struct hash_map_node *flat_hash_map_insert(struct flat_hash_map *map, struct hash_map_node *node);
+
+/**
+ * Find item by key.
+ */
+struct hash_map_node *flat_hash_map_find(struct flat_hash_map *map, struct hash_map_node *node);
+
+/**
+ * Delete item by key. Return deleted item. If item not found, return NULL.
+ */
+struct hash_map_node *flat_hash_map_delete(struct flat_hash_map *map, struct hash_map_node *node);
+
+/**
+ * Debug print for hash map.
+ */
+void flat_hash_map_print(struct flat_hash_map *map, void (*print_node)(struct hash_map_node *node));
+
+/**
+ * Free allocated memory. Before delete all items with free_callback.
+ */
+void flat_hash_map_free(struct flat_hash_map *map, void (*free_callback)(struct hash_map_node *));
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,6 +2,29 @@
 
 #include <stdlib.h>
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Initial (and minimal) count of buckets. Capacity is always power of two.
+ */
+#define HASH_MAP_MIN_CAPACITY 16
+
+/**
+ * Count of buckets migrated from old table on each insert/find/delete
+ * while incremental rehash is in progress.
+ */
+#define HASH_MAP_REHASH_STEP 4
+
+/**
+ * Default load factors, table grows when size > capacity * max and
+ * shrinks when size < capacity * min.
+ */
+#define HASH_MAP_MAX_LOAD_FACTOR 1.0f
+#define HASH_MAP_MIN_LOAD_FACTOR 0.25f
+
 /**
  * Basic node for item. You must derivative this struct for insert.
  *
@@ -17,10 +40,15 @@
 struct hash_map_node
 {
     struct hash_map_node *next;
+
+    /** Cached result of hash function, filled by map on insert */
+    int hash;
 };
 
 /**
- * Simple hash map with fixed size of buckets.
+ * Hash map with chains sorted by hash and then by comparator. Table grows and shrinks by load factor,
+ * items are moved to new table incrementally by HASH_MAP_REHASH_STEP buckets
+ * per operation, so single operation never rehash whole map.
  */
 struct hash_map
 {
@@ -33,7 +61,22 @@ struct hash_map
     /** Comparator for items */
     int (*comparator)(struct hash_map_node *first, struct hash_map_node *second);
 
-    struct hash_map_node *buckets[16];
+    /** Current table */
+    struct hash_map_node **buckets;
+    int capacity;
+
+    /** Table which is migrated to current table, NULL if rehash is not in progress */
+    struct hash_map_node **old_buckets;
+    int old_capacity;
+
+    /** Next bucket of old table for migration */
+    int rehash_index;
+
+    float max_load_factor;
+    float min_load_factor;
+
+    /** Count of comparator calls skipped by insert and delete because cached hashes differ */
+    long long skipped_comparisons;
 };
 
 /**
@@ -50,6 +93,12 @@ int hash_map_init(
     int (*comparator)(struct hash_map_node *a, struct hash_map_node *b),
     int (*hash_function)(struct hash_map_node *node));
 
+/**
+ * Set load factors for resizing. Max load factor must be more than
+ * two min load factors, otherwise returns -1.
+ */
+int hash_map_set_load_factor(struct hash_map *map, float min_load_factor, float max_load_factor);
+
 /**
  * Insert node to hash map. If map contains node with same key,
  * return previous item, otherwise return NULL.
@@ -57,12 +106,26 @@ int hash_map_init(
 struct hash_map_node *hash_map_insert(struct hash_map *map, struct hash_map_node *node);
 
 /**
- * Find item by key.
+ * Find item by key. Key is not changed.
  */
 struct hash_map_node *hash_map_find(struct hash_map *map, struct hash_map_node *node);
 
+/**
+ * Find item by raw key without key node. Hash must equal hash function of item with same key,
+ * compare returns -1, 0 or 1 if key is less, equals or greater than key of node and must order
+ * keys as comparator of map.
+ *
+ * Find does not allocate and does not write to map: it does not migrate buckets of incremental
+ * rehash and does not count skipped comparisons.
+ */
+struct hash_map_node *hash_map_find_key(struct hash_map *map,
+                                        const void *key,
+                                        int hash,
+                                        int (*compare)(const void *key, struct hash_map_node *node));
+
 /**
  * Delete item by key. Return deleted item. If item not found, return NULL.
+ * Key is not changed, so stored item may be passed as key.
  */
 struct hash_map_node *hash_map_delete(struct hash_map *map, struct hash_map_node *node);
 
@@ -72,6 +135,10 @@ struct hash_map_node *hash_map_delete(struct hash_map *map, struct hash_map_node
 void hash_map_print(struct hash_map *map, void (*print_node)(struct hash_map_node *node));
 
 /**
- * Free allocated memory. Before delete all items.
+ * Free allocated memory. Before delete all items with free_callback.
  */
 void hash_map_free(struct hash_map *map, void (*free_callback)(struct hash_map_node *));
+
+#ifdef __cplusplus
+}
+#endif
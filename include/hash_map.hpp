@@ -0,0 +1,823 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <hash_map.h>
+
+namespace strlib
+{
+
+/**
+ * Unordered map over C hash map with std::unordered_map like interface.
+ *
+ * Items are allocated by allocator as nodes which derive struct hash_map_node, so map links them
+ * into chains and references to items are stable until items are erased. Tables of map are
+ * allocated by C core (calloc), allocator is used for items and struct hash_map itself.
+ *
+ * C core calls hash and comparator by function pointers without context, so Hash and KeyEqual must
+ * be stateless: instances are created for each call. Lookups (find, count, contains) do not call
+ * C core and do not migrate buckets of incremental rehash, they walk chain with inlined Hash and
+ * KeyEqual and support heterogeneous keys if both define is_transparent. Hash and KeyEqual must
+ * not throw, exceptions can not pass C core.
+ *
+ * For example:
+ *
+ * strlib::hash_map<std::string, int, string_hash, std::equal_to<>> map;
+ * map.emplace("first", 1);
+ * map.find(std::string_view("first"))->second == 1;
+ *
+ * Iterators are forward and are valid until map is modified. Insert and erase migrate buckets of
+ * incremental rehash and may start new one, so order of items changes and erase does not return
+ * next iterator, erase_if removes items by predicate.
+ */
+template <class K,
+          class V,
+          class Hash = std::hash<K>,
+          class KeyEqual = std::equal_to<K>,
+          class Allocator = std::allocator<std::pair<const K, V>>>
+class hash_map
+{
+    static_assert(std::is_empty<Hash>::value && std::is_default_constructible<Hash>::value,
+                  "Hash is called by C core without context, it must be stateless");
+    static_assert(std::is_empty<KeyEqual>::value && std::is_default_constructible<KeyEqual>::value,
+                  "KeyEqual is called by C core without context, it must be stateless");
+
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+    using reference = value_type &;
+    using const_reference = const value_type &;
+    using pointer = typename std::allocator_traits<Allocator>::pointer;
+    using const_pointer = typename std::allocator_traits<Allocator>::const_pointer;
+
+  private:
+    struct node : hash_map_node
+    {
+        template <class... Args>
+        explicit node(Args &&...args) : value(std::forward<Args>(args)...)
+        {
+        }
+
+        value_type value;
+    };
+
+    using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+    using node_traits = std::allocator_traits<node_allocator>;
+    using map_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<::hash_map>;
+    using map_traits = std::allocator_traits<map_allocator>;
+    using node_pointer_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node *>;
+
+    static_assert(std::is_same<typename node_traits::pointer, node *>::value,
+                  "C core stores raw pointers, allocator must not use fancy pointers");
+
+    /**
+     * Position of item: table (old table of incremental rehash is walked first), bucket and node.
+     */
+    struct position
+    {
+        ::hash_map *map;
+        int old;
+        int index;
+        hash_map_node *current;
+    };
+
+    template <bool Const>
+    class iterator_base
+    {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename hash_map::value_type;
+        using difference_type = typename hash_map::difference_type;
+        using reference = typename std::conditional<Const, const value_type &, value_type &>::type;
+        using pointer = typename std::conditional<Const, const value_type *, value_type *>::type;
+
+        iterator_base() : position_{nullptr, 0, 0, nullptr}
+        {
+        }
+
+        /** Iterator converts to const iterator */
+        template <bool Other, class = typename std::enable_if<Const && !Other>::type>
+        iterator_base(const iterator_base<Other> &other) : position_(other.position_)
+        {
+        }
+
+        reference operator*() const
+        {
+            return static_cast<node *>(position_.current)->value;
+        }
+
+        pointer operator->() const
+        {
+            return &**this;
+        }
+
+        iterator_base &operator++()
+        {
+            position_.current = position_.current->next;
+
+            if (position_.current == nullptr)
+            {
+                position_.index++;
+                skip_empty(position_);
+            }
+
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        template <bool Other>
+        bool operator==(const iterator_base<Other> &other) const
+        {
+            return position_.current == other.position_.current;
+        }
+
+        template <bool Other>
+        bool operator!=(const iterator_base<Other> &other) const
+        {
+            return !(*this == other);
+        }
+
+      private:
+        friend class hash_map;
+
+        template <bool Other>
+        friend class iterator_base;
+
+        explicit iterator_base(const struct position &position) : position_(position)
+        {
+        }
+
+        struct position position_;
+    };
+
+  public:
+    using iterator = iterator_base<false>;
+    using const_iterator = iterator_base<true>;
+
+    /** Map is allocated by first insert */
+    hash_map() noexcept(std::is_nothrow_default_constructible<node_allocator>::value) : hash_map(Allocator())
+    {
+    }
+
+    explicit hash_map(const Allocator &allocator) noexcept : map_(nullptr), allocator_(allocator)
+    {
+    }
+
+    hash_map(std::initializer_list<value_type> items, const Allocator &allocator = Allocator()) : hash_map(allocator)
+    {
+        insert(items.begin(), items.end());
+    }
+
+    hash_map(const hash_map &other)
+        : map_(nullptr), allocator_(node_traits::select_on_container_copy_construction(other.allocator_))
+    {
+        insert(other.begin(), other.end());
+    }
+
+    hash_map(const hash_map &other, const Allocator &allocator) : map_(nullptr), allocator_(allocator)
+    {
+        insert(other.begin(), other.end());
+    }
+
+    hash_map(hash_map &&other) noexcept : map_(other.map_), allocator_(std::move(other.allocator_))
+    {
+        other.map_ = nullptr;
+    }
+
+    ~hash_map()
+    {
+        clear();
+    }
+
+    hash_map &operator=(const hash_map &other)
+    {
+        if (this != &other)
+        {
+            clear();
+
+            if (node_traits::propagate_on_container_copy_assignment::value)
+            {
+                allocator_ = other.allocator_;
+            }
+
+            insert(other.begin(), other.end());
+        }
+
+        return *this;
+    }
+
+    /** Nodes are moved with map if allocators are equal or allocator propagates, otherwise items are moved */
+    hash_map &operator=(hash_map &&other) noexcept(node_traits::propagate_on_container_move_assignment::value)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        clear();
+
+        if (node_traits::propagate_on_container_move_assignment::value || allocator_ == other.allocator_)
+        {
+            if (node_traits::propagate_on_container_move_assignment::value)
+            {
+                allocator_ = std::move(other.allocator_);
+            }
+
+            map_ = other.map_;
+            other.map_ = nullptr;
+        }
+        else
+        {
+            for (auto &item : other)
+            {
+                try_emplace(item.first, std::move(item.second));
+            }
+
+            other.clear();
+        }
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(allocator_);
+    }
+
+    hasher hash_function() const
+    {
+        return hasher();
+    }
+
+    key_equal key_eq() const
+    {
+        return key_equal();
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(first_position());
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(first_position());
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(end_position());
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(end_position());
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    size_type size() const noexcept
+    {
+        return map_ != nullptr ? map_->size : 0;
+    }
+
+    size_type max_size() const noexcept
+    {
+        return std::numeric_limits<int>::max();
+    }
+
+    /** Count of buckets of current table */
+    size_type bucket_count() const noexcept
+    {
+        return map_ != nullptr ? map_->capacity : 0;
+    }
+
+    /** Destroy all items and free tables, map is allocated again by next insert */
+    void clear() noexcept
+    {
+        if (map_ == nullptr)
+        {
+            return;
+        }
+
+        map_allocator allocator(allocator_);
+        destroy_items(map_->buckets, map_->capacity);
+
+        if (map_->old_buckets != nullptr)
+        {
+            destroy_items(map_->old_buckets, map_->old_capacity);
+        }
+
+        /* Chains are empty, so callback is not called */
+        hash_map_free(map_, free_nothing);
+        map_traits::deallocate(allocator, map_, 1);
+        map_ = nullptr;
+    }
+
+    std::pair<iterator, bool> insert(const value_type &item)
+    {
+        return try_emplace(item.first, item.second);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&item)
+    {
+        return emplace(std::move(item));
+    }
+
+    template <class InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        for (; first != last; ++first)
+        {
+            emplace(*first);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> items)
+    {
+        insert(items.begin(), items.end());
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&mapped)
+    {
+        return assign(try_emplace(key, std::forward<M>(mapped)), std::forward<M>(mapped));
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&mapped)
+    {
+        return assign(try_emplace(std::move(key), std::forward<M>(mapped)), std::forward<M>(mapped));
+    }
+
+    /** Item is constructed before lookup, it is destroyed if map contains its key */
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&...args)
+    {
+        node *created = create_node(std::forward<Args>(args)...);
+        iterator found = find(created->value.first);
+
+        if (found != end())
+        {
+            destroy_node(created);
+            return {found, false};
+        }
+
+        return {link_node(created), true};
+    }
+
+    /** Item is constructed only if map does not contain key */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args)
+    {
+        iterator found = find(key);
+
+        if (found != end())
+        {
+            return {found, false};
+        }
+
+        return {link_node(create_node(std::piecewise_construct,
+                                      std::forward_as_tuple(key),
+                                      std::forward_as_tuple(std::forward<Args>(args)...))),
+                true};
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        iterator found = find(key);
+
+        if (found != end())
+        {
+            return {found, false};
+        }
+
+        return {link_node(create_node(std::piecewise_construct,
+                                      std::forward_as_tuple(std::move(key)),
+                                      std::forward_as_tuple(std::forward<Args>(args)...))),
+                true};
+    }
+
+    /** Erase invalidates all iterators, see erase_if for erase while walking */
+    void erase(const_iterator position)
+    {
+        unlink_node(static_cast<node *>(position.position_.current));
+    }
+
+    size_type erase(const K &key)
+    {
+        return erase_key(key);
+    }
+
+    template <class Kx,
+              class H = Hash,
+              class E = KeyEqual,
+              class = typename H::is_transparent,
+              class = typename E::is_transparent>
+    size_type erase(const Kx &key)
+    {
+        return erase_key(key);
+    }
+
+    /**
+     * Erase items for which predicate returns true. Items are collected by walk first and then
+     * erased, so rehash started by erase does not move items during walk.
+     */
+    template <class Predicate>
+    size_type erase_if(Predicate predicate)
+    {
+        std::vector<node *, node_pointer_allocator> erased{node_pointer_allocator(allocator_)};
+
+        for (const_iterator current = begin(); current != end(); ++current)
+        {
+            if (predicate(*current))
+            {
+                erased.push_back(static_cast<node *>(current.position_.current));
+            }
+        }
+
+        for (node *current : erased)
+        {
+            unlink_node(current);
+        }
+
+        return erased.size();
+    }
+
+    void swap(hash_map &other) noexcept
+    {
+        using std::swap;
+
+        if (node_traits::propagate_on_container_swap::value)
+        {
+            swap(allocator_, other.allocator_);
+        }
+
+        swap(map_, other.map_);
+    }
+
+    V &operator[](const K &key)
+    {
+        return try_emplace(key).first->second;
+    }
+
+    V &operator[](K &&key)
+    {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    V &at(const K &key)
+    {
+        return at_key(*this, key);
+    }
+
+    const V &at(const K &key) const
+    {
+        return at_key(*this, key);
+    }
+
+    iterator find(const K &key)
+    {
+        return iterator(find_position(key));
+    }
+
+    const_iterator find(const K &key) const
+    {
+        return const_iterator(find_position(key));
+    }
+
+    template <class Kx,
+              class H = Hash,
+              class E = KeyEqual,
+              class = typename H::is_transparent,
+              class = typename E::is_transparent>
+    iterator find(const Kx &key)
+    {
+        return iterator(find_position(key));
+    }
+
+    template <class Kx,
+              class H = Hash,
+              class E = KeyEqual,
+              class = typename H::is_transparent,
+              class = typename E::is_transparent>
+    const_iterator find(const Kx &key) const
+    {
+        return const_iterator(find_position(key));
+    }
+
+    size_type count(const K &key) const
+    {
+        return find_position(key).current != nullptr;
+    }
+
+    template <class Kx,
+              class H = Hash,
+              class E = KeyEqual,
+              class = typename H::is_transparent,
+              class = typename E::is_transparent>
+    size_type count(const Kx &key) const
+    {
+        return find_position(key).current != nullptr;
+    }
+
+    bool contains(const K &key) const
+    {
+        return find_position(key).current != nullptr;
+    }
+
+    template <class Kx,
+              class H = Hash,
+              class E = KeyEqual,
+              class = typename H::is_transparent,
+              class = typename E::is_transparent>
+    bool contains(const Kx &key) const
+    {
+        return find_position(key).current != nullptr;
+    }
+
+    /** Underlying C map, NULL if map is empty and not allocated */
+    ::hash_map *native() noexcept
+    {
+        return map_;
+    }
+
+  private:
+    static const K &node_key(hash_map_node *item)
+    {
+        return static_cast<node *>(item)->value.first;
+    }
+
+    /** Hash of C core must be non-negative */
+    template <class Kx>
+    static int key_hash(const Kx &key)
+    {
+        return static_cast<int>(Hash()(key) & INT_MAX);
+    }
+
+    static int hash_node(hash_map_node *item)
+    {
+        return key_hash(node_key(item));
+    }
+
+    /** KeyEqual does not order items, so items of same hash are kept in insert order */
+    static int compare_nodes(hash_map_node *first, hash_map_node *second)
+    {
+        return KeyEqual()(node_key(first), node_key(second)) ? 0 : -1;
+    }
+
+    static void free_nothing(hash_map_node *)
+    {
+    }
+
+    /** Move position to first item from its bucket, end position has NULL current */
+    static void skip_empty(struct position &position)
+    {
+        ::hash_map *map = position.map;
+
+        if (position.old)
+        {
+            for (; position.index < map->old_capacity; position.index++)
+            {
+                if (map->old_buckets[position.index] != nullptr)
+                {
+                    position.current = map->old_buckets[position.index];
+                    return;
+                }
+            }
+
+            position.old = 0;
+            position.index = 0;
+        }
+
+        for (; position.index < map->capacity; position.index++)
+        {
+            if (map->buckets[position.index] != nullptr)
+            {
+                position.current = map->buckets[position.index];
+                return;
+            }
+        }
+
+        position.current = nullptr;
+    }
+
+    struct position first_position() const
+    {
+        struct position position = end_position();
+
+        if (map_ != nullptr)
+        {
+            position.old = map_->old_buckets != nullptr;
+            skip_empty(position);
+        }
+
+        return position;
+    }
+
+    struct position end_position() const
+    {
+        return position{map_, 0, 0, nullptr};
+    }
+
+    /** Not migrated bucket of old table holds all its keys, chains are sorted by hash */
+    template <class Kx>
+    struct position find_position(const Kx &key) const
+    {
+        if (map_ == nullptr)
+        {
+            return end_position();
+        }
+
+        int hash = key_hash(key);
+        struct position position = {map_, 0, hash & (map_->capacity - 1), nullptr};
+        hash_map_node *current = map_->buckets[position.index];
+
+        if (map_->old_buckets != nullptr && map_->old_buckets[hash & (map_->old_capacity - 1)] != nullptr)
+        {
+            position.old = 1;
+            position.index = hash & (map_->old_capacity - 1);
+            current = map_->old_buckets[position.index];
+        }
+
+        for (; current != nullptr && current->hash <= hash; current = current->next)
+        {
+            if (current->hash == hash && KeyEqual()(node_key(current), key))
+            {
+                position.current = current;
+                return position;
+            }
+        }
+
+        return end_position();
+    }
+
+    template <class Map>
+    static auto at_key(Map &map, const K &key) -> decltype((map.find(key)->second))
+    {
+        auto found = map.find(key);
+
+        if (found == map.end())
+        {
+            throw std::out_of_range("strlib::hash_map::at");
+        }
+
+        return found->second;
+    }
+
+    /** Mapped is moved by try_emplace only if it inserted item, otherwise it is assigned */
+    template <class M>
+    static std::pair<iterator, bool> assign(std::pair<iterator, bool> result, M &&mapped)
+    {
+        if (!result.second)
+        {
+            result.first->second = std::forward<M>(mapped);
+        }
+
+        return result;
+    }
+
+    template <class Kx>
+    size_type erase_key(const Kx &key)
+    {
+        hash_map_node *found = find_position(key).current;
+
+        if (found == nullptr)
+        {
+            return 0;
+        }
+
+        unlink_node(static_cast<node *>(found));
+        return 1;
+    }
+
+    void allocate_map()
+    {
+        map_allocator allocator(allocator_);
+        ::hash_map *map = map_traits::allocate(allocator, 1);
+
+        if (hash_map_init(map, compare_nodes, hash_node) != 0)
+        {
+            map_traits::deallocate(allocator, map, 1);
+            throw std::bad_alloc();
+        }
+
+        map_ = map;
+    }
+
+    template <class... Args>
+    node *create_node(Args &&...args)
+    {
+        node *created = node_traits::allocate(allocator_, 1);
+
+        try
+        {
+            node_traits::construct(allocator_, created, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            node_traits::deallocate(allocator_, created, 1);
+            throw;
+        }
+
+        return created;
+    }
+
+    void destroy_node(node *destroyed) noexcept
+    {
+        node_traits::destroy(allocator_, destroyed);
+        node_traits::deallocate(allocator_, destroyed, 1);
+    }
+
+    /** Insert node whose key is not in map and return its iterator, insert may start rehash */
+    iterator link_node(node *linked)
+    {
+        if (map_ == nullptr)
+        {
+            try
+            {
+                allocate_map();
+            }
+            catch (...)
+            {
+                destroy_node(linked);
+                throw;
+            }
+        }
+
+        hash_map_insert(map_, linked);
+        return find(linked->value.first);
+    }
+
+    void unlink_node(node *unlinked) noexcept
+    {
+        hash_map_delete(map_, unlinked);
+        destroy_node(unlinked);
+    }
+
+    void destroy_items(hash_map_node **buckets, int capacity) noexcept
+    {
+        for (int i = 0; i < capacity; i++)
+        {
+            hash_map_node *current = buckets[i];
+
+            while (current != nullptr)
+            {
+                hash_map_node *next = current->next;
+                destroy_node(static_cast<node *>(current));
+                current = next;
+            }
+
+            buckets[i] = nullptr;
+        }
+    }
+
+    ::hash_map *map_;
+    node_allocator allocator_;
+};
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator>
+void swap(hash_map<K, V, Hash, KeyEqual, Allocator> &first, hash_map<K, V, Hash, KeyEqual, Allocator> &second) noexcept
+{
+    first.swap(second);
+}
+
+} // namespace strlib
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <hash_map.h>
+
+/**
+ * Define hash map functions specialized for item type, hash and compare are inlined into lookup.
+ *
+ * Item type must contain struct hash_map_node member. Hash_item is int hash_item(const type *item)
+ * and must return non-negative value, compare is int compare(const type *first, const type *second)
+ * and returns -1, 0 or 1 (chains are sorted by it). Both should be static inline functions.
+ *
+ * For example:
+ *
+ * HASH_MAP_SPECIALIZE(int_map, struct test_node, core, test_node_hash, test_node_cmp)
+ *
+ * defines:
+ *
+ * int int_map_init(struct hash_map *map) - init map with generated hash function and comparator
+ * type *int_map_insert(struct hash_map *map, type *item) - hash_map_insert
+ * type *int_map_find(struct hash_map *map, const type *key) - specialized find
+ * type *int_map_delete(struct hash_map *map, type *key) - hash_map_delete
+ *
+ * Map is same struct hash_map, so generic functions may be used with it too. Specialized find
+ * calls no function pointers and does not write to map or key: it does not migrate buckets of
+ * incremental rehash (insert and delete do) and does not count skipped comparisons, bucket of old
+ * table which is not migrated yet is searched in place.
+ */
+#define HASH_MAP_SPECIALIZE(name, type, member, hash_item, compare)                                             \
+    static inline type *name##_item(struct hash_map_node *node)                                                 \
+    {                                                                                                           \
+        return node != NULL ? (type *)((char *)node - offsetof(type, member)) : NULL;                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int name##_hash_node(struct hash_map_node *node)                                              \
+    {                                                                                                           \
+        return hash_item(name##_item(node));                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int name##_compare_nodes(struct hash_map_node *first, struct hash_map_node *second)           \
+    {                                                                                                           \
+        return compare(name##_item(first), name##_item(second));                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int name##_init(struct hash_map *map)                                                         \
+    {                                                                                                           \
+        return hash_map_init(map, name##_compare_nodes, name##_hash_node);                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_insert(struct hash_map *map, type *item)                                         \
+    {                                                                                                           \
+        return name##_item(hash_map_insert(map, &item->member));                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_delete(struct hash_map *map, type *key)                                          \
+    {                                                                                                           \
+        return name##_item(hash_map_delete(map, &key->member));                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    /* Chain is sorted by hash and then by compare, so walk stops at first greater node */                      \
+    static inline type *name##_find_chain(struct hash_map_node *current, const type *key, int key_hash)         \
+    {                                                                                                           \
+        for (; current != NULL; current = current->next)                                                        \
+        {                                                                                                       \
+            if (current->hash != key_hash)                                                                      \
+            {                                                                                                   \
+                if (current->hash > key_hash)                                                                   \
+                {                                                                                               \
+                    return NULL;                                                                                \
+                }                                                                                               \
+                                                                                                                \
+                continue;                                                                                       \
+            }                                                                                                   \
+                                                                                                                \
+            int result = compare(name##_item(current), key);                                                    \
+                                                                                                                \
+            if (result >= 0)                                                                                    \
+            {                                                                                                   \
+                return result == 0 ? name##_item(current) : NULL;                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+                                                                                                                \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline type *name##_find(struct hash_map *map, const type *key)                                      \
+    {                                                                                                           \
+        int key_hash = hash_item(key);                                                                          \
+                                                                                                                \
+        /* Not migrated bucket of old table holds all its keys */                                               \
+        if (map->old_buckets != NULL)                                                                           \
+        {                                                                                                       \
+            struct hash_map_node *old = map->old_buckets[key_hash & (map->old_capacity - 1)];                   \
+                                                                                                                \
+            if (old != NULL)                                                                                    \
+            {                                                                                                   \
+                return name##_find_chain(old, key, key_hash);                                                   \
+            }                                                                                                   \
+        }                                                                                                       \
+                                                                                                                \
+        return name##_find_chain(map->buckets[key_hash & (map->capacity - 1)], key, key_hash);                  \
+    }
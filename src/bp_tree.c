@@ -1,4 +1,382 @@
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
 #include <bp_tree.h>
+#include <bp_tree_wal.h>
+
+/**
+ * Inline keys window which is scanned by SIMD compares after binary search.
+ */
+#define BP_TREE_SIMD_WINDOW 16
+
+/**
+ * Bits of node version. Version is increased by step after each write which changed node.
+ */
+#define BP_TREE_VERSION_LOCKED 1ull
+#define BP_TREE_VERSION_OBSOLETE 2ull
+#define BP_TREE_VERSION_STEP 4ull
+
+/**
+ * Nodes which insert or delete of one key can lock: changed node, its sibling and new or freed
+ * node on each level and new root. Leaves hold at least two keys and size is int, so tree is not
+ * higher than 32 levels.
+ */
+#define BP_TREE_TOUCHED_PER_KEY 128
+
+/**
+ * Retired groups of tree, it is not part of tree, so bp_tree_free_async hands pending groups
+ * to background thread with nodes.
+ */
+struct bp_tree_reclaim
+{
+    /** Retired nodes which are not readable anymore, writer returns them to slabs */
+    struct bp_tree_struct_node *released;
+
+    /** Count of retired groups of nodes which are not released yet */
+    int pending;
+};
+
+/**
+ * Nodes freed by one write, they are retired to epoch domain together.
+ */
+struct bp_tree_retired_nodes
+{
+    struct bp_tree_reclaim *reclaim;
+
+    /** Nodes linked by parent field */
+    struct bp_tree_struct_node *nodes;
+};
+
+/**
+ * Kinds of measured operations.
+ */
+#define BP_TREE_OP_LOOKUP 0
+#define BP_TREE_OP_INSERT 1
+#define BP_TREE_OP_DELETE 2
+
+/**
+ * Counters of thread at start of measured operation.
+ */
+struct bp_tree_measure
+{
+    /** Stats of tree, NULL if operation is not measured */
+    struct bp_tree_stats *stats;
+
+    long long comparisons;
+    long long nodes;
+
+    /** Hardware counters were read */
+    int hardware;
+    unsigned long long cycles;
+    unsigned long long cache_misses;
+};
+
+/**
+ * Software counters of thread, they are increased only while tree has stats.
+ */
+static __thread long long bp_tree_thread_comparisons = 0;
+static __thread long long bp_tree_thread_nodes = 0;
+
+/**
+ * Perf events of thread: 0 if not opened, 1 if opened, -1 if perf_event_open failed.
+ */
+static __thread int bp_tree_perf_state = 0;
+static __thread int bp_tree_perf_fd = -1;
+
+/**
+ * Closes perf events of thread when thread exits.
+ */
+static pthread_key_t bp_tree_perf_key;
+static pthread_once_t bp_tree_perf_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Nodes, slabs and pending retired groups handed to background thread by bp_tree_free_async.
+ */
+struct bp_tree_free_task
+{
+    struct bp_tree_struct_node *root;
+    struct bp_tree_slab leaf_slab;
+    struct bp_tree_slab non_leaf_slab;
+    struct epoch *domain;
+    struct bp_tree_reclaim *reclaim;
+    struct bp_tree_stats *stats;
+    void (*free_callback)(struct bp_tree_node *);
+};
+
+/**
+ * Key of lookup: key node with its inline key, or raw key compared with keys of nodes
+ * by compare (then inline keys are not used).
+ */
+struct bp_tree_probe
+{
+    struct bp_tree_node *node;
+    long long prefix;
+
+    const void *key;
+    int (*compare)(const void *key, struct bp_tree_node *node);
+};
+
+/**
+ * Sorted array input of bp_tree_bulk_load.
+ */
+struct bp_tree_bulk_array
+{
+    struct bp_tree_node **keys;
+    int size;
+    int index;
+};
+
+/**
+ * Next key of sorted array, NULL after last key.
+ */
+static struct bp_tree_node *bp_tree_bulk_array_next(void *context);
+
+/**
+ * Count of items in node filled to fill_factor of max, but not less than min.
+ */
+static inline int bp_tree_fill_count(int max, int min, float fill_factor);
+
+/**
+ * Call comparator, call is counted if tree has stats.
+ */
+static inline int bp_tree_compare(struct bp_tree *tree, struct bp_tree_node *first, struct bp_tree_node *second);
+
+/**
+ * Call comparator of raw key, call is counted if tree has stats.
+ */
+static inline int bp_tree_compare_key(struct bp_tree *tree,
+                                      const void *key,
+                                      int (*compare)(const void *key, struct bp_tree_node *node),
+                                      struct bp_tree_node *node);
+
+/**
+ * Count visited node if tree has stats.
+ */
+static inline void bp_tree_count_node(struct bp_tree *tree);
+
+/**
+ * Remember counters of thread before operation, if tree has stats.
+ */
+static inline void bp_tree_measure_begin(struct bp_tree *tree, struct bp_tree_measure *measure);
+
+/**
+ * Add counters of operation to stats of tree.
+ */
+static inline void bp_tree_measure_end(struct bp_tree_measure *measure, int op);
+
+/**
+ * Add counters of measured operation, see bp_tree_measure_end.
+ */
+static void bp_tree_measure_add(struct bp_tree_measure *measure, int op);
+
+/**
+ * Copy counters which are increased concurrently by lookups.
+ */
+static void bp_tree_load_op_stats(struct bp_tree_op_stats *to, struct bp_tree_op_stats *from);
+
+/**
+ * Read cycles and cache misses of thread, perf events are opened on first call.
+ * Returns -1 if perf events are not available.
+ */
+static int bp_tree_perf_read(unsigned long long *cycles, unsigned long long *cache_misses);
+
+/**
+ * Create key which closes perf events of exited threads.
+ */
+static void bp_tree_perf_key_create(void);
+
+/**
+ * Close perf events of exited thread.
+ */
+static void bp_tree_perf_close(void *fds);
+
+/**
+ * Compare keys with inline keys (prefixes).
+ */
+static inline int bp_tree_compare_keys(struct bp_tree *tree,
+                                       struct bp_tree_node *first,
+                                       long long first_prefix,
+                                       struct bp_tree_node *second,
+                                       long long second_prefix);
+
+/**
+ * Build tree from sorted keys, see bp_tree_bulk_load_iterator.
+ */
+static int bp_tree_bulk_build(struct bp_tree *tree,
+                              struct bp_tree_node *(*next)(void *context),
+                              void *context,
+                              float fill_factor);
+
+/**
+ * Free leaves after first and empty first, so failed bulk load leaves tree empty.
+ */
+static void bp_tree_bulk_abort(struct bp_tree *tree, struct bp_tree_struct_node *first);
+
+/**
+ * Fill last leaf from its left neighbour (or merge them) if last leaf has too few keys.
+ * Returns count of leaves after merge.
+ */
+static int bp_tree_bulk_fix_last_leaf(struct bp_tree *tree, struct bp_tree_struct_node *last, int count);
+
+/**
+ * Build non leaf levels above count nodes linked by right pointers starting from first.
+ * Returns root.
+ */
+static struct bp_tree_struct_node *bp_tree_bulk_build_levels(struct bp_tree *tree,
+                                                             struct bp_tree_struct_node *first,
+                                                             int count,
+                                                             float fill_factor);
+
+/**
+ * Key of batch with its inline key (prefix).
+ */
+struct bp_tree_batch_item
+{
+    struct bp_tree_node *key;
+    long long prefix;
+};
+
+/**
+ * Copy keys of batch with inline keys and sort them by stable merge sort.
+ */
+static struct bp_tree_batch_item *bp_tree_batch_sort(struct bp_tree *tree, struct bp_tree_batch *batch);
+
+/**
+ * Create empty result batch for capacity keys.
+ */
+static struct bp_tree_batch *bp_tree_batch_result(int capacity);
+
+/**
+ * Free result batch, result may be NULL.
+ */
+static void bp_tree_batch_result_free(struct bp_tree_batch *result);
+
+/**
+ * End of run of sorted items from index which fall into leaf: items less than minimal
+ * key of right leaf (it equals separator between leaves).
+ */
+static int bp_tree_batch_run(struct bp_tree *tree,
+                             struct bp_tree_struct_node *leaf,
+                             struct bp_tree_batch_item *items,
+                             int from,
+                             int size);
+
+/**
+ * Merge sorted items into leaf. If leaf overflows, split it to as many leaves as needed at once.
+ * Replaced keys are added to result.
+ */
+static void bp_tree_insert_run(struct bp_tree *tree,
+                               struct bp_tree_struct_node *leaf,
+                               struct bp_tree_batch_item *items,
+                               int size,
+                               struct bp_tree_batch_item *buffer,
+                               struct bp_tree_batch *result);
+
+/**
+ * Delete sorted items from leaf in one pass and rebalance leaf once. Deleted keys are added to result.
+ */
+static void bp_tree_delete_run(struct bp_tree *tree,
+                               struct bp_tree_struct_node *leaf,
+                               struct bp_tree_batch_item *items,
+                               int size,
+                               struct bp_tree_batch *result);
+
+/**
+ * Inline key (prefix) in node position, 0 in BP_TREE_KEY_POINTER mode.
+ */
+static inline long long bp_tree_prefix_at(struct bp_tree_struct_node *node, int index);
+
+/**
+ * Count of keys in leaf from index which are less than high, if high is NULL count of all keys.
+ */
+static int bp_tree_range_end(struct bp_tree *tree,
+                             struct bp_tree_struct_node *leaf,
+                             struct bp_tree_node *high,
+                             long long high_prefix);
+
+/**
+ * Set cursor to first key of leaf from index, move to right leaf if index is out of leaf.
+ */
+static struct bp_tree_node *bp_tree_cursor_set(struct bp_tree_cursor *cursor,
+                                               struct bp_tree_struct_node *leaf,
+                                               int index);
+
+/**
+ * Take writer mutex in concurrent mode.
+ */
+static inline void bp_tree_write_begin(struct bp_tree *tree);
+
+/**
+ * Unlock nodes changed by write and release writer mutex.
+ */
+static inline void bp_tree_write_end(struct bp_tree *tree);
+
+/**
+ * Unlock nodes changed by write, their versions are increased. Batches unlock nodes after each leaf,
+ * so lookups do not wait for whole batch.
+ */
+static void bp_tree_unlock_touched(struct bp_tree *tree);
+
+/**
+ * Make room for count more nodes in touched before write changes any node, so each changed node
+ * is locked. Returns -1 if memory can not be allocated, then write must not change tree.
+ */
+static int bp_tree_reserve_touched(struct bp_tree *tree, int count);
+
+/**
+ * Make room in slabs for nodes which insert of count keys may create, before write changes tree,
+ * so splits do not fail. Keys fall into runs leaves. Returns -1 if memory can not be allocated.
+ */
+static int bp_tree_reserve_nodes(struct bp_tree *tree, int count, int runs);
+
+/**
+ * Lock node before change in concurrent mode, node stays locked until write ends. Room for node
+ * is reserved by bp_tree_reserve_touched.
+ */
+static inline void bp_tree_touch(struct bp_tree *tree, struct bp_tree_struct_node *node);
+
+/**
+ * Lock node and mark it as freed (or allocated again), so readers which keep pointer to freed node restart.
+ */
+static inline void bp_tree_set_obsolete(struct bp_tree *tree, struct bp_tree_struct_node *node, int obsolete);
+
+/**
+ * Set root, readers load it concurrently.
+ */
+static inline void bp_tree_set_root(struct bp_tree *tree, struct bp_tree_struct_node *root);
+
+/**
+ * Read version of not locked node. If node is locked or obsolete returns 0.
+ */
+static inline int bp_tree_read_version(struct bp_tree_struct_node *node, unsigned long long *version);
+
+/**
+ * Returns true if node was not changed since version was read.
+ */
+static inline int bp_tree_validate_version(struct bp_tree_struct_node *node, unsigned long long version);
+
+/**
+ * One optimistic descent of concurrent lookup. Each node is copied to local arrays and
+ * its version is checked before copy is used. Returns -1 if descent must be restarted.
+ */
+static int bp_tree_lookup_optimistic(struct bp_tree *tree,
+                                     struct bp_tree_probe *probe,
+                                     struct bp_tree_node **keys,
+                                     long long *prefixes,
+                                     struct bp_tree_struct_node **children,
+                                     struct bp_tree_node **result);
 
 /**
  * Returns true if node is leaf.
@@ -6,12 +384,12 @@
 static inline int bp_tree_node_is_leaf(struct bp_tree_struct_node *node);
 
 /**
- * Create non leaf node;
+ * Create non leaf node. Returns NULL if memory can not be allocated.
  */
 static struct bp_tree_non_leaf_node *bp_tree_init_non_leaf(struct bp_tree *tree);
 
 /**
- * Create leaf node;
+ * Create leaf node. Returns NULL if memory can not be allocated.
  */
 static struct bp_tree_leaf_node *bp_tree_init_leaf(struct bp_tree *tree);
 
@@ -19,8 +397,7 @@ static struct bp_tree_leaf_node *bp_tree_init_leaf(struct bp_tree *tree);
  * Find minimal key in node.
  */
 static struct bp_tree_node *bp_tree_min_node_key(struct bp_tree *tree,
-                                                 struct bp_tree_struct_node *node,
-                                                 int ignore_size);
+                                                 struct bp_tree_struct_node *node);
 
 /**
  * Find maximal key in node.
@@ -29,48 +406,204 @@ static struct bp_tree_node *bp_tree_max_node_key(struct bp_tree *tree,
                                                  struct bp_tree_struct_node *node);
 
 /**
- * Update each key in node by minimal keys in children.
+ * Find index of child in parent node.
+ */
+static int bp_tree_child_index(struct bp_tree_struct_node *parent, struct bp_tree_struct_node *child);
+
+/**
+ * Separators in non leaf nodes are lower bounds of right subtrees and point to minimal
+ * keys of some leaves. When such key is replaced or deleted, update separator which points to it:
+ * set new_key, or minimal key of right subtree if new_key is NULL.
+ */
+static void bp_tree_replace_separator(struct bp_tree *tree,
+                                      struct bp_tree_node *key,
+                                      long long prefix,
+                                      struct bp_tree_node *new_key);
+
+/**
+ * Find most left leaf in subtree of node.
+ */
+static struct bp_tree_struct_node *bp_tree_min_node_leaf(struct bp_tree_struct_node *node);
+
+/**
+ * Inline key (or key prefix) of key, 0 in BP_TREE_KEY_POINTER mode.
+ */
+static inline long long bp_tree_key_prefix(struct bp_tree *tree, struct bp_tree_node *key);
+
+/**
+ * Set key with inline key (prefix) to node position.
+ */
+static inline void bp_tree_set_key(struct bp_tree_struct_node *node,
+                                   int index,
+                                   struct bp_tree_node *key,
+                                   long long prefix);
+
+/**
+ * Copy count keys with inline keys from src node to dst node, ranges may overlap.
+ */
+static inline void bp_tree_copy_keys(struct bp_tree_struct_node *dst,
+                                     int dst_index,
+                                     struct bp_tree_struct_node *src,
+                                     int src_index,
+                                     int count);
+
+/**
+ * Count of keys in node which are less than key. If upper is set,
+ * count of keys which are less or equal key.
+ */
+static int bp_tree_search(struct bp_tree *tree,
+                          struct bp_tree_struct_node *node,
+                          struct bp_tree_node *key,
+                          long long prefix,
+                          int upper);
+
+/**
+ * Compare common prefix of separators of inner node with key in BP_TREE_KEY_BYTES mode, separators
+ * must be encoded. If key is less or more than prefix returns its position, otherwise returns -1
+ * and sets prefix to inline key of key in node.
+ */
+static int bp_tree_search_skip(struct bp_tree *tree,
+                               struct bp_tree_struct_node *node,
+                               struct bp_tree_node *key,
+                               long long *prefix);
+
+/**
+ * Find common prefix of separators of inner node and set inline keys after it.
+ */
+static void bp_tree_encode_separators(struct bp_tree *tree, struct bp_tree_struct_node *node);
+
+/**
+ * Binary search by comparator in keys[base, base + size).
+ */
+static int bp_tree_search_keys(struct bp_tree *tree,
+                               struct bp_tree_node **keys,
+                               int base,
+                               int size,
+                               struct bp_tree_node *key,
+                               int upper);
+
+/**
+ * Binary search of raw key by its comparator in keys[0, size).
+ */
+static int bp_tree_search_raw_key(struct bp_tree *tree,
+                                  struct bp_tree_node **keys,
+                                  int size,
+                                  const void *key,
+                                  int (*compare)(const void *key, struct bp_tree_node *node),
+                                  int upper);
+
+/**
+ * Search of probe in node, see bp_tree_search.
+ */
+static inline int bp_tree_probe_search(struct bp_tree *tree,
+                                       struct bp_tree_struct_node *node,
+                                       struct bp_tree_probe *probe,
+                                       int upper);
+
+/**
+ * Returns true if key in node position equals probe.
+ */
+static inline int bp_tree_probe_equals(struct bp_tree *tree,
+                                       struct bp_tree_struct_node *node,
+                                       int index,
+                                       struct bp_tree_probe *probe);
+
+/**
+ * Binary search by inline keys, last BP_TREE_SIMD_WINDOW keys are counted by SIMD compares.
+ */
+static int bp_tree_search_prefixes(const long long *prefixes, int size, long long prefix, int upper);
+
+/**
+ * Returns true if key in node position equals key.
+ */
+static inline int bp_tree_key_equals(struct bp_tree *tree,
+                                     struct bp_tree_struct_node *node,
+                                     int index,
+                                     struct bp_tree_node *key,
+                                     long long prefix);
+
+/**
+ * Free all nodes and use new key mode, see bp_tree_set_key_mode. Returns -1 if memory for locks of
+ * write can not be allocated.
+ */
+static int bp_tree_change_key_mode(struct bp_tree *tree,
+                                   enum bp_tree_key_mode mode,
+                                   long long (*key_prefix)(struct bp_tree_node *),
+                                   const void *(*key_bytes)(struct bp_tree_node *key, size_t *size));
+
+/**
+ * Count of keys in subtree of node.
+ */
+static inline int bp_tree_subtree_count(struct bp_tree_struct_node *node);
+
+/**
+ * Add delta to counts of ancestors of node.
+ */
+static inline void bp_tree_add_count(struct bp_tree_struct_node *node, int delta);
+
+/**
+ * Count of keys which are less than key, writer mutex must be held.
  */
-static void bp_tree_update_node(struct bp_tree *tree, struct bp_tree_struct_node *node);
+static int bp_tree_rank_key(struct bp_tree *tree, struct bp_tree_node *key);
 
 /**
  * Find leaf node which contains key.
  */
 static struct bp_tree_struct_node *bp_tree_lookup_leaf(struct bp_tree *tree,
-                                                       struct bp_tree_node *key);
+                                                       struct bp_tree_node *key,
+                                                       long long prefix);
 
 /**
- * Find key in leaf node.
+ * Find probe in tree, optimistically in concurrent mode.
  */
-static struct bp_tree_node *bp_tree_lookup_leaf_child(struct bp_tree *tree,
-                                                      struct bp_tree_node *key);
+static struct bp_tree_node *bp_tree_lookup_probe(struct bp_tree *tree, struct bp_tree_probe *probe);
 
 /**
  * Insert key to leaf node.
  */
 static struct bp_tree_node *bp_tree_insert_leaf_child(struct bp_tree *tree, struct bp_tree_node *key);
 /**
- * Split struct node (leaf or non-leaf).
+ * Split struct node (leaf or non-leaf). New nodes are reserved by writer, see bp_tree_reserve_nodes.
  */
 static void bp_tree_split(struct bp_tree *tree,
                           struct bp_tree_struct_node *for_split);
 
 /**
- * Delete key in leaf or non-leaf node.
+ * Insert separator key and new_node right after node to parent of node, split parent if it overflows.
+ * If node is root, create new root.
  */
-static struct bp_tree_node *bp_tree_delete_child(struct bp_tree *tree, struct bp_tree_struct_node *found, struct bp_tree_node *key);
+static void bp_tree_insert_separator(struct bp_tree *tree,
+                                     struct bp_tree_struct_node *node,
+                                     struct bp_tree_node *key,
+                                     long long prefix,
+                                     struct bp_tree_struct_node *new_node);
+
+/**
+ * Transfer key from sibling or merge with sibling if node has too few keys.
+ */
+static void bp_tree_rebalance(struct bp_tree *tree, struct bp_tree_struct_node *node);
+
 /**
- * Move key from left node to right node.
+ * Delete key in leaf node.
+ */
+static struct bp_tree_node *bp_tree_delete_child(struct bp_tree *tree,
+                                                 struct bp_tree_struct_node *found,
+                                                 struct bp_tree_node *key,
+                                                 long long prefix);
+/**
+ * Move count keys from left node to right node, count must be 1 for non leaf nodes.
  */
 static void bp_tree_transfer_from_left_to_right(struct bp_tree *tree,
                                                 struct bp_tree_struct_node *left,
-                                                struct bp_tree_struct_node *right);
+                                                struct bp_tree_struct_node *right,
+                                                int count);
 /**
- * Move key from right node to left node.
+ * Move count keys from right node to left node, count must be 1 for non leaf nodes.
  */
 static void bp_tree_transfer_from_right_to_left(struct bp_tree *tree,
                                                 struct bp_tree_struct_node *left,
-                                                struct bp_tree_struct_node *right);
+                                                struct bp_tree_struct_node *right,
+                                                int count);
 /**
  * Merge left and right nodes.
  */
@@ -81,303 +614,2378 @@ static void bp_tree_merge_nodes(struct bp_tree *tree,
 /**
  * Free non leaf node;
  */
-static struct bp_tree_non_leaf_node *bp_tree_free_non_leaf(struct bp_tree_non_leaf_node *node);
+static struct bp_tree_non_leaf_node *bp_tree_free_non_leaf(struct bp_tree *tree, struct bp_tree_non_leaf_node *node);
 
 /**
  * Free leaf node;
  */
-static struct bp_tree_leaf_node *bp_tree_free_leaf(struct bp_tree_leaf_node *node);
+static struct bp_tree_leaf_node *bp_tree_free_leaf(struct bp_tree *tree, struct bp_tree_leaf_node *node);
 
-int bp_tree_init(struct bp_tree *tree,
-                 int size,
-                 int (*node_comparator)(struct bp_tree_node *, struct bp_tree_node *))
-{
-    tree->degree = size;
-    tree->size = 0;
-    tree->comparator = node_comparator;
-    tree->root = &bp_tree_init_leaf(tree)->core;
-    tree->split_leaf = 0;
-    tree->split_non_leaf = 0;
-    tree->rebalance_left_leaf = 0;
-    tree->rebalance_left_non_leaf = 0;
-    tree->rebalance_right_leaf = 0;
-    tree->rebalance_right_non_leaf = 0;
-    tree->merge_left_leaf = 0;
-    tree->merge_left_non_leaf = 0;
-    tree->merge_right_leaf = 0;
-    tree->merge_right_non_leaf = 0;
-    return 0;
+/**
+ * Return freed node to its slab or, if tree has epoch domain, keep it until write ends.
+ */
+static void bp_tree_release_node(struct bp_tree *tree, struct bp_tree_struct_node *node);
+
+/**
+ * Retire nodes freed by write to epoch domain as one group.
+ */
+static void bp_tree_retire_nodes(struct bp_tree *tree);
+
+/**
+ * Epoch callback, pass retired group of nodes to writer.
+ */
+static void bp_tree_release_retired(void *retired);
+
+/**
+ * Return released nodes to slabs, writer mutex must be held.
+ */
+static void bp_tree_reuse_released(struct bp_tree *tree);
+
+/**
+ * Wait until all retired nodes are released and return them to slabs.
+ */
+static void bp_tree_wait_retired(struct bp_tree *tree);
+
+/**
+ * Wait until all retired groups (reclaim may be NULL) are released.
+ */
+static void bp_tree_wait_reclaim(struct epoch *domain, struct bp_tree_reclaim *reclaim);
+
+/**
+ * Pass keys of all leaves to free_callback (if it is not NULL) in one pass over leaves.
+ * If tree has log, delete entry is appended for each key. Returns sequence number of last entry.
+ */
+static unsigned long long bp_tree_release_keys(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *));
+
+/**
+ * Free all nodes level by level from root, nodes are not rebalanced.
+ */
+static void bp_tree_release_levels(struct bp_tree *tree);
+
+/**
+ * Background thread of bp_tree_free_async.
+ */
+static void *bp_tree_free_task_run(void *task);
+
+/**
+ * Append entry for key to log of tree. Returns sequence number of entry or 0 if tree has no log.
+ */
+static inline unsigned long long bp_tree_log(struct bp_tree *tree, int type, struct bp_tree_node *key);
+
+/**
+ * Wait until logged entries are durable, call after write ends. Returns BP_TREE_ERROR_WAL
+ * if log can not be written.
+ */
+static inline int bp_tree_commit(struct bp_tree *tree, unsigned long long sequence);
+
+/**
+ * Size of node struct in block, keys array starts after it.
+ */
+static inline size_t bp_tree_header_size(int leaf);
+
+/**
+ * Size of node block for tree degree and key mode, multiple of cache line.
+ */
+static size_t bp_tree_block_size(struct bp_tree *tree, int leaf);
+
+/**
+ * Init slab for blocks of block_size.
+ */
+static void bp_tree_slab_init(struct bp_tree_slab *slab, size_t block_size);
+
+/**
+ * Take block from free list or carve it from chunk.
+ */
+static void *bp_tree_slab_alloc(struct bp_tree_slab *slab);
+
+/**
+ * Add chunk which blocks are carved from. Returns -1 if memory can not be allocated.
+ */
+static int bp_tree_slab_grow(struct bp_tree_slab *slab);
+
+/**
+ * Make sure count blocks can be taken without allocation. Returns -1 if memory can not be allocated.
+ */
+static int bp_tree_slab_reserve(struct bp_tree_slab *slab, int count);
+
+/**
+ * Return node block to free list.
+ */
+static void bp_tree_slab_free(struct bp_tree_slab *slab, struct bp_tree_struct_node *node);
+
+/**
+ * Release all chunks.
+ */
+static void bp_tree_slab_destroy(struct bp_tree_slab *slab);
+
+int bp_tree_init(struct bp_tree *tree,
+                 int size,
+                 int (*node_comparator)(struct bp_tree_node *, struct bp_tree_node *))
+{
+    tree->degree = size;
+    tree->size = 0;
+    tree->comparator = node_comparator;
+    tree->key_mode = BP_TREE_KEY_POINTER;
+    tree->key_prefix = NULL;
+    tree->key_bytes = NULL;
+    tree->concurrent = 0;
+    tree->touched = NULL;
+    tree->touched_size = 0;
+    tree->touched_capacity = 0;
+    tree->domain = NULL;
+    tree->retiring = NULL;
+    tree->reclaim = NULL;
+    tree->wal = NULL;
+    tree->stats = NULL;
+    bp_tree_slab_init(&tree->leaf_slab, bp_tree_block_size(tree, 1));
+    bp_tree_slab_init(&tree->non_leaf_slab, bp_tree_block_size(tree, 0));
+    tree->root = (struct bp_tree_struct_node *)bp_tree_init_leaf(tree);
+
+    if (tree->root == NULL)
+    {
+        return -1;
+    }
+
+    tree->split_leaf = 0;
+    tree->split_non_leaf = 0;
+    tree->rebalance_left_leaf = 0;
+    tree->rebalance_left_non_leaf = 0;
+    tree->rebalance_right_leaf = 0;
+    tree->rebalance_right_non_leaf = 0;
+    tree->merge_left_leaf = 0;
+    tree->merge_left_non_leaf = 0;
+    tree->merge_right_leaf = 0;
+    tree->merge_right_non_leaf = 0;
+    return 0;
+}
+
+int bp_tree_set_key_mode(struct bp_tree *tree,
+                         enum bp_tree_key_mode mode,
+                         long long (*key_prefix)(struct bp_tree_node *))
+{
+    if (tree->size != 0 || mode == BP_TREE_KEY_BYTES || (mode != BP_TREE_KEY_POINTER && key_prefix == NULL))
+    {
+        return -1;
+    }
+
+    return bp_tree_change_key_mode(tree, mode, key_prefix, NULL);
+}
+
+int bp_tree_set_key_bytes(struct bp_tree *tree, const void *(*key_bytes)(struct bp_tree_node *key, size_t *size))
+{
+    if (tree->size != 0 || key_bytes == NULL)
+    {
+        return -1;
+    }
+
+    return bp_tree_change_key_mode(tree, BP_TREE_KEY_BYTES, NULL, key_bytes);
+}
+
+static int bp_tree_change_key_mode(struct bp_tree *tree,
+                                   enum bp_tree_key_mode mode,
+                                   long long (*key_prefix)(struct bp_tree_node *),
+                                   const void *(*key_bytes)(struct bp_tree_node *key, size_t *size))
+{
+    enum bp_tree_key_mode old_mode = tree->key_mode;
+    struct bp_tree_slab leaf_slab;
+    struct bp_tree_slab non_leaf_slab;
+
+    /* Slabs for new block sizes get room for new root before old root is freed */
+    tree->key_mode = mode;
+    bp_tree_slab_init(&leaf_slab, bp_tree_block_size(tree, 1));
+    bp_tree_slab_init(&non_leaf_slab, bp_tree_block_size(tree, 0));
+    tree->key_mode = old_mode;
+    bp_tree_write_begin(tree);
+
+    /* Old root is freed and new root is created after touched nodes are dropped */
+    if (bp_tree_reserve_touched(tree, 1) != 0 || bp_tree_slab_reserve(&leaf_slab, 1) != 0)
+    {
+        bp_tree_write_end(tree);
+        bp_tree_slab_destroy(&leaf_slab);
+        return -1;
+    }
+
+    bp_tree_free_leaf(tree, (struct bp_tree_leaf_node *)tree->root);
+    bp_tree_wait_retired(tree);
+    bp_tree_slab_destroy(&tree->leaf_slab);
+    bp_tree_slab_destroy(&tree->non_leaf_slab);
+    tree->touched_size = 0;
+    tree->key_mode = mode;
+    tree->key_prefix = key_prefix;
+    tree->key_bytes = key_bytes;
+    tree->leaf_slab = leaf_slab;
+    tree->non_leaf_slab = non_leaf_slab;
+    bp_tree_set_root(tree, &bp_tree_init_leaf(tree)->core);
+    bp_tree_write_end(tree);
+    return 0;
+}
+
+int bp_tree_set_concurrent(struct bp_tree *tree, int concurrent)
+{
+    if (tree->size != 0)
+    {
+        return -1;
+    }
+
+    if (concurrent && !tree->concurrent)
+    {
+        if (pthread_mutex_init(&tree->writer_lock, NULL) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (!concurrent && tree->concurrent)
+    {
+        pthread_mutex_destroy(&tree->writer_lock);
+    }
+
+    tree->concurrent = concurrent != 0;
+    return 0;
+}
+
+int bp_tree_set_epoch(struct bp_tree *tree, struct epoch *domain)
+{
+    if (tree->size != 0)
+    {
+        return -1;
+    }
+
+    bp_tree_write_begin(tree);
+    bp_tree_wait_retired(tree);
+    tree->domain = domain;
+    bp_tree_write_end(tree);
+    return 0;
+}
+
+int bp_tree_set_stats(struct bp_tree *tree, int flags)
+{
+    free(tree->stats);
+    tree->stats = NULL;
+
+    if ((flags & BP_TREE_STATS_ON) == 0)
+    {
+        return 0;
+    }
+
+    struct bp_tree_stats *stats = (struct bp_tree_stats *)calloc(1, sizeof(struct bp_tree_stats));
+
+    if (stats == NULL)
+    {
+        return -1;
+    }
+
+    unsigned long long cycles;
+    unsigned long long cache_misses;
+    stats->hardware = (flags & BP_TREE_STATS_HARDWARE) != 0 && bp_tree_perf_read(&cycles, &cache_misses) == 0;
+    tree->stats = stats;
+    return 0;
+}
+
+int bp_tree_get_stats(struct bp_tree *tree, struct bp_tree_stats *stats)
+{
+    memset(stats, 0, sizeof(struct bp_tree_stats));
+    bp_tree_write_begin(tree);
+
+    /* Lookups add their counters without mutex */
+    if (tree->stats != NULL)
+    {
+        bp_tree_load_op_stats(&stats->lookups, &tree->stats->lookups);
+        bp_tree_load_op_stats(&stats->inserts, &tree->stats->inserts);
+        bp_tree_load_op_stats(&stats->deletes, &tree->stats->deletes);
+        stats->hardware = tree->stats->hardware;
+    }
+
+    stats->size = tree->size;
+    stats->split_leaf = tree->split_leaf;
+    stats->split_non_leaf = tree->split_non_leaf;
+    stats->rebalance_right_leaf = tree->rebalance_right_leaf;
+    stats->rebalance_right_non_leaf = tree->rebalance_right_non_leaf;
+    stats->rebalance_left_leaf = tree->rebalance_left_leaf;
+    stats->rebalance_left_non_leaf = tree->rebalance_left_non_leaf;
+    stats->merge_left_leaf = tree->merge_left_leaf;
+    stats->merge_left_non_leaf = tree->merge_left_non_leaf;
+    stats->merge_right_leaf = tree->merge_right_leaf;
+    stats->merge_right_non_leaf = tree->merge_right_non_leaf;
+
+    /* Levels are walked by right links from first node of level */
+    for (struct bp_tree_struct_node *first = tree->root; first != NULL;)
+    {
+        stats->height++;
+
+        for (struct bp_tree_struct_node *node = first; node != NULL; node = node->right)
+        {
+            int bucket = node->size * BP_TREE_STATS_FILL_BUCKETS / (tree->degree + 1);
+
+            if (bp_tree_node_is_leaf(node))
+            {
+                stats->leaf_count++;
+                stats->leaf_fill[bucket]++;
+            }
+            else
+            {
+                stats->non_leaf_count++;
+                stats->non_leaf_fill[bucket]++;
+            }
+        }
+
+        first = bp_tree_node_is_leaf(first) ? NULL : ((struct bp_tree_non_leaf_node *)first)->children[0];
+    }
+
+    bp_tree_write_end(tree);
+    return 0;
+}
+
+int bp_tree_set_wal(struct bp_tree *tree, struct bp_tree_wal *wal)
+{
+    tree->wal = wal;
+    return 0;
+}
+
+int bp_tree_free(struct bp_tree *tree,
+                 void (*free_callback)(struct bp_tree_node *))
+{
+    /* Keys are freed, not deleted, and nodes are released with their slabs */
+    tree->wal = NULL;
+    bp_tree_release_keys(tree, free_callback);
+    tree->size = 0;
+    tree->root = NULL;
+    bp_tree_wait_retired(tree);
+    free(tree->reclaim);
+    tree->reclaim = NULL;
+    tree->domain = NULL;
+    bp_tree_slab_destroy(&tree->leaf_slab);
+    bp_tree_slab_destroy(&tree->non_leaf_slab);
+    bp_tree_set_concurrent(tree, 0);
+    free(tree->touched);
+    tree->touched = NULL;
+    tree->touched_size = 0;
+    tree->touched_capacity = 0;
+    free(tree->stats);
+    tree->stats = NULL;
+    return 0;
+}
+
+int bp_tree_free_async(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *), pthread_t *thread)
+{
+    tree->wal = NULL;
+
+    if (tree->retiring != NULL)
+    {
+        bp_tree_retire_nodes(tree);
+    }
+
+    struct bp_tree_free_task *task = (struct bp_tree_free_task *)malloc(sizeof(struct bp_tree_free_task));
+
+    if (task == NULL)
+    {
+        bp_tree_free(tree, free_callback);
+        return -1;
+    }
+
+    /* Task owns nodes, slabs and pending retired groups, tree keeps its mutex and touched array */
+    task->root = tree->root;
+    task->leaf_slab = tree->leaf_slab;
+    task->non_leaf_slab = tree->non_leaf_slab;
+    task->domain = tree->domain;
+    task->reclaim = tree->reclaim;
+    task->stats = tree->stats;
+    task->free_callback = free_callback;
+
+    tree->size = 0;
+    tree->root = NULL;
+    bp_tree_slab_init(&tree->leaf_slab, tree->leaf_slab.block_size);
+    bp_tree_slab_init(&tree->non_leaf_slab, tree->non_leaf_slab.block_size);
+    bp_tree_set_concurrent(tree, 0);
+    free(tree->touched);
+    tree->touched = NULL;
+    tree->touched_size = 0;
+    tree->touched_capacity = 0;
+    tree->domain = NULL;
+    tree->reclaim = NULL;
+    tree->stats = NULL;
+
+    pthread_attr_t attributes;
+    int created = pthread_attr_init(&attributes) == 0;
+
+    if (created)
+    {
+        pthread_t detached;
+        pthread_attr_setdetachstate(&attributes, thread != NULL ? PTHREAD_CREATE_JOINABLE : PTHREAD_CREATE_DETACHED);
+        created = pthread_create(thread != NULL ? thread : &detached, &attributes, bp_tree_free_task_run, task) == 0;
+        pthread_attr_destroy(&attributes);
+    }
+
+    if (!created)
+    {
+        bp_tree_free_task_run(task);
+        return -1;
+    }
+
+    return 0;
+}
+
+int bp_tree_clear(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *))
+{
+    bp_tree_write_begin(tree);
+
+    /* Each node is marked obsolete and new root is created */
+    if (bp_tree_reserve_touched(tree, tree->leaf_slab.node_count + tree->non_leaf_slab.node_count + 1) != 0 ||
+        bp_tree_slab_reserve(&tree->leaf_slab, 1) != 0)
+    {
+        bp_tree_write_end(tree);
+        return -1;
+    }
+
+    unsigned long long sequence = bp_tree_release_keys(tree, free_callback);
+    bp_tree_release_levels(tree);
+    tree->size = 0;
+    bp_tree_set_root(tree, &bp_tree_init_leaf(tree)->core);
+    bp_tree_write_end(tree);
+    return bp_tree_commit(tree, sequence);
+}
+
+struct bp_tree_node *bp_tree_select(struct bp_tree *tree, int index)
+{
+    struct bp_tree_node *result = NULL;
+
+    bp_tree_write_begin(tree);
+
+    if (index >= 0 && index < tree->size)
+    {
+        struct bp_tree_struct_node *current = tree->root;
+
+        /* Skip children whose subtrees are before index */
+        while (!bp_tree_node_is_leaf(current))
+        {
+            struct bp_tree_struct_node **children = ((struct bp_tree_non_leaf_node *)current)->children;
+            int child = 0;
+
+            while (child < current->size && index >= bp_tree_subtree_count(children[child]))
+            {
+                index -= bp_tree_subtree_count(children[child]);
+                child++;
+            }
+
+            current = children[child];
+        }
+
+        result = current->keys[index];
+    }
+
+    bp_tree_write_end(tree);
+    return result;
+}
+
+int bp_tree_rank(struct bp_tree *tree, struct bp_tree_node *key)
+{
+    bp_tree_write_begin(tree);
+    int result = bp_tree_rank_key(tree, key);
+    bp_tree_write_end(tree);
+    return result;
+}
+
+struct bp_tree_node *bp_tree_min_key(struct bp_tree *tree)
+{
+    bp_tree_write_begin(tree);
+    struct bp_tree_node *result = bp_tree_min_node_key(tree, tree->root);
+    bp_tree_write_end(tree);
+    return result;
+}
+
+struct bp_tree_node *bp_tree_max_key(struct bp_tree *tree)
+{
+    bp_tree_write_begin(tree);
+    struct bp_tree_node *result = bp_tree_max_node_key(tree, tree->root);
+    bp_tree_write_end(tree);
+    return result;
+}
+
+struct bp_tree_node *bp_tree_lookup(struct bp_tree *tree, struct bp_tree_node *node)
+{
+    struct bp_tree_measure measure;
+    struct bp_tree_probe probe = {node, bp_tree_key_prefix(tree, node), NULL, NULL};
+    bp_tree_measure_begin(tree, &measure);
+    struct bp_tree_node *result = bp_tree_lookup_probe(tree, &probe);
+    bp_tree_measure_end(&measure, BP_TREE_OP_LOOKUP);
+    return result;
+}
+
+struct bp_tree_node *bp_tree_lookup_key(struct bp_tree *tree,
+                                        const void *key,
+                                        int (*compare)(const void *key, struct bp_tree_node *node))
+{
+    struct bp_tree_measure measure;
+    struct bp_tree_probe probe = {NULL, 0, key, compare};
+    bp_tree_measure_begin(tree, &measure);
+    struct bp_tree_node *result = bp_tree_lookup_probe(tree, &probe);
+    bp_tree_measure_end(&measure, BP_TREE_OP_LOOKUP);
+    return result;
+}
+
+struct bp_tree_node *bp_tree_insert(struct bp_tree *tree, struct bp_tree_node *node)
+{
+    struct bp_tree_node *previous = NULL;
+    bp_tree_try_insert(tree, node, &previous);
+    return previous;
+}
+
+struct bp_tree_node *bp_tree_delete(struct bp_tree *tree, struct bp_tree_node *node)
+{
+    struct bp_tree_node *deleted = NULL;
+    bp_tree_try_delete(tree, node, &deleted);
+    return deleted;
+}
+
+int bp_tree_try_insert(struct bp_tree *tree, struct bp_tree_node *node, struct bp_tree_node **previous)
+{
+    struct bp_tree_measure measure;
+    *previous = NULL;
+    bp_tree_write_begin(tree);
+
+    if (bp_tree_reserve_touched(tree, BP_TREE_TOUCHED_PER_KEY) != 0 || bp_tree_reserve_nodes(tree, 1, 1) != 0)
+    {
+        bp_tree_write_end(tree);
+        return BP_TREE_ERROR_MEMORY;
+    }
+
+    bp_tree_measure_begin(tree, &measure);
+    *previous = bp_tree_insert_leaf_child(tree, node);
+    bp_tree_measure_end(&measure, BP_TREE_OP_INSERT);
+    unsigned long long sequence = bp_tree_log(tree, BP_TREE_WAL_INSERT, node);
+    bp_tree_write_end(tree);
+    return bp_tree_commit(tree, sequence);
+}
+
+int bp_tree_try_delete(struct bp_tree *tree, struct bp_tree_node *node, struct bp_tree_node **deleted)
+{
+    struct bp_tree_measure measure;
+    long long prefix = bp_tree_key_prefix(tree, node);
+    *deleted = NULL;
+    bp_tree_write_begin(tree);
+
+    if (bp_tree_reserve_touched(tree, BP_TREE_TOUCHED_PER_KEY) != 0)
+    {
+        bp_tree_write_end(tree);
+        return BP_TREE_ERROR_MEMORY;
+    }
+
+    bp_tree_measure_begin(tree, &measure);
+    *deleted = bp_tree_delete_child(tree, bp_tree_lookup_leaf(tree, node, prefix), node, prefix);
+    bp_tree_measure_end(&measure, BP_TREE_OP_DELETE);
+    unsigned long long sequence = *deleted != NULL ? bp_tree_log(tree, BP_TREE_WAL_DELETE, node) : 0;
+    bp_tree_write_end(tree);
+    return bp_tree_commit(tree, sequence);
+}
+
+int bp_tree_bulk_load(struct bp_tree *tree, struct bp_tree_node **keys, int size, float fill_factor)
+{
+    struct bp_tree_bulk_array array = {keys, size, 0};
+    return bp_tree_bulk_load_iterator(tree, bp_tree_bulk_array_next, &array, fill_factor);
+}
+
+int bp_tree_bulk_load_iterator(struct bp_tree *tree,
+                               struct bp_tree_node *(*next)(void *context),
+                               void *context,
+                               float fill_factor)
+{
+    bp_tree_write_begin(tree);
+    int result = bp_tree_bulk_build(tree, next, context, fill_factor);
+    bp_tree_write_end(tree);
+    return result;
+}
+
+static int bp_tree_bulk_build(struct bp_tree *tree,
+                              struct bp_tree_node *(*next)(void *context),
+                              void *context,
+                              float fill_factor)
+{
+    if (tree->size != 0 || !bp_tree_node_is_leaf(tree->root) || !(fill_factor > 0 && fill_factor <= 1))
+    {
+        return -1;
+    }
+
+    /* New leaves are locked one by one, so room is reserved for each of them */
+    if (bp_tree_reserve_touched(tree, 1) != 0)
+    {
+        return -1;
+    }
+
+    bp_tree_touch(tree, tree->root);
+
+    int leaf_size = bp_tree_fill_count(tree->degree - 1, tree->degree / 2, fill_factor);
+    struct bp_tree_struct_node *first = tree->root;
+    struct bp_tree_struct_node *last = first;
+    struct bp_tree_node *prev = NULL;
+    long long prev_prefix = 0;
+    int count = 1;
+
+    /* Leaves are filled from left to right, so each key is written once */
+    for (struct bp_tree_node *key = next(context); key != NULL; key = next(context))
+    {
+        long long prefix = bp_tree_key_prefix(tree, key);
+
+        if (prev != NULL && bp_tree_compare_keys(tree, prev, prev_prefix, key, prefix) >= 0)
+        {
+            bp_tree_bulk_abort(tree, first);
+            return -1;
+        }
+
+        if (last->size == leaf_size)
+        {
+            if (bp_tree_reserve_touched(tree, 1) != 0)
+            {
+                bp_tree_bulk_abort(tree, first);
+                return -1;
+            }
+
+            struct bp_tree_leaf_node *leaf = bp_tree_init_leaf(tree);
+
+            if (leaf == NULL)
+            {
+                bp_tree_bulk_abort(tree, first);
+                return -1;
+            }
+
+            leaf->core.left = last;
+            last->right = &leaf->core;
+            last = &leaf->core;
+            count++;
+        }
+
+        bp_tree_set_key(last, last->size++, key, prefix);
+        tree->size++;
+        prev = key;
+        prev_prefix = prefix;
+    }
+
+    count = bp_tree_bulk_fix_last_leaf(tree, last, count);
+
+    /* Each level has less nodes than level below it */
+    if (bp_tree_reserve_touched(tree, count) != 0 || bp_tree_slab_reserve(&tree->non_leaf_slab, count) != 0)
+    {
+        bp_tree_bulk_abort(tree, first);
+        return -1;
+    }
+
+    bp_tree_set_root(tree, bp_tree_bulk_build_levels(tree, first, count, fill_factor));
+    return 0;
+}
+
+struct bp_tree_batch *bp_tree_lookup_batch(struct bp_tree *tree, struct bp_tree_batch *node)
+{
+    struct bp_tree_batch_item *items = bp_tree_batch_sort(tree, node);
+    struct bp_tree_batch *result = bp_tree_batch_result(node->size);
+
+    if (items == NULL || result == NULL)
+    {
+        free(items);
+        bp_tree_batch_result_free(result);
+        return NULL;
+    }
+
+    bp_tree_write_begin(tree);
+
+    for (int i = 0; i < node->size;)
+    {
+        struct bp_tree_struct_node *leaf = bp_tree_lookup_leaf(tree, items[i].key, items[i].prefix);
+        int end = bp_tree_batch_run(tree, leaf, items, i, node->size);
+        int position = 0;
+
+        /* Keys of run are sorted, so leaf is scanned once */
+        for (; i < end; i++)
+        {
+            while (position < leaf->size &&
+                   bp_tree_compare_keys(tree, leaf->keys[position], bp_tree_prefix_at(leaf, position), items[i].key, items[i].prefix) < 0)
+            {
+                position++;
+            }
+
+            if (bp_tree_key_equals(tree, leaf, position, items[i].key, items[i].prefix))
+            {
+                result->nodes[result->size++] = leaf->keys[position];
+            }
+        }
+    }
+
+    bp_tree_write_end(tree);
+    free(items);
+    return result;
+}
+
+struct bp_tree_batch *bp_tree_insert_batch(struct bp_tree *tree, struct bp_tree_batch *node)
+{
+    struct bp_tree_batch_item *items = bp_tree_batch_sort(tree, node);
+    struct bp_tree_batch *result = bp_tree_batch_result(node->size);
+    struct bp_tree_batch_item *buffer = (struct bp_tree_batch_item *)malloc((node->size + tree->degree) * sizeof(struct bp_tree_batch_item));
+    unsigned long long sequence = 0;
+
+    if (items == NULL || result == NULL || buffer == NULL)
+    {
+        free(items);
+        free(buffer);
+        bp_tree_batch_result_free(result);
+        return NULL;
+    }
+
+    bp_tree_write_begin(tree);
+
+    /* Nodes are unlocked after each run, run adds at most all items to one leaf, runs fall into distinct leaves */
+    if (bp_tree_reserve_touched(tree, BP_TREE_TOUCHED_PER_KEY + 2 * ((node->size + tree->degree) / (tree->degree - 1) + 1)) != 0 ||
+        bp_tree_reserve_nodes(tree, node->size, node->size < tree->leaf_slab.node_count ? node->size : tree->leaf_slab.node_count) != 0)
+    {
+        bp_tree_write_end(tree);
+        free(items);
+        free(buffer);
+        bp_tree_batch_result_free(result);
+        return NULL;
+    }
+
+    for (int i = 0; i < node->size;)
+    {
+        struct bp_tree_struct_node *leaf = bp_tree_lookup_leaf(tree, items[i].key, items[i].prefix);
+        int end = bp_tree_batch_run(tree, leaf, items, i, node->size);
+
+        bp_tree_insert_run(tree, leaf, items + i, end - i, buffer, result);
+        bp_tree_unlock_touched(tree);
+
+        for (; i < end; i++)
+        {
+            sequence = bp_tree_log(tree, BP_TREE_WAL_INSERT, items[i].key);
+        }
+    }
+
+    bp_tree_write_end(tree);
+    result->error = bp_tree_commit(tree, sequence);
+    free(items);
+    free(buffer);
+    return result;
+}
+
+struct bp_tree_batch *bp_tree_delete_batch(struct bp_tree *tree, struct bp_tree_batch *node)
+{
+    struct bp_tree_batch_item *items = bp_tree_batch_sort(tree, node);
+    struct bp_tree_batch *result = bp_tree_batch_result(node->size);
+    unsigned long long sequence = 0;
+
+    if (items == NULL || result == NULL)
+    {
+        free(items);
+        bp_tree_batch_result_free(result);
+        return NULL;
+    }
+
+    bp_tree_write_begin(tree);
+
+    /* Nodes are unlocked after each run, run rebalances one leaf */
+    if (bp_tree_reserve_touched(tree, BP_TREE_TOUCHED_PER_KEY) != 0)
+    {
+        bp_tree_write_end(tree);
+        free(items);
+        bp_tree_batch_result_free(result);
+        return NULL;
+    }
+
+    for (int i = 0; i < node->size;)
+    {
+        struct bp_tree_struct_node *leaf = bp_tree_lookup_leaf(tree, items[i].key, items[i].prefix);
+        int end = bp_tree_batch_run(tree, leaf, items, i, node->size);
+
+        bp_tree_delete_run(tree, leaf, items + i, end - i, result);
+        bp_tree_unlock_touched(tree);
+
+        for (; i < end; i++)
+        {
+            sequence = bp_tree_log(tree, BP_TREE_WAL_DELETE, items[i].key);
+        }
+    }
+
+    bp_tree_write_end(tree);
+    result->error = bp_tree_commit(tree, sequence);
+    free(items);
+    return result;
+}
+
+struct bp_tree_node *bp_tree_cursor_first(struct bp_tree_cursor *cursor, struct bp_tree *tree)
+{
+    cursor->tree = tree;
+    return bp_tree_cursor_set(cursor, &bp_tree_min_leaf(tree)->core, 0);
+}
+
+struct bp_tree_node *bp_tree_cursor_last(struct bp_tree_cursor *cursor, struct bp_tree *tree)
+{
+    struct bp_tree_struct_node *leaf = &bp_tree_max_leaf(tree)->core;
+    cursor->tree = tree;
+    cursor->leaf = leaf->size > 0 ? leaf : NULL;
+    cursor->index = leaf->size - 1;
+    return bp_tree_cursor_key(cursor);
+}
+
+struct bp_tree_node *bp_tree_cursor_seek(struct bp_tree_cursor *cursor, struct bp_tree *tree, struct bp_tree_node *key)
+{
+    long long prefix = bp_tree_key_prefix(tree, key);
+    struct bp_tree_struct_node *leaf = bp_tree_lookup_leaf(tree, key, prefix);
+    cursor->tree = tree;
+    return bp_tree_cursor_set(cursor, leaf, bp_tree_search(tree, leaf, key, prefix, 0));
+}
+
+struct bp_tree_node *bp_tree_cursor_key(struct bp_tree_cursor *cursor)
+{
+    return cursor->leaf != NULL ? cursor->leaf->keys[cursor->index] : NULL;
+}
+
+struct bp_tree_node *bp_tree_cursor_next(struct bp_tree_cursor *cursor)
+{
+    if (cursor->leaf == NULL)
+    {
+        return NULL;
+    }
+
+    return bp_tree_cursor_set(cursor, cursor->leaf, cursor->index + 1);
+}
+
+struct bp_tree_node *bp_tree_cursor_prev(struct bp_tree_cursor *cursor)
+{
+    if (cursor->leaf == NULL)
+    {
+        return NULL;
+    }
+
+    if (cursor->index > 0)
+    {
+        cursor->index--;
+    }
+    else
+    {
+        /* Only root leaf may be empty, so left leaf has keys */
+        cursor->leaf = cursor->leaf->left;
+        cursor->index = cursor->leaf != NULL ? cursor->leaf->size - 1 : 0;
+    }
+
+    return bp_tree_cursor_key(cursor);
+}
+
+int bp_tree_range(struct bp_tree *tree,
+                  struct bp_tree_node *low,
+                  struct bp_tree_node *high,
+                  int (*callback)(struct bp_tree_node *key, void *context),
+                  void *context)
+{
+    struct bp_tree_cursor cursor;
+    long long high_prefix = high != NULL ? bp_tree_key_prefix(tree, high) : 0;
+    int count = 0;
+
+    bp_tree_write_begin(tree);
+
+    if (low != NULL)
+    {
+        bp_tree_cursor_seek(&cursor, tree, low);
+    }
+    else
+    {
+        bp_tree_cursor_first(&cursor, tree);
+    }
+
+    /* Keys before end of leaf are passed without compares with high */
+    for (struct bp_tree_struct_node *leaf = cursor.leaf; leaf != NULL; leaf = leaf->right)
+    {
+        int index = leaf == cursor.leaf ? cursor.index : 0;
+        int end = bp_tree_range_end(tree, leaf, high, high_prefix);
+
+        for (; index < end; index++)
+        {
+            count++;
+
+            if (callback(leaf->keys[index], context) != 0)
+            {
+                bp_tree_write_end(tree);
+                return count;
+            }
+        }
+
+        if (end < leaf->size)
+        {
+            break;
+        }
+    }
+
+    bp_tree_write_end(tree);
+    return count;
+}
+
+int bp_tree_range_count(struct bp_tree *tree, struct bp_tree_node *low, struct bp_tree_node *high)
+{
+    bp_tree_write_begin(tree);
+    int low_rank = low != NULL ? bp_tree_rank_key(tree, low) : 0;
+    int high_rank = high != NULL ? bp_tree_rank_key(tree, high) : tree->size;
+    bp_tree_write_end(tree);
+    return high_rank > low_rank ? high_rank - low_rank : 0;
+}
+
+void bp_tree_print(struct bp_tree *tree,
+                   void (*print_node)(struct bp_tree_node *))
+{
+    struct bp_tree_struct_node *current = (struct bp_tree_struct_node *)tree->root;
+    int level = tree->size / tree->degree;
+    while (current)
+    {
+        struct bp_tree_struct_node *step = current;
+
+        for (int i = 0; i < level; i++)
+        {
+            printf(" ");
+        }
+
+        while (step)
+        {
+            printf("[");
+            for (int i = 0; i < step->size; i++)
+            {
+                print_node(step->keys[i]);
+            }
+            printf("]");
+
+            step = step->right;
+
+            if (step != NULL)
+            {
+                for (int i = 0; i < level; i++)
+                {
+                    printf(" ");
+                }
+            }
+        }
+
+        printf("\n\n");
+
+        if (current->leaf == 1 || current->size == 0)
+        {
+            current = NULL;
+        }
+        else
+        {
+            current = (struct bp_tree_struct_node *)((struct bp_tree_non_leaf_node *)current)->children[0];
+        }
+
+        level--;
+    }
+}
+
+struct bp_tree_leaf_node *bp_tree_min_leaf(struct bp_tree *tree)
+{
+    struct bp_tree_struct_node *current = tree->root;
+    while (1)
+    {
+        if (bp_tree_node_is_leaf(current))
+        {
+            return (struct bp_tree_leaf_node *)current;
+        }
+
+        current = ((struct bp_tree_non_leaf_node *)current)->children[0];
+    }
+}
+
+struct bp_tree_leaf_node *bp_tree_max_leaf(struct bp_tree *tree)
+{
+    struct bp_tree_struct_node *current = tree->root;
+    while (1)
+    {
+        if (bp_tree_node_is_leaf(current))
+        {
+            return (struct bp_tree_leaf_node *)current;
+        }
+
+        current = ((struct bp_tree_non_leaf_node *)current)->children[current->size];
+    }
+}
+
+static inline size_t bp_tree_header_size(int leaf)
+{
+    size_t size = leaf ? sizeof(struct bp_tree_leaf_node) : sizeof(struct bp_tree_non_leaf_node);
+    return (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+}
+
+static size_t bp_tree_block_size(struct bp_tree *tree, int leaf)
+{
+    size_t size = bp_tree_header_size(leaf);
+    size += tree->degree * sizeof(struct bp_tree_node *);
+
+    if (tree->key_mode != BP_TREE_KEY_POINTER)
+    {
+        size += tree->degree * sizeof(long long);
+    }
+
+    if (!leaf)
+    {
+        size += (tree->degree + 1) * sizeof(struct bp_tree_struct_node *);
+    }
+
+    return (size + BP_TREE_CACHE_LINE - 1) / BP_TREE_CACHE_LINE * BP_TREE_CACHE_LINE;
+}
+
+static void bp_tree_slab_init(struct bp_tree_slab *slab, size_t block_size)
+{
+    slab->block_size = block_size;
+    slab->free_list = NULL;
+    slab->chunks = NULL;
+    slab->cursor = NULL;
+    slab->limit = NULL;
+    slab->chunk_count = 0;
+    slab->node_count = 0;
+    slab->free_count = 0;
+}
+
+static void *bp_tree_slab_alloc(struct bp_tree_slab *slab)
+{
+    void *block = NULL;
+
+    if (slab->free_list != NULL)
+    {
+        block = slab->free_list;
+        slab->free_list = slab->free_list->parent;
+        slab->free_count--;
+    }
+    else
+    {
+        if (slab->cursor == slab->limit && bp_tree_slab_grow(slab) != 0)
+        {
+            return NULL;
+        }
+
+        block = slab->cursor;
+        ((struct bp_tree_struct_node *)block)->version = 0;
+        slab->cursor += slab->block_size;
+    }
+
+    slab->node_count++;
+    return block;
+}
+
+static int bp_tree_slab_grow(struct bp_tree_slab *slab)
+{
+    size_t size = BP_TREE_CACHE_LINE + slab->block_size * BP_TREE_SLAB_CHUNK_NODES;
+    void **chunk = (void **)aligned_alloc(BP_TREE_CACHE_LINE, size);
+
+    if (chunk == NULL)
+    {
+        return -1;
+    }
+
+    *chunk = slab->chunks;
+    slab->chunks = chunk;
+    slab->cursor = (char *)chunk + BP_TREE_CACHE_LINE;
+    slab->limit = (char *)chunk + size;
+    slab->chunk_count++;
+    return 0;
+}
+
+static int bp_tree_slab_reserve(struct bp_tree_slab *slab, int count)
+{
+    while (slab->free_count + (slab->limit - slab->cursor) / (long long)slab->block_size < count)
+    {
+        /* Rest of current chunk is moved to free list, so blocks of both chunks can be taken */
+        for (; slab->cursor != slab->limit; slab->cursor += slab->block_size)
+        {
+            struct bp_tree_struct_node *node = (struct bp_tree_struct_node *)slab->cursor;
+            node->version = 0;
+            node->parent = slab->free_list;
+            slab->free_list = node;
+            slab->free_count++;
+        }
+
+        if (bp_tree_slab_grow(slab) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void bp_tree_slab_free(struct bp_tree_slab *slab, struct bp_tree_struct_node *node)
+{
+    node->parent = slab->free_list;
+    slab->free_list = node;
+    slab->free_count++;
+    slab->node_count--;
+}
+
+static void bp_tree_slab_destroy(struct bp_tree_slab *slab)
+{
+    void **chunk = (void **)slab->chunks;
+
+    while (chunk != NULL)
+    {
+        void **next = (void **)*chunk;
+        free(chunk);
+        chunk = next;
+    }
+
+    bp_tree_slab_init(slab, slab->block_size);
+}
+
+static inline void bp_tree_write_begin(struct bp_tree *tree)
+{
+    if (tree->concurrent)
+    {
+        pthread_mutex_lock(&tree->writer_lock);
+    }
+
+    if (tree->reclaim != NULL && __atomic_load_n(&tree->reclaim->released, __ATOMIC_RELAXED) != NULL)
+    {
+        bp_tree_reuse_released(tree);
+    }
+}
+
+static inline void bp_tree_write_end(struct bp_tree *tree)
+{
+    if (tree->retiring != NULL)
+    {
+        bp_tree_retire_nodes(tree);
+    }
+
+    if (tree->touched_size > 0)
+    {
+        bp_tree_unlock_touched(tree);
+    }
+
+    if (tree->concurrent)
+    {
+        pthread_mutex_unlock(&tree->writer_lock);
+    }
+}
+
+static inline unsigned long long bp_tree_log(struct bp_tree *tree, int type, struct bp_tree_node *key)
+{
+    return tree->wal != NULL ? bp_tree_wal_append(tree->wal, type, key) : 0;
+}
+
+static inline int bp_tree_commit(struct bp_tree *tree, unsigned long long sequence)
+{
+    if (sequence != 0 && bp_tree_wal_commit(tree->wal, sequence) != 0)
+    {
+        return BP_TREE_ERROR_WAL;
+    }
+
+    return 0;
+}
+
+static void bp_tree_unlock_touched(struct bp_tree *tree)
+{
+    for (int i = 0; i < tree->touched_size; i++)
+    {
+        struct bp_tree_struct_node *node = tree->touched[i];
+
+        /* Readers see only encoded separators */
+        if (tree->key_mode == BP_TREE_KEY_BYTES && node->skip < 0 && !bp_tree_node_is_leaf(node))
+        {
+            bp_tree_encode_separators(tree, node);
+        }
+
+        unsigned long long version = (node->version & ~BP_TREE_VERSION_LOCKED) + BP_TREE_VERSION_STEP;
+
+        /* Release: changes of node are visible before new version */
+        __atomic_store_n(&node->version, version, __ATOMIC_RELEASE);
+    }
+
+    tree->touched_size = 0;
+}
+
+static int bp_tree_reserve_touched(struct bp_tree *tree, int count)
+{
+    if ((!tree->concurrent && tree->key_mode != BP_TREE_KEY_BYTES) || tree->touched_size + count <= tree->touched_capacity)
+    {
+        return 0;
+    }
+
+    int capacity = tree->touched_capacity * 2 > tree->touched_size + count ? tree->touched_capacity * 2 : tree->touched_size + count;
+    struct bp_tree_struct_node **touched = (struct bp_tree_struct_node **)realloc(tree->touched, capacity * sizeof(struct bp_tree_struct_node *));
+
+    if (touched == NULL)
+    {
+        return -1;
+    }
+
+    tree->touched = touched;
+    tree->touched_capacity = capacity;
+    return 0;
+}
+
+static int bp_tree_reserve_nodes(struct bp_tree *tree, int count, int runs)
+{
+    int height = 0;
+
+    for (struct bp_tree_struct_node *node = tree->root; !bp_tree_node_is_leaf(node); node = ((struct bp_tree_non_leaf_node *)node)->children[0])
+    {
+        height++;
+    }
+
+    /* Run of r keys adds at most (r + degree - 2) / (degree - 1) leaves */
+    int leaves = (int)((count + (long long)runs * (tree->degree - 2)) / (tree->degree - 1));
+
+    /* One leaf splits node on each level and adds root, else level gets (new below + nodes) / 2 */
+    int non_leaves = leaves <= 1 ? height + 1 : tree->non_leaf_slab.node_count + 3 * leaves;
+
+    if (bp_tree_slab_reserve(&tree->leaf_slab, leaves) != 0 || bp_tree_slab_reserve(&tree->non_leaf_slab, non_leaves) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void bp_tree_touch(struct bp_tree *tree, struct bp_tree_struct_node *node)
+{
+    /* Changed inner nodes are also encoded when write ends in BP_TREE_KEY_BYTES mode */
+    if ((!tree->concurrent && tree->key_mode != BP_TREE_KEY_BYTES) || (node->version & BP_TREE_VERSION_LOCKED) != 0)
+    {
+        return;
+    }
+
+    tree->touched[tree->touched_size++] = node;
+    __atomic_store_n(&node->version, node->version | BP_TREE_VERSION_LOCKED, __ATOMIC_RELAXED);
+
+    /* Lock is visible before changes of node */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void bp_tree_set_obsolete(struct bp_tree *tree, struct bp_tree_struct_node *node, int obsolete)
+{
+    if (!tree->concurrent)
+    {
+        return;
+    }
+
+    bp_tree_touch(tree, node);
+
+    unsigned long long version = obsolete ? node->version | BP_TREE_VERSION_OBSOLETE : node->version & ~BP_TREE_VERSION_OBSOLETE;
+    __atomic_store_n(&node->version, version, __ATOMIC_RELAXED);
+}
+
+static inline void bp_tree_set_root(struct bp_tree *tree, struct bp_tree_struct_node *root)
+{
+    __atomic_store_n(&tree->root, root, __ATOMIC_RELEASE);
+}
+
+static inline int bp_tree_read_version(struct bp_tree_struct_node *node, unsigned long long *version)
+{
+    *version = __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+    return (*version & (BP_TREE_VERSION_LOCKED | BP_TREE_VERSION_OBSOLETE)) == 0;
+}
+
+static inline int bp_tree_validate_version(struct bp_tree_struct_node *node, unsigned long long version)
+{
+    /* Reads of node are done before version is checked again */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&node->version, __ATOMIC_RELAXED) == version;
+}
+
+static int bp_tree_lookup_optimistic(struct bp_tree *tree,
+                                     struct bp_tree_probe *probe,
+                                     struct bp_tree_node **keys,
+                                     long long *prefixes,
+                                     struct bp_tree_struct_node **children,
+                                     struct bp_tree_node **result)
+{
+    struct bp_tree_struct_node *node = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+    unsigned long long version;
+
+    /* Root may be replaced by split or merge after it was loaded */
+    if (!bp_tree_read_version(node, &version) || __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE) != node)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        bp_tree_count_node(tree);
+
+        /* Node may be changed while it is copied, so copy is used only after version check */
+        struct bp_tree_struct_node copy = *node;
+        int size = copy.size < 0 ? 0 : copy.size > tree->degree ? tree->degree : copy.size;
+
+        memcpy(keys, copy.keys, size * sizeof(struct bp_tree_node *));
+
+        if (copy.prefixes != NULL)
+        {
+            memcpy(prefixes, copy.prefixes, size * sizeof(long long));
+        }
+
+        if (!copy.leaf)
+        {
+            memcpy(children, ((struct bp_tree_non_leaf_node *)node)->children, (size + 1) * sizeof(struct bp_tree_struct_node *));
+        }
+
+        if (!bp_tree_validate_version(node, version))
+        {
+            return -1;
+        }
+
+        copy.size = size;
+        copy.keys = keys;
+        copy.prefixes = copy.prefixes != NULL ? prefixes : NULL;
+
+        if (copy.leaf)
+        {
+            int position = bp_tree_probe_search(tree, &copy, probe, 0);
+            *result = bp_tree_probe_equals(tree, &copy, position, probe) ? keys[position] : NULL;
+            return 0;
+        }
+
+        struct bp_tree_struct_node *child = children[bp_tree_probe_search(tree, &copy, probe, 1)];
+        unsigned long long child_version;
+
+        /* Child version is valid only if node was not changed after child was read */
+        if (!bp_tree_read_version(child, &child_version) || !bp_tree_validate_version(node, version))
+        {
+            return -1;
+        }
+
+        node = child;
+        version = child_version;
+    }
+}
+
+static struct bp_tree_node *bp_tree_lookup_probe(struct bp_tree *tree, struct bp_tree_probe *probe)
+{
+    struct bp_tree_node *result = NULL;
+
+    if (!tree->concurrent)
+    {
+        struct bp_tree_struct_node *current = tree->root;
+        bp_tree_count_node(tree);
+
+        while (!bp_tree_node_is_leaf(current))
+        {
+            current = ((struct bp_tree_non_leaf_node *)current)->children[bp_tree_probe_search(tree, current, probe, 1)];
+            bp_tree_count_node(tree);
+        }
+
+        int position = bp_tree_probe_search(tree, current, probe, 0);
+        return bp_tree_probe_equals(tree, current, position, probe) ? current->keys[position] : NULL;
+    }
+
+    struct bp_tree_node *keys[tree->degree];
+    long long prefixes[tree->degree];
+    struct bp_tree_struct_node *children[tree->degree + 1];
+
+    while (bp_tree_lookup_optimistic(tree, probe, keys, prefixes, children, &result) != 0)
+    {
+    }
+
+    return result;
+}
+
+static struct bp_tree_non_leaf_node *bp_tree_init_non_leaf(struct bp_tree *tree)
+{
+    struct bp_tree_non_leaf_node *node = (struct bp_tree_non_leaf_node *)bp_tree_slab_alloc(&tree->non_leaf_slab);
+
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    bp_tree_set_obsolete(tree, &node->core, 0);
+    char *data = (char *)node + bp_tree_header_size(0);
+    memset(data, 0, tree->non_leaf_slab.block_size - (data - (char *)node));
+
+    node->core.keys = (struct bp_tree_node **)data;
+    data += tree->degree * sizeof(struct bp_tree_node *);
+    node->core.prefixes = NULL;
+
+    if (tree->key_mode != BP_TREE_KEY_POINTER)
+    {
+        node->core.prefixes = (long long *)data;
+        data += tree->degree * sizeof(long long);
+    }
+
+    node->children = (struct bp_tree_struct_node **)data;
+    node->core.leaf = 0;
+    node->core.size = 0;
+    node->core.skip = 0;
+    node->core.count = 0;
+    node->core.left = NULL;
+    node->core.right = NULL;
+    node->core.parent = NULL;
+    return node;
+}
+
+static struct bp_tree_leaf_node *bp_tree_init_leaf(struct bp_tree *tree)
+{
+    struct bp_tree_leaf_node *node = (struct bp_tree_leaf_node *)bp_tree_slab_alloc(&tree->leaf_slab);
+
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    bp_tree_set_obsolete(tree, &node->core, 0);
+    char *data = (char *)node + bp_tree_header_size(1);
+    memset(data, 0, tree->leaf_slab.block_size - (data - (char *)node));
+
+    node->core.keys = (struct bp_tree_node **)data;
+    data += tree->degree * sizeof(struct bp_tree_node *);
+    node->core.prefixes = tree->key_mode == BP_TREE_KEY_POINTER ? NULL : (long long *)data;
+    node->core.leaf = 1;
+    node->core.size = 0;
+    node->core.skip = 0;
+    node->core.count = 0;
+    node->core.left = NULL;
+    node->core.right = NULL;
+    node->core.parent = NULL;
+    return node;
+}
+
+static inline int bp_tree_node_is_leaf(struct bp_tree_struct_node *node)
+{
+    return node->leaf == 1;
+}
+
+static inline long long bp_tree_key_prefix(struct bp_tree *tree, struct bp_tree_node *key)
+{
+    if (tree->key_mode == BP_TREE_KEY_BYTES)
+    {
+        size_t size;
+        const void *bytes = tree->key_bytes(key, &size);
+        return bp_tree_bytes_prefix(bytes, size);
+    }
+
+    return tree->key_mode == BP_TREE_KEY_POINTER ? 0 : tree->key_prefix(key);
+}
+
+static inline void bp_tree_set_key(struct bp_tree_struct_node *node,
+                                   int index,
+                                   struct bp_tree_node *key,
+                                   long long prefix)
+{
+    node->keys[index] = key;
+    node->skip = -1;
+
+    if (node->prefixes != NULL)
+    {
+        node->prefixes[index] = prefix;
+    }
+}
+
+static inline void bp_tree_copy_keys(struct bp_tree_struct_node *dst,
+                                     int dst_index,
+                                     struct bp_tree_struct_node *src,
+                                     int src_index,
+                                     int count)
+{
+    dst->skip = -1;
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    memmove(dst->keys + dst_index, src->keys + src_index, count * sizeof(struct bp_tree_node *));
+
+    if (dst->prefixes != NULL)
+    {
+        memmove(dst->prefixes + dst_index, src->prefixes + src_index, count * sizeof(long long));
+    }
+}
+
+static inline int bp_tree_subtree_count(struct bp_tree_struct_node *node)
+{
+    return bp_tree_node_is_leaf(node) ? node->size : node->count;
+}
+
+static inline void bp_tree_add_count(struct bp_tree_struct_node *node, int delta)
+{
+    for (struct bp_tree_struct_node *parent = node->parent; parent != NULL; parent = parent->parent)
+    {
+        parent->count += delta;
+    }
+}
+
+static int bp_tree_rank_key(struct bp_tree *tree, struct bp_tree_node *key)
+{
+    long long prefix = bp_tree_key_prefix(tree, key);
+    struct bp_tree_struct_node *current = tree->root;
+    int rank = 0;
+
+    /* Keys of children before descent child are less than key */
+    while (!bp_tree_node_is_leaf(current))
+    {
+        struct bp_tree_struct_node **children = ((struct bp_tree_non_leaf_node *)current)->children;
+        int child = bp_tree_search(tree, current, key, prefix, 1);
+
+        for (int i = 0; i < child; i++)
+        {
+            rank += bp_tree_subtree_count(children[i]);
+        }
+
+        current = children[child];
+    }
+
+    return rank + bp_tree_search(tree, current, key, prefix, 0);
+}
+
+static struct bp_tree_struct_node *bp_tree_lookup_leaf(struct bp_tree *tree,
+                                                       struct bp_tree_node *key,
+                                                       long long prefix)
+{
+    struct bp_tree_struct_node *current = (struct bp_tree_struct_node *)tree->root;
+    bp_tree_count_node(tree);
+
+    while (!bp_tree_node_is_leaf(current))
+    {
+        struct bp_tree_non_leaf_node *as_non_leaf = (struct bp_tree_non_leaf_node *)current;
+        current = as_non_leaf->children[bp_tree_search(tree, current, key, prefix, 1)];
+        bp_tree_count_node(tree);
+    }
+
+    return current;
+}
+
+static int bp_tree_search(struct bp_tree *tree,
+                          struct bp_tree_struct_node *node,
+                          struct bp_tree_node *key,
+                          long long prefix,
+                          int upper)
+{
+    if (tree->key_mode == BP_TREE_KEY_POINTER)
+    {
+        return bp_tree_search_keys(tree, node->keys, 0, node->size, key, upper);
+    }
+
+    if (tree->key_mode == BP_TREE_KEY_INT64)
+    {
+        return bp_tree_search_prefixes(node->prefixes, node->size, prefix, upper);
+    }
+
+    if (tree->key_mode == BP_TREE_KEY_BYTES && !bp_tree_node_is_leaf(node))
+    {
+        /* Separators changed by current write are encoded when it ends, till then search is read-only */
+        if (node->skip < 0)
+        {
+            return bp_tree_search_keys(tree, node->keys, 0, node->size, key, upper);
+        }
+
+        int position = bp_tree_search_skip(tree, node, key, &prefix);
+
+        if (position >= 0)
+        {
+            return position;
+        }
+    }
+
+    /* Keys with equal prefix are ordered by comparator */
+    int low = bp_tree_search_prefixes(node->prefixes, node->size, prefix, 0);
+    int high = bp_tree_search_prefixes(node->prefixes, node->size, prefix, 1);
+
+    if (low == high)
+    {
+        return low;
+    }
+
+    return bp_tree_search_keys(tree, node->keys, low, high - low, key, upper);
+}
+
+static int bp_tree_search_skip(struct bp_tree *tree,
+                               struct bp_tree_struct_node *node,
+                               struct bp_tree_node *key,
+                               long long *prefix)
+{
+    size_t size;
+    const unsigned char *bytes = (const unsigned char *)tree->key_bytes(key, &size);
+    size_t skip = node->skip;
+
+    if (skip > 0)
+    {
+        size_t first_size;
+        const void *first = tree->key_bytes(node->keys[0], &first_size);
+        int cmp = memcmp(bytes, first, size < skip ? size : skip);
+
+        /* Key without common prefix is out of separators */
+        if (cmp < 0 || (cmp == 0 && size < skip))
+        {
+            return 0;
+        }
+
+        if (cmp > 0)
+        {
+            return node->size;
+        }
+    }
+
+    *prefix = bp_tree_bytes_prefix(bytes + skip, size - skip);
+    return -1;
+}
+
+static void bp_tree_encode_separators(struct bp_tree *tree, struct bp_tree_struct_node *node)
+{
+    size_t skip = 0;
+
+    if (node->size > 0)
+    {
+        size_t first_size;
+        size_t last_size;
+        const unsigned char *first = (const unsigned char *)tree->key_bytes(node->keys[0], &first_size);
+        const unsigned char *last = (const unsigned char *)tree->key_bytes(node->keys[node->size - 1], &last_size);
+        size_t limit = first_size < last_size ? first_size : last_size;
+
+        while (skip < limit && first[skip] == last[skip])
+        {
+            skip++;
+        }
+    }
+
+    for (int i = 0; i < node->size; i++)
+    {
+        size_t size;
+        const unsigned char *bytes = (const unsigned char *)tree->key_bytes(node->keys[i], &size);
+        node->prefixes[i] = bp_tree_bytes_prefix(bytes + skip, size - skip);
+    }
+
+    node->skip = skip;
+}
+
+static int bp_tree_search_keys(struct bp_tree *tree,
+                               struct bp_tree_node **keys,
+                               int base,
+                               int size,
+                               struct bp_tree_node *key,
+                               int upper)
+{
+    if (size == 0)
+    {
+        return base;
+    }
+
+    /* Branch-free: compiler selects base by conditional move */
+    while (size > 1)
+    {
+        int half = size / 2;
+        int cmp = bp_tree_compare(tree, keys[base + half], key);
+        base = (cmp < 0 || (upper && cmp == 0)) ? base + half : base;
+        size -= half;
+    }
+
+    int cmp = bp_tree_compare(tree, keys[base], key);
+    return base + (cmp < 0 || (upper && cmp == 0));
+}
+
+static int bp_tree_search_raw_key(struct bp_tree *tree,
+                                  struct bp_tree_node **keys,
+                                  int size,
+                                  const void *key,
+                                  int (*compare)(const void *key, struct bp_tree_node *node),
+                                  int upper)
+{
+    int base = 0;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    /* Comparator orders key against node, so node key is less if result is positive */
+    while (size > 1)
+    {
+        int half = size / 2;
+        int cmp = bp_tree_compare_key(tree, key, compare, keys[base + half]);
+        base = (cmp > 0 || (upper && cmp == 0)) ? base + half : base;
+        size -= half;
+    }
+
+    int cmp = bp_tree_compare_key(tree, key, compare, keys[base]);
+    return base + (cmp > 0 || (upper && cmp == 0));
+}
+
+static inline int bp_tree_probe_search(struct bp_tree *tree,
+                                       struct bp_tree_struct_node *node,
+                                       struct bp_tree_probe *probe,
+                                       int upper)
+{
+    if (probe->compare != NULL)
+    {
+        return bp_tree_search_raw_key(tree, node->keys, node->size, probe->key, probe->compare, upper);
+    }
+
+    return bp_tree_search(tree, node, probe->node, probe->prefix, upper);
+}
+
+static inline int bp_tree_probe_equals(struct bp_tree *tree,
+                                       struct bp_tree_struct_node *node,
+                                       int index,
+                                       struct bp_tree_probe *probe)
+{
+    if (probe->compare != NULL)
+    {
+        return index < node->size && bp_tree_compare_key(tree, probe->key, probe->compare, node->keys[index]) == 0;
+    }
+
+    return bp_tree_key_equals(tree, node, index, probe->node, probe->prefix);
+}
+
+static int bp_tree_search_prefixes(const long long *prefixes, int size, long long prefix, int upper)
+{
+    int base = 0;
+
+    while (size > BP_TREE_SIMD_WINDOW)
+    {
+        int half = size / 2;
+        long long current = prefixes[base + half];
+        base = (current < prefix || (upper && current == prefix)) ? base + half : base;
+        size -= half;
+    }
+
+    /* Keys are sorted, so position is count of keys less (or equal) in window */
+    const long long *window = prefixes + base;
+    int count = 0;
+    int i = 0;
+
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi64x(prefix);
+
+    for (; i + 4 <= size; i += 4)
+    {
+        __m256i current = _mm256_loadu_si256((const __m256i *)(window + i));
+        __m256i mask = upper ? _mm256_xor_si256(_mm256_cmpgt_epi64(current, key), _mm256_set1_epi64x(-1))
+                             : _mm256_cmpgt_epi64(key, current);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(mask)));
+    }
+#elif defined(__SSE4_2__)
+    __m128i key = _mm_set1_epi64x(prefix);
+
+    for (; i + 2 <= size; i += 2)
+    {
+        __m128i current = _mm_loadu_si128((const __m128i *)(window + i));
+        __m128i mask = upper ? _mm_xor_si128(_mm_cmpgt_epi64(current, key), _mm_set1_epi64x(-1))
+                             : _mm_cmpgt_epi64(key, current);
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(mask)));
+    }
+#endif
+
+    for (; i < size; i++)
+    {
+        count += window[i] < prefix || (upper && window[i] == prefix);
+    }
+
+    return base + count;
+}
+
+static inline int bp_tree_key_equals(struct bp_tree *tree,
+                                     struct bp_tree_struct_node *node,
+                                     int index,
+                                     struct bp_tree_node *key,
+                                     long long prefix)
+{
+    if (index >= node->size)
+    {
+        return 0;
+    }
+
+    if (tree->key_mode == BP_TREE_KEY_INT64)
+    {
+        return node->prefixes[index] == prefix;
+    }
+
+    if (tree->key_mode != BP_TREE_KEY_POINTER && node->prefixes[index] != prefix)
+    {
+        return 0;
+    }
+
+    return bp_tree_compare(tree, node->keys[index], key) == 0;
+}
+
+static inline int bp_tree_compare(struct bp_tree *tree, struct bp_tree_node *first, struct bp_tree_node *second)
+{
+    if (tree->stats != NULL)
+    {
+        bp_tree_thread_comparisons++;
+    }
+
+    return tree->comparator(first, second);
 }
 
-int bp_tree_free(struct bp_tree *tree,
-                 void (*free_callback)(struct bp_tree_node *))
+static inline int bp_tree_compare_key(struct bp_tree *tree,
+                                      const void *key,
+                                      int (*compare)(const void *key, struct bp_tree_node *node),
+                                      struct bp_tree_node *node)
 {
-    while (1)
+    if (tree->stats != NULL)
     {
-        struct bp_tree_node *min_key = bp_tree_min_node_key(tree, tree->root, 0);
-
-        if (min_key == NULL)
-        {
-            break;
-        }
-        else
-        {
-            free_callback(bp_tree_delete(tree, min_key));
-        }
+        bp_tree_thread_comparisons++;
     }
-    bp_tree_free_leaf((struct bp_tree_leaf_node *)tree->root);
-    return 0;
+
+    return compare(key, node);
 }
 
-struct bp_tree_node *bp_tree_min_key(struct bp_tree *tree)
+static inline void bp_tree_count_node(struct bp_tree *tree)
 {
-    return bp_tree_min_node_key(tree, tree->root, 0);
+    if (tree->stats != NULL)
+    {
+        bp_tree_thread_nodes++;
+    }
 }
 
-struct bp_tree_node *bp_tree_max_key(struct bp_tree *tree)
+static inline void bp_tree_measure_begin(struct bp_tree *tree, struct bp_tree_measure *measure)
 {
-    return bp_tree_max_node_key(tree, tree->root);
+    measure->stats = tree->stats;
+
+    if (measure->stats == NULL)
+    {
+        return;
+    }
+
+    measure->comparisons = bp_tree_thread_comparisons;
+    measure->nodes = bp_tree_thread_nodes;
+    measure->hardware = measure->stats->hardware && bp_tree_perf_read(&measure->cycles, &measure->cache_misses) == 0;
 }
 
-struct bp_tree_node *bp_tree_lookup(struct bp_tree *tree, struct bp_tree_node *node)
+static inline void bp_tree_measure_end(struct bp_tree_measure *measure, int op)
 {
-    return bp_tree_lookup_leaf_child(tree, node);
+    if (measure->stats != NULL)
+    {
+        bp_tree_measure_add(measure, op);
+    }
 }
 
-struct bp_tree_node *bp_tree_insert(struct bp_tree *tree, struct bp_tree_node *node)
+static void bp_tree_measure_add(struct bp_tree_measure *measure, int op)
 {
-    return bp_tree_insert_leaf_child(tree, node);
+    unsigned long long cycles = 0;
+    unsigned long long cache_misses = 0;
+    int measured = measure->hardware && bp_tree_perf_read(&cycles, &cache_misses) == 0;
+    struct bp_tree_op_stats *stats = op == BP_TREE_OP_LOOKUP   ? &measure->stats->lookups
+                                     : op == BP_TREE_OP_INSERT ? &measure->stats->inserts
+                                                               : &measure->stats->deletes;
+
+    /* Lookups of many threads add to same counters */
+    __atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->comparisons, bp_tree_thread_comparisons - measure->comparisons, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->nodes, bp_tree_thread_nodes - measure->nodes, __ATOMIC_RELAXED);
+
+    if (measured)
+    {
+        __atomic_add_fetch(&stats->measured, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->cycles, (long long)(cycles - measure->cycles), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->cache_misses, (long long)(cache_misses - measure->cache_misses), __ATOMIC_RELAXED);
+    }
 }
 
-struct bp_tree_node *bp_tree_delete(struct bp_tree *tree, struct bp_tree_node *node)
+static void bp_tree_load_op_stats(struct bp_tree_op_stats *to, struct bp_tree_op_stats *from)
 {
-    return bp_tree_delete_child(tree, bp_tree_lookup_leaf(tree, node), node);
+    to->count = __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+    to->comparisons = __atomic_load_n(&from->comparisons, __ATOMIC_RELAXED);
+    to->nodes = __atomic_load_n(&from->nodes, __ATOMIC_RELAXED);
+    to->measured = __atomic_load_n(&from->measured, __ATOMIC_RELAXED);
+    to->cycles = __atomic_load_n(&from->cycles, __ATOMIC_RELAXED);
+    to->cache_misses = __atomic_load_n(&from->cache_misses, __ATOMIC_RELAXED);
 }
 
-struct bp_tree_batch *bp_tree_lookup_batch(struct bp_tree *tree, struct bp_tree_batch *node)
+static int bp_tree_perf_read(unsigned long long *cycles, unsigned long long *cache_misses)
 {
-    struct bp_tree_batch *result = (struct bp_tree_batch *)malloc(sizeof(struct bp_tree_batch));
-    result->nodes = (struct bp_tree_node **)malloc(sizeof(struct bp_tree_batch));
-
-    int result_size = 0;
-
-    for (int i = 0; i < node->size; i++)
+#if defined(__linux__)
+    if (bp_tree_perf_state == 0)
     {
-        struct bp_tree_node *found = bp_tree_lookup_leaf_child(tree, node->nodes[i]);
-
-        if (found != NULL)
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+        attributes.read_format = PERF_FORMAT_GROUP;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        /* Cache misses are member of cycles group, so both are read by one call */
+        int leader = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        int member = leader >= 0 ? (int)syscall(SYS_perf_event_open, &attributes, 0, -1, leader, 0) : -1;
+        int *fds = member >= 0 ? (int *)malloc(2 * sizeof(int)) : NULL;
+
+        if (fds == NULL)
         {
-            result->nodes[result_size++] = found;
+            if (member >= 0)
+            {
+                close(member);
+            }
+
+            if (leader >= 0)
+            {
+                close(leader);
+            }
+
+            bp_tree_perf_state = -1;
+            return -1;
         }
+
+        fds[0] = leader;
+        fds[1] = member;
+        pthread_once(&bp_tree_perf_once, bp_tree_perf_key_create);
+        pthread_setspecific(bp_tree_perf_key, fds);
+        bp_tree_perf_fd = leader;
+        bp_tree_perf_state = 1;
     }
 
-    result->size = result_size;
+    struct
+    {
+        unsigned long long count;
+        unsigned long long values[2];
+    } group;
 
-    return result;
+    if (bp_tree_perf_state < 0 || read(bp_tree_perf_fd, &group, sizeof(group)) != sizeof(group))
+    {
+        return -1;
+    }
+
+    *cycles = group.values[0];
+    *cache_misses = group.values[1];
+    return 0;
+#else
+    return -1;
+#endif
 }
 
-struct bp_tree_batch *bp_tree_insert_batch(struct bp_tree *tree, struct bp_tree_batch *node)
+static void bp_tree_perf_key_create(void)
 {
-    struct bp_tree_batch *result = (struct bp_tree_batch *)malloc(sizeof(struct bp_tree_batch));
-    result->nodes = (struct bp_tree_node **)malloc(sizeof(struct bp_tree_batch));
+    pthread_key_create(&bp_tree_perf_key, bp_tree_perf_close);
+}
 
-    int result_size = 0;
+static void bp_tree_perf_close(void *pointer)
+{
+    int *fds = (int *)pointer;
+    close(fds[1]);
+    close(fds[0]);
+    free(fds);
+}
 
-    for (int i = 0; i < node->size; i++)
+static inline int bp_tree_compare_keys(struct bp_tree *tree,
+                                       struct bp_tree_node *first,
+                                       long long first_prefix,
+                                       struct bp_tree_node *second,
+                                       long long second_prefix)
+{
+    if (tree->key_mode != BP_TREE_KEY_POINTER && first_prefix != second_prefix)
     {
-        struct bp_tree_node *found = bp_tree_insert_leaf_child(tree, node->nodes[i]);
-
-        if (found != NULL)
-        {
-            result->nodes[result_size++] = found;
-        }
+        return first_prefix < second_prefix ? -1 : 1;
     }
 
-    result->size = result_size;
+    if (tree->key_mode == BP_TREE_KEY_INT64)
+    {
+        return 0;
+    }
 
-    return result;
+    return bp_tree_compare(tree, first, second);
 }
 
-struct bp_tree_batch *bp_tree_delete_batch(struct bp_tree *tree, struct bp_tree_batch *node)
+static struct bp_tree_node *bp_tree_bulk_array_next(void *context)
 {
-    struct bp_tree_batch *result = (struct bp_tree_batch *)malloc(sizeof(struct bp_tree_batch));
-    result->nodes = (struct bp_tree_node **)malloc(sizeof(struct bp_tree_batch));
+    struct bp_tree_bulk_array *array = (struct bp_tree_bulk_array *)context;
+    return array->index < array->size ? array->keys[array->index++] : NULL;
+}
 
-    int result_size = 0;
+static inline int bp_tree_fill_count(int max, int min, float fill_factor)
+{
+    int count = (int)(max * fill_factor);
+    return count < min ? min : count > max ? max : count;
+}
 
-    for (int i = 0; i < node->size; i++)
+static void bp_tree_bulk_abort(struct bp_tree *tree, struct bp_tree_struct_node *first)
+{
+    while (first->right != NULL)
     {
-        struct bp_tree_leaf_node *found = (struct bp_tree_leaf_node *)bp_tree_lookup_leaf(tree, node->nodes[i]);
+        struct bp_tree_struct_node *right = first->right;
+        first->right = right->right;
+        bp_tree_free_leaf(tree, (struct bp_tree_leaf_node *)right);
+    }
 
-        struct bp_tree_node *deleted = bp_tree_delete_child(tree, &found->core, node->nodes[i]);
+    first->size = 0;
+    tree->size = 0;
+}
 
-        if (deleted != NULL)
-        {
-            result->nodes[result_size++] = deleted;
-        }
+static int bp_tree_bulk_fix_last_leaf(struct bp_tree *tree, struct bp_tree_struct_node *last, int count)
+{
+    struct bp_tree_struct_node *left = last->left;
+
+    if (left == NULL || last->size >= tree->degree / 2)
+    {
+        return count;
     }
 
-    result->size = result_size;
+    int total = left->size + last->size;
 
-    return result;
+    if (total < tree->degree)
+    {
+        bp_tree_copy_keys(left, left->size, last, 0, last->size);
+        left->size = total;
+        left->right = NULL;
+        bp_tree_free_leaf(tree, (struct bp_tree_leaf_node *)last);
+        return count - 1;
+    }
+
+    /* Both halves have at least degree / 2 keys */
+    int move = total / 2 - last->size;
+    bp_tree_copy_keys(last, move, last, 0, last->size);
+    bp_tree_copy_keys(last, 0, left, left->size - move, move);
+    left->size -= move;
+    last->size += move;
+    return count;
 }
 
-void bp_tree_print(struct bp_tree *tree,
-                   void (*print_node)(struct bp_tree_node *))
+static struct bp_tree_struct_node *bp_tree_bulk_build_levels(struct bp_tree *tree,
+                                                             struct bp_tree_struct_node *first,
+                                                             int count,
+                                                             float fill_factor)
 {
-    struct bp_tree_struct_node *current = (struct bp_tree_struct_node *)tree->root;
-    int level = tree->size / tree->degree;
-    while (current)
+    int max_children = bp_tree_fill_count(tree->degree, tree->degree / 2 + 1, fill_factor);
+
+    while (count > 1)
     {
-        struct bp_tree_struct_node *step = current;
+        /* Children are spread evenly, node gets degree / 2 + 1 children (rebalance minimum) if level fits */
+        int parents = (count + max_children - 1) / max_children;
+        int max_parents = count / (tree->degree / 2 + 1);
+        int min_parents = (count + tree->degree - 1) / tree->degree;
 
-        for (int i = 0; i < level; i++)
-        {
-            printf(" ");
-        }
+        parents = parents > max_parents ? max_parents : parents;
+        parents = parents < min_parents ? min_parents : parents;
+        struct bp_tree_struct_node *child = first;
+        struct bp_tree_struct_node *prev = NULL;
 
-        while (step)
+        for (int i = 0; i < parents; i++)
         {
-            printf("[");
-            for (int i = 0; i < step->size; i++)
-            {
-                print_node(step->keys[i]);
-            }
-            printf("]");
-
-            step = step->right;
+            struct bp_tree_non_leaf_node *parent = bp_tree_init_non_leaf(tree);
+            int children = count / parents + (i < count % parents);
+            bp_tree_touch(tree, &parent->core);
 
-            if (step != NULL)
+            for (int j = 0; j < children; j++)
             {
-                for (int i = 0; i < level; i++)
+                if (j > 0)
                 {
-                    printf(" ");
+                    bp_tree_copy_keys(&parent->core, j - 1, bp_tree_min_node_leaf(child), 0, 1);
                 }
+
+                parent->children[j] = child;
+                parent->core.count += bp_tree_subtree_count(child);
+                child->parent = &parent->core;
+                child = child->right;
             }
-        }
 
-        printf("\n\n");
+            parent->core.size = children - 1;
+            parent->core.left = prev;
 
-        if (current->leaf == 1 || current->size == 0)
-        {
-            current = NULL;
-        }
-        else
-        {
-            current = (struct bp_tree_struct_node *)((struct bp_tree_non_leaf_node *)current)->children[0];
+            if (prev != NULL)
+            {
+                prev->right = &parent->core;
+            }
+            else
+            {
+                first = &parent->core;
+            }
+
+            prev = &parent->core;
         }
 
-        level--;
+        count = parents;
     }
+
+    return first;
 }
 
-struct bp_tree_leaf_node *bp_tree_min_leaf(struct bp_tree *tree)
+static inline long long bp_tree_prefix_at(struct bp_tree_struct_node *node, int index)
 {
-    struct bp_tree_struct_node *current = tree->root;
-    while (1)
+    return node->prefixes != NULL ? node->prefixes[index] : 0;
+}
+
+static struct bp_tree_batch_item *bp_tree_batch_sort(struct bp_tree *tree, struct bp_tree_batch *batch)
+{
+    int size = batch->size;
+    struct bp_tree_batch_item *items = (struct bp_tree_batch_item *)malloc((2 * size + 1) * sizeof(struct bp_tree_batch_item));
+
+    if (items == NULL)
     {
-        if (bp_tree_node_is_leaf(current))
-        {
-            return (struct bp_tree_leaf_node *)current;
-        }
+        return NULL;
+    }
 
-        current = ((struct bp_tree_non_leaf_node *)current)->children[0];
+    struct bp_tree_batch_item *from = items;
+    struct bp_tree_batch_item *to = items + size;
+
+    for (int i = 0; i < size; i++)
+    {
+        from[i].key = batch->nodes[i];
+        from[i].prefix = bp_tree_key_prefix(tree, batch->nodes[i]);
     }
-}
 
-struct bp_tree_leaf_node *bp_tree_max_leaf(struct bp_tree *tree)
-{
-    struct bp_tree_struct_node *current = tree->root;
-    while (1)
+    for (int width = 1; width < size; width *= 2)
     {
-        if (bp_tree_node_is_leaf(current))
+        for (int low = 0; low < size; low += 2 * width)
         {
-            return (struct bp_tree_leaf_node *)current;
+            int middle = low + width < size ? low + width : size;
+            int high = low + 2 * width < size ? low + 2 * width : size;
+            int i = low;
+            int j = middle;
+            int k = low;
+
+            /* Ordered ranges (batch is often sorted already) are copied without merge */
+            if (middle == high ||
+                bp_tree_compare_keys(tree, from[middle - 1].key, from[middle - 1].prefix, from[middle].key, from[middle].prefix) <= 0)
+            {
+                memcpy(to + low, from + low, (high - low) * sizeof(struct bp_tree_batch_item));
+                continue;
+            }
+
+            while (i < middle && j < high)
+            {
+                int cmp = bp_tree_compare_keys(tree, from[j].key, from[j].prefix, from[i].key, from[i].prefix);
+                to[k++] = cmp < 0 ? from[j++] : from[i++];
+            }
+
+            while (i < middle)
+            {
+                to[k++] = from[i++];
+            }
+
+            while (j < high)
+            {
+                to[k++] = from[j++];
+            }
         }
 
-        current = ((struct bp_tree_non_leaf_node *)current)->children[current->size];
+        struct bp_tree_batch_item *swap = from;
+        from = to;
+        to = swap;
     }
+
+    if (from != items)
+    {
+        memcpy(items, from, size * sizeof(struct bp_tree_batch_item));
+    }
+
+    return items;
 }
 
-static struct bp_tree_non_leaf_node *bp_tree_init_non_leaf(struct bp_tree *tree)
+static struct bp_tree_batch *bp_tree_batch_result(int capacity)
 {
-    struct bp_tree_non_leaf_node *node = (struct bp_tree_non_leaf_node *)malloc(sizeof(struct bp_tree_non_leaf_node));
-    node->core.keys = (struct bp_tree_node **)calloc(tree->degree, sizeof(struct bp_tree_node *));
-    node->children = (struct bp_tree_struct_node **)calloc(tree->degree + 1, sizeof(struct bp_tree_struct_node *));
-    node->core.leaf = 0;
-    node->core.size = 0;
-    node->core.left = NULL;
-    node->core.right = NULL;
-    node->core.parent = NULL;
-    return node;
+    struct bp_tree_batch *result = (struct bp_tree_batch *)malloc(sizeof(struct bp_tree_batch));
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->nodes = (struct bp_tree_node **)malloc((capacity + 1) * sizeof(struct bp_tree_node *));
+    result->size = 0;
+    result->error = 0;
+
+    if (result->nodes == NULL)
+    {
+        free(result);
+        return NULL;
+    }
+
+    return result;
 }
 
-static struct bp_tree_leaf_node *bp_tree_init_leaf(struct bp_tree *tree)
+static void bp_tree_batch_result_free(struct bp_tree_batch *result)
 {
-    struct bp_tree_leaf_node *node = (struct bp_tree_leaf_node *)malloc(sizeof(struct bp_tree_leaf_node));
-    node->core.keys = (struct bp_tree_node **)calloc(tree->degree, sizeof(struct bp_tree_node *));
-    node->core.parent = NULL;
-    node->core.leaf = 1;
-    node->core.size = 0;
-    node->index = 0;
-    node->core.left = NULL;
-    node->core.right = NULL;
-    node->core.parent = NULL;
-    return node;
+    if (result != NULL)
+    {
+        free(result->nodes);
+        free(result);
+    }
 }
 
-static inline int bp_tree_node_is_leaf(struct bp_tree_struct_node *node)
+static int bp_tree_batch_run(struct bp_tree *tree,
+                             struct bp_tree_struct_node *leaf,
+                             struct bp_tree_batch_item *items,
+                             int from,
+                             int size)
 {
-    return node->leaf == 1;
+    struct bp_tree_struct_node *right = leaf->right;
+
+    if (right == NULL)
+    {
+        return size;
+    }
+
+    int end = from + 1;
+
+    while (end < size &&
+           bp_tree_compare_keys(tree, items[end].key, items[end].prefix, right->keys[0], bp_tree_prefix_at(right, 0)) < 0)
+    {
+        end++;
+    }
+
+    return end;
 }
 
-static struct bp_tree_struct_node *bp_tree_lookup_leaf(struct bp_tree *tree, struct bp_tree_node *key)
+static void bp_tree_insert_run(struct bp_tree *tree,
+                               struct bp_tree_struct_node *leaf,
+                               struct bp_tree_batch_item *items,
+                               int size,
+                               struct bp_tree_batch_item *buffer,
+                               struct bp_tree_batch *result)
 {
-    struct bp_tree_struct_node *current = (struct bp_tree_struct_node *)tree->root;
+    struct bp_tree_node *min_key = leaf->size > 0 ? leaf->keys[0] : NULL;
+    long long min_prefix = bp_tree_prefix_at(leaf, 0);
+    int leaf_size = leaf->size;
+    int count = 0;
+    int i = 0;
+    int j = 0;
 
-    while (!bp_tree_node_is_leaf(current))
+    bp_tree_touch(tree, leaf);
+
+    /* Merge leaf keys and items, item replaces equal key (or equal previous item) */
+    while (i < leaf->size || j < size)
     {
-        struct bp_tree_non_leaf_node *as_non_leaf = (struct bp_tree_non_leaf_node *)current;
-        current = NULL;
+        if (j == size ||
+            (i < leaf->size &&
+             bp_tree_compare_keys(tree, leaf->keys[i], bp_tree_prefix_at(leaf, i), items[j].key, items[j].prefix) <= 0))
+        {
+            buffer[count].key = leaf->keys[i];
+            buffer[count].prefix = bp_tree_prefix_at(leaf, i);
+            count++;
+            i++;
+        }
+        else if (count > 0 &&
+                 bp_tree_compare_keys(tree, buffer[count - 1].key, buffer[count - 1].prefix, items[j].key, items[j].prefix) == 0)
+        {
+            result->nodes[result->size++] = buffer[count - 1].key;
+            buffer[count - 1] = items[j++];
+        }
+        else
+        {
+            buffer[count++] = items[j++];
+            tree->size++;
+        }
+    }
+
+    /* Smaller keys than minimal key fall only into most left leaf, so minimal key was replaced */
+    if (min_key != NULL && buffer[0].key != min_key)
+    {
+        bp_tree_replace_separator(tree, min_key, min_prefix, buffer[0].key);
+    }
 
-        for (int i = 0; i < as_non_leaf->core.size; i++)
+    /* Keys are spread evenly, so each leaf has at least degree / 2 keys */
+    int leaves = (count + tree->degree - 2) / (tree->degree - 1);
+    struct bp_tree_struct_node *current = leaf;
+    int from = 0;
+
+    for (int k = 0; k < leaves; k++)
+    {
+        if (k > 0)
         {
-            int cmp = tree->comparator(key, as_non_leaf->core.keys[i]);
-            if (cmp == -1)
-            {
-                current = (struct bp_tree_struct_node *)as_non_leaf->children[i];
-                break;
-            }
+            struct bp_tree_struct_node *next = &bp_tree_init_leaf(tree)->core;
+            next->right = current->right;
 
-            if (i == as_non_leaf->core.size - 1)
+            if (current->right != NULL)
             {
-                current = (struct bp_tree_struct_node *)as_non_leaf->children[as_non_leaf->core.size];
-                break;
+                current->right->left = next;
             }
+
+            current->right = next;
+            next->left = current;
+            current = next;
         }
-    }
 
-    return current;
+        current->size = count / leaves + (k < count % leaves);
+
+        for (int m = 0; m < current->size; m++)
+        {
+            bp_tree_set_key(current, m, buffer[from + m].key, buffer[from + m].prefix);
+        }
+
+        from += current->size;
+
+        /* Counts are updated per leaf, so split of parent sees only placed keys */
+        if (k == 0)
+        {
+            bp_tree_add_count(current, current->size - leaf_size);
+        }
+        else
+        {
+            tree->split_leaf++;
+            bp_tree_add_count(current->left, current->size);
+            bp_tree_insert_separator(tree, current->left, current->keys[0], bp_tree_prefix_at(current, 0), current);
+        }
+    }
 }
 
-static struct bp_tree_node *bp_tree_lookup_leaf_child(struct bp_tree *tree, struct bp_tree_node *key)
+static void bp_tree_delete_run(struct bp_tree *tree,
+                               struct bp_tree_struct_node *leaf,
+                               struct bp_tree_batch_item *items,
+                               int size,
+                               struct bp_tree_batch *result)
 {
-    struct bp_tree_leaf_node *found = (struct bp_tree_leaf_node *)bp_tree_lookup_leaf(tree, key);
+    struct bp_tree_node *min_key = leaf->size > 0 ? leaf->keys[0] : NULL;
+    long long min_prefix = bp_tree_prefix_at(leaf, 0);
+    int min_deleted = 0;
+    int count = 0;
+    int position = 0;
 
-    for (int i = 0; i < found->core.size; i++)
+    /* Keep not deleted keys in place, leaf is scanned once */
+    for (int j = 0; j < size; j++)
     {
-        int cmp = tree->comparator(found->core.keys[i], key);
-        if (cmp == 0)
+        int cmp = -1;
+
+        while (position < leaf->size &&
+               (cmp = bp_tree_compare_keys(tree, leaf->keys[position], bp_tree_prefix_at(leaf, position), items[j].key, items[j].prefix)) < 0)
         {
-            return found->core.keys[i];
+            if (count != position)
+            {
+                bp_tree_copy_keys(leaf, count, leaf, position, 1);
+            }
+
+            count++;
+            position++;
         }
-        else if (cmp == 1)
+
+        if (position < leaf->size && cmp == 0)
         {
-            break;
+            bp_tree_touch(tree, leaf);
+            min_deleted |= position == 0;
+            result->nodes[result->size++] = leaf->keys[position++];
+            tree->size--;
         }
     }
 
-    return NULL;
+    if (position == count)
+    {
+        return;
+    }
+
+    bp_tree_copy_keys(leaf, count, leaf, position, leaf->size - position);
+    leaf->size = count + leaf->size - position;
+    bp_tree_add_count(leaf, count - position);
+
+    bp_tree_rebalance(tree, leaf);
+
+    if (min_deleted)
+    {
+        bp_tree_replace_separator(tree, min_key, min_prefix, NULL);
+    }
+}
+
+static int bp_tree_range_end(struct bp_tree *tree,
+                             struct bp_tree_struct_node *leaf,
+                             struct bp_tree_node *high,
+                             long long high_prefix)
+{
+    if (high == NULL ||
+        bp_tree_compare_keys(tree, leaf->keys[leaf->size - 1], bp_tree_prefix_at(leaf, leaf->size - 1), high, high_prefix) < 0)
+    {
+        return leaf->size;
+    }
+
+    return bp_tree_search(tree, leaf, high, high_prefix, 0);
+}
+
+static struct bp_tree_node *bp_tree_cursor_set(struct bp_tree_cursor *cursor,
+                                               struct bp_tree_struct_node *leaf,
+                                               int index)
+{
+    if (index >= leaf->size)
+    {
+        leaf = leaf->right;
+        index = 0;
+    }
+
+    cursor->leaf = leaf;
+    cursor->index = index;
+    return bp_tree_cursor_key(cursor);
 }
 
 static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_split)
@@ -385,6 +2993,9 @@ static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_
 
     struct bp_tree_struct_node *new_node = NULL;
     struct bp_tree_node *mid = NULL;
+    long long mid_prefix = 0;
+
+    bp_tree_touch(tree, for_split);
 
     if (bp_tree_node_is_leaf(for_split))
     {
@@ -406,13 +3017,11 @@ static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_
 
         int t = tree->degree / 2;
         mid = node->core.keys[t];
+        mid_prefix = node->core.prefixes != NULL ? node->core.prefixes[t] : 0;
         leaf->core.size = node->core.size - t;
         node->core.size = t;
 
-        for (int i = 0; i < leaf->core.size; i++)
-        {
-            leaf->core.keys[i] = node->core.keys[i + node->core.size];
-        }
+        bp_tree_copy_keys(&leaf->core, 0, &node->core, node->core.size, leaf->core.size);
     }
     else
     {
@@ -421,6 +3030,7 @@ static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_
         struct bp_tree_non_leaf_node *node = (struct bp_tree_non_leaf_node *)for_split;
         struct bp_tree_non_leaf_node *non_leaf = bp_tree_init_non_leaf(tree);
         new_node = &non_leaf->core;
+        bp_tree_touch(tree, new_node);
         non_leaf->core.right = node->core.right;
         non_leaf->core.parent = node->core.parent;
 
@@ -434,47 +3044,54 @@ static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_
 
         int t = tree->degree / 2;
         mid = node->core.keys[t];
+        mid_prefix = node->core.prefixes != NULL ? node->core.prefixes[t] : 0;
         non_leaf->core.size = node->core.size - t - 1;
         node->core.size = t;
 
-        for (int i = 0; i < non_leaf->core.size; i++)
-        {
-            non_leaf->core.keys[i] = node->core.keys[i + node->core.size + 1];
-        }
+        bp_tree_copy_keys(&non_leaf->core, 0, &node->core, node->core.size + 1, non_leaf->core.size);
 
         for (int i = 0; i <= non_leaf->core.size; i++)
         {
             non_leaf->children[i] = node->children[i + node->core.size + 1];
             ((struct bp_tree_struct_node *)non_leaf->children[i])->parent = (struct bp_tree_struct_node *)non_leaf;
+            non_leaf->core.count += bp_tree_subtree_count(non_leaf->children[i]);
         }
+
+        node->core.count -= non_leaf->core.count;
     }
 
-    if (for_split == tree->root)
+    bp_tree_insert_separator(tree, for_split, mid, mid_prefix, new_node);
+}
+
+static void bp_tree_insert_separator(struct bp_tree *tree,
+                                     struct bp_tree_struct_node *node,
+                                     struct bp_tree_node *key,
+                                     long long prefix,
+                                     struct bp_tree_struct_node *new_node)
+{
+    if (node == tree->root)
     {
-        tree->root = &bp_tree_init_non_leaf(tree)->core;
-        ((struct bp_tree_struct_node *)tree->root)->keys[0] = mid;
-        ((struct bp_tree_non_leaf_node *)tree->root)->children[0] = for_split;
-        ((struct bp_tree_non_leaf_node *)tree->root)->children[1] = new_node;
-        ((struct bp_tree_struct_node *)tree->root)->size = 1;
-        for_split->parent = tree->root;
-        new_node->parent = tree->root;
+        struct bp_tree_non_leaf_node *root = bp_tree_init_non_leaf(tree);
+        bp_tree_touch(tree, &root->core);
+        bp_tree_set_key(&root->core, 0, key, prefix);
+        root->children[0] = node;
+        root->children[1] = new_node;
+        root->core.size = 1;
+        root->core.count = bp_tree_subtree_count(node) + bp_tree_subtree_count(new_node);
+        node->parent = &root->core;
+        new_node->parent = &root->core;
+        bp_tree_set_root(tree, &root->core);
     }
     else
     {
-        new_node->parent = for_split->parent;
-        struct bp_tree_struct_node *parent = for_split->parent;
+        new_node->parent = node->parent;
+        struct bp_tree_struct_node *parent = node->parent;
 
-        int position = 0;
+        bp_tree_touch(tree, parent);
 
-        while (position < parent->size && tree->comparator(mid, parent->keys[position]) != -1)
-        {
-            position++;
-        }
+        int position = bp_tree_search(tree, parent, key, prefix, 1);
 
-        for (int i = parent->size; i > position; i--)
-        {
-            parent->keys[i] = parent->keys[i - 1];
-        }
+        bp_tree_copy_keys(parent, position + 1, parent, position, parent->size - position);
 
         struct bp_tree_non_leaf_node *parent_as_non_leaf = ((struct bp_tree_non_leaf_node *)parent);
         for (int i = parent->size + 1; i > position + 1; i--)
@@ -482,7 +3099,7 @@ static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_
             parent_as_non_leaf->children[i] = parent_as_non_leaf->children[i - 1];
         }
 
-        parent_as_non_leaf->core.keys[position] = mid;
+        bp_tree_set_key(&parent_as_non_leaf->core, position, key, prefix);
         parent_as_non_leaf->children[position + 1] = new_node;
         parent_as_non_leaf->children[position + 1]->parent = &parent_as_non_leaf->core;
         parent_as_non_leaf->core.size++;
@@ -496,42 +3113,33 @@ static void bp_tree_split(struct bp_tree *tree, struct bp_tree_struct_node *for_
 
 static struct bp_tree_node *bp_tree_insert_leaf_child(struct bp_tree *tree, struct bp_tree_node *key)
 {
-    struct bp_tree_leaf_node *found = (struct bp_tree_leaf_node *)bp_tree_lookup_leaf(tree, key);
+    long long prefix = bp_tree_key_prefix(tree, key);
+    struct bp_tree_leaf_node *found = (struct bp_tree_leaf_node *)bp_tree_lookup_leaf(tree, key, prefix);
     struct bp_tree_node *prev = NULL;
-    int position = 0;
+    int position = bp_tree_search(tree, &found->core, key, prefix, 0);
 
-    for (int i = 0; i < found->core.size; i++)
+    if (bp_tree_key_equals(tree, &found->core, position, key, prefix))
     {
-        int cmp = tree->comparator(found->core.keys[i], key);
-
-        if (cmp == 0)
-        {
-            prev = found->core.keys[i];
-            break;
-        }
-        else if (cmp == -1)
-        {
-            position++;
-        }
-        else
-        {
-            break;
-        }
+        prev = found->core.keys[position];
     }
 
+    bp_tree_touch(tree, &found->core);
+
     if (prev == NULL)
     {
-        for (int i = found->core.size; i > position; i--)
-        {
-            found->core.keys[i] = found->core.keys[i - 1];
-        }
+        bp_tree_copy_keys(&found->core, position + 1, &found->core, position, found->core.size - position);
 
         found->core.size++;
         tree->size++;
+        bp_tree_add_count(&found->core, 1);
     }
 
-    found->core.keys[position] = key;
-    bp_tree_update_node(tree, &found->core);
+    bp_tree_set_key(&found->core, position, key, prefix);
+
+    if (prev != NULL && position == 0)
+    {
+        bp_tree_replace_separator(tree, prev, prefix, key);
+    }
 
     if (found->core.size >= tree->degree)
     {
@@ -541,80 +3149,306 @@ static struct bp_tree_node *bp_tree_insert_leaf_child(struct bp_tree *tree, stru
     return prev;
 }
 
+static struct bp_tree_struct_node *bp_tree_min_node_leaf(struct bp_tree_struct_node *node)
+{
+    struct bp_tree_struct_node *current = node;
+
+    while (!bp_tree_node_is_leaf(current))
+    {
+        current = ((struct bp_tree_non_leaf_node *)current)->children[0];
+    }
+
+    return current;
+}
+
 static struct bp_tree_node *bp_tree_min_node_key(struct bp_tree *tree,
-                                                 struct bp_tree_struct_node *node,
-                                                 int ignore_size)
+                                                 struct bp_tree_struct_node *node)
+{
+    struct bp_tree_struct_node *current = bp_tree_min_node_leaf(node);
+    return current->size == 0 ? NULL : current->keys[0];
+}
+
+static struct bp_tree_node *bp_tree_max_node_key(struct bp_tree *tree,
+                                                 struct bp_tree_struct_node *node)
 {
     struct bp_tree_struct_node *current = node;
     while (1)
     {
         if (bp_tree_node_is_leaf(current))
         {
-            if (ignore_size)
+            return current->size == 0 ? NULL : current->keys[current->size - 1];
+        }
+
+        current = ((struct bp_tree_non_leaf_node *)current)->children[current->size];
+    }
+}
+
+static struct bp_tree_non_leaf_node *bp_tree_free_non_leaf(struct bp_tree *tree, struct bp_tree_non_leaf_node *node)
+{
+    /* Freed node is not encoded when write ends */
+    node->core.skip = 0;
+    bp_tree_set_obsolete(tree, &node->core, 1);
+    bp_tree_release_node(tree, &node->core);
+    return NULL;
+}
+
+static struct bp_tree_leaf_node *bp_tree_free_leaf(struct bp_tree *tree, struct bp_tree_leaf_node *node)
+{
+    bp_tree_set_obsolete(tree, &node->core, 1);
+    bp_tree_release_node(tree, &node->core);
+    return NULL;
+}
+
+static void bp_tree_release_node(struct bp_tree *tree, struct bp_tree_struct_node *node)
+{
+    if (tree->domain != NULL)
+    {
+        node->parent = tree->retiring;
+        tree->retiring = node;
+    }
+    else
+    {
+        bp_tree_slab_free(node->leaf ? &tree->leaf_slab : &tree->non_leaf_slab, node);
+    }
+}
+
+static void bp_tree_retire_nodes(struct bp_tree *tree)
+{
+    if (tree->reclaim == NULL)
+    {
+        tree->reclaim = (struct bp_tree_reclaim *)calloc(1, sizeof(struct bp_tree_reclaim));
+    }
+
+    struct bp_tree_retired_nodes *retired = NULL;
+
+    if (tree->reclaim != NULL)
+    {
+        retired = (struct bp_tree_retired_nodes *)malloc(sizeof(struct bp_tree_retired_nodes));
+    }
+
+    if (retired != NULL)
+    {
+        retired->reclaim = tree->reclaim;
+        retired->nodes = tree->retiring;
+        __atomic_add_fetch(&tree->reclaim->pending, 1, __ATOMIC_RELAXED);
+
+        if (epoch_retire(tree->domain, retired, bp_tree_release_retired) == 0)
+        {
+            tree->retiring = NULL;
+            return;
+        }
+
+        __atomic_sub_fetch(&tree->reclaim->pending, 1, __ATOMIC_RELAXED);
+        free(retired);
+    }
+
+    /* Readers check versions of nodes, so nodes may be reused at once if they can not be retired */
+    while (tree->retiring != NULL)
+    {
+        struct bp_tree_struct_node *node = tree->retiring;
+        tree->retiring = node->parent;
+        bp_tree_slab_free(node->leaf ? &tree->leaf_slab : &tree->non_leaf_slab, node);
+    }
+}
+
+static void bp_tree_release_retired(void *pointer)
+{
+    struct bp_tree_retired_nodes *retired = (struct bp_tree_retired_nodes *)pointer;
+    struct bp_tree_reclaim *reclaim = retired->reclaim;
+    struct bp_tree_struct_node *last = retired->nodes;
+
+    while (last->parent != NULL)
+    {
+        last = last->parent;
+    }
+
+    /* Callback may run in any thread, so nodes are pushed to writer without lock */
+    struct bp_tree_struct_node *head = __atomic_load_n(&reclaim->released, __ATOMIC_RELAXED);
+
+    do
+    {
+        last->parent = head;
+    } while (!__atomic_compare_exchange_n(&reclaim->released, &head, retired->nodes, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_sub_fetch(&reclaim->pending, 1, __ATOMIC_RELEASE);
+    free(retired);
+}
+
+static void bp_tree_reuse_released(struct bp_tree *tree)
+{
+    if (tree->reclaim == NULL)
+    {
+        return;
+    }
+
+    struct bp_tree_struct_node *node = __atomic_exchange_n(&tree->reclaim->released, NULL, __ATOMIC_ACQUIRE);
+
+    while (node != NULL)
+    {
+        struct bp_tree_struct_node *next = node->parent;
+        bp_tree_slab_free(node->leaf ? &tree->leaf_slab : &tree->non_leaf_slab, node);
+        node = next;
+    }
+}
+
+static void bp_tree_wait_retired(struct bp_tree *tree)
+{
+    if (tree->retiring != NULL)
+    {
+        bp_tree_retire_nodes(tree);
+    }
+
+    bp_tree_wait_reclaim(tree->domain, tree->reclaim);
+    bp_tree_reuse_released(tree);
+}
+
+static void bp_tree_wait_reclaim(struct epoch *domain, struct bp_tree_reclaim *reclaim)
+{
+    while (reclaim != NULL && __atomic_load_n(&reclaim->pending, __ATOMIC_ACQUIRE) > 0)
+    {
+        epoch_reclaim(domain);
+        sched_yield();
+    }
+}
+
+static unsigned long long bp_tree_release_keys(struct bp_tree *tree, void (*free_callback)(struct bp_tree_node *))
+{
+    unsigned long long sequence = 0;
+
+    for (struct bp_tree_struct_node *leaf = bp_tree_min_node_leaf(tree->root); leaf != NULL; leaf = leaf->right)
+    {
+        for (int i = 0; i < leaf->size; i++)
+        {
+            if (tree->wal != NULL)
+            {
+                sequence = bp_tree_log(tree, BP_TREE_WAL_DELETE, leaf->keys[i]);
+            }
+
+            if (free_callback != NULL)
+            {
+                free_callback(leaf->keys[i]);
+            }
+        }
+    }
+
+    return sequence;
+}
+
+static void bp_tree_release_levels(struct bp_tree *tree)
+{
+    struct bp_tree_struct_node *first = tree->root;
+
+    while (first != NULL)
+    {
+        struct bp_tree_struct_node *next_first = bp_tree_node_is_leaf(first) ? NULL : ((struct bp_tree_non_leaf_node *)first)->children[0];
+
+        /* Right link is read before node is released, release reuses parent link only */
+        for (struct bp_tree_struct_node *node = first; node != NULL;)
+        {
+            struct bp_tree_struct_node *right = node->right;
+
+            if (bp_tree_node_is_leaf(node))
             {
-                return current->keys[0];
+                bp_tree_free_leaf(tree, (struct bp_tree_leaf_node *)node);
             }
             else
             {
-                return current->size == 0 ? NULL : current->keys[0];
+                bp_tree_free_non_leaf(tree, (struct bp_tree_non_leaf_node *)node);
             }
+
+            node = right;
         }
 
-        current = ((struct bp_tree_non_leaf_node *)current)->children[0];
+        first = next_first;
     }
 }
 
-static struct bp_tree_node *bp_tree_max_node_key(struct bp_tree *tree,
-                                                 struct bp_tree_struct_node *node)
+static void *bp_tree_free_task_run(void *pointer)
 {
-    struct bp_tree_struct_node *current = node;
-    while (1)
+    struct bp_tree_free_task *task = (struct bp_tree_free_task *)pointer;
+
+    /* Keys are freed in one pass over leaves, nodes are released with slabs after retired groups */
+    for (struct bp_tree_struct_node *leaf = bp_tree_min_node_leaf(task->root); task->free_callback != NULL && leaf != NULL; leaf = leaf->right)
     {
-        if (bp_tree_node_is_leaf(current))
+        for (int i = 0; i < leaf->size; i++)
         {
-            return current->size == 0 ? NULL : current->keys[current->size - 1];
+            task->free_callback(leaf->keys[i]);
         }
+    }
 
-        current = ((struct bp_tree_non_leaf_node *)current)->children[current->size];
+    bp_tree_wait_reclaim(task->domain, task->reclaim);
+    free(task->reclaim);
+    bp_tree_slab_destroy(&task->leaf_slab);
+    bp_tree_slab_destroy(&task->non_leaf_slab);
+    free(task->stats);
+    free(task);
+    return NULL;
+}
+
+static int bp_tree_child_index(struct bp_tree_struct_node *parent, struct bp_tree_struct_node *child)
+{
+    struct bp_tree_non_leaf_node *non_leaf = (struct bp_tree_non_leaf_node *)parent;
+    int index = 0;
+
+    while (non_leaf->children[index] != child)
+    {
+        index++;
     }
+
+    return index;
 }
 
-static void bp_tree_update_node(struct bp_tree *tree, struct bp_tree_struct_node *node)
+static void bp_tree_replace_separator(struct bp_tree *tree,
+                                      struct bp_tree_node *key,
+                                      long long prefix,
+                                      struct bp_tree_node *new_key)
 {
-    struct bp_tree_struct_node *current = node;
+    struct bp_tree_struct_node *current = tree->root;
 
-    while (current != NULL)
+    while (!bp_tree_node_is_leaf(current))
     {
-        if (current->leaf != 1)
+        int index = bp_tree_search(tree, current, key, prefix, 1);
+
+        if (index > 0 && current->keys[index - 1] == key)
         {
-            struct bp_tree_non_leaf_node *non_leaf = (struct bp_tree_non_leaf_node *)current;
+            bp_tree_touch(tree, current);
 
-            for (int i = 0; i < non_leaf->core.size; i++)
+            if (new_key != NULL)
+            {
+                bp_tree_set_key(current, index - 1, new_key, prefix);
+            }
+            else
             {
-                struct bp_tree_node *min_node = bp_tree_min_node_key(tree, non_leaf->children[i + 1], 1);
-                non_leaf->core.keys[i] = min_node;
+                struct bp_tree_struct_node *min_leaf = bp_tree_min_node_leaf(((struct bp_tree_non_leaf_node *)current)->children[index]);
+                bp_tree_copy_keys(current, index - 1, min_leaf, 0, 1);
             }
+
+            return;
         }
 
-        current = current->parent;
+        current = ((struct bp_tree_non_leaf_node *)current)->children[index];
     }
 }
 
 static void bp_tree_transfer_from_left_to_right(struct bp_tree *tree,
                                                 struct bp_tree_struct_node *left,
-                                                struct bp_tree_struct_node *right)
+                                                struct bp_tree_struct_node *right,
+                                                int count)
 {
-    struct bp_tree_node *shift = right->keys[0];
+    struct bp_tree_struct_node *parent = right->parent;
+    int separator = bp_tree_child_index(parent, right) - 1;
 
-    for (int i = right->size; i > 0; i--)
-    {
-        right->keys[i] = right->keys[i - 1];
-    }
-    right->keys[0] = left->keys[left->size - 1];
+    bp_tree_touch(tree, left);
+    bp_tree_touch(tree, right);
+    bp_tree_touch(tree, parent);
+    bp_tree_copy_keys(right, count, right, 0, right->size);
 
     if (right->leaf == 1)
     {
         tree->rebalance_left_leaf++;
+
+        bp_tree_copy_keys(right, 0, left, left->size - count, count);
+        bp_tree_copy_keys(parent, separator, right, 0, 1);
     }
     else
     {
@@ -626,63 +3460,75 @@ static void bp_tree_transfer_from_left_to_right(struct bp_tree *tree,
             right_non_leaf->children[i] = right_non_leaf->children[i - 1];
         }
 
+        bp_tree_copy_keys(right, 0, parent, separator, 1);
+        bp_tree_copy_keys(parent, separator, left, left->size - 1, 1);
         right_non_leaf->children[0] = ((struct bp_tree_non_leaf_node *)left)->children[left->size];
         right_non_leaf->children[0]->parent = &right_non_leaf->core;
+        left->count -= bp_tree_subtree_count(right_non_leaf->children[0]);
+        right->count += bp_tree_subtree_count(right_non_leaf->children[0]);
     }
 
-    left->size--;
-    right->size++;
-    bp_tree_update_node(tree, right->parent);
+    left->size -= count;
+    right->size += count;
 }
 
 static void bp_tree_transfer_from_right_to_left(struct bp_tree *tree,
                                                 struct bp_tree_struct_node *left,
-                                                struct bp_tree_struct_node *right)
+                                                struct bp_tree_struct_node *right,
+                                                int count)
 {
-    left->keys[left->size] = right->keys[0];
+    struct bp_tree_struct_node *parent = right->parent;
+    int separator = bp_tree_child_index(parent, right) - 1;
 
-    for (int i = 0; i < right->size - 1; i++)
-    {
-        right->keys[i] = right->keys[i + 1];
-    }
+    bp_tree_touch(tree, left);
+    bp_tree_touch(tree, right);
+    bp_tree_touch(tree, parent);
 
     if (bp_tree_node_is_leaf(left))
     {
         tree->rebalance_right_leaf++;
+
+        bp_tree_copy_keys(left, left->size, right, 0, count);
+        bp_tree_copy_keys(right, 0, right, count, right->size - count);
+        bp_tree_copy_keys(parent, separator, right, 0, 1);
     }
     else
     {
         tree->rebalance_right_non_leaf++;
+
+        bp_tree_copy_keys(left, left->size, parent, separator, 1);
+        bp_tree_copy_keys(parent, separator, right, 0, 1);
+        bp_tree_copy_keys(right, 0, right, 1, right->size - 1);
+
         ((struct bp_tree_non_leaf_node *)left)->children[left->size + 1] = ((struct bp_tree_non_leaf_node *)right)->children[0];
         ((struct bp_tree_non_leaf_node *)left)->children[left->size + 1]->parent = left;
+        left->count += bp_tree_subtree_count(((struct bp_tree_non_leaf_node *)right)->children[0]);
+        right->count -= bp_tree_subtree_count(((struct bp_tree_non_leaf_node *)right)->children[0]);
 
         for (int i = 0; i < right->size; i++)
         {
             ((struct bp_tree_non_leaf_node *)right)->children[i] = ((struct bp_tree_non_leaf_node *)right)->children[i + 1];
-            ((struct bp_tree_non_leaf_node *)right)->children[i]->parent = right;
         }
     }
 
-    right->size--;
-    left->size++;
-
-    bp_tree_update_node(tree, left->parent);
+    right->size -= count;
+    left->size += count;
 }
 
 static void bp_tree_merge_nodes(struct bp_tree *tree,
                                 struct bp_tree_struct_node *left,
                                 struct bp_tree_struct_node *right)
 {
-    struct bp_tree_node *mid = bp_tree_min_node_key(tree, right, 1);
-
     struct bp_tree_struct_node *parent = right->parent;
+    struct bp_tree_non_leaf_node *parent_as_non_leaf = (struct bp_tree_non_leaf_node *)parent;
+    int separator = bp_tree_child_index(parent, right) - 1;
+
+    bp_tree_touch(tree, left);
+    bp_tree_touch(tree, parent);
 
     if (bp_tree_node_is_leaf(left))
     {
-        for (int i = 0; i < right->size; i++)
-        {
-            left->keys[left->size + i] = right->keys[i];
-        }
+        bp_tree_copy_keys(left, left->size, right, 0, right->size);
         left->size += right->size;
     }
     else
@@ -693,13 +3539,10 @@ static void bp_tree_merge_nodes(struct bp_tree *tree,
             ((struct bp_tree_non_leaf_node *)left)->children[left->size + i + 1]->parent = left;
         }
 
-        for (int i = 0; i < right->size; i++)
-        {
-            left->keys[left->size + i + 1] = right->keys[i];
-        }
-
-        left->keys[left->size] = ((struct bp_tree_non_leaf_node *)left)->children[left->size + 1]->keys[0];
+        bp_tree_copy_keys(left, left->size, parent, separator, 1);
+        bp_tree_copy_keys(left, left->size + 1, right, 0, right->size);
         left->size += right->size + 1;
+        left->count += right->count;
     }
 
     left->right = right->right;
@@ -709,141 +3552,134 @@ static void bp_tree_merge_nodes(struct bp_tree *tree,
         left->right->left = left;
     }
 
-    bp_tree_update_node(tree, left);
-    bp_tree_delete_child(tree, right->parent, mid);
-    bp_tree_update_node(tree, left->parent);
+    bp_tree_copy_keys(parent, separator, parent, separator + 1, parent->size - separator - 1);
+
+    for (int i = separator + 1; i < parent->size; i++)
+    {
+        parent_as_non_leaf->children[i] = parent_as_non_leaf->children[i + 1];
+    }
+
+    parent->size--;
 
     if (bp_tree_node_is_leaf(right))
     {
-        bp_tree_free_leaf((struct bp_tree_leaf_node *)right);
+        bp_tree_free_leaf(tree, (struct bp_tree_leaf_node *)right);
     }
     else
     {
-        bp_tree_free_non_leaf((struct bp_tree_non_leaf_node *)right);
+        bp_tree_free_non_leaf(tree, (struct bp_tree_non_leaf_node *)right);
     }
-}
-
-static struct bp_tree_non_leaf_node *bp_tree_free_non_leaf(struct bp_tree_non_leaf_node *node)
-{
-    free(node->children);
-    free(node->core.keys);
-    free(node);
-}
 
-static struct bp_tree_leaf_node *bp_tree_free_leaf(struct bp_tree_leaf_node *node)
-{
-    free(node->core.keys);
-    free(node);
+    bp_tree_rebalance(tree, parent);
 }
 
-static struct bp_tree_node *bp_tree_delete_child(struct bp_tree *tree, struct bp_tree_struct_node *node, struct bp_tree_node *key)
+static void bp_tree_rebalance(struct bp_tree *tree, struct bp_tree_struct_node *node)
 {
-    struct bp_tree_node *result_key = NULL;
-    int position = 0;
-
-    for (int i = 0; i < node->size; i++)
+    if (node == tree->root)
     {
-        int cmp = tree->comparator(node->keys[i], key);
-
-        if (cmp == 0)
-        {
-            result_key = node->keys[i];
-            break;
-        }
-        else if (cmp == -1)
-        {
-            position++;
-        }
-        else
+        if (node->size == 0 && node->leaf != 1)
         {
-            break;
+            struct bp_tree_non_leaf_node *last_root = (struct bp_tree_non_leaf_node *)node;
+            last_root->children[0]->parent = NULL;
+            bp_tree_set_root(tree, last_root->children[0]);
+
+            bp_tree_free_non_leaf(tree, last_root);
         }
-    }
 
-    if (result_key == NULL)
-    {
-        return NULL;
+        return;
     }
 
-    for (int i = position; i < node->size - 1; i++)
+    int degree = tree->degree / 2;
+
+    if (node->size >= degree)
     {
-        node->keys[i] = node->keys[i + 1];
+        return;
     }
 
-    if (node->leaf != 1)
-    {
-        struct bp_tree_struct_node *child = ((struct bp_tree_non_leaf_node *)node)->children[position + 1];
-        for (int i = position + 1; i < node->size; i++)
-        {
-            ((struct bp_tree_non_leaf_node *)node)->children[i] = ((struct bp_tree_non_leaf_node *)node)->children[i + 1];
-        }
+    struct bp_tree_non_leaf_node *parent = (struct bp_tree_non_leaf_node *)node->parent;
+    int index = bp_tree_child_index(&parent->core, node);
+    struct bp_tree_struct_node *left = index > 0 ? parent->children[index - 1] : NULL;
+    struct bp_tree_struct_node *right = index < parent->core.size ? parent->children[index + 1] : NULL;
 
-        if (child->right != NULL)
+    /* Leaf may lack several keys after batch delete, it takes keys only if sibling keeps degree / 2 keys */
+    if (node->leaf == 1)
+    {
+        if (left != NULL && left->size + node->size >= 2 * degree)
         {
-            child->right->left = child->left;
+            bp_tree_transfer_from_left_to_right(tree, left, node, (left->size + node->size) / 2 - node->size);
+            return;
         }
 
-        if (child->left != NULL)
+        if (right != NULL && right->size + node->size >= 2 * degree)
         {
-            child->left->right = child->right;
+            bp_tree_transfer_from_right_to_left(tree, node, right, (right->size + node->size) / 2 - node->size);
+            return;
         }
     }
-    else
+    else if (left != NULL && left->size > degree - 1)
     {
-        tree->size--;
+        bp_tree_transfer_from_left_to_right(tree, left, node, 1);
+        return;
     }
-
-    bp_tree_update_node(tree, node);
-    node->size--;
-
-    if (node->size < tree->degree / 2)
+    else if (right != NULL && right->size > degree - 1)
     {
-        struct bp_tree_struct_node *left = (struct bp_tree_struct_node *)node->left;
-        struct bp_tree_struct_node *right = (struct bp_tree_struct_node *)node->right;
-
-        int degree = tree->degree / 2;
+        bp_tree_transfer_from_right_to_left(tree, node, right, 1);
+        return;
+    }
 
-        if (node->left != NULL && left->size > degree - 1)
+    if (left != NULL)
+    {
+        if (left->leaf == 1)
         {
-            bp_tree_transfer_from_left_to_right(tree, left, node);
+            tree->merge_left_leaf++;
         }
-        else if (node->right != NULL && right->size > degree - 1)
+        else
         {
-            bp_tree_transfer_from_right_to_left(tree, node, right);
+            tree->merge_left_non_leaf++;
         }
-        else if (left != NULL && node->parent == left->parent)
+        bp_tree_merge_nodes(tree, left, node);
+    }
+    else if (right != NULL)
+    {
+        if (right->leaf == 1)
         {
-            if (left->leaf == 1)
-            {
-                tree->merge_left_leaf++;
-            }
-            else
-            {
-                tree->merge_left_non_leaf++;
-            }
-            bp_tree_merge_nodes(tree, left, node);
+            tree->merge_right_leaf++;
         }
-        else if (right != NULL && node->parent == right->parent)
+        else
         {
-            if (right->leaf == 1)
-            {
-                tree->merge_right_leaf++;
-            }
-            else
-            {
-                tree->merge_right_non_leaf++;
-            }
-            bp_tree_merge_nodes(tree, node, right);
+            tree->merge_right_non_leaf++;
         }
+        bp_tree_merge_nodes(tree, node, right);
     }
+}
+
+static struct bp_tree_node *bp_tree_delete_child(struct bp_tree *tree,
+                                                 struct bp_tree_struct_node *node,
+                                                 struct bp_tree_node *key,
+                                                 long long prefix)
+{
+    int position = bp_tree_search(tree, node, key, prefix, 0);
 
-    if (tree->root->size == 0 && tree->root->leaf != 1)
+    if (!bp_tree_key_equals(tree, node, position, key, prefix))
     {
-        struct bp_tree_non_leaf_node *last_root = (struct bp_tree_non_leaf_node *)tree->root;
-        tree->root = last_root->children[0];
-        tree->root->parent = NULL;
+        return NULL;
+    }
+
+    struct bp_tree_node *result_key = node->keys[position];
+
+    bp_tree_touch(tree, node);
+    bp_tree_copy_keys(node, position, node, position + 1, node->size - 1 - position);
+    node->size--;
+    tree->size--;
+    bp_tree_add_count(node, -1);
+
+    bp_tree_rebalance(tree, node);
 
-        bp_tree_free_non_leaf(last_root);
+    /* Only minimal key of leaf may be used as separator */
+    if (position == 0)
+    {
+        bp_tree_replace_separator(tree, result_key, prefix, NULL);
     }
+
     return result_key;
 }
@@ -0,0 +1,795 @@
+#include <string.h>
+
+#include <bp_tree_disk.h>
+
+/**
+ * Header of node page. Leaf records follow header, inner page stores
+ * inner_capacity + 1 children after header and then separators.
+ */
+struct bp_tree_disk_page
+{
+    unsigned int leaf;
+
+    /** Count of records in leaf or count of separators in inner page */
+    unsigned int size;
+
+    /** Neighbour leaves, 0 if there is no neighbour */
+    unsigned long long left;
+    unsigned long long right;
+};
+
+/**
+ * Inner pages and child indexes from root to leaf, pages are not pinned.
+ */
+struct bp_tree_disk_path
+{
+    unsigned long long pages[BP_TREE_DISK_MAX_HEIGHT];
+    int indexes[BP_TREE_DISK_MAX_HEIGHT];
+    int depth;
+};
+
+/**
+ * Record of leaf by index.
+ */
+static inline char *bp_tree_disk_record(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, int index);
+
+/**
+ * Children of inner page.
+ */
+static inline unsigned long long *bp_tree_disk_children(struct bp_tree_disk_page *node);
+
+/**
+ * Separator of inner page by index.
+ */
+static inline char *bp_tree_disk_separator(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, int index);
+
+/**
+ * Pin node page.
+ */
+static inline struct bp_tree_disk_page *bp_tree_disk_pin(struct bp_tree_disk *tree, unsigned long long page);
+
+/**
+ * Index of child of inner page which may contain key.
+ */
+static int bp_tree_disk_child_index(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, const void *key);
+
+/**
+ * Index of first record of leaf which is more or equals key.
+ */
+static int bp_tree_disk_lower_bound(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, const void *key);
+
+/**
+ * Descend from root to leaf which may contain key. If path is not NULL, inner pages are saved to it.
+ * Returns leaf page or 0 on IO error.
+ */
+static unsigned long long bp_tree_disk_find_leaf(struct bp_tree_disk *tree, const void *key, struct bp_tree_disk_path *path);
+
+/**
+ * Take page from free list or append it to file. Page is pinned and filled by zeroes.
+ * Returns page or 0 on IO error.
+ */
+static unsigned long long bp_tree_disk_alloc_page(struct bp_tree_disk *tree, struct bp_tree_disk_page **node);
+
+/**
+ * Link pinned page to free list and unpin it.
+ */
+static void bp_tree_disk_free_page(struct bp_tree_disk *tree, unsigned long long page, struct bp_tree_disk_page *node);
+
+/**
+ * Split full leaf and insert record to it. Minimal record of new right leaf is copied to separator.
+ * Returns new leaf page or 0 on IO error.
+ */
+static unsigned long long bp_tree_disk_split_leaf(struct bp_tree_disk *tree,
+                                                  unsigned long long page,
+                                                  struct bp_tree_disk_page *leaf,
+                                                  int position,
+                                                  const void *record,
+                                                  char *separator);
+
+/**
+ * Insert separator and right child after split to parents from path, split full parents
+ * and grow new root if root is split.
+ */
+static int bp_tree_disk_insert_separator(struct bp_tree_disk *tree,
+                                         struct bp_tree_disk_path *path,
+                                         char *separator,
+                                         unsigned long long child);
+
+/**
+ * Remove empty leaf from leaf list and parents from path, free parents which become empty
+ * and shrink root with one child.
+ */
+static int bp_tree_disk_remove_leaf(struct bp_tree_disk *tree,
+                                    struct bp_tree_disk_path *path,
+                                    unsigned long long page,
+                                    struct bp_tree_disk_page *leaf);
+
+int bp_tree_disk_open(struct bp_tree_disk *tree,
+                      const char *path,
+                      size_t record_size,
+                      int pool_pages,
+                      int (*comparator)(const void *first, const void *second))
+{
+    size_t space = BP_TREE_DISK_PAGE_SIZE - sizeof(struct bp_tree_disk_page);
+
+    if (record_size == 0 ||
+        space / record_size < 3 ||
+        (space - sizeof(unsigned long long)) / (sizeof(unsigned long long) + record_size) < 3 ||
+        pool_pages < BP_TREE_DISK_MIN_POOL_PAGES)
+    {
+        return -1;
+    }
+
+    tree->comparator = comparator;
+    tree->scratch = (char *)malloc(BP_TREE_DISK_PAGE_SIZE * 3);
+
+    if (tree->scratch == NULL)
+    {
+        return -1;
+    }
+
+    if (buffer_pool_init(&tree->pool, path, BP_TREE_DISK_PAGE_SIZE, pool_pages) != 0)
+    {
+        free(tree->scratch);
+        return -1;
+    }
+
+    struct bp_tree_disk_header *header = (struct bp_tree_disk_header *)buffer_pool_pin(&tree->pool, 0);
+    int result = header == NULL ? -1 : 0;
+
+    if (header != NULL && header->magic == 0)
+    {
+        /* New file, root is empty leaf */
+        struct bp_tree_disk_page *root = NULL;
+
+        memset(&tree->header, 0, sizeof(tree->header));
+        tree->header.magic = BP_TREE_DISK_MAGIC;
+        tree->header.page_size = BP_TREE_DISK_PAGE_SIZE;
+        tree->header.record_size = record_size;
+        tree->header.height = 1;
+        tree->header.leaf_capacity = space / record_size;
+        tree->header.inner_capacity = (space - sizeof(unsigned long long)) / (sizeof(unsigned long long) + record_size);
+        tree->header.page_count = 1;
+        tree->header.root = bp_tree_disk_alloc_page(tree, &root);
+
+        if (tree->header.root == 0)
+        {
+            result = -1;
+        }
+        else
+        {
+            root->leaf = 1;
+            buffer_pool_unpin(&tree->pool, tree->header.root, 1);
+            memcpy(header, &tree->header, sizeof(tree->header));
+        }
+    }
+    else if (header != NULL)
+    {
+        if (header->magic != BP_TREE_DISK_MAGIC ||
+            header->page_size != BP_TREE_DISK_PAGE_SIZE ||
+            header->record_size != record_size ||
+            header->height > BP_TREE_DISK_MAX_HEIGHT)
+        {
+            result = -1;
+        }
+
+        memcpy(&tree->header, header, sizeof(tree->header));
+    }
+
+    if (header != NULL)
+    {
+        buffer_pool_unpin(&tree->pool, 0, 1);
+    }
+
+    if (result != 0)
+    {
+        buffer_pool_free(&tree->pool);
+        free(tree->scratch);
+    }
+
+    return result;
+}
+
+int bp_tree_disk_lookup(struct bp_tree_disk *tree, const void *key, void *record)
+{
+    unsigned long long page = bp_tree_disk_find_leaf(tree, key, NULL);
+    struct bp_tree_disk_page *leaf = page == 0 ? NULL : bp_tree_disk_pin(tree, page);
+
+    if (leaf == NULL)
+    {
+        return -1;
+    }
+
+    int position = bp_tree_disk_lower_bound(tree, leaf, key);
+    int found = position < (int)leaf->size && tree->comparator(bp_tree_disk_record(tree, leaf, position), key) == 0;
+
+    if (found && record != NULL)
+    {
+        memcpy(record, bp_tree_disk_record(tree, leaf, position), tree->header.record_size);
+    }
+
+    buffer_pool_unpin(&tree->pool, page, 0);
+    return found;
+}
+
+int bp_tree_disk_insert(struct bp_tree_disk *tree, const void *record, void *previous)
+{
+    struct bp_tree_disk_path path;
+    size_t record_size = tree->header.record_size;
+    unsigned long long page = bp_tree_disk_find_leaf(tree, record, &path);
+    struct bp_tree_disk_page *leaf = page == 0 ? NULL : bp_tree_disk_pin(tree, page);
+
+    if (leaf == NULL)
+    {
+        return -1;
+    }
+
+    int position = bp_tree_disk_lower_bound(tree, leaf, record);
+
+    if (position < (int)leaf->size && tree->comparator(bp_tree_disk_record(tree, leaf, position), record) == 0)
+    {
+        if (previous != NULL)
+        {
+            memcpy(previous, bp_tree_disk_record(tree, leaf, position), record_size);
+        }
+
+        memcpy(bp_tree_disk_record(tree, leaf, position), record, record_size);
+        buffer_pool_unpin(&tree->pool, page, 1);
+        return 1;
+    }
+
+    if (leaf->size < tree->header.leaf_capacity)
+    {
+        memmove(bp_tree_disk_record(tree, leaf, position + 1),
+                bp_tree_disk_record(tree, leaf, position),
+                (leaf->size - position) * record_size);
+        memcpy(bp_tree_disk_record(tree, leaf, position), record, record_size);
+        leaf->size++;
+        tree->header.size++;
+        buffer_pool_unpin(&tree->pool, page, 1);
+        return 0;
+    }
+
+    char *separator = tree->scratch + BP_TREE_DISK_PAGE_SIZE * 2;
+    unsigned long long right = bp_tree_disk_split_leaf(tree, page, leaf, position, record, separator);
+    buffer_pool_unpin(&tree->pool, page, 1);
+
+    /* Size counts record only after it is reachable from root */
+    if (right == 0 || bp_tree_disk_insert_separator(tree, &path, separator, right) != 0)
+    {
+        return -1;
+    }
+
+    tree->header.size++;
+    return 0;
+}
+
+int bp_tree_disk_delete(struct bp_tree_disk *tree, const void *key, void *previous)
+{
+    struct bp_tree_disk_path path;
+    size_t record_size = tree->header.record_size;
+    unsigned long long page = bp_tree_disk_find_leaf(tree, key, &path);
+    struct bp_tree_disk_page *leaf = page == 0 ? NULL : bp_tree_disk_pin(tree, page);
+
+    if (leaf == NULL)
+    {
+        return -1;
+    }
+
+    int position = bp_tree_disk_lower_bound(tree, leaf, key);
+
+    if (position == (int)leaf->size || tree->comparator(bp_tree_disk_record(tree, leaf, position), key) != 0)
+    {
+        buffer_pool_unpin(&tree->pool, page, 0);
+        return 0;
+    }
+
+    if (previous != NULL)
+    {
+        memcpy(previous, bp_tree_disk_record(tree, leaf, position), record_size);
+    }
+
+    memmove(bp_tree_disk_record(tree, leaf, position),
+            bp_tree_disk_record(tree, leaf, position + 1),
+            (leaf->size - position - 1) * record_size);
+    leaf->size--;
+    tree->header.size--;
+
+    if (leaf->size > 0 || page == tree->header.root)
+    {
+        buffer_pool_unpin(&tree->pool, page, 1);
+        return 1;
+    }
+
+    return bp_tree_disk_remove_leaf(tree, &path, page, leaf) == 0 ? 1 : -1;
+}
+
+int bp_tree_disk_range(struct bp_tree_disk *tree,
+                       const void *low,
+                       const void *high,
+                       int (*callback)(const void *record, void *context),
+                       void *context)
+{
+    unsigned long long page = tree->header.root;
+    int index = 0;
+    int count = 0;
+
+    if (low != NULL)
+    {
+        page = bp_tree_disk_find_leaf(tree, low, NULL);
+    }
+    else
+    {
+        /* Most left leaf */
+        for (unsigned int level = 1; level < tree->header.height && page != 0; level++)
+        {
+            struct bp_tree_disk_page *node = bp_tree_disk_pin(tree, page);
+
+            if (node == NULL)
+            {
+                return -1;
+            }
+
+            unsigned long long child = bp_tree_disk_children(node)[0];
+            buffer_pool_unpin(&tree->pool, page, 0);
+            page = child;
+        }
+    }
+
+    while (page != 0)
+    {
+        struct bp_tree_disk_page *leaf = bp_tree_disk_pin(tree, page);
+
+        if (leaf == NULL)
+        {
+            return -1;
+        }
+
+        if (low != NULL && count == 0)
+        {
+            index = bp_tree_disk_lower_bound(tree, leaf, low);
+        }
+
+        for (; index < (int)leaf->size; index++)
+        {
+            const char *record = bp_tree_disk_record(tree, leaf, index);
+
+            if (high != NULL && tree->comparator(record, high) >= 0)
+            {
+                buffer_pool_unpin(&tree->pool, page, 0);
+                return count;
+            }
+
+            count++;
+
+            if (callback(record, context) != 0)
+            {
+                buffer_pool_unpin(&tree->pool, page, 0);
+                return count;
+            }
+        }
+
+        unsigned long long right = leaf->right;
+        buffer_pool_unpin(&tree->pool, page, 0);
+        page = right;
+        index = 0;
+        low = NULL;
+    }
+
+    return count;
+}
+
+int bp_tree_disk_flush(struct bp_tree_disk *tree)
+{
+    struct bp_tree_disk_header *header = (struct bp_tree_disk_header *)buffer_pool_pin(&tree->pool, 0);
+
+    if (header == NULL)
+    {
+        return -1;
+    }
+
+    memcpy(header, &tree->header, sizeof(tree->header));
+    buffer_pool_unpin(&tree->pool, 0, 1);
+    return buffer_pool_flush(&tree->pool);
+}
+
+int bp_tree_disk_close(struct bp_tree_disk *tree)
+{
+    int result = bp_tree_disk_flush(tree);
+
+    if (buffer_pool_free(&tree->pool) != 0)
+    {
+        result = -1;
+    }
+
+    free(tree->scratch);
+    tree->scratch = NULL;
+    return result;
+}
+
+static inline char *bp_tree_disk_record(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, int index)
+{
+    return (char *)(node + 1) + index * tree->header.record_size;
+}
+
+static inline unsigned long long *bp_tree_disk_children(struct bp_tree_disk_page *node)
+{
+    return (unsigned long long *)(node + 1);
+}
+
+static inline char *bp_tree_disk_separator(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, int index)
+{
+    char *separators = (char *)(bp_tree_disk_children(node) + tree->header.inner_capacity + 1);
+    return separators + index * tree->header.record_size;
+}
+
+static inline struct bp_tree_disk_page *bp_tree_disk_pin(struct bp_tree_disk *tree, unsigned long long page)
+{
+    return (struct bp_tree_disk_page *)buffer_pool_pin(&tree->pool, page);
+}
+
+static int bp_tree_disk_child_index(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, const void *key)
+{
+    /* Separators are lower bounds of right children, so child is after all separators <= key */
+    int low = 0;
+    int high = node->size;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (tree->comparator(bp_tree_disk_separator(tree, node, middle), key) <= 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static int bp_tree_disk_lower_bound(struct bp_tree_disk *tree, struct bp_tree_disk_page *node, const void *key)
+{
+    int low = 0;
+    int high = node->size;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (tree->comparator(bp_tree_disk_record(tree, node, middle), key) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static unsigned long long bp_tree_disk_find_leaf(struct bp_tree_disk *tree, const void *key, struct bp_tree_disk_path *path)
+{
+    unsigned long long page = tree->header.root;
+
+    if (path != NULL)
+    {
+        path->depth = 0;
+    }
+
+    for (unsigned int level = 1; level < tree->header.height; level++)
+    {
+        struct bp_tree_disk_page *node = bp_tree_disk_pin(tree, page);
+
+        if (node == NULL)
+        {
+            return 0;
+        }
+
+        int index = bp_tree_disk_child_index(tree, node, key);
+
+        if (path != NULL)
+        {
+            path->pages[path->depth] = page;
+            path->indexes[path->depth] = index;
+            path->depth++;
+        }
+
+        unsigned long long child = bp_tree_disk_children(node)[index];
+        buffer_pool_unpin(&tree->pool, page, 0);
+        page = child;
+    }
+
+    return page;
+}
+
+static unsigned long long bp_tree_disk_alloc_page(struct bp_tree_disk *tree, struct bp_tree_disk_page **node)
+{
+    unsigned long long page = tree->header.free_list;
+
+    if (page == 0)
+    {
+        page = tree->header.page_count;
+    }
+
+    *node = bp_tree_disk_pin(tree, page);
+
+    if (*node == NULL)
+    {
+        return 0;
+    }
+
+    if (page == tree->header.free_list)
+    {
+        tree->header.free_list = (*node)->right;
+    }
+    else
+    {
+        tree->header.page_count++;
+    }
+
+    memset(*node, 0, BP_TREE_DISK_PAGE_SIZE);
+    return page;
+}
+
+static void bp_tree_disk_free_page(struct bp_tree_disk *tree, unsigned long long page, struct bp_tree_disk_page *node)
+{
+    memset(node, 0, sizeof(struct bp_tree_disk_page));
+    node->right = tree->header.free_list;
+    tree->header.free_list = page;
+    buffer_pool_unpin(&tree->pool, page, 1);
+}
+
+static unsigned long long bp_tree_disk_split_leaf(struct bp_tree_disk *tree,
+                                                  unsigned long long page,
+                                                  struct bp_tree_disk_page *leaf,
+                                                  int position,
+                                                  const void *record,
+                                                  char *separator)
+{
+    size_t record_size = tree->header.record_size;
+    struct bp_tree_disk_page *right = NULL;
+    unsigned long long right_page = bp_tree_disk_alloc_page(tree, &right);
+
+    if (right_page == 0)
+    {
+        return 0;
+    }
+
+    /* Merge records with new record in scratch, then spread them over both leaves */
+    int total = leaf->size + 1;
+    int left_size = (total + 1) / 2;
+
+    memcpy(tree->scratch, bp_tree_disk_record(tree, leaf, 0), position * record_size);
+    memcpy(tree->scratch + position * record_size, record, record_size);
+    memcpy(tree->scratch + (position + 1) * record_size,
+           bp_tree_disk_record(tree, leaf, position),
+           (leaf->size - position) * record_size);
+
+    memcpy(bp_tree_disk_record(tree, leaf, 0), tree->scratch, left_size * record_size);
+    memcpy(bp_tree_disk_record(tree, right, 0), tree->scratch + left_size * record_size, (total - left_size) * record_size);
+    memcpy(separator, bp_tree_disk_record(tree, right, 0), record_size);
+
+    leaf->size = left_size;
+    right->leaf = 1;
+    right->size = total - left_size;
+    right->left = page;
+    right->right = leaf->right;
+
+    if (leaf->right != 0)
+    {
+        struct bp_tree_disk_page *next = bp_tree_disk_pin(tree, leaf->right);
+
+        if (next == NULL)
+        {
+            buffer_pool_unpin(&tree->pool, right_page, 1);
+            return 0;
+        }
+
+        next->left = right_page;
+        buffer_pool_unpin(&tree->pool, leaf->right, 1);
+    }
+
+    leaf->right = right_page;
+    buffer_pool_unpin(&tree->pool, right_page, 1);
+    return right_page;
+}
+
+static int bp_tree_disk_insert_separator(struct bp_tree_disk *tree,
+                                         struct bp_tree_disk_path *path,
+                                         char *separator,
+                                         unsigned long long child)
+{
+    size_t record_size = tree->header.record_size;
+    unsigned int capacity = tree->header.inner_capacity;
+    char *separators = tree->scratch;
+    unsigned long long *children = (unsigned long long *)(tree->scratch + BP_TREE_DISK_PAGE_SIZE + record_size);
+
+    for (int depth = path->depth - 1; depth >= 0; depth--)
+    {
+        unsigned long long page = path->pages[depth];
+        int index = path->indexes[depth];
+        struct bp_tree_disk_page *node = bp_tree_disk_pin(tree, page);
+
+        if (node == NULL)
+        {
+            return -1;
+        }
+
+        if (node->size < capacity)
+        {
+            memmove(bp_tree_disk_separator(tree, node, index + 1),
+                    bp_tree_disk_separator(tree, node, index),
+                    (node->size - index) * record_size);
+            memmove(bp_tree_disk_children(node) + index + 2,
+                    bp_tree_disk_children(node) + index + 1,
+                    (node->size - index) * sizeof(unsigned long long));
+            memcpy(bp_tree_disk_separator(tree, node, index), separator, record_size);
+            bp_tree_disk_children(node)[index + 1] = child;
+            node->size++;
+            buffer_pool_unpin(&tree->pool, page, 1);
+            return 0;
+        }
+
+        /* Full inner page: middle separator of capacity + 1 separators goes to parent */
+        int total = capacity + 1;
+        int middle = total / 2;
+        struct bp_tree_disk_page *right = NULL;
+        unsigned long long right_page = bp_tree_disk_alloc_page(tree, &right);
+
+        if (right_page == 0)
+        {
+            buffer_pool_unpin(&tree->pool, page, 0);
+            return -1;
+        }
+
+        memcpy(separators, bp_tree_disk_separator(tree, node, 0), index * record_size);
+        memcpy(separators + index * record_size, separator, record_size);
+        memcpy(separators + (index + 1) * record_size,
+               bp_tree_disk_separator(tree, node, index),
+               (node->size - index) * record_size);
+        memcpy(children, bp_tree_disk_children(node), (index + 1) * sizeof(unsigned long long));
+        children[index + 1] = child;
+        memcpy(children + index + 2,
+               bp_tree_disk_children(node) + index + 1,
+               (node->size - index) * sizeof(unsigned long long));
+
+        memcpy(bp_tree_disk_separator(tree, node, 0), separators, middle * record_size);
+        memcpy(bp_tree_disk_children(node), children, (middle + 1) * sizeof(unsigned long long));
+        node->size = middle;
+
+        right->leaf = 0;
+        right->size = total - middle - 1;
+        memcpy(bp_tree_disk_separator(tree, right, 0), separators + (middle + 1) * record_size, right->size * record_size);
+        memcpy(bp_tree_disk_children(right), children + middle + 1, (right->size + 1) * sizeof(unsigned long long));
+
+        memcpy(separator, separators + middle * record_size, record_size);
+        child = right_page;
+        buffer_pool_unpin(&tree->pool, right_page, 1);
+        buffer_pool_unpin(&tree->pool, page, 1);
+    }
+
+    if (tree->header.height == BP_TREE_DISK_MAX_HEIGHT)
+    {
+        return -1;
+    }
+
+    /* Root is split */
+    struct bp_tree_disk_page *root = NULL;
+    unsigned long long root_page = bp_tree_disk_alloc_page(tree, &root);
+
+    if (root_page == 0)
+    {
+        return -1;
+    }
+
+    root->leaf = 0;
+    root->size = 1;
+    bp_tree_disk_children(root)[0] = tree->header.root;
+    bp_tree_disk_children(root)[1] = child;
+    memcpy(bp_tree_disk_separator(tree, root, 0), separator, record_size);
+    buffer_pool_unpin(&tree->pool, root_page, 1);
+
+    tree->header.root = root_page;
+    tree->header.height++;
+    return 0;
+}
+
+static int bp_tree_disk_remove_leaf(struct bp_tree_disk *tree,
+                                    struct bp_tree_disk_path *path,
+                                    unsigned long long page,
+                                    struct bp_tree_disk_page *leaf)
+{
+    size_t record_size = tree->header.record_size;
+    unsigned long long left = leaf->left;
+    unsigned long long right = leaf->right;
+
+    bp_tree_disk_free_page(tree, page, leaf);
+
+    if (left != 0)
+    {
+        struct bp_tree_disk_page *node = bp_tree_disk_pin(tree, left);
+
+        if (node == NULL)
+        {
+            return -1;
+        }
+
+        node->right = right;
+        buffer_pool_unpin(&tree->pool, left, 1);
+    }
+
+    if (right != 0)
+    {
+        struct bp_tree_disk_page *node = bp_tree_disk_pin(tree, right);
+
+        if (node == NULL)
+        {
+            return -1;
+        }
+
+        node->left = left;
+        buffer_pool_unpin(&tree->pool, right, 1);
+    }
+
+    for (int depth = path->depth - 1; depth >= 0; depth--)
+    {
+        unsigned long long parent = path->pages[depth];
+        int index = path->indexes[depth];
+        struct bp_tree_disk_page *node = bp_tree_disk_pin(tree, parent);
+
+        if (node == NULL)
+        {
+            return -1;
+        }
+
+        if (node->size == 0)
+        {
+            /* Only child is removed, so parent is removed too */
+            bp_tree_disk_free_page(tree, parent, node);
+            continue;
+        }
+
+        /* Separator before removed child (or after first child) is removed with it */
+        int separator = index > 0 ? index - 1 : 0;
+
+        memmove(bp_tree_disk_separator(tree, node, separator),
+                bp_tree_disk_separator(tree, node, separator + 1),
+                (node->size - separator - 1) * record_size);
+        memmove(bp_tree_disk_children(node) + index,
+                bp_tree_disk_children(node) + index + 1,
+                (node->size - index) * sizeof(unsigned long long));
+        node->size--;
+        buffer_pool_unpin(&tree->pool, parent, 1);
+        break;
+    }
+
+    /* Root with one child is replaced by child */
+    while (tree->header.height > 1)
+    {
+        unsigned long long page = tree->header.root;
+        struct bp_tree_disk_page *root = bp_tree_disk_pin(tree, page);
+
+        if (root == NULL)
+        {
+            return -1;
+        }
+
+        if (root->size > 0)
+        {
+            buffer_pool_unpin(&tree->pool, page, 0);
+            break;
+        }
+
+        tree->header.root = bp_tree_disk_children(root)[0];
+        tree->header.height--;
+        bp_tree_disk_free_page(tree, page, root);
+    }
+
+    return 0;
+}
@@ -0,0 +1,638 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bp_tree_snapshot.h>
+
+/**
+ * Header of leaf and inner pages. Leaf records follow header, inner page stores
+ * inner_capacity + 1 children after header and then separators.
+ */
+struct bp_tree_snapshot_page
+{
+    unsigned int leaf;
+
+    /** Count of records in leaf or count of separators in inner page */
+    unsigned int size;
+
+    /** Next leaf page, 0 for last leaf and inner pages */
+    unsigned long long right;
+};
+
+/**
+ * Pages of one level which are written, but not linked to parent level yet.
+ */
+struct bp_tree_snapshot_level
+{
+    /** Page numbers */
+    unsigned long long *pages;
+
+    /** Minimal record of each page, separator in parent */
+    char *first;
+
+    int size;
+    int capacity;
+};
+
+/**
+ * Snapshot file which is written.
+ */
+struct bp_tree_snapshot_writer
+{
+    int fd;
+    size_t record_size;
+    unsigned long long page_count;
+
+    /** Page which is filled */
+    char *page;
+};
+
+/**
+ * Page by number in mapped file.
+ */
+static inline const struct bp_tree_snapshot_page *bp_tree_snapshot_page(struct bp_tree_snapshot *snapshot, unsigned long long page);
+
+/**
+ * Record of leaf page by index.
+ */
+static inline const char *bp_tree_snapshot_record(struct bp_tree_snapshot *snapshot, const struct bp_tree_snapshot_page *page, int index);
+
+/**
+ * Children of inner page.
+ */
+static inline const unsigned long long *bp_tree_snapshot_children(const struct bp_tree_snapshot_page *page);
+
+/**
+ * Separator of inner page by index.
+ */
+static inline const char *bp_tree_snapshot_separator(struct bp_tree_snapshot *snapshot, const struct bp_tree_snapshot_page *page, int index);
+
+/**
+ * Descend from root to leaf which may contain record.
+ */
+static const struct bp_tree_snapshot_page *bp_tree_snapshot_find_leaf(struct bp_tree_snapshot *snapshot, const void *record);
+
+/**
+ * Index of first record in leaf which is more or equals record.
+ */
+static int bp_tree_snapshot_lower_bound(struct bp_tree_snapshot *snapshot, const struct bp_tree_snapshot_page *leaf, const void *record);
+
+/**
+ * Append page to level, grow arrays if needed.
+ */
+static int bp_tree_snapshot_level_add(struct bp_tree_snapshot_level *level, size_t record_size, unsigned long long page, const void *first);
+
+/**
+ * Append filled page to file. Returns number of written page or 0 on error.
+ */
+static unsigned long long bp_tree_snapshot_flush(struct bp_tree_snapshot_writer *writer);
+
+/**
+ * Write leaf pages with all keys of tree, leaves are filled completely.
+ */
+static int bp_tree_snapshot_write_leaves(struct bp_tree_snapshot_writer *writer,
+                                         struct bp_tree *tree,
+                                         struct bp_tree_snapshot_header *header,
+                                         void (*encode)(struct bp_tree_node *key, void *record),
+                                         struct bp_tree_snapshot_level *leaves);
+
+/**
+ * Write inner pages over level, children are spread evenly over pages. Returns parent level in level.
+ */
+static int bp_tree_snapshot_write_level(struct bp_tree_snapshot_writer *writer,
+                                        struct bp_tree_snapshot_header *header,
+                                        struct bp_tree_snapshot_level *level);
+
+/**
+ * Max count of records in leaf and separators in inner page for record_size.
+ * Returns -1 if record does not fit at least two times to page.
+ */
+static int bp_tree_snapshot_capacities(unsigned long long record_size, unsigned int *leaf_capacity, unsigned int *inner_capacity);
+
+/**
+ * Sync directory which contains path, so rename of file in it is durable.
+ */
+static int bp_tree_snapshot_sync_directory(const char *path);
+
+int bp_tree_snapshot_write(struct bp_tree *tree,
+                           const char *path,
+                           size_t record_size,
+                           void (*encode)(struct bp_tree_node *key, void *record))
+{
+    struct bp_tree_snapshot_header header;
+    struct bp_tree_snapshot_level level = {NULL, NULL, 0, 0};
+    struct bp_tree_snapshot_writer writer;
+    memset(&header, 0, sizeof(header));
+
+    if (bp_tree_snapshot_capacities(record_size, &header.leaf_capacity, &header.inner_capacity) != 0)
+    {
+        return -1;
+    }
+
+    header.magic = BP_TREE_SNAPSHOT_MAGIC;
+    header.byte_order = BP_TREE_SNAPSHOT_BYTE_ORDER;
+    header.page_size = BP_TREE_SNAPSHOT_PAGE_SIZE;
+    header.record_size = record_size;
+
+    /* New snapshot is written aside and renamed over path, so mapped old file stays intact */
+    size_t path_size = strlen(path) + sizeof(".tmp");
+    char *temporary = (char *)malloc(path_size);
+
+    if (temporary == NULL)
+    {
+        return -1;
+    }
+
+    snprintf(temporary, path_size, "%s.tmp", path);
+    writer.fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer.record_size = record_size;
+    writer.page_count = 1;
+    writer.page = (char *)calloc(1, BP_TREE_SNAPSHOT_PAGE_SIZE);
+
+    if (writer.fd < 0 || writer.page == NULL)
+    {
+        free(writer.page);
+
+        if (writer.fd >= 0)
+        {
+            close(writer.fd);
+            unlink(temporary);
+        }
+
+        free(temporary);
+        return -1;
+    }
+
+    int result = bp_tree_snapshot_write_leaves(&writer, tree, &header, encode, &level);
+
+    if (result == 0 && level.size > 0)
+    {
+        header.height = 1;
+        header.first_leaf = level.pages[0];
+
+        while (result == 0 && level.size > 1)
+        {
+            result = bp_tree_snapshot_write_level(&writer, &header, &level);
+            header.height++;
+        }
+
+        header.root = level.pages[0];
+    }
+
+    /* Header is written last, so reader never maps snapshot without all pages */
+    if (result == 0)
+    {
+        header.page_count = writer.page_count;
+        memset(writer.page, 0, BP_TREE_SNAPSHOT_PAGE_SIZE);
+        memcpy(writer.page, &header, sizeof(header));
+
+        if (pwrite(writer.fd, writer.page, BP_TREE_SNAPSHOT_PAGE_SIZE, 0) != BP_TREE_SNAPSHOT_PAGE_SIZE || fsync(writer.fd) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    if (close(writer.fd) != 0)
+    {
+        result = -1;
+    }
+
+    if (result == 0 && rename(temporary, path) != 0)
+    {
+        result = -1;
+    }
+
+    if (result != 0)
+    {
+        unlink(temporary);
+    }
+    else
+    {
+        result = bp_tree_snapshot_sync_directory(path);
+    }
+
+    free(temporary);
+    free(writer.page);
+    free(level.pages);
+    free(level.first);
+    return result;
+}
+
+int bp_tree_snapshot_open(struct bp_tree_snapshot *snapshot,
+                          const char *path,
+                          int (*comparator)(const void *first, const void *second))
+{
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &info) != 0 || info.st_size < BP_TREE_SNAPSHOT_PAGE_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    const struct bp_tree_snapshot_header *header = (const struct bp_tree_snapshot_header *)base;
+    unsigned int leaf_capacity = 0;
+    unsigned int inner_capacity = 0;
+    unsigned long long pages = info.st_size / BP_TREE_SNAPSHOT_PAGE_SIZE;
+
+    /* Only header is checked, page layout is derived from record size, so it must match */
+    if (header->magic != BP_TREE_SNAPSHOT_MAGIC ||
+        header->byte_order != BP_TREE_SNAPSHOT_BYTE_ORDER ||
+        header->page_size != BP_TREE_SNAPSHOT_PAGE_SIZE ||
+        bp_tree_snapshot_capacities(header->record_size, &leaf_capacity, &inner_capacity) != 0 ||
+        header->leaf_capacity != leaf_capacity ||
+        header->inner_capacity != inner_capacity ||
+        header->page_count > pages ||
+        header->root >= header->page_count ||
+        header->first_leaf >= header->page_count ||
+        (header->size == 0) != (header->root == 0) ||
+        (header->size == 0) != (header->first_leaf == 0) ||
+        (header->size == 0) != (header->height == 0) ||
+        header->height >= header->page_count ||
+        header->size > (header->page_count - 1) * leaf_capacity)
+    {
+        munmap(base, info.st_size);
+        return -1;
+    }
+
+    snapshot->header = header;
+    snapshot->base = (const char *)base;
+    snapshot->length = info.st_size;
+    snapshot->comparator = comparator;
+    return 0;
+}
+
+const void *bp_tree_snapshot_lookup(struct bp_tree_snapshot *snapshot, const void *record)
+{
+    if (snapshot->header->size == 0)
+    {
+        return NULL;
+    }
+
+    const struct bp_tree_snapshot_page *leaf = bp_tree_snapshot_find_leaf(snapshot, record);
+    int index = bp_tree_snapshot_lower_bound(snapshot, leaf, record);
+
+    if (index < (int)leaf->size && snapshot->comparator(bp_tree_snapshot_record(snapshot, leaf, index), record) == 0)
+    {
+        return bp_tree_snapshot_record(snapshot, leaf, index);
+    }
+
+    return NULL;
+}
+
+int bp_tree_snapshot_range(struct bp_tree_snapshot *snapshot,
+                           const void *low,
+                           const void *high,
+                           int (*callback)(const void *record, void *context),
+                           void *context)
+{
+    const struct bp_tree_snapshot_page *leaf = NULL;
+    int index = 0;
+    int count = 0;
+
+    if (snapshot->header->size == 0)
+    {
+        return 0;
+    }
+
+    if (low != NULL)
+    {
+        leaf = bp_tree_snapshot_find_leaf(snapshot, low);
+        index = bp_tree_snapshot_lower_bound(snapshot, leaf, low);
+    }
+    else
+    {
+        leaf = bp_tree_snapshot_page(snapshot, snapshot->header->first_leaf);
+    }
+
+    while (1)
+    {
+        for (; index < (int)leaf->size; index++)
+        {
+            const char *record = bp_tree_snapshot_record(snapshot, leaf, index);
+
+            if (high != NULL && snapshot->comparator(record, high) >= 0)
+            {
+                return count;
+            }
+
+            count++;
+
+            if (callback(record, context) != 0)
+            {
+                return count;
+            }
+        }
+
+        if (leaf->right == 0)
+        {
+            return count;
+        }
+
+        leaf = bp_tree_snapshot_page(snapshot, leaf->right);
+        index = 0;
+    }
+}
+
+void bp_tree_snapshot_close(struct bp_tree_snapshot *snapshot)
+{
+    munmap((void *)snapshot->base, snapshot->length);
+    snapshot->header = NULL;
+    snapshot->base = NULL;
+    snapshot->length = 0;
+}
+
+static inline const struct bp_tree_snapshot_page *bp_tree_snapshot_page(struct bp_tree_snapshot *snapshot, unsigned long long page)
+{
+    return (const struct bp_tree_snapshot_page *)(snapshot->base + page * BP_TREE_SNAPSHOT_PAGE_SIZE);
+}
+
+static inline const char *bp_tree_snapshot_record(struct bp_tree_snapshot *snapshot, const struct bp_tree_snapshot_page *page, int index)
+{
+    return (const char *)(page + 1) + index * snapshot->header->record_size;
+}
+
+static inline const unsigned long long *bp_tree_snapshot_children(const struct bp_tree_snapshot_page *page)
+{
+    return (const unsigned long long *)(page + 1);
+}
+
+static inline const char *bp_tree_snapshot_separator(struct bp_tree_snapshot *snapshot, const struct bp_tree_snapshot_page *page, int index)
+{
+    const char *separators = (const char *)(bp_tree_snapshot_children(page) + snapshot->header->inner_capacity + 1);
+    return separators + index * snapshot->header->record_size;
+}
+
+static const struct bp_tree_snapshot_page *bp_tree_snapshot_find_leaf(struct bp_tree_snapshot *snapshot, const void *record)
+{
+    const struct bp_tree_snapshot_page *page = bp_tree_snapshot_page(snapshot, snapshot->header->root);
+
+    while (!page->leaf)
+    {
+        /* Separator is minimal record of right child, so child is after all separators <= record */
+        int low = 0;
+        int high = page->size;
+
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+
+            if (snapshot->comparator(bp_tree_snapshot_separator(snapshot, page, middle), record) <= 0)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        page = bp_tree_snapshot_page(snapshot, bp_tree_snapshot_children(page)[low]);
+    }
+
+    return page;
+}
+
+static int bp_tree_snapshot_lower_bound(struct bp_tree_snapshot *snapshot, const struct bp_tree_snapshot_page *leaf, const void *record)
+{
+    int low = 0;
+    int high = leaf->size;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (snapshot->comparator(bp_tree_snapshot_record(snapshot, leaf, middle), record) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static int bp_tree_snapshot_level_add(struct bp_tree_snapshot_level *level, size_t record_size, unsigned long long page, const void *first)
+{
+    if (level->size == level->capacity)
+    {
+        int capacity = level->capacity == 0 ? 64 : level->capacity * 2;
+        unsigned long long *pages = (unsigned long long *)realloc(level->pages, capacity * sizeof(unsigned long long));
+
+        if (pages == NULL)
+        {
+            return -1;
+        }
+
+        level->pages = pages;
+
+        char *records = (char *)realloc(level->first, capacity * record_size);
+
+        if (records == NULL)
+        {
+            return -1;
+        }
+
+        level->first = records;
+        level->capacity = capacity;
+    }
+
+    level->pages[level->size] = page;
+    memcpy(level->first + level->size * record_size, first, record_size);
+    level->size++;
+    return 0;
+}
+
+static unsigned long long bp_tree_snapshot_flush(struct bp_tree_snapshot_writer *writer)
+{
+    unsigned long long page = writer->page_count;
+    off_t offset = (off_t)page * BP_TREE_SNAPSHOT_PAGE_SIZE;
+
+    if (pwrite(writer->fd, writer->page, BP_TREE_SNAPSHOT_PAGE_SIZE, offset) != BP_TREE_SNAPSHOT_PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    memset(writer->page, 0, BP_TREE_SNAPSHOT_PAGE_SIZE);
+    writer->page_count++;
+    return page;
+}
+
+static int bp_tree_snapshot_write_leaves(struct bp_tree_snapshot_writer *writer,
+                                         struct bp_tree *tree,
+                                         struct bp_tree_snapshot_header *header,
+                                         void (*encode)(struct bp_tree_node *key, void *record),
+                                         struct bp_tree_snapshot_level *leaves)
+{
+    struct bp_tree_snapshot_page *page = (struct bp_tree_snapshot_page *)writer->page;
+    char *first = (char *)malloc(writer->record_size);
+    struct bp_tree_cursor cursor;
+
+    if (first == NULL)
+    {
+        return -1;
+    }
+
+    page->leaf = 1;
+
+    for (struct bp_tree_node *key = bp_tree_cursor_first(&cursor, tree); key != NULL; key = bp_tree_cursor_next(&cursor))
+    {
+        /* Full leaf is written when next key is known, so it is linked to next page */
+        if (page->size == header->leaf_capacity)
+        {
+            page->right = writer->page_count + 1;
+
+            if (bp_tree_snapshot_level_add(leaves, writer->record_size, writer->page_count, first) != 0 ||
+                bp_tree_snapshot_flush(writer) == 0)
+            {
+                free(first);
+                return -1;
+            }
+
+            page->leaf = 1;
+        }
+
+        char *record = writer->page + sizeof(struct bp_tree_snapshot_page) + page->size * writer->record_size;
+        encode(key, record);
+
+        if (page->size == 0)
+        {
+            memcpy(first, record, writer->record_size);
+        }
+
+        page->size++;
+        header->size++;
+    }
+
+    int result = 0;
+
+    if (page->size > 0 &&
+        (bp_tree_snapshot_level_add(leaves, writer->record_size, writer->page_count, first) != 0 ||
+         bp_tree_snapshot_flush(writer) == 0))
+    {
+        result = -1;
+    }
+
+    free(first);
+    return result;
+}
+
+static int bp_tree_snapshot_write_level(struct bp_tree_snapshot_writer *writer,
+                                        struct bp_tree_snapshot_header *header,
+                                        struct bp_tree_snapshot_level *level)
+{
+    struct bp_tree_snapshot_level parent = {NULL, NULL, 0, 0};
+    struct bp_tree_snapshot_page *page = (struct bp_tree_snapshot_page *)writer->page;
+    unsigned long long *children = (unsigned long long *)(page + 1);
+    char *separators = (char *)(children + header->inner_capacity + 1);
+    int fanout = header->inner_capacity + 1;
+    int count = (level->size + fanout - 1) / fanout;
+    int child = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        int size = level->size / count + (i < level->size % count ? 1 : 0);
+
+        page->leaf = 0;
+        page->size = size - 1;
+
+        for (int j = 0; j < size; j++)
+        {
+            children[j] = level->pages[child + j];
+
+            if (j > 0)
+            {
+                memcpy(separators + (j - 1) * writer->record_size, level->first + (child + j) * writer->record_size, writer->record_size);
+            }
+        }
+
+        if (bp_tree_snapshot_level_add(&parent, writer->record_size, writer->page_count, level->first + child * writer->record_size) != 0 ||
+            bp_tree_snapshot_flush(writer) == 0)
+        {
+            free(parent.pages);
+            free(parent.first);
+            return -1;
+        }
+
+        child += size;
+    }
+
+    free(level->pages);
+    free(level->first);
+    *level = parent;
+    return 0;
+}
+
+static int bp_tree_snapshot_capacities(unsigned long long record_size, unsigned int *leaf_capacity, unsigned int *inner_capacity)
+{
+    size_t space = BP_TREE_SNAPSHOT_PAGE_SIZE - sizeof(struct bp_tree_snapshot_page);
+
+    if (record_size == 0 || record_size > space)
+    {
+        return -1;
+    }
+
+    *leaf_capacity = space / record_size;
+    *inner_capacity = (space - sizeof(unsigned long long)) / (sizeof(unsigned long long) + record_size);
+    return *leaf_capacity < 2 || *inner_capacity < 2 ? -1 : 0;
+}
+
+static int bp_tree_snapshot_sync_directory(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    int fd;
+
+    if (slash == NULL)
+    {
+        fd = open(".", O_RDONLY);
+    }
+    else
+    {
+        size_t size = slash == path ? 1 : (size_t)(slash - path);
+        char *directory = (char *)malloc(size + 1);
+
+        if (directory == NULL)
+        {
+            return -1;
+        }
+
+        memcpy(directory, path, size);
+        directory[size] = '\0';
+        fd = open(directory, O_RDONLY);
+        free(directory);
+    }
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int result = fsync(fd) == 0 ? 0 : -1;
+
+    if (close(fd) != 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
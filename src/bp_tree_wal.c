@@ -0,0 +1,562 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bp_tree_snapshot.h>
+#include <bp_tree_wal.h>
+
+/**
+ * Count of log entries read by replay at once.
+ */
+#define BP_TREE_WAL_READ_ENTRIES 256
+
+/**
+ * Fill factor of leaves loaded from snapshot, leaves keep room for replayed inserts.
+ */
+#define BP_TREE_WAL_FILL_FACTOR 0.8f
+
+/**
+ * Keys decoded from snapshot for bulk load.
+ */
+struct bp_tree_wal_keys
+{
+    struct bp_tree_node **nodes;
+    int size;
+    struct bp_tree_node *(*decode)(const void *record);
+};
+
+/**
+ * Size of entry with header.
+ */
+static inline size_t bp_tree_wal_entry_size(size_t record_size);
+
+/**
+ * FNV-1a hash of entry type and record.
+ */
+static unsigned int bp_tree_wal_checksum(unsigned int type, const char *record, size_t record_size);
+
+/**
+ * Write appended entries and sync log as leader of group. Lock must be held, it is released
+ * while entries are written.
+ */
+static void bp_tree_wal_write(struct bp_tree_wal *wal);
+
+/**
+ * Mark log as failed and free buffers, entries appended after failure are never written.
+ * Lock must be held.
+ */
+static void bp_tree_wal_fail(struct bp_tree_wal *wal);
+
+/**
+ * Write all bytes, retrying partial writes.
+ */
+static int bp_tree_wal_write_all(int fd, const char *data, size_t size);
+
+/**
+ * Range callback, decode snapshot record to key.
+ */
+static int bp_tree_wal_decode_record(const void *record, void *context);
+
+/**
+ * Bulk load keys of snapshot to empty tree.
+ */
+static int bp_tree_wal_load_snapshot(struct bp_tree *tree,
+                                     const char *path,
+                                     size_t record_size,
+                                     struct bp_tree_node *(*decode)(const void *record),
+                                     void (*free_callback)(struct bp_tree_node *key));
+
+/**
+ * Apply one log entry to tree.
+ */
+static int bp_tree_wal_apply(struct bp_tree *tree,
+                             unsigned int type,
+                             const char *record,
+                             struct bp_tree_node *(*decode)(const void *record),
+                             void (*free_callback)(struct bp_tree_node *key));
+
+int bp_tree_wal_open(struct bp_tree_wal *wal,
+                     const char *path,
+                     size_t record_size,
+                     void (*encode)(struct bp_tree_node *key, void *record))
+{
+    struct bp_tree_wal_header header;
+    struct stat info;
+
+    if (record_size == 0)
+    {
+        return -1;
+    }
+
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+    if (wal->fd < 0)
+    {
+        return -1;
+    }
+
+    if (fstat(wal->fd, &info) != 0)
+    {
+        close(wal->fd);
+        return -1;
+    }
+
+    if (info.st_size == 0)
+    {
+        header.magic = BP_TREE_WAL_MAGIC;
+        header.record_size = record_size;
+
+        if (bp_tree_wal_write_all(wal->fd, (const char *)&header, sizeof(header)) != 0 || fdatasync(wal->fd) != 0)
+        {
+            close(wal->fd);
+            return -1;
+        }
+    }
+    else if (pread(wal->fd, &header, sizeof(header), 0) != sizeof(header) ||
+             header.magic != BP_TREE_WAL_MAGIC ||
+             header.record_size != record_size)
+    {
+        close(wal->fd);
+        return -1;
+    }
+
+    if (pthread_mutex_init(&wal->lock, NULL) != 0)
+    {
+        close(wal->fd);
+        return -1;
+    }
+
+    if (pthread_cond_init(&wal->written, NULL) != 0)
+    {
+        pthread_mutex_destroy(&wal->lock);
+        close(wal->fd);
+        return -1;
+    }
+
+    wal->record_size = record_size;
+    wal->encode = encode;
+    wal->buffer = NULL;
+    wal->buffer_size = 0;
+    wal->buffer_capacity = 0;
+    wal->spare = NULL;
+    wal->spare_capacity = 0;
+    wal->appended = 0;
+    wal->durable = 0;
+    wal->syncing = 0;
+    wal->failed = 0;
+    wal->syncs = 0;
+    return 0;
+}
+
+unsigned long long bp_tree_wal_append(struct bp_tree_wal *wal, int type, struct bp_tree_node *key)
+{
+    size_t entry_size = bp_tree_wal_entry_size(wal->record_size);
+    unsigned long long sequence;
+
+    pthread_mutex_lock(&wal->lock);
+
+    /* Nothing is committed after failure, so entry is only counted */
+    if (wal->failed)
+    {
+        sequence = ++wal->appended;
+        pthread_mutex_unlock(&wal->lock);
+        return sequence;
+    }
+
+    if (wal->buffer_size + entry_size > wal->buffer_capacity)
+    {
+        size_t capacity = wal->buffer_capacity * 2 > entry_size * 64 ? wal->buffer_capacity * 2 : entry_size * 64;
+        char *buffer = (char *)realloc(wal->buffer, capacity);
+
+        if (buffer == NULL)
+        {
+            /* Entry is lost, so nothing after it may be committed */
+            bp_tree_wal_fail(wal);
+            sequence = ++wal->appended;
+            pthread_mutex_unlock(&wal->lock);
+            return sequence;
+        }
+
+        wal->buffer = buffer;
+        wal->buffer_capacity = capacity;
+    }
+
+    /* Entries are packed, so header is copied instead of written in place */
+    struct bp_tree_wal_entry entry;
+    char *record = wal->buffer + wal->buffer_size + sizeof(entry);
+
+    memset(record, 0, wal->record_size);
+    wal->encode(key, record);
+    entry.type = type;
+    entry.checksum = bp_tree_wal_checksum(type, record, wal->record_size);
+    memcpy(wal->buffer + wal->buffer_size, &entry, sizeof(entry));
+    wal->buffer_size += entry_size;
+    sequence = ++wal->appended;
+
+    pthread_mutex_unlock(&wal->lock);
+    return sequence;
+}
+
+int bp_tree_wal_commit(struct bp_tree_wal *wal, unsigned long long sequence)
+{
+    pthread_mutex_lock(&wal->lock);
+
+    while (wal->durable < sequence && !wal->failed)
+    {
+        if (wal->syncing)
+        {
+            pthread_cond_wait(&wal->written, &wal->lock);
+        }
+        else
+        {
+            bp_tree_wal_write(wal);
+        }
+    }
+
+    int result = wal->failed ? -1 : 0;
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+int bp_tree_wal_truncate(struct bp_tree_wal *wal)
+{
+    pthread_mutex_lock(&wal->lock);
+
+    while (wal->syncing)
+    {
+        pthread_cond_wait(&wal->written, &wal->lock);
+    }
+
+    /* Appended entries are in snapshot */
+    wal->buffer_size = 0;
+    wal->durable = wal->appended;
+
+    if (ftruncate(wal->fd, sizeof(struct bp_tree_wal_header)) != 0 || fdatasync(wal->fd) != 0)
+    {
+        bp_tree_wal_fail(wal);
+    }
+
+    int result = wal->failed ? -1 : 0;
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+int bp_tree_wal_close(struct bp_tree_wal *wal)
+{
+    int result = bp_tree_wal_commit(wal, wal->appended);
+
+    if (close(wal->fd) != 0)
+    {
+        result = -1;
+    }
+
+    pthread_cond_destroy(&wal->written);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->buffer);
+    free(wal->spare);
+    wal->buffer = NULL;
+    wal->spare = NULL;
+    return result;
+}
+
+int bp_tree_wal_replay(struct bp_tree *tree,
+                       const char *snapshot_path,
+                       const char *wal_path,
+                       size_t record_size,
+                       struct bp_tree_node *(*decode)(const void *record),
+                       void (*free_callback)(struct bp_tree_node *key))
+{
+    struct bp_tree_wal_header header;
+    size_t entry_size = bp_tree_wal_entry_size(record_size);
+
+    if (tree->size != 0 || tree->wal != NULL)
+    {
+        return -1;
+    }
+
+    if (snapshot_path != NULL && access(snapshot_path, F_OK) == 0 &&
+        bp_tree_wal_load_snapshot(tree, snapshot_path, record_size, decode, free_callback) != 0)
+    {
+        return -1;
+    }
+
+    int fd = open(wal_path, O_RDWR);
+
+    if (fd < 0)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    ssize_t size = pread(fd, &header, sizeof(header), 0);
+
+    if (size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    if (size != sizeof(header) || header.magic != BP_TREE_WAL_MAGIC || header.record_size != record_size)
+    {
+        close(fd);
+        return -1;
+    }
+
+    char *buffer = (char *)malloc(entry_size * BP_TREE_WAL_READ_ENTRIES);
+    off_t offset = sizeof(header);
+    int count = 0;
+    int valid = 1;
+
+    if (buffer == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    while (valid)
+    {
+        size = pread(fd, buffer, entry_size * BP_TREE_WAL_READ_ENTRIES, offset);
+
+        if (size < 0)
+        {
+            count = -1;
+            break;
+        }
+
+        int entries = size / entry_size;
+
+        for (int i = 0; i < entries; i++)
+        {
+            struct bp_tree_wal_entry entry;
+            const char *record = buffer + i * entry_size + sizeof(entry);
+            memcpy(&entry, buffer + i * entry_size, sizeof(entry));
+
+            if ((entry.type != BP_TREE_WAL_INSERT && entry.type != BP_TREE_WAL_DELETE) ||
+                entry.checksum != bp_tree_wal_checksum(entry.type, record, record_size))
+            {
+                valid = 0;
+                break;
+            }
+
+            if (bp_tree_wal_apply(tree, entry.type, record, decode, free_callback) != 0)
+            {
+                valid = 0;
+                count = -1;
+                break;
+            }
+
+            offset += entry_size;
+            count++;
+        }
+
+        /* Short read is end of log, partial entry is torn write */
+        if (size < (ssize_t)(entry_size * BP_TREE_WAL_READ_ENTRIES))
+        {
+            break;
+        }
+    }
+
+    struct stat info;
+
+    if (count >= 0 && fstat(fd, &info) == 0 && info.st_size > offset)
+    {
+        if (ftruncate(fd, offset) != 0 || fdatasync(fd) != 0)
+        {
+            count = -1;
+        }
+    }
+
+    free(buffer);
+    close(fd);
+    return count;
+}
+
+static inline size_t bp_tree_wal_entry_size(size_t record_size)
+{
+    return sizeof(struct bp_tree_wal_entry) + record_size;
+}
+
+static unsigned int bp_tree_wal_checksum(unsigned int type, const char *record, size_t record_size)
+{
+    unsigned int hash = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(type); i++)
+    {
+        hash = (hash ^ ((type >> (i * 8)) & 0xff)) * 16777619u;
+    }
+
+    for (size_t i = 0; i < record_size; i++)
+    {
+        hash = (hash ^ (unsigned char)record[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void bp_tree_wal_write(struct bp_tree_wal *wal)
+{
+    /* Take appended entries, next writers append to other buffer meanwhile */
+    char *data = wal->buffer;
+    size_t size = wal->buffer_size;
+    size_t capacity = wal->buffer_capacity;
+    unsigned long long sequence = wal->appended;
+
+    wal->buffer = wal->spare;
+    wal->buffer_capacity = wal->spare_capacity;
+    wal->buffer_size = 0;
+    wal->spare = data;
+    wal->spare_capacity = capacity;
+    wal->syncing = 1;
+    pthread_mutex_unlock(&wal->lock);
+
+    int result = bp_tree_wal_write_all(wal->fd, data, size);
+
+    if (result == 0 && fdatasync(wal->fd) != 0)
+    {
+        result = -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->syncing = 0;
+    wal->syncs++;
+
+    if (result == 0)
+    {
+        wal->durable = sequence;
+    }
+    else
+    {
+        bp_tree_wal_fail(wal);
+    }
+
+    pthread_cond_broadcast(&wal->written);
+}
+
+static void bp_tree_wal_fail(struct bp_tree_wal *wal)
+{
+    wal->failed = 1;
+    free(wal->buffer);
+    free(wal->spare);
+    wal->buffer = NULL;
+    wal->buffer_size = 0;
+    wal->buffer_capacity = 0;
+    wal->spare = NULL;
+    wal->spare_capacity = 0;
+}
+
+static int bp_tree_wal_write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+static int bp_tree_wal_decode_record(const void *record, void *context)
+{
+    struct bp_tree_wal_keys *keys = (struct bp_tree_wal_keys *)context;
+    struct bp_tree_node *key = keys->decode(record);
+
+    if (key == NULL)
+    {
+        return 1;
+    }
+
+    keys->nodes[keys->size++] = key;
+    return 0;
+}
+
+static int bp_tree_wal_load_snapshot(struct bp_tree *tree,
+                                     const char *path,
+                                     size_t record_size,
+                                     struct bp_tree_node *(*decode)(const void *record),
+                                     void (*free_callback)(struct bp_tree_node *key))
+{
+    struct bp_tree_snapshot snapshot;
+
+    /* Whole snapshot is scanned, so records are not compared */
+    if (bp_tree_snapshot_open(&snapshot, path, NULL) != 0)
+    {
+        return -1;
+    }
+
+    if (snapshot.header->record_size != record_size)
+    {
+        bp_tree_snapshot_close(&snapshot);
+        return -1;
+    }
+
+    struct bp_tree_wal_keys keys;
+    keys.size = 0;
+    keys.decode = decode;
+    keys.nodes = (struct bp_tree_node **)malloc((snapshot.header->size + 1) * sizeof(struct bp_tree_node *));
+
+    if (keys.nodes == NULL)
+    {
+        bp_tree_snapshot_close(&snapshot);
+        return -1;
+    }
+
+    int result = 0;
+
+    if (bp_tree_snapshot_range(&snapshot, NULL, NULL, bp_tree_wal_decode_record, &keys) != (int)snapshot.header->size ||
+        keys.size != (int)snapshot.header->size ||
+        bp_tree_bulk_load(tree, keys.nodes, keys.size, BP_TREE_WAL_FILL_FACTOR) != 0)
+    {
+        for (int i = 0; i < keys.size; i++)
+        {
+            free_callback(keys.nodes[i]);
+        }
+
+        result = -1;
+    }
+
+    free(keys.nodes);
+    bp_tree_snapshot_close(&snapshot);
+    return result;
+}
+
+static int bp_tree_wal_apply(struct bp_tree *tree,
+                             unsigned int type,
+                             const char *record,
+                             struct bp_tree_node *(*decode)(const void *record),
+                             void (*free_callback)(struct bp_tree_node *key))
+{
+    struct bp_tree_node *key = decode(record);
+
+    if (key == NULL)
+    {
+        return -1;
+    }
+
+    struct bp_tree_node *previous;
+    int result = type == BP_TREE_WAL_INSERT ? bp_tree_try_insert(tree, key, &previous) : bp_tree_try_delete(tree, key, &previous);
+
+    if (previous != NULL)
+    {
+        free_callback(previous);
+    }
+
+    if (type != BP_TREE_WAL_INSERT || result != 0)
+    {
+        free_callback(key);
+    }
+
+    return result != 0 ? -1 : 0;
+}
@@ -0,0 +1,238 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <buffer_pool.h>
+
+/**
+ * Hash of frame page for index.
+ */
+static int buffer_pool_frame_hash(struct hash_map_node *node);
+
+/**
+ * Compare pages of frames.
+ */
+static int buffer_pool_frame_compare(struct hash_map_node *first, struct hash_map_node *second);
+
+/**
+ * Find frame of cached page. If page is not cached returns NULL.
+ */
+static struct buffer_pool_frame *buffer_pool_find(struct buffer_pool *pool, unsigned long long page);
+
+/**
+ * Choose frame for new page by clock and evict its page. If all frames are pinned returns NULL.
+ */
+static struct buffer_pool_frame *buffer_pool_victim(struct buffer_pool *pool);
+
+/**
+ * Write dirty page of frame.
+ */
+static int buffer_pool_write(struct buffer_pool *pool, struct buffer_pool_frame *frame);
+
+/**
+ * Frames are not freed with index.
+ */
+static void buffer_pool_keep_frame(struct hash_map_node *node);
+
+int buffer_pool_init(struct buffer_pool *pool, const char *path, size_t page_size, int capacity)
+{
+    pool->fd = open(path, O_RDWR | O_CREAT, 0644);
+    pool->page_size = page_size;
+    pool->capacity = capacity;
+    pool->hand = 0;
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->writes = 0;
+    pool->frames = (struct buffer_pool_frame *)calloc(capacity, sizeof(struct buffer_pool_frame));
+
+    if (pool->fd < 0 || pool->frames == NULL || flat_hash_map_init(&pool->index, buffer_pool_frame_compare, buffer_pool_frame_hash) != 0)
+    {
+        if (pool->fd >= 0)
+        {
+            close(pool->fd);
+        }
+
+        free(pool->frames);
+        return -1;
+    }
+
+    for (int i = 0; i < capacity; i++)
+    {
+        pool->frames[i].data = (char *)aligned_alloc(page_size, page_size);
+
+        if (pool->frames[i].data == NULL)
+        {
+            pool->capacity = i;
+            buffer_pool_free(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void *buffer_pool_pin(struct buffer_pool *pool, unsigned long long page)
+{
+    struct buffer_pool_frame *frame = buffer_pool_find(pool, page);
+
+    if (frame != NULL)
+    {
+        pool->hits++;
+        frame->pins++;
+        frame->referenced = 1;
+        return frame->data;
+    }
+
+    frame = buffer_pool_victim(pool);
+
+    if (frame == NULL)
+    {
+        return NULL;
+    }
+
+    pool->misses++;
+
+    ssize_t size = pread(pool->fd, frame->data, pool->page_size, (off_t)(page * pool->page_size));
+
+    if (size < 0)
+    {
+        return NULL;
+    }
+
+    memset(frame->data + size, 0, pool->page_size - size);
+    frame->page = page;
+    frame->pins = 1;
+    frame->dirty = 0;
+    frame->referenced = 1;
+    frame->used = 1;
+    flat_hash_map_insert(&pool->index, &frame->core);
+    return frame->data;
+}
+
+void buffer_pool_unpin(struct buffer_pool *pool, unsigned long long page, int dirty)
+{
+    struct buffer_pool_frame *frame = buffer_pool_find(pool, page);
+
+    if (frame != NULL)
+    {
+        frame->pins--;
+        frame->dirty |= dirty;
+    }
+}
+
+int buffer_pool_flush(struct buffer_pool *pool)
+{
+    int result = 0;
+
+    for (int i = 0; i < pool->capacity; i++)
+    {
+        if (pool->frames[i].used && pool->frames[i].dirty && buffer_pool_write(pool, &pool->frames[i]) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    if (fsync(pool->fd) != 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+int buffer_pool_free(struct buffer_pool *pool)
+{
+    int result = buffer_pool_flush(pool);
+
+    for (int i = 0; i < pool->capacity; i++)
+    {
+        free(pool->frames[i].data);
+    }
+
+    flat_hash_map_free(&pool->index, buffer_pool_keep_frame);
+    free(pool->frames);
+    pool->frames = NULL;
+    pool->capacity = 0;
+
+    if (close(pool->fd) != 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+static int buffer_pool_frame_hash(struct hash_map_node *node)
+{
+    unsigned long long page = ((struct buffer_pool_frame *)node)->page;
+    return (int)((page * 0x9E3779B97F4A7C15ull) >> 33);
+}
+
+static int buffer_pool_frame_compare(struct hash_map_node *first, struct hash_map_node *second)
+{
+    unsigned long long first_page = ((struct buffer_pool_frame *)first)->page;
+    unsigned long long second_page = ((struct buffer_pool_frame *)second)->page;
+    return first_page < second_page ? -1 : first_page > second_page ? 1 : 0;
+}
+
+static struct buffer_pool_frame *buffer_pool_find(struct buffer_pool *pool, unsigned long long page)
+{
+    struct buffer_pool_frame key;
+    key.page = page;
+    return (struct buffer_pool_frame *)flat_hash_map_find(&pool->index, &key.core);
+}
+
+static struct buffer_pool_frame *buffer_pool_victim(struct buffer_pool *pool)
+{
+    /* Two turns: first turn may only clear reference bits */
+    for (int i = 0; i < pool->capacity * 2; i++)
+    {
+        struct buffer_pool_frame *frame = &pool->frames[pool->hand];
+        pool->hand = (pool->hand + 1) % pool->capacity;
+
+        if (frame->pins > 0)
+        {
+            continue;
+        }
+
+        if (frame->referenced)
+        {
+            frame->referenced = 0;
+            continue;
+        }
+
+        if (frame->used)
+        {
+            if (frame->dirty && buffer_pool_write(pool, frame) != 0)
+            {
+                continue;
+            }
+
+            flat_hash_map_delete(&pool->index, &frame->core);
+            frame->used = 0;
+        }
+
+        return frame;
+    }
+
+    return NULL;
+}
+
+static int buffer_pool_write(struct buffer_pool *pool, struct buffer_pool_frame *frame)
+{
+    off_t offset = (off_t)(frame->page * pool->page_size);
+
+    if (pwrite(pool->fd, frame->data, pool->page_size, offset) != (ssize_t)pool->page_size)
+    {
+        return -1;
+    }
+
+    frame->dirty = 0;
+    pool->writes++;
+    return 0;
+}
+
+static void buffer_pool_keep_frame(struct hash_map_node *node)
+{
+    (void)node;
+}
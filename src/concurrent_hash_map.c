@@ -0,0 +1,341 @@
+#include <concurrent_hash_map.h>
+
+/**
+ * Index of bucket for hash in table with capacity (power of two).
+ */
+static inline int concurrent_hash_map_index(int hash, int capacity);
+
+/**
+ * Compare chain node with key node. If cached hashes differ, order by hash
+ * without comparator call.
+ */
+static inline int concurrent_hash_map_compare(struct concurrent_hash_map *map,
+                                              struct hash_map_node *current,
+                                              struct hash_map_node *node,
+                                              int hash);
+
+/**
+ * Capacity of table for size by load factors, returns capacity if resize is not needed.
+ */
+static int concurrent_hash_map_target_capacity(struct concurrent_hash_map *map, int size, int capacity);
+
+/**
+ * Allocate empty table.
+ */
+static struct concurrent_hash_map_table *concurrent_hash_map_alloc_table(int capacity);
+
+/**
+ * Free table retired to epoch domain.
+ */
+static void concurrent_hash_map_free_table(void *table);
+
+/**
+ * Link node to sorted chain of table. Each link points to greater node at any moment,
+ * so concurrent readers never loop.
+ */
+static void concurrent_hash_map_link(struct concurrent_hash_map *map,
+                                     struct concurrent_hash_map_table *table,
+                                     struct hash_map_node *node);
+
+/**
+ * Lock all stripes and move items to table with capacity by load factors.
+ */
+static void concurrent_hash_map_resize(struct concurrent_hash_map *map);
+
+int concurrent_hash_map_init(
+    struct concurrent_hash_map *map,
+    int (*comparator)(struct hash_map_node *a, struct hash_map_node *b),
+    int (*hash_function)(struct hash_map_node *node),
+    struct epoch *domain)
+{
+    map->comparator = comparator;
+    map->hash_function = hash_function;
+    map->size = 0;
+    map->resize_version = 0;
+    map->max_load_factor = HASH_MAP_MAX_LOAD_FACTOR;
+    map->min_load_factor = HASH_MAP_MIN_LOAD_FACTOR;
+    map->domain = domain;
+    map->table = concurrent_hash_map_alloc_table(CONCURRENT_HASH_MAP_MIN_CAPACITY);
+
+    for (int i = 0; i < CONCURRENT_HASH_MAP_STRIPES; i++)
+    {
+        pthread_mutex_init(&map->stripes[i], NULL);
+    }
+
+    return map->table == NULL ? -1 : 0;
+}
+
+struct hash_map_node *concurrent_hash_map_insert(struct concurrent_hash_map *map, struct hash_map_node *node)
+{
+    int hash = map->hash_function(node);
+    pthread_mutex_t *stripe = &map->stripes[hash & (CONCURRENT_HASH_MAP_STRIPES - 1)];
+
+    pthread_mutex_lock(stripe);
+
+    /* Table is not replaced while any stripe is locked */
+    struct concurrent_hash_map_table *table = map->table;
+    struct hash_map_node **link = &table->buckets[concurrent_hash_map_index(hash, table->capacity)];
+    struct hash_map_node *current = *link;
+
+    node->hash = hash;
+
+    while (current != NULL)
+    {
+        int result = concurrent_hash_map_compare(map, current, node, hash);
+
+        if (result == 0)
+        {
+            /* Replaced item keeps its link, so readers standing on it continue */
+            node->next = current->next;
+            __atomic_store_n(link, node, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(stripe);
+            return current;
+        }
+
+        if (result > 0)
+        {
+            break;
+        }
+
+        link = &current->next;
+        current = current->next;
+    }
+
+    node->next = current;
+    __atomic_store_n(link, node, __ATOMIC_RELEASE);
+
+    int size = __atomic_add_fetch(&map->size, 1, __ATOMIC_RELAXED);
+    int resize = concurrent_hash_map_target_capacity(map, size, table->capacity) != table->capacity;
+
+    pthread_mutex_unlock(stripe);
+
+    if (resize)
+    {
+        concurrent_hash_map_resize(map);
+    }
+
+    return NULL;
+}
+
+struct hash_map_node *concurrent_hash_map_find(struct concurrent_hash_map *map, struct hash_map_node *node)
+{
+    int hash = map->hash_function(node);
+
+    while (1)
+    {
+        /* Chain is walked even while resize runs, found key is valid in any table */
+        unsigned long long version = __atomic_load_n(&map->resize_version, __ATOMIC_ACQUIRE);
+        struct concurrent_hash_map_table *table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+        int index = concurrent_hash_map_index(hash, table->capacity);
+        struct hash_map_node *current = __atomic_load_n(&table->buckets[index], __ATOMIC_ACQUIRE);
+
+        while (current != NULL)
+        {
+            int result = concurrent_hash_map_compare(map, current, node, hash);
+
+            if (result == 0)
+            {
+                return current;
+            }
+
+            if (result > 0)
+            {
+                break;
+            }
+
+            current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE);
+        }
+
+        /* Miss is valid only if resize did not run or relink chain under reader */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if ((version & 1) == 0 && __atomic_load_n(&map->resize_version, __ATOMIC_RELAXED) == version)
+        {
+            return NULL;
+        }
+    }
+}
+
+struct hash_map_node *concurrent_hash_map_delete(struct concurrent_hash_map *map, struct hash_map_node *node)
+{
+    int hash = map->hash_function(node);
+    pthread_mutex_t *stripe = &map->stripes[hash & (CONCURRENT_HASH_MAP_STRIPES - 1)];
+
+    pthread_mutex_lock(stripe);
+
+    struct concurrent_hash_map_table *table = map->table;
+    struct hash_map_node **link = &table->buckets[concurrent_hash_map_index(hash, table->capacity)];
+    struct hash_map_node *current = *link;
+
+    while (current != NULL)
+    {
+        int result = concurrent_hash_map_compare(map, current, node, hash);
+
+        if (result > 0)
+        {
+            break;
+        }
+
+        if (result == 0)
+        {
+            /* Deleted item keeps its link until it is retired */
+            __atomic_store_n(link, current->next, __ATOMIC_RELEASE);
+
+            int size = __atomic_sub_fetch(&map->size, 1, __ATOMIC_RELAXED);
+            int resize = concurrent_hash_map_target_capacity(map, size, table->capacity) != table->capacity;
+
+            pthread_mutex_unlock(stripe);
+
+            if (resize)
+            {
+                concurrent_hash_map_resize(map);
+            }
+
+            return current;
+        }
+
+        link = &current->next;
+        current = current->next;
+    }
+
+    pthread_mutex_unlock(stripe);
+    return NULL;
+}
+
+void concurrent_hash_map_free(struct concurrent_hash_map *map, void (*free_callback)(struct hash_map_node *))
+{
+    for (int i = 0; i < map->table->capacity; i++)
+    {
+        struct hash_map_node *current = map->table->buckets[i];
+
+        while (current != NULL)
+        {
+            struct hash_map_node *prev = current;
+            current = current->next;
+            free_callback(prev);
+        }
+    }
+
+    for (int i = 0; i < CONCURRENT_HASH_MAP_STRIPES; i++)
+    {
+        pthread_mutex_destroy(&map->stripes[i]);
+    }
+
+    free(map->table);
+    map->table = NULL;
+    map->size = 0;
+}
+
+static inline int concurrent_hash_map_index(int hash, int capacity)
+{
+    return hash & (capacity - 1);
+}
+
+static inline int concurrent_hash_map_compare(struct concurrent_hash_map *map,
+                                              struct hash_map_node *current,
+                                              struct hash_map_node *node,
+                                              int hash)
+{
+    if (current->hash != hash)
+    {
+        return current->hash < hash ? -1 : 1;
+    }
+
+    return map->comparator(current, node);
+}
+
+static int concurrent_hash_map_target_capacity(struct concurrent_hash_map *map, int size, int capacity)
+{
+    if (size > capacity * map->max_load_factor)
+    {
+        return capacity * 2;
+    }
+    else if (capacity > CONCURRENT_HASH_MAP_MIN_CAPACITY && size < capacity * map->min_load_factor)
+    {
+        return capacity / 2;
+    }
+
+    return capacity;
+}
+
+static struct concurrent_hash_map_table *concurrent_hash_map_alloc_table(int capacity)
+{
+    struct concurrent_hash_map_table *table = (struct concurrent_hash_map_table *)calloc(
+        1, sizeof(struct concurrent_hash_map_table) + sizeof(struct hash_map_node *) * capacity);
+
+    if (table != NULL)
+    {
+        table->capacity = capacity;
+    }
+
+    return table;
+}
+
+static void concurrent_hash_map_free_table(void *table)
+{
+    free(table);
+}
+
+static void concurrent_hash_map_link(struct concurrent_hash_map *map,
+                                     struct concurrent_hash_map_table *table,
+                                     struct hash_map_node *node)
+{
+    struct hash_map_node **link = &table->buckets[concurrent_hash_map_index(node->hash, table->capacity)];
+
+    while (*link != NULL && concurrent_hash_map_compare(map, *link, node, node->hash) < 0)
+    {
+        link = &(*link)->next;
+    }
+
+    __atomic_store_n(&node->next, *link, __ATOMIC_RELAXED);
+    __atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
+static void concurrent_hash_map_resize(struct concurrent_hash_map *map)
+{
+    for (int i = 0; i < CONCURRENT_HASH_MAP_STRIPES; i++)
+    {
+        pthread_mutex_lock(&map->stripes[i]);
+    }
+
+    struct concurrent_hash_map_table *old_table = map->table;
+    int capacity = concurrent_hash_map_target_capacity(map, __atomic_load_n(&map->size, __ATOMIC_RELAXED), old_table->capacity);
+    struct concurrent_hash_map_table *table = NULL;
+
+    if (capacity != old_table->capacity)
+    {
+        table = concurrent_hash_map_alloc_table(capacity);
+    }
+
+    if (table != NULL)
+    {
+        __atomic_store_n(&map->resize_version, map->resize_version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        for (int i = 0; i < old_table->capacity; i++)
+        {
+            struct hash_map_node *current = old_table->buckets[i];
+
+            while (current != NULL)
+            {
+                struct hash_map_node *next = current->next;
+                concurrent_hash_map_link(map, table, current);
+                current = next;
+            }
+        }
+
+        __atomic_store_n(&map->table, table, __ATOMIC_RELEASE);
+        __atomic_store_n(&map->resize_version, map->resize_version + 1, __ATOMIC_RELEASE);
+    }
+
+    for (int i = CONCURRENT_HASH_MAP_STRIPES - 1; i >= 0; i--)
+    {
+        pthread_mutex_unlock(&map->stripes[i]);
+    }
+
+    if (table != NULL)
+    {
+        /* Readers may still traverse old table */
+        epoch_retire(map->domain, old_table, concurrent_hash_map_free_table);
+    }
+}
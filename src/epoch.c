@@ -0,0 +1,341 @@
+#include <time.h>
+
+#include <epoch.h>
+
+/**
+ * Pointer retired at epoch may be freed when global epoch is advanced twice: threads pinned
+ * at retire moment block second advance until they unpin.
+ */
+#define EPOCH_GRACE_PERIODS 2ull
+
+/**
+ * Create retired record for pointer. Pointer must be unlinked before call.
+ */
+static struct epoch_retired *epoch_alloc_retired(struct epoch *domain, void *pointer, void (*free_callback)(void *pointer));
+
+/**
+ * Advance global epoch if all pinned threads observed it. Domain lock must be held.
+ */
+static void epoch_try_advance(struct epoch *domain);
+
+/**
+ * Detach retired pointers of list which are not readable at global epoch.
+ */
+static struct epoch_retired *epoch_collect(struct epoch_retired **list, int *count, unsigned long long global);
+
+/**
+ * Call free callbacks for detached list and count them as reclaimed by domain.
+ * Returns count of freed pointers.
+ */
+static int epoch_free_list(struct epoch *domain, struct epoch_retired *list);
+
+/**
+ * Body of background drain thread.
+ */
+static void *epoch_drain(void *context);
+
+int epoch_init(struct epoch *domain)
+{
+    domain->global = 0;
+    domain->threads = NULL;
+    domain->retired = NULL;
+    domain->retired_count = 0;
+    domain->reclaimed = 0;
+    domain->drain_interval = 0;
+    domain->draining = 0;
+
+    if (pthread_mutex_init(&domain->lock, NULL) != 0)
+    {
+        return -1;
+    }
+
+    if (pthread_cond_init(&domain->drain_cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&domain->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+int epoch_register(struct epoch *domain, struct epoch_thread *thread)
+{
+    thread->domain = domain;
+    thread->local = 0;
+    thread->retired = NULL;
+    thread->retired_count = 0;
+
+    pthread_mutex_lock(&domain->lock);
+    thread->next = domain->threads;
+    domain->threads = thread;
+    pthread_mutex_unlock(&domain->lock);
+    return 0;
+}
+
+void epoch_unregister(struct epoch_thread *thread)
+{
+    struct epoch *domain = thread->domain;
+    struct epoch_thread **current = &domain->threads;
+
+    pthread_mutex_lock(&domain->lock);
+
+    while (*current != NULL && *current != thread)
+    {
+        current = &(*current)->next;
+    }
+
+    if (*current != NULL)
+    {
+        *current = thread->next;
+    }
+
+    while (thread->retired != NULL)
+    {
+        struct epoch_retired *retired = thread->retired;
+        thread->retired = retired->next;
+        retired->next = domain->retired;
+        domain->retired = retired;
+        domain->retired_count++;
+    }
+
+    pthread_mutex_unlock(&domain->lock);
+    thread->retired_count = 0;
+    thread->next = NULL;
+    thread->domain = NULL;
+}
+
+void epoch_enter(struct epoch_thread *thread)
+{
+    unsigned long long global = __atomic_load_n(&thread->domain->global, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&thread->local, (global << 1) | 1, __ATOMIC_RELEASE);
+
+    /* Pin must be visible to reclaimer before thread reads shared pointers */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(struct epoch_thread *thread)
+{
+    __atomic_store_n(&thread->local, 0, __ATOMIC_RELEASE);
+}
+
+int epoch_retire(struct epoch *domain, void *pointer, void (*free_callback)(void *pointer))
+{
+    struct epoch_retired *retired = epoch_alloc_retired(domain, pointer, free_callback);
+
+    if (retired == NULL)
+    {
+        return -1;
+    }
+
+    struct epoch_retired *freed = NULL;
+
+    pthread_mutex_lock(&domain->lock);
+    retired->next = domain->retired;
+    domain->retired = retired;
+    domain->retired_count++;
+
+    if (domain->retired_count % EPOCH_RECLAIM_THRESHOLD == 0)
+    {
+        epoch_try_advance(domain);
+        freed = epoch_collect(&domain->retired, &domain->retired_count, domain->global);
+    }
+
+    pthread_mutex_unlock(&domain->lock);
+
+    epoch_free_list(domain, freed);
+    return 0;
+}
+
+int epoch_thread_retire(struct epoch_thread *thread, void *pointer, void (*free_callback)(void *pointer))
+{
+    struct epoch *domain = thread->domain;
+    struct epoch_retired *retired = epoch_alloc_retired(domain, pointer, free_callback);
+
+    if (retired == NULL)
+    {
+        return -1;
+    }
+
+    retired->next = thread->retired;
+    thread->retired = retired;
+    thread->retired_count++;
+
+    if (thread->retired_count % EPOCH_RECLAIM_THRESHOLD == 0)
+    {
+        pthread_mutex_lock(&domain->lock);
+        epoch_try_advance(domain);
+        pthread_mutex_unlock(&domain->lock);
+
+        unsigned long long global = __atomic_load_n(&domain->global, __ATOMIC_ACQUIRE);
+        epoch_free_list(domain, epoch_collect(&thread->retired, &thread->retired_count, global));
+    }
+
+    return 0;
+}
+
+int epoch_reclaim(struct epoch *domain)
+{
+    pthread_mutex_lock(&domain->lock);
+    epoch_try_advance(domain);
+    struct epoch_retired *freed = epoch_collect(&domain->retired, &domain->retired_count, domain->global);
+    pthread_mutex_unlock(&domain->lock);
+
+    return epoch_free_list(domain, freed);
+}
+
+int epoch_start_drain(struct epoch *domain, int interval)
+{
+    if (domain->draining || interval <= 0)
+    {
+        return -1;
+    }
+
+    domain->drain_interval = interval;
+    domain->draining = 1;
+
+    if (pthread_create(&domain->drain_thread, NULL, epoch_drain, domain) != 0)
+    {
+        domain->draining = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void epoch_stop_drain(struct epoch *domain)
+{
+    if (!domain->draining)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&domain->lock);
+    domain->draining = 0;
+    pthread_cond_signal(&domain->drain_cond);
+    pthread_mutex_unlock(&domain->lock);
+    pthread_join(domain->drain_thread, NULL);
+}
+
+void epoch_free(struct epoch *domain)
+{
+    epoch_stop_drain(domain);
+    epoch_free_list(domain, domain->retired);
+    domain->retired = NULL;
+    domain->retired_count = 0;
+    domain->threads = NULL;
+    pthread_cond_destroy(&domain->drain_cond);
+    pthread_mutex_destroy(&domain->lock);
+}
+
+static struct epoch_retired *epoch_alloc_retired(struct epoch *domain, void *pointer, void (*free_callback)(void *pointer))
+{
+    struct epoch_retired *retired = (struct epoch_retired *)malloc(sizeof(struct epoch_retired));
+
+    if (retired == NULL)
+    {
+        return NULL;
+    }
+
+    retired->pointer = pointer;
+    retired->free_callback = free_callback;
+
+    /* Pointer is unlinked before epoch is read, stale epoch only delays free */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    retired->epoch = __atomic_load_n(&domain->global, __ATOMIC_ACQUIRE);
+    return retired;
+}
+
+static void epoch_try_advance(struct epoch *domain)
+{
+    unsigned long long global = domain->global;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (struct epoch_thread *thread = domain->threads; thread != NULL; thread = thread->next)
+    {
+        unsigned long long local = __atomic_load_n(&thread->local, __ATOMIC_ACQUIRE);
+
+        if ((local & 1) != 0 && (local >> 1) != global)
+        {
+            return;
+        }
+    }
+
+    __atomic_store_n(&domain->global, global + 1, __ATOMIC_SEQ_CST);
+}
+
+static struct epoch_retired *epoch_collect(struct epoch_retired **list, int *count, unsigned long long global)
+{
+    struct epoch_retired *freed = NULL;
+    struct epoch_retired **current = list;
+
+    /* Lists are not ordered by epoch after unregistered threads move their pointers */
+    while (*current != NULL)
+    {
+        struct epoch_retired *retired = *current;
+
+        if (retired->epoch + EPOCH_GRACE_PERIODS <= global)
+        {
+            *current = retired->next;
+            retired->next = freed;
+            freed = retired;
+            (*count)--;
+        }
+        else
+        {
+            current = &retired->next;
+        }
+    }
+
+    return freed;
+}
+
+static int epoch_free_list(struct epoch *domain, struct epoch_retired *list)
+{
+    int count = 0;
+
+    while (list != NULL)
+    {
+        struct epoch_retired *next = list->next;
+        list->free_callback(list->pointer);
+        free(list);
+        list = next;
+        count++;
+    }
+
+    __atomic_fetch_add(&domain->reclaimed, count, __ATOMIC_RELAXED);
+    return count;
+}
+
+static void *epoch_drain(void *context)
+{
+    struct epoch *domain = (struct epoch *)context;
+
+    pthread_mutex_lock(&domain->lock);
+
+    while (domain->draining)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += domain->drain_interval / 1000;
+        deadline.tv_nsec += (long)(domain->drain_interval % 1000) * 1000000;
+
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&domain->drain_cond, &domain->lock, &deadline);
+
+        if (domain->draining)
+        {
+            pthread_mutex_unlock(&domain->lock);
+            epoch_reclaim(domain);
+            pthread_mutex_lock(&domain->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&domain->lock);
+    return NULL;
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <flat_hash_map.h>
+
+/**
+ * Count of control bytes compared by one instruction.
+ */
+#if defined(__AVX2__)
+#define FLAT_HASH_MAP_GROUP_SIZE 32
+#else
+#define FLAT_HASH_MAP_GROUP_SIZE 16
+#endif
+
+#define FLAT_HASH_MAP_EMPTY ((signed char)-128)
+#define FLAT_HASH_MAP_DELETED ((signed char)-2)
+
+/**
+ * Spread bits of user hash, user hash functions often return key itself.
+ */
+static inline unsigned int flat_hash_map_mix(int hash);
+
+/**
+ * 7 bits of mixed hash stored in control byte.
+ */
+static inline signed char flat_hash_map_tag(unsigned int mixed);
+
+/**
+ * Bit mask of slots in group with control byte equals tag.
+ */
+static inline unsigned int flat_hash_map_match(const signed char *group, signed char tag);
+
+/**
+ * Bit mask of empty or deleted slots in group.
+ */
+static inline unsigned int flat_hash_map_match_free(const signed char *group);
+
+/**
+ * Max count of used (full and deleted) slots for capacity.
+ */
+static inline int flat_hash_map_max_size(int capacity);
+
+/**
+ * Find slot of item with same key. If item not found returns -1. Comparator calls skipped because
+ * cached hashes differ are added to skipped (if it is not NULL, so lookup does not write map).
+ */
+static int flat_hash_map_find_slot(struct flat_hash_map *map, struct hash_map_node *node, int hash, long long *skipped);
+
+/**
+ * Find first empty or deleted slot on probe sequence of hash.
+ */
+static int flat_hash_map_find_free(struct flat_hash_map *map, unsigned int mixed);
+
+/**
+ * Put node to free slot and cache its hash.
+ */
+static void flat_hash_map_put(struct flat_hash_map *map, int slot, struct hash_map_node *node, int hash);
+
+/**
+ * Move all items to new table with capacity and drop deleted slots.
+ */
+static int flat_hash_map_rehash(struct flat_hash_map *map, int capacity);
+
+/**
+ * Allocate empty table.
+ */
+static int flat_hash_map_alloc(struct flat_hash_map *map, int capacity);
+
+int flat_hash_map_init(
+    struct flat_hash_map *map,
+    int (*comparator)(struct hash_map_node *a, struct hash_map_node *b),
+    int (*hash_function)(struct hash_map_node *node))
+{
+    map->comparator = comparator;
+    map->hash_function = hash_function;
+    map->size = 0;
+    map->skipped_comparisons = 0;
+    return flat_hash_map_alloc(map, FLAT_HASH_MAP_MIN_CAPACITY);
+}
+
+struct hash_map_node *flat_hash_map_insert(struct flat_hash_map *map, struct hash_map_node *node)
+{
+    int hash = map->hash_function(node);
+    int slot = flat_hash_map_find_slot(map, node, hash, &map->skipped_comparisons);
+
+    if (slot != -1)
+    {
+        struct hash_map_node *prev = map->slots[slot];
+        node->hash = hash;
+        map->slots[slot] = node;
+        return prev;
+    }
+
+    slot = flat_hash_map_find_free(map, flat_hash_map_mix(hash));
+
+    if (map->growth_left == 0 && map->control[slot] == FLAT_HASH_MAP_EMPTY)
+    {
+        int capacity = map->capacity;
+
+        if (map->size + 1 > flat_hash_map_max_size(capacity) / 2)
+        {
+            capacity *= 2;
+        }
+
+        if (flat_hash_map_rehash(map, capacity) != 0)
+        {
+            return NULL;
+        }
+
+        slot = flat_hash_map_find_free(map, flat_hash_map_mix(hash));
+    }
+
+    flat_hash_map_put(map, slot, node, hash);
+    return NULL;
+}
+
+struct hash_map_node *flat_hash_map_find(struct flat_hash_map *map, struct hash_map_node *node)
+{
+    int slot = flat_hash_map_find_slot(map, node, map->hash_function(node), NULL);
+    return slot == -1 ? NULL : map->slots[slot];
+}
+
+struct hash_map_node *flat_hash_map_delete(struct flat_hash_map *map, struct hash_map_node *node)
+{
+    int slot = flat_hash_map_find_slot(map, node, map->hash_function(node), &map->skipped_comparisons);
+
+    if (slot == -1)
+    {
+        return NULL;
+    }
+
+    struct hash_map_node *result = map->slots[slot];
+    const signed char *group = map->control + (slot & ~(FLAT_HASH_MAP_GROUP_SIZE - 1));
+
+    /* Probe never passes group with empty slot, so slot may become empty again */
+    if (flat_hash_map_match(group, FLAT_HASH_MAP_EMPTY) != 0)
+    {
+        map->control[slot] = FLAT_HASH_MAP_EMPTY;
+        map->growth_left++;
+    }
+    else
+    {
+        map->control[slot] = FLAT_HASH_MAP_DELETED;
+    }
+
+    map->slots[slot] = NULL;
+    map->size--;
+
+    if (map->capacity > FLAT_HASH_MAP_MIN_CAPACITY && map->size < map->capacity / 8)
+    {
+        flat_hash_map_rehash(map, map->capacity / 2);
+    }
+
+    return result;
+}
+
+void flat_hash_map_print(struct flat_hash_map *map, void (*print_node)(struct hash_map_node *node))
+{
+    for (int i = 0; i < map->capacity; i++)
+    {
+        printf("slot %d: ", i);
+
+        if (map->control[i] == FLAT_HASH_MAP_EMPTY)
+        {
+            printf("EMPTY");
+        }
+        else if (map->control[i] == FLAT_HASH_MAP_DELETED)
+        {
+            printf("DELETED");
+        }
+        else
+        {
+            print_node(map->slots[i]);
+        }
+
+        printf("\n");
+    }
+}
+
+void flat_hash_map_free(struct flat_hash_map *map, void (*free_callback)(struct hash_map_node *))
+{
+    for (int i = 0; i < map->capacity; i++)
+    {
+        if (map->control[i] >= 0)
+        {
+            free_callback(map->slots[i]);
+        }
+    }
+
+    free(map->control);
+    free(map->slots);
+    map->control = NULL;
+    map->slots = NULL;
+    map->capacity = 0;
+    map->growth_left = 0;
+    map->size = 0;
+}
+
+static inline unsigned int flat_hash_map_mix(int hash)
+{
+    unsigned int mixed = (unsigned int)hash * 0x9E3779B1u;
+    return mixed ^ (mixed >> 16);
+}
+
+static inline signed char flat_hash_map_tag(unsigned int mixed)
+{
+    return (signed char)(mixed >> 25);
+}
+
+static inline unsigned int flat_hash_map_match(const signed char *group, signed char tag)
+{
+#if defined(__AVX2__)
+    __m256i control = _mm256_load_si256((const __m256i *)group);
+    return (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(tag), control));
+#elif defined(__SSE2__)
+    __m128i control = _mm_load_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), control));
+#else
+    unsigned int mask = 0;
+
+    for (int i = 0; i < FLAT_HASH_MAP_GROUP_SIZE; i++)
+    {
+        mask |= (unsigned int)(group[i] == tag) << i;
+    }
+
+    return mask;
+#endif
+}
+
+static inline unsigned int flat_hash_map_match_free(const signed char *group)
+{
+#if defined(__AVX2__)
+    return (unsigned int)_mm256_movemask_epi8(_mm256_load_si256((const __m256i *)group));
+#elif defined(__SSE2__)
+    return (unsigned int)_mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+    unsigned int mask = 0;
+
+    for (int i = 0; i < FLAT_HASH_MAP_GROUP_SIZE; i++)
+    {
+        mask |= (unsigned int)(group[i] < 0) << i;
+    }
+
+    return mask;
+#endif
+}
+
+static inline int flat_hash_map_max_size(int capacity)
+{
+    return capacity - capacity / 8;
+}
+
+static int flat_hash_map_find_slot(struct flat_hash_map *map, struct hash_map_node *node, int hash, long long *skipped)
+{
+    unsigned int mixed = flat_hash_map_mix(hash);
+    signed char tag = flat_hash_map_tag(mixed);
+    int groups_mask = map->capacity / FLAT_HASH_MAP_GROUP_SIZE - 1;
+    int group = mixed & groups_mask;
+
+    for (int step = 1;; step++)
+    {
+        const signed char *control = map->control + group * FLAT_HASH_MAP_GROUP_SIZE;
+        unsigned int mask = flat_hash_map_match(control, tag);
+
+        while (mask != 0)
+        {
+            int slot = group * FLAT_HASH_MAP_GROUP_SIZE + __builtin_ctz(mask);
+
+            if (map->slots[slot]->hash != hash)
+            {
+                if (skipped != NULL)
+                {
+                    (*skipped)++;
+                }
+            }
+            else if (map->comparator(map->slots[slot], node) == 0)
+            {
+                return slot;
+            }
+
+            mask &= mask - 1;
+        }
+
+        if (flat_hash_map_match(control, FLAT_HASH_MAP_EMPTY) != 0)
+        {
+            return -1;
+        }
+
+        group = (group + step) & groups_mask;
+    }
+}
+
+static int flat_hash_map_find_free(struct flat_hash_map *map, unsigned int mixed)
+{
+    int groups_mask = map->capacity / FLAT_HASH_MAP_GROUP_SIZE - 1;
+    int group = mixed & groups_mask;
+
+    for (int step = 1;; step++)
+    {
+        unsigned int mask = flat_hash_map_match_free(map->control + group * FLAT_HASH_MAP_GROUP_SIZE);
+
+        if (mask != 0)
+        {
+            return group * FLAT_HASH_MAP_GROUP_SIZE + __builtin_ctz(mask);
+        }
+
+        group = (group + step) & groups_mask;
+    }
+}
+
+static void flat_hash_map_put(struct flat_hash_map *map, int slot, struct hash_map_node *node, int hash)
+{
+    if (map->control[slot] == FLAT_HASH_MAP_EMPTY)
+    {
+        map->growth_left--;
+    }
+
+    map->control[slot] = flat_hash_map_tag(flat_hash_map_mix(hash));
+    map->slots[slot] = node;
+    node->hash = hash;
+    map->size++;
+}
+
+static int flat_hash_map_alloc(struct flat_hash_map *map, int capacity)
+{
+    map->control = (signed char *)aligned_alloc(FLAT_HASH_MAP_GROUP_SIZE, capacity);
+    map->slots = (struct hash_map_node **)calloc(capacity, sizeof(struct hash_map_node *));
+
+    if (map->control == NULL || map->slots == NULL)
+    {
+        free(map->control);
+        free(map->slots);
+        return -1;
+    }
+
+    memset(map->control, FLAT_HASH_MAP_EMPTY, capacity);
+    map->capacity = capacity;
+    map->growth_left = flat_hash_map_max_size(capacity);
+    return 0;
+}
+
+static int flat_hash_map_rehash(struct flat_hash_map *map, int capacity)
+{
+    signed char *control = map->control;
+    struct hash_map_node **slots = map->slots;
+    int old_capacity = map->capacity;
+
+    if (flat_hash_map_alloc(map, capacity) != 0)
+    {
+        map->control = control;
+        map->slots = slots;
+        return -1;
+    }
+
+    map->size = 0;
+
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (control[i] >= 0)
+        {
+            int hash = slots[i]->hash;
+            flat_hash_map_put(map, flat_hash_map_find_free(map, flat_hash_map_mix(hash)), slots[i], hash);
+        }
+    }
+
+    free(control);
+    free(slots);
+    return 0;
+}
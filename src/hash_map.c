@@ -1,12 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+
 #include <hash_map.h>
 
-int hash_map_print(struct hash_map *map, void (*print_node)(struct hash_map_node *node))
+/**
+ * Index of bucket for hash in table with capacity (power of two).
+ */
+static inline int hash_map_index(int hash, int capacity);
+
+/**
+ * Compare chain node with key node. If cached hashes differ, order by hash
+ * without comparator call and count it in skipped (if it is not NULL, so lookup does not write map).
+ */
+static inline int hash_map_compare(struct hash_map *map,
+                                   struct hash_map_node *current,
+                                   struct hash_map_node *node,
+                                   int hash,
+                                   long long *skipped);
+
+/**
+ * Link node to sorted chain of table. Table must not contain node with same key.
+ */
+static void hash_map_link(struct hash_map *map,
+                          struct hash_map_node **buckets,
+                          int capacity,
+                          struct hash_map_node *node);
+
+/**
+ * Move all nodes of old bucket to current table.
+ */
+static void hash_map_migrate_bucket(struct hash_map *map, int index);
+
+/**
+ * Migrate next HASH_MAP_REHASH_STEP buckets of old table.
+ */
+static void hash_map_rehash_step(struct hash_map *map);
+
+/**
+ * Start incremental rehash to table with new capacity.
+ */
+static void hash_map_resize(struct hash_map *map, int capacity);
+
+/**
+ * Start grow or shrink if load factor is out of bounds.
+ */
+static void hash_map_check_load(struct hash_map *map);
+
+/**
+ * Find bucket for hash in current table. If bucket of old table for this hash is not
+ * migrated yet, migrate it first.
+ */
+static struct hash_map_node **hash_map_bucket(struct hash_map *map, int hash);
+
+static void hash_map_print_buckets(struct hash_map_node **buckets,
+                                   int capacity,
+                                   const char *name,
+                                   void (*print_node)(struct hash_map_node *node))
 {
-    for (int i = 0; i < 16; i++)
+    for (int i = 0; i < capacity; i++)
     {
-        printf("bucket %d: ", i);
+        printf("%s %d: ", name, i);
 
-        struct hash_map_node *current = map->buckets[i];
+        struct hash_map_node *current = buckets[i];
 
         if (current == NULL)
         {
@@ -35,7 +90,17 @@ int hash_map_print(struct hash_map *map, void (*print_node)(struct hash_map_node
     }
 }
 
-void hash_map_init(
+void hash_map_print(struct hash_map *map, void (*print_node)(struct hash_map_node *node))
+{
+    hash_map_print_buckets(map->buckets, map->capacity, "bucket", print_node);
+
+    if (map->old_buckets != NULL)
+    {
+        hash_map_print_buckets(map->old_buckets, map->old_capacity, "old bucket", print_node);
+    }
+}
+
+int hash_map_init(
     struct hash_map *map,
     int (*comparator)(struct hash_map_node *a, struct hash_map_node *b),
     int (*hash_function)(struct hash_map_node *node))
@@ -43,24 +108,48 @@ void hash_map_init(
     map->comparator = comparator;
     map->hash_function = hash_function;
     map->size = 0;
-    memset(map->buckets, 0, sizeof(struct hash_map_node *) * 16);
+    map->capacity = HASH_MAP_MIN_CAPACITY;
+    map->buckets = (struct hash_map_node **)calloc(map->capacity, sizeof(struct hash_map_node *));
+    map->old_buckets = NULL;
+    map->old_capacity = 0;
+    map->rehash_index = 0;
+    map->max_load_factor = HASH_MAP_MAX_LOAD_FACTOR;
+    map->min_load_factor = HASH_MAP_MIN_LOAD_FACTOR;
+    map->skipped_comparisons = 0;
+    return map->buckets == NULL ? -1 : 0;
+}
+
+int hash_map_set_load_factor(struct hash_map *map, float min_load_factor, float max_load_factor)
+{
+    if (max_load_factor <= 0 || min_load_factor < 0 || min_load_factor * 2 >= max_load_factor)
+    {
+        return -1;
+    }
+
+    map->min_load_factor = min_load_factor;
+    map->max_load_factor = max_load_factor;
+    return 0;
 }
 
 struct hash_map_node *hash_map_insert(
     struct hash_map *map,
     struct hash_map_node *node)
 {
+    hash_map_rehash_step(map);
 
     int hash = map->hash_function(node);
-    struct hash_map_node *current = map->buckets[hash % 16];
+    struct hash_map_node **bucket = hash_map_bucket(map, hash);
+    struct hash_map_node *current = *bucket;
     struct hash_map_node *prev = NULL;
 
     node->next = NULL;
+    node->hash = hash;
 
     if (current == NULL)
     {
         map->size++;
-        map->buckets[hash % 16] = node;
+        *bucket = node;
+        hash_map_check_load(map);
         return NULL;
     }
 
@@ -70,10 +159,11 @@ struct hash_map_node *hash_map_insert(
         {
             map->size++;
             prev->next = node;
+            hash_map_check_load(map);
             return NULL;
         }
 
-        int result = map->comparator(current, node);
+        int result = hash_map_compare(map, current, node, hash, &map->skipped_comparisons);
         if (result < 0)
         {
             prev = current;
@@ -89,9 +179,10 @@ struct hash_map_node *hash_map_insert(
             }
             else
             {
-                map->buckets[hash % 16] = node;
+                *bucket = node;
             }
             map->size++;
+            hash_map_check_load(map);
             return NULL;
         }
         else
@@ -104,7 +195,7 @@ struct hash_map_node *hash_map_insert(
             }
             else
             {
-                map->buckets[hash % 16] = node;
+                *bucket = node;
             }
             return current;
         }
@@ -115,10 +206,10 @@ struct hash_map_node *hash_map_find(
     struct hash_map *map,
     struct hash_map_node *node)
 {
-    int hash = map->hash_function(node);
-    struct hash_map_node *current = map->buckets[hash % 16];
+    hash_map_rehash_step(map);
 
-    node->next = NULL;
+    int hash = map->hash_function(node);
+    struct hash_map_node *current = *hash_map_bucket(map, hash);
 
     while (1)
     {
@@ -127,7 +218,7 @@ struct hash_map_node *hash_map_find(
             return NULL;
         }
 
-        int result = map->comparator(current, node);
+        int result = hash_map_compare(map, current, node, hash, NULL);
         if (result < 0)
         {
             current = current->next;
@@ -143,12 +234,47 @@ struct hash_map_node *hash_map_find(
     }
 }
 
+struct hash_map_node *hash_map_find_key(struct hash_map *map,
+                                        const void *key,
+                                        int hash,
+                                        int (*compare)(const void *key, struct hash_map_node *node))
+{
+    struct hash_map_node *current = map->buckets[hash_map_index(hash, map->capacity)];
+
+    /* Not migrated bucket of old table holds all its keys */
+    if (map->old_buckets != NULL && map->old_buckets[hash_map_index(hash, map->old_capacity)] != NULL)
+    {
+        current = map->old_buckets[hash_map_index(hash, map->old_capacity)];
+    }
+
+    /* Chain is sorted by hash and then by comparator, so walk stops at first greater node */
+    for (; current != NULL && current->hash <= hash; current = current->next)
+    {
+        if (current->hash < hash)
+        {
+            continue;
+        }
+
+        int result = compare(key, current);
+
+        if (result <= 0)
+        {
+            return result == 0 ? current : NULL;
+        }
+    }
+
+    return NULL;
+}
+
 struct hash_map_node *hash_map_delete(
     struct hash_map *map,
     struct hash_map_node *node)
 {
+    hash_map_rehash_step(map);
+
     int hash = map->hash_function(node);
-    struct hash_map_node *current = map->buckets[hash % 16];
+    struct hash_map_node **bucket = hash_map_bucket(map, hash);
+    struct hash_map_node *current = *bucket;
     struct hash_map_node *prev = NULL;
 
     if (current == NULL)
@@ -156,8 +282,6 @@ struct hash_map_node *hash_map_delete(
         return NULL;
     }
 
-    node->next = NULL;
-
     while (1)
     {
         if (current == NULL)
@@ -165,7 +289,7 @@ struct hash_map_node *hash_map_delete(
             return NULL;
         }
 
-        int result = map->comparator(current, node);
+        int result = hash_map_compare(map, current, node, hash, &map->skipped_comparisons);
         if (result < 0)
         {
             prev = current;
@@ -183,27 +307,186 @@ struct hash_map_node *hash_map_delete(
             }
             else
             {
-                map->buckets[hash % 16] = current->next;
+                *bucket = current->next;
             }
             map->size--;
+            hash_map_check_load(map);
             return current;
         }
     }
 }
 
-void hash_map_free(struct hash_map *map, void (*free_callback)(struct hash_map_node *))
+static void hash_map_free_buckets(struct hash_map_node **buckets,
+                                  int capacity,
+                                  void (*free_callback)(struct hash_map_node *))
 {
-    for (int i = 0; i < 16; i++)
+    for (int i = 0; i < capacity; i++)
     {
-        struct hash_map_node *current = map->buckets[i];
+        struct hash_map_node *current = buckets[i];
 
         while (current != NULL)
         {
             struct hash_map_node *prev = current;
             current = current->next;
-            free(prev);
+            free_callback(prev);
         }
 
-        map->buckets[i] = NULL;
+        buckets[i] = NULL;
     }
+
+    free(buckets);
+}
+
+void hash_map_free(struct hash_map *map, void (*free_callback)(struct hash_map_node *))
+{
+    hash_map_free_buckets(map->buckets, map->capacity, free_callback);
+
+    if (map->old_buckets != NULL)
+    {
+        hash_map_free_buckets(map->old_buckets, map->old_capacity, free_callback);
+    }
+
+    map->buckets = NULL;
+    map->old_buckets = NULL;
+    map->capacity = 0;
+    map->old_capacity = 0;
+    map->size = 0;
+}
+
+static inline int hash_map_index(int hash, int capacity)
+{
+    return hash & (capacity - 1);
+}
+
+static inline int hash_map_compare(struct hash_map *map,
+                                   struct hash_map_node *current,
+                                   struct hash_map_node *node,
+                                   int hash,
+                                   long long *skipped)
+{
+    if (current->hash != hash)
+    {
+        if (skipped != NULL)
+        {
+            (*skipped)++;
+        }
+
+        return current->hash < hash ? -1 : 1;
+    }
+
+    return map->comparator(current, node);
+}
+
+static void hash_map_link(struct hash_map *map,
+                          struct hash_map_node **buckets,
+                          int capacity,
+                          struct hash_map_node *node)
+{
+    int index = hash_map_index(node->hash, capacity);
+    struct hash_map_node *current = buckets[index];
+    struct hash_map_node *prev = NULL;
+
+    while (current != NULL && hash_map_compare(map, current, node, node->hash, NULL) < 0)
+    {
+        prev = current;
+        current = current->next;
+    }
+
+    node->next = current;
+
+    if (prev != NULL)
+    {
+        prev->next = node;
+    }
+    else
+    {
+        buckets[index] = node;
+    }
+}
+
+static void hash_map_migrate_bucket(struct hash_map *map, int index)
+{
+    struct hash_map_node *current = map->old_buckets[index];
+    map->old_buckets[index] = NULL;
+
+    while (current != NULL)
+    {
+        struct hash_map_node *next = current->next;
+        hash_map_link(map, map->buckets, map->capacity, current);
+        current = next;
+    }
+}
+
+static void hash_map_rehash_step(struct hash_map *map)
+{
+    if (map->old_buckets == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < HASH_MAP_REHASH_STEP && map->rehash_index < map->old_capacity; i++)
+    {
+        if (map->old_buckets[map->rehash_index] != NULL)
+        {
+            hash_map_migrate_bucket(map, map->rehash_index);
+        }
+
+        map->rehash_index++;
+    }
+
+    if (map->rehash_index == map->old_capacity)
+    {
+        free(map->old_buckets);
+        map->old_buckets = NULL;
+        map->old_capacity = 0;
+        map->rehash_index = 0;
+    }
+}
+
+static void hash_map_resize(struct hash_map *map, int capacity)
+{
+    struct hash_map_node **buckets = (struct hash_map_node **)calloc(capacity, sizeof(struct hash_map_node *));
+
+    if (buckets == NULL)
+    {
+        return;
+    }
+
+    map->old_buckets = map->buckets;
+    map->old_capacity = map->capacity;
+    map->rehash_index = 0;
+    map->buckets = buckets;
+    map->capacity = capacity;
+}
+
+static void hash_map_check_load(struct hash_map *map)
+{
+    if (map->old_buckets != NULL)
+    {
+        return;
+    }
+
+    if (map->size > map->capacity * map->max_load_factor)
+    {
+        hash_map_resize(map, map->capacity * 2);
+    }
+    else if (map->capacity > HASH_MAP_MIN_CAPACITY && map->size < map->capacity * map->min_load_factor)
+    {
+        hash_map_resize(map, map->capacity / 2);
+    }
+}
+
+static struct hash_map_node **hash_map_bucket(struct hash_map *map, int hash)
+{
+    if (map->old_buckets != NULL)
+    {
+        int index = hash_map_index(hash, map->old_capacity);
+
+        if (map->old_buckets[index] != NULL)
+        {
+            hash_map_migrate_bucket(map, index);
+        }
+    }
+
+    return &map->buckets[hash_map_index(hash, map->capacity)];
 }
@@ -0,0 +1,198 @@
+#include <unistd.h>
+
+#include <bp_tree_disk.h>
+
+/**
+ * Large record, so few records make several levels.
+ */
+struct test_record
+{
+    int key;
+    int value;
+    char payload[120];
+};
+
+static int record_cmp(const void *first, const void *second)
+{
+    int first_key = ((const struct test_record *)first)->key;
+    int second_key = ((const struct test_record *)second)->key;
+    return first_key < second_key ? -1 : first_key > second_key ? 1 : 0;
+}
+
+static int sum_record(const void *record, void *context)
+{
+    *(long long *)context += ((const struct test_record *)record)->key;
+    return 0;
+}
+
+static int stop_record(const void *record, void *context)
+{
+    return ++*(int *)context == 10;
+}
+
+static void disk_path(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/bp_tree_disk_test_%d", (int)getpid());
+}
+
+static struct test_record make_record(int key, int value)
+{
+    struct test_record record;
+    memset(&record, 0, sizeof(record));
+    record.key = key;
+    record.value = value;
+    return record;
+}
+
+int lookup_int_disk(struct bp_tree_disk *tree, int key)
+{
+    struct test_record record = make_record(key, 0);
+
+    if (bp_tree_disk_lookup(tree, &record, &record) != 1)
+    {
+        return -1;
+    }
+
+    return record.value;
+}
+
+int bp_tree_disk_test_1(void *unused)
+{
+    char path[64];
+    struct bp_tree_disk tree;
+    int n = 20000;
+    disk_path(path, sizeof(path));
+    unlink(path);
+
+    /* Pool is much smaller than tree */
+    assert(bp_tree_disk_open(&tree, path, sizeof(struct test_record), 16, record_cmp) == 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        int key = (i * 7919) % n;
+        struct test_record record = make_record(key * 2, key);
+        assert(bp_tree_disk_insert(&tree, &record, NULL) == 0);
+    }
+
+    assert(tree.header.size == (unsigned long long)n);
+    assert(tree.header.height >= 3);
+    assert(tree.pool.misses > 0 && tree.pool.writes > 0);
+
+    for (int i = -1; i < n * 2 + 1; i++)
+    {
+        assert(lookup_int_disk(&tree, i) == (i >= 0 && i < n * 2 && i % 2 == 0 ? i / 2 : -1));
+    }
+
+    /* Replace returns previous record */
+    struct test_record record = make_record(12, 100);
+    struct test_record previous;
+    assert(bp_tree_disk_insert(&tree, &record, &previous) == 1);
+    assert(previous.value == 6);
+    assert(lookup_int_disk(&tree, 12) == 100);
+
+    long long sum = 0;
+    assert(bp_tree_disk_range(&tree, NULL, NULL, sum_record, &sum) == n);
+    assert(sum == (long long)n * (n - 1));
+
+    struct test_record low = make_record(101, 0);
+    struct test_record high = make_record(301, 0);
+    sum = 0;
+    assert(bp_tree_disk_range(&tree, &low, &high, sum_record, &sum) == 100);
+
+    int count = 0;
+    assert(bp_tree_disk_range(&tree, &low, NULL, stop_record, &count) == 10);
+
+    assert(bp_tree_disk_close(&tree) == 0);
+
+    /* Records survive reopen */
+    assert(bp_tree_disk_open(&tree, path, sizeof(struct test_record), 16, record_cmp) == 0);
+    assert(tree.header.size == (unsigned long long)n);
+    assert(lookup_int_disk(&tree, 12) == 100);
+
+    for (int i = 0; i < n; i += 2)
+    {
+        record = make_record(i * 2, 0);
+        assert(bp_tree_disk_delete(&tree, &record, &previous) == 1);
+        assert(previous.key == i * 2);
+        assert(bp_tree_disk_delete(&tree, &record, NULL) == 0);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(lookup_int_disk(&tree, i * 2) == (i % 2 == 1 ? i : -1));
+    }
+
+    sum = 0;
+    assert(bp_tree_disk_range(&tree, NULL, NULL, sum_record, &sum) == n / 2);
+
+    unsigned long long page_count = tree.header.page_count;
+    assert(bp_tree_disk_close(&tree) == 0);
+
+    /* Delete all records, pages of removed leaves are reused */
+    assert(bp_tree_disk_open(&tree, path, sizeof(struct test_record), 16, record_cmp) == 0);
+
+    for (int i = 1; i < n; i += 2)
+    {
+        record = make_record(i * 2, 0);
+        assert(bp_tree_disk_delete(&tree, &record, NULL) == 1);
+    }
+
+    assert(tree.header.size == 0);
+    assert(tree.header.height == 1);
+    assert(bp_tree_disk_range(&tree, NULL, NULL, sum_record, &sum) == 0);
+
+    for (int i = 0; i < n / 2; i++)
+    {
+        record = make_record(i, i);
+        assert(bp_tree_disk_insert(&tree, &record, NULL) == 0);
+    }
+
+    assert(tree.header.page_count == page_count);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(lookup_int_disk(&tree, i) == (i < n / 2 ? i : -1));
+    }
+
+    assert(bp_tree_disk_close(&tree) == 0);
+    unlink(path);
+    return 0;
+}
+
+int bp_tree_disk_test_2(void *unused)
+{
+    char path[64];
+    struct bp_tree_disk tree;
+    disk_path(path, sizeof(path));
+
+    /* Not tree files are rejected */
+    FILE *file = fopen(path, "w");
+
+    for (int i = 0; i < BP_TREE_DISK_PAGE_SIZE * 2; i++)
+    {
+        fputc(i + 1, file);
+    }
+
+    fclose(file);
+    assert(bp_tree_disk_open(&tree, path, sizeof(int), 16, record_cmp) == -1);
+    unlink(path);
+
+    /* Pool must hold pages of split and record must fit three times */
+    assert(bp_tree_disk_open(&tree, path, sizeof(int), BP_TREE_DISK_MIN_POOL_PAGES - 1, record_cmp) == -1);
+    assert(bp_tree_disk_open(&tree, path, BP_TREE_DISK_PAGE_SIZE / 2, 16, record_cmp) == -1);
+
+    /* Record size is checked on reopen */
+    assert(bp_tree_disk_open(&tree, path, sizeof(struct test_record), 16, record_cmp) == 0);
+    assert(bp_tree_disk_close(&tree) == 0);
+    assert(bp_tree_disk_open(&tree, path, sizeof(int), 16, record_cmp) == -1);
+
+    unlink(path);
+    return 0;
+}
+
+int main()
+{
+    run_test(bp_tree_disk_test_1, (void *)NULL);
+    run_test(bp_tree_disk_test_2, (void *)NULL);
+    return 0;
+}
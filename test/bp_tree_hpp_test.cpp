@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <bp_tree.hpp>
+
+/**
+ * Allocator which counts live allocations in shared counter, allocators with same counter are equal.
+ */
+template <class T>
+struct counting_allocator
+{
+    using value_type = T;
+
+    explicit counting_allocator(long *live) : live(live)
+    {
+    }
+
+    template <class U>
+    counting_allocator(const counting_allocator<U> &other) : live(other.live)
+    {
+    }
+
+    T *allocate(std::size_t size)
+    {
+        ++*live;
+        return static_cast<T *>(::operator new(size * sizeof(T)));
+    }
+
+    void deallocate(T *pointer, std::size_t)
+    {
+        --*live;
+        ::operator delete(pointer);
+    }
+
+    template <class U>
+    bool operator==(const counting_allocator<U> &other) const
+    {
+        return live == other.live;
+    }
+
+    template <class U>
+    bool operator!=(const counting_allocator<U> &other) const
+    {
+        return live != other.live;
+    }
+
+    long *live;
+};
+
+using int_tree = strlib::bptree<int, int>;
+using string_tree = strlib::bptree<std::string,
+                                   std::unique_ptr<int>,
+                                   std::less<>,
+                                   counting_allocator<std::pair<const std::string, std::unique_ptr<int>>>>;
+
+int bp_tree_hpp_test_1(void *unused)
+{
+    int_tree tree(4);
+
+    assert(tree.empty() && tree.begin() == tree.end() && tree.find(1) == tree.end());
+
+    /* Keys in shuffled order */
+    for (int i = 0; i < 1000; i++)
+    {
+        int key = (i * 7919) % 1000;
+        assert(tree.insert({key, key * 2}).second);
+    }
+
+    assert(!tree.insert({5, 0}).second && tree.at(5) == 10);
+    assert(!tree.try_emplace(5, 0).second && tree[5] == 10);
+    assert(!tree.insert_or_assign(5, 11).second && tree.at(5) == 11);
+    assert(tree.size() == 1000 && tree.native()->size == 1000);
+
+    int expected = 0;
+
+    for (const auto &item : tree)
+    {
+        assert(item.first == expected);
+        expected++;
+    }
+
+    assert(expected == 1000);
+
+    for (auto current = tree.rbegin(); current != tree.rend(); ++current)
+    {
+        expected--;
+        assert(current->first == expected);
+    }
+
+    assert(expected == 0);
+    assert(tree.count(999) == 1 && tree.count(1000) == 0 && tree.contains(0) && !tree.contains(-1));
+    assert(tree.lower_bound(-5)->first == 0 && tree.upper_bound(500)->first == 501);
+    assert(tree.lower_bound(1000) == tree.end() && tree.upper_bound(999) == tree.end());
+    assert((--tree.end())->first == 999);
+
+    bool thrown = false;
+
+    try
+    {
+        tree.at(1000);
+    }
+    catch (const std::out_of_range &)
+    {
+        thrown = true;
+    }
+
+    assert(thrown);
+
+    /* Erase returns next item while leaves are merged */
+    for (auto current = tree.begin(); current != tree.end();)
+    {
+        current = current->first % 3 == 0 ? tree.erase(current) : std::next(current);
+    }
+
+    assert(tree.size() == 666);
+    assert(tree.erase(1) == 1 && tree.erase(1) == 0 && tree.erase(3) == 0);
+    assert(tree.erase(tree.lower_bound(100), tree.lower_bound(200))->first == 200);
+    assert(tree.size() == 665 - 67);
+
+    expected = 0;
+
+    for (const auto &item : tree)
+    {
+        assert(item.first % 3 != 0 && item.first != 1 && (item.first < 100 || item.first >= 200));
+        assert(item.second == (item.first == 5 ? 11 : item.first * 2));
+        expected++;
+    }
+
+    assert(expected == 665 - 67);
+
+    /* Copy is bulk loaded */
+    int_tree copy = tree;
+    assert(copy.size() == tree.size() && std::equal(copy.begin(), copy.end(), tree.begin()));
+    copy[-1] = 1;
+    assert(copy.size() == tree.size() + 1 && copy.begin()->first == -1 && tree.begin()->first == 2);
+
+    tree.clear();
+    assert(tree.empty() && tree.begin() == tree.end());
+    tree[7] = 7;
+    assert(tree.size() == 1 && tree.begin()->second == 7);
+    return 0;
+}
+
+int bp_tree_hpp_test_2(void *unused)
+{
+    long live = 0;
+
+    {
+        string_tree tree(8, counting_allocator<std::pair<const std::string, std::unique_ptr<int>>>(&live));
+
+        for (int i = 0; i < 100; i++)
+        {
+            tree.try_emplace(std::to_string(i), std::unique_ptr<int>(new int(i)));
+        }
+
+        /* Nodes of items and struct bp_tree */
+        assert(live == 101);
+
+        /* Heterogeneous lookup does not construct std::string */
+        assert(*tree.find("42")->second == 42);
+        assert(tree.find("420") == tree.end());
+        assert(tree.lower_bound("420")->first == "43");
+        assert(tree.count("7") == 1 && tree.erase("7") == 1 && tree.count("7") == 0);
+        assert(live == 100);
+
+        /* Move takes nodes */
+        string_tree moved = std::move(tree);
+        assert(tree.empty() && tree.find("42") == tree.end() && moved.size() == 99);
+        assert(*moved.at("99") == 99 && live == 100);
+
+        tree = std::move(moved);
+        assert(moved.empty() && tree.size() == 99);
+
+        tree.emplace("100", std::unique_ptr<int>(new int(100)));
+        assert(tree.upper_bound("1")->first == "10" && live == 101);
+    }
+
+    assert(live == 0);
+    return 0;
+}
+
+int main()
+{
+    run_test(bp_tree_hpp_test_1, (void *)NULL);
+    run_test(bp_tree_hpp_test_2, (void *)NULL);
+    return 0;
+}
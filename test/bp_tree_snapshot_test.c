@@ -0,0 +1,279 @@
+#include <stddef.h>
+#include <unistd.h>
+
+#include <bp_tree.h>
+#include <bp_tree_snapshot.h>
+
+struct test_node
+{
+    struct bp_tree_node core;
+    int value;
+};
+
+static void free_bp_tree_node(struct bp_tree_node *node)
+{
+    free(node);
+}
+
+static int node_cmp(struct bp_tree_node *first, struct bp_tree_node *second)
+{
+    int first_value = ((struct test_node *)first)->value;
+    int second_value = ((struct test_node *)second)->value;
+
+    if (first_value < second_value)
+    {
+        return -1;
+    }
+    else if (first_value > second_value)
+    {
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+static void encode_node(struct bp_tree_node *key, void *record)
+{
+    memcpy(record, &((struct test_node *)key)->value, sizeof(int));
+}
+
+static int record_cmp(const void *first, const void *second)
+{
+    int first_value;
+    int second_value;
+    memcpy(&first_value, first, sizeof(int));
+    memcpy(&second_value, second, sizeof(int));
+    return first_value < second_value ? -1 : first_value > second_value ? 1 : 0;
+}
+
+static int sum_record(const void *record, void *context)
+{
+    int value;
+    memcpy(&value, record, sizeof(int));
+    *(long long *)context += value;
+    return 0;
+}
+
+static void patch_header(const char *path, size_t offset, const void *value, size_t size)
+{
+    FILE *file = fopen(path, "r+b");
+    fseek(file, (long)offset, SEEK_SET);
+    fwrite(value, size, 1, file);
+    fclose(file);
+}
+
+static void snapshot_path(char *path, size_t size)
+{
+    snprintf(path, size, "/tmp/bp_tree_snapshot_test_%d", (int)getpid());
+}
+
+int lookup_int_snapshot(struct bp_tree_snapshot *snapshot, int val)
+{
+    const void *result = bp_tree_snapshot_lookup(snapshot, &val);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res;
+        memcpy(&res, result, sizeof(int));
+        return res;
+    }
+}
+
+int bp_tree_snapshot_test_1(void *unused)
+{
+    char path[64];
+    snapshot_path(path, sizeof(path));
+
+    /* Sizes cover single leaf root and several inner levels */
+    int sizes[] = {0, 1, 1020, 1021, 400000};
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        int n = sizes[s];
+        struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+        struct bp_tree_snapshot snapshot;
+        bp_tree_init(tree, 16, node_cmp);
+
+        for (int i = 0; i < n; i++)
+        {
+            struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+            node->value = i * 2;
+            bp_tree_insert(tree, &node->core);
+        }
+
+        assert(bp_tree_snapshot_write(tree, path, sizeof(int), encode_node) == 0);
+        bp_tree_free(tree, free_bp_tree_node);
+        free(tree);
+
+        assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == 0);
+        assert(snapshot.header->size == (unsigned long long)n);
+
+        for (int i = -1; i < n * 2 + 1; i++)
+        {
+            assert(lookup_int_snapshot(&snapshot, i) == (i >= 0 && i < n * 2 && i % 2 == 0 ? i : -1));
+        }
+
+        long long sum = 0;
+        assert(bp_tree_snapshot_range(&snapshot, NULL, NULL, sum_record, &sum) == n);
+        assert(sum == (long long)n * (n - 1));
+
+        int low = n / 2 - 1;
+        int high = n + 1;
+        int expected = 0;
+
+        for (int i = 0; i < n; i++)
+        {
+            expected += i * 2 >= low && i * 2 < high;
+        }
+
+        sum = 0;
+        assert(bp_tree_snapshot_range(&snapshot, &low, &high, sum_record, &sum) == expected);
+
+        bp_tree_snapshot_close(&snapshot);
+    }
+
+    unlink(path);
+    return 0;
+}
+
+int bp_tree_snapshot_test_2(void *unused)
+{
+    char path[64];
+    struct bp_tree_snapshot snapshot;
+    snapshot_path(path, sizeof(path));
+
+    /* Not snapshot files are rejected */
+    FILE *file = fopen(path, "w");
+
+    for (int i = 0; i < BP_TREE_SNAPSHOT_PAGE_SIZE * 2; i++)
+    {
+        fputc(i, file);
+    }
+
+    fclose(file);
+    assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == -1);
+
+    unlink(path);
+    assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == -1);
+
+    /* Record must fit at least two times to page */
+    struct bp_tree tree;
+    bp_tree_init(&tree, 4, node_cmp);
+    assert(bp_tree_snapshot_write(&tree, path, BP_TREE_SNAPSHOT_PAGE_SIZE, encode_node) == -1);
+
+    for (int i = 0; i < 10000; i++)
+    {
+        struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+        node->value = i;
+        bp_tree_insert(&tree, &node->core);
+    }
+
+    assert(bp_tree_snapshot_write(&tree, path, sizeof(int), encode_node) == 0);
+    bp_tree_free(&tree, free_bp_tree_node);
+    assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == 0);
+    struct bp_tree_snapshot_header header = *snapshot.header;
+    bp_tree_snapshot_close(&snapshot);
+
+    /* Page layout follows from record size, so header which does not match it is rejected */
+    unsigned long long record_sizes[] = {0, 2, 8, BP_TREE_SNAPSHOT_PAGE_SIZE};
+    unsigned int capacities[] = {0, 1, header.leaf_capacity + 1, header.inner_capacity + 1};
+    unsigned int heights[] = {0, (unsigned int)header.page_count, 1000};
+
+    for (int i = 0; i < (int)(sizeof(record_sizes) / sizeof(record_sizes[0])); i++)
+    {
+        patch_header(path, offsetof(struct bp_tree_snapshot_header, record_size), &record_sizes[i], sizeof(record_sizes[i]));
+        assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == -1);
+    }
+
+    patch_header(path, offsetof(struct bp_tree_snapshot_header, record_size), &header.record_size, sizeof(header.record_size));
+
+    for (int i = 0; i < (int)(sizeof(capacities) / sizeof(capacities[0])); i++)
+    {
+        patch_header(path, offsetof(struct bp_tree_snapshot_header, leaf_capacity), &capacities[i], sizeof(capacities[i]));
+        assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == -1);
+        patch_header(path, offsetof(struct bp_tree_snapshot_header, leaf_capacity), &header.leaf_capacity, sizeof(header.leaf_capacity));
+        patch_header(path, offsetof(struct bp_tree_snapshot_header, inner_capacity), &capacities[i], sizeof(capacities[i]));
+        assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == -1);
+        patch_header(path, offsetof(struct bp_tree_snapshot_header, inner_capacity), &header.inner_capacity, sizeof(header.inner_capacity));
+    }
+
+    for (int i = 0; i < (int)(sizeof(heights) / sizeof(heights[0])); i++)
+    {
+        patch_header(path, offsetof(struct bp_tree_snapshot_header, height), &heights[i], sizeof(heights[i]));
+        assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == -1);
+    }
+
+    patch_header(path, offsetof(struct bp_tree_snapshot_header, height), &header.height, sizeof(header.height));
+    assert(bp_tree_snapshot_open(&snapshot, path, record_cmp) == 0);
+    assert(lookup_int_snapshot(&snapshot, 9999) == 9999);
+    bp_tree_snapshot_close(&snapshot);
+    unlink(path);
+    return 0;
+}
+
+int bp_tree_snapshot_test_3(void *unused)
+{
+    char path[64];
+    char temporary[80];
+    struct bp_tree_snapshot old_snapshot;
+    struct bp_tree_snapshot new_snapshot;
+    snapshot_path(path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 16, node_cmp);
+
+    for (int i = 0; i < 100000; i++)
+    {
+        struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+        node->value = i;
+        bp_tree_insert(tree, &node->core);
+    }
+
+    assert(bp_tree_snapshot_write(tree, path, sizeof(int), encode_node) == 0);
+    assert(bp_tree_snapshot_open(&old_snapshot, path, record_cmp) == 0);
+
+    /* New snapshot is much smaller, mapped pages of old one must stay readable */
+    for (int i = 10; i < 100000; i++)
+    {
+        struct test_node key;
+        key.value = i;
+        free_bp_tree_node(bp_tree_delete(tree, &key.core));
+    }
+
+    assert(bp_tree_snapshot_write(tree, path, sizeof(int), encode_node) == 0);
+    assert(access(temporary, F_OK) != 0);
+
+    assert(old_snapshot.header->size == 100000);
+    assert(lookup_int_snapshot(&old_snapshot, 99999) == 99999);
+    assert(lookup_int_snapshot(&old_snapshot, 50000) == 50000);
+
+    long long sum = 0;
+    assert(bp_tree_snapshot_range(&old_snapshot, NULL, NULL, sum_record, &sum) == 100000);
+    assert(sum == 100000LL * 99999 / 2);
+
+    assert(bp_tree_snapshot_open(&new_snapshot, path, record_cmp) == 0);
+    assert(new_snapshot.header->size == 10);
+    assert(lookup_int_snapshot(&new_snapshot, 9) == 9 && lookup_int_snapshot(&new_snapshot, 10) == -1);
+
+    bp_tree_snapshot_close(&new_snapshot);
+    bp_tree_snapshot_close(&old_snapshot);
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    unlink(path);
+    return 0;
+}
+
+int main()
+{
+    run_test(bp_tree_snapshot_test_1, (void *)NULL);
+    run_test(bp_tree_snapshot_test_2, (void *)NULL);
+    run_test(bp_tree_snapshot_test_3, (void *)NULL);
+    return 0;
+}
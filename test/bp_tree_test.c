@@ -1,5 +1,7 @@
 #include <hash_map.h>
 #include <bp_tree.h>
+#include <bp_tree_specialize.h>
+#include <epoch.h>
 
 struct test_node
 {
@@ -7,6 +9,19 @@ struct test_node
     int value;
 };
 
+struct test_bytes_node
+{
+    struct bp_tree_node core;
+    unsigned char key[12];
+};
+
+struct test_string_node
+{
+    struct bp_tree_node core;
+    size_t size;
+    char key[48];
+};
+
 struct test_hash_node
 {
     struct hash_map_node core;
@@ -73,10 +88,63 @@ static int node_cmp(struct bp_tree_node *first, struct bp_tree_node *second)
     }
 }
 
+static long long node_prefix(struct bp_tree_node *node)
+{
+    return ((struct test_node *)node)->value;
+}
+
+static long long bytes_node_prefix(struct bp_tree_node *node)
+{
+    return bp_tree_bytes_prefix(((struct test_bytes_node *)node)->key, 12);
+}
+
+static int bytes_node_cmp(struct bp_tree_node *first, struct bp_tree_node *second)
+{
+    int cmp = memcmp(((struct test_bytes_node *)first)->key, ((struct test_bytes_node *)second)->key, 12);
+    return cmp < 0 ? -1 : cmp > 0 ? 1 : 0;
+}
+
+static struct test_bytes_node *bytes_node(int value)
+{
+    struct test_bytes_node *node = (struct test_bytes_node *)malloc(sizeof(struct test_bytes_node));
+
+    /* Same 8-byte prefix for each 1000 values, so prefixes collide */
+    memset(node->key, 0, 12);
+    node->key[6] = (unsigned char)(value / 1000 >> 8);
+    node->key[7] = (unsigned char)(value / 1000);
+    node->key[10] = (unsigned char)(value % 1000 >> 8);
+    node->key[11] = (unsigned char)(value % 1000);
+    return node;
+}
+
+/**
+ * Check that each node except root keeps minimal size which split and rebalance keep: degree / 2
+ * keys in leaf and degree / 2 children in inner node.
+ */
+static void assert_fill(struct bp_tree *tree, struct bp_tree_struct_node *node)
+{
+    if (node != tree->root)
+    {
+        assert(node->size >= (node->leaf ? tree->degree / 2 : tree->degree / 2 - 1));
+    }
+
+    assert(node->size < tree->degree);
+
+    if (!node->leaf)
+    {
+        for (int i = 0; i <= node->size; i++)
+        {
+            assert_fill(tree, ((struct bp_tree_non_leaf_node *)node)->children[i]);
+        }
+    }
+}
+
 static void assert_tree(struct bp_tree *tree)
 {
     struct bp_tree_struct_node *current = (struct bp_tree_struct_node *)tree->root;
     int level = tree->size / tree->degree;
+    assert((current->leaf ? current->size : current->count) == tree->size);
+    assert_fill(tree, current);
     while (current)
     {
         for (int i = 0; i < current->size - 1; i++)
@@ -86,6 +154,16 @@ static void assert_tree(struct bp_tree *tree)
 
         if (!current->leaf)
         {
+            int count = 0;
+
+            for (int i = 0; i <= current->size; i++)
+            {
+                struct bp_tree_struct_node *child = ((struct bp_tree_non_leaf_node *)current)->children[i];
+                count += child->leaf ? child->size : child->count;
+            }
+
+            assert(count == current->count);
+
             for (int i = 0; i < current->size; i++)
             {
                 assert(tree->comparator(current->keys[i], (((struct bp_tree_non_leaf_node *)current)->children[i])->keys[0]) >= 0);
@@ -722,6 +800,1357 @@ int bp_tree_test_10(void *unused)
     return 0;
 }
 
+int bp_tree_test_11(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 128, node_cmp);
+    int n = 100000;
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(-1 == insert_int_bp_tree(tree, (i * 7919) % n));
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == lookup_int_bp_tree(tree, i));
+    }
+
+    assert(-1 == lookup_int_bp_tree(tree, -1));
+    assert(-1 == lookup_int_bp_tree(tree, n));
+
+    for (int i = 0; i < n; i += 2)
+    {
+        assert(i == delete_int_bp_tree(tree, i));
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        assert((i % 2 == 0 ? -1 : i) == lookup_int_bp_tree(tree, i));
+    }
+
+    assert(tree->size == n / 2);
+
+    print_stat(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+int bp_tree_test_12(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    bp_tree_init(tree, 64, node_cmp);
+    assert(0 == bp_tree_set_key_mode(tree, BP_TREE_KEY_INT64, node_prefix));
+    hash_map_init(map, hash_node_cmp, hash_node_hash);
+
+    for (int i = 0; i < 200000; i++)
+    {
+        int value = rand() % 5000 - 2500;
+        int op = rand() % 3;
+
+        if (op == 0)
+        {
+            assert(lookup_int_bp_tree(tree, value) == lookup_int_hash_map(map, value));
+        }
+        else if (op == 1)
+        {
+            assert(insert_int_bp_tree(tree, value) == insert_int_hash_map(map, value));
+        }
+        else
+        {
+            assert(delete_int_bp_tree(tree, value) == delete_int_hash_map(map, value));
+        }
+    }
+
+    assert(tree->size == map->size);
+    assert(-1 == bp_tree_set_key_mode(tree, BP_TREE_KEY_POINTER, NULL));
+
+    print_stat(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    hash_map_free(map, free_hash_map_node);
+    free(tree);
+    free(map);
+    return 0;
+}
+
+int bp_tree_test_13(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 32, bytes_node_cmp);
+    assert(0 == bp_tree_set_key_mode(tree, BP_TREE_KEY_PREFIX, bytes_node_prefix));
+    int n = 20000;
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(NULL == bp_tree_insert(tree, &bytes_node((i * 7919) % n)->core));
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        struct test_bytes_node *key = bytes_node(i);
+        struct test_bytes_node *found = (struct test_bytes_node *)bp_tree_lookup(tree, &key->core);
+        assert(found != NULL && memcmp(found->key, key->key, 12) == 0);
+
+        if (i % 3 == 0)
+        {
+            free(bp_tree_delete(tree, &key->core));
+            assert(NULL == bp_tree_lookup(tree, &key->core));
+        }
+
+        free(key);
+    }
+
+    struct test_bytes_node *previous = NULL;
+    int index = 0;
+    bp_tree_for_each(tree, var, struct test_bytes_node)
+    {
+        if (previous != NULL)
+        {
+            assert(bytes_node_cmp(&previous->core, &var->core) == -1);
+        }
+
+        previous = var;
+        index++;
+    }
+
+    assert(index == tree->size);
+    assert(tree->size == n - (n + 2) / 3);
+
+    print_stat(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+struct test_bulk_input
+{
+    int next;
+    int size;
+};
+
+static struct bp_tree_node *bulk_next(void *context)
+{
+    struct test_bulk_input *input = (struct test_bulk_input *)context;
+
+    if (input->next >= input->size)
+    {
+        return NULL;
+    }
+
+    struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+    node->value = 2 * input->next++;
+    return &node->core;
+}
+
+int bp_tree_test_14(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    int n = 100000;
+    struct bp_tree_node **keys = (struct bp_tree_node **)malloc(n * sizeof(struct bp_tree_node *));
+
+    for (int i = 0; i < n; i++)
+    {
+        struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+        node->value = i;
+        keys[i] = &node->core;
+    }
+
+    /* Unsorted input is rejected */
+    bp_tree_init(tree, 64, node_cmp);
+    ((struct test_node *)keys[n / 2])->value = 0;
+    assert(-1 == bp_tree_bulk_load(tree, keys, n, 1.0f));
+    assert(tree->size == 0 && tree->leaf_slab.node_count == 1);
+    ((struct test_node *)keys[n / 2])->value = n / 2;
+
+    assert(0 == bp_tree_bulk_load(tree, keys, n, 1.0f));
+    assert(-1 == bp_tree_bulk_load(tree, keys, n, 1.0f));
+    assert(tree->size == n);
+    assert(tree->split_leaf == 0 && tree->split_non_leaf == 0);
+    assert_tree(tree);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == lookup_int_bp_tree(tree, i));
+    }
+
+    bp_tree_free(tree, free_bp_tree_node);
+
+    /* Inner nodes of each level are not underfilled */
+    for (int size = 1; size <= 300; size++)
+    {
+        for (int degree = 4; degree <= 9; degree++)
+        {
+            struct test_bulk_input small = {0, size};
+            bp_tree_init(tree, degree, node_cmp);
+            assert(0 == bp_tree_bulk_load_iterator(tree, bulk_next, &small, 0.7f));
+            assert(tree->size == size);
+            assert_tree(tree);
+            bp_tree_free(tree, free_bp_tree_node);
+        }
+    }
+
+    /* Iterator input, small degree, keys are changed after load */
+    bp_tree_init(tree, 5, node_cmp);
+    hash_map_init(map, hash_node_cmp, hash_node_hash);
+    struct test_bulk_input input = {0, n};
+    assert(0 == bp_tree_bulk_load_iterator(tree, bulk_next, &input, 0.7f));
+    assert(tree->size == n);
+    assert_tree(tree);
+
+    for (int i = 0; i < n; i++)
+    {
+        insert_int_hash_map(map, 2 * i);
+    }
+
+    for (int i = 0; i < 200000; i++)
+    {
+        int value = rand() % (2 * n + 100);
+        int op = rand() % 3;
+
+        if (op == 0)
+        {
+            assert(lookup_int_bp_tree(tree, value) == lookup_int_hash_map(map, value));
+        }
+        else if (op == 1)
+        {
+            assert(insert_int_bp_tree(tree, value) == insert_int_hash_map(map, value));
+        }
+        else
+        {
+            assert(delete_int_bp_tree(tree, value) == delete_int_hash_map(map, value));
+        }
+    }
+
+    assert(tree->size == map->size);
+
+    print_stat(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    hash_map_free(map, free_hash_map_node);
+    free(keys);
+    free(tree);
+    free(map);
+    return 0;
+}
+
+static struct bp_tree_batch *random_batch(int size, int range)
+{
+    struct bp_tree_batch *batch = (struct bp_tree_batch *)malloc(sizeof(struct bp_tree_batch));
+    batch->nodes = (struct bp_tree_node **)malloc(size * sizeof(struct bp_tree_node *));
+    batch->size = size;
+
+    for (int i = 0; i < size; i++)
+    {
+        struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+        node->value = rand() % range;
+        batch->nodes[i] = &node->core;
+    }
+
+    return batch;
+}
+
+static void free_batch(struct bp_tree_batch *batch, int free_nodes)
+{
+    for (int i = 0; free_nodes && i < batch->size; i++)
+    {
+        free(batch->nodes[i]);
+    }
+
+    free(batch->nodes);
+    free(batch);
+}
+
+int bp_tree_test_15(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    bp_tree_init(tree, 16, node_cmp);
+    hash_map_init(map, hash_node_cmp, hash_node_hash);
+    int range = 50000;
+
+    for (int round = 0; round < 40; round++)
+    {
+        int size = rand() % 10000 + 1;
+        struct bp_tree_batch *batch = random_batch(size, range);
+        struct bp_tree_batch *result = NULL;
+
+        if (round % 2 == 0)
+        {
+            int replaced = 0;
+
+            for (int i = 0; i < size; i++)
+            {
+                replaced += insert_int_hash_map(map, ((struct test_node *)batch->nodes[i])->value) != -1;
+            }
+
+            result = bp_tree_insert_batch(tree, batch);
+            assert(result->size == replaced);
+            free_batch(batch, 0);
+        }
+        else
+        {
+            int deleted = 0;
+
+            for (int i = 0; i < size; i++)
+            {
+                deleted += delete_int_hash_map(map, ((struct test_node *)batch->nodes[i])->value) != -1;
+            }
+
+            result = bp_tree_delete_batch(tree, batch);
+            assert(result->size == deleted);
+            free_batch(batch, 1);
+        }
+
+        for (int i = 1; i < result->size; i++)
+        {
+            assert(node_cmp(result->nodes[i - 1], result->nodes[i]) <= 0);
+        }
+
+        free_batch(result, 1);
+        assert(tree->size == map->size);
+        assert_tree(tree);
+    }
+
+    struct bp_tree_batch *batch = random_batch(20000, range);
+    struct bp_tree_batch *result = bp_tree_lookup_batch(tree, batch);
+    int found = 0;
+
+    for (int i = 0; i < batch->size; i++)
+    {
+        found += lookup_int_hash_map(map, ((struct test_node *)batch->nodes[i])->value) != -1;
+    }
+
+    assert(result->size == found);
+    free_batch(result, 0);
+    free_batch(batch, 1);
+
+    print_stat(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    hash_map_free(map, free_hash_map_node);
+    free(tree);
+    free(map);
+    return 0;
+}
+
+static int collect_node(struct bp_tree_node *key, void *context)
+{
+    int *values = (int *)context;
+    values[++values[0]] = ((struct test_node *)key)->value;
+    return values[0] == 100;
+}
+
+int bp_tree_test_16(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct bp_tree_cursor cursor;
+    struct test_node low;
+    struct test_node high;
+    int *values = (int *)malloc(101 * sizeof(int));
+    int n = 10000;
+
+    bp_tree_init(tree, 8, node_cmp);
+    assert(NULL == bp_tree_cursor_first(&cursor, tree));
+    assert(NULL == bp_tree_cursor_last(&cursor, tree));
+    assert(0 == bp_tree_range_count(tree, NULL, NULL));
+
+    /* Even keys from 0 to 2 * (n - 1) */
+    for (int i = 0; i < n; i++)
+    {
+        insert_int_bp_tree(tree, ((i * 7919) % n) * 2);
+    }
+
+    low.value = 501;
+    assert(502 == ((struct test_node *)bp_tree_cursor_seek(&cursor, tree, &low.core))->value);
+    assert(500 == ((struct test_node *)bp_tree_cursor_prev(&cursor))->value);
+    assert(502 == ((struct test_node *)bp_tree_cursor_next(&cursor))->value);
+    assert(504 == ((struct test_node *)bp_tree_cursor_next(&cursor))->value);
+
+    low.value = 2 * n;
+    assert(NULL == bp_tree_cursor_seek(&cursor, tree, &low.core));
+    assert(NULL == bp_tree_cursor_next(&cursor));
+
+    int expected = 0;
+    for (struct bp_tree_node *key = bp_tree_cursor_first(&cursor, tree); key != NULL; key = bp_tree_cursor_next(&cursor))
+    {
+        assert(expected == ((struct test_node *)key)->value);
+        expected += 2;
+    }
+    assert(expected == 2 * n);
+
+    for (struct bp_tree_node *key = bp_tree_cursor_last(&cursor, tree); key != NULL; key = bp_tree_cursor_prev(&cursor))
+    {
+        expected -= 2;
+        assert(expected == ((struct test_node *)key)->value);
+    }
+    assert(expected == 0);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        low.value = rand() % (2 * n + 10) - 5;
+        high.value = low.value + rand() % 300;
+        int count = 0;
+
+        for (int value = low.value; value < high.value; value++)
+        {
+            count += value >= 0 && value < 2 * n && value % 2 == 0;
+        }
+
+        assert(count == bp_tree_range_count(tree, &low.core, &high.core));
+
+        values[0] = 0;
+        int visited = bp_tree_range(tree, &low.core, &high.core, collect_node, values);
+        assert(visited == values[0] && visited == (count < 100 ? count : 100));
+
+        for (int j = 1; j <= visited; j++)
+        {
+            assert(values[j] >= low.value && values[j] < high.value && (j == 1 || values[j] == values[j - 1] + 2));
+        }
+    }
+
+    high.value = 100;
+    assert(50 == bp_tree_range_count(tree, NULL, &high.core));
+    low.value = 2 * n - 100;
+    assert(50 == bp_tree_range_count(tree, &low.core, NULL));
+    assert(n == bp_tree_range_count(tree, NULL, NULL));
+
+    bp_tree_free(tree, free_bp_tree_node);
+    free(values);
+    free(tree);
+    return 0;
+}
+
+int bp_tree_test_17(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 4, node_cmp);
+    int n = 300;
+
+    for (int i = 0; i < n; i++)
+    {
+        insert_int_bp_tree(tree, i);
+    }
+
+    /* Nested iterations over same leaves do not disturb each other */
+    long long pairs = 0;
+    int outer_index = 0;
+    bp_tree_for_each(tree, outer, struct test_node)
+    {
+        assert(outer->value == outer_index++);
+        int inner_index = 0;
+
+        bp_tree_for_each(tree, inner, struct test_node)
+        {
+            assert(inner->value == inner_index++);
+
+            if (inner->value >= outer->value)
+            {
+                break;
+            }
+
+            pairs++;
+        }
+    }
+
+    assert(outer_index == n);
+    assert(pairs == (long long)n * (n - 1) / 2);
+
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+struct test_reader
+{
+    struct bp_tree *tree;
+    int n;
+    int stop;
+    long long lookups;
+};
+
+static void *lookup_odd_keys(void *context)
+{
+    struct test_reader *reader = (struct test_reader *)context;
+    struct test_node key;
+
+    do
+    {
+        for (int i = 1; i < reader->n; i += 2)
+        {
+            key.value = i;
+            struct test_node *found = (struct test_node *)bp_tree_lookup(reader->tree, &key.core);
+            assert(found != NULL && found->value == i);
+            reader->lookups++;
+        }
+    } while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE));
+
+    return NULL;
+}
+
+int bp_tree_test_18(void *unused)
+{
+    for (int mode = 0; mode < 2; mode++)
+    {
+        struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+        bp_tree_init(tree, 6, node_cmp);
+
+        if (mode == 1)
+        {
+            bp_tree_set_key_mode(tree, BP_TREE_KEY_INT64, node_prefix);
+        }
+
+        assert(bp_tree_set_concurrent(tree, 1) == 0);
+        int n = 4000;
+
+        for (int i = 1; i < n; i += 2)
+        {
+            insert_int_bp_tree(tree, i);
+        }
+
+        struct test_reader readers[4];
+        pthread_t threads[4];
+
+        for (int i = 0; i < 4; i++)
+        {
+            readers[i].tree = tree;
+            readers[i].n = n;
+            readers[i].stop = 0;
+            readers[i].lookups = 0;
+            pthread_create(&threads[i], NULL, lookup_odd_keys, &readers[i]);
+        }
+
+        /* Even keys split and merge nodes under readers, deleted keys are freed after join */
+        struct test_node **deleted = (struct test_node **)malloc(sizeof(struct test_node *) * n * 5);
+        int deleted_size = 0;
+
+        for (int round = 0; round < 10; round++)
+        {
+            for (int i = 0; i < n; i += 2)
+            {
+                insert_int_bp_tree(tree, i);
+            }
+
+            for (int i = 0; i < n; i += 2)
+            {
+                struct test_node key = {.value = i};
+                deleted[deleted_size++] = (struct test_node *)bp_tree_delete(tree, &key.core);
+            }
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            __atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELEASE);
+            pthread_join(threads[i], NULL);
+            assert(readers[i].lookups > 0);
+        }
+
+        assert(tree->size == n / 2);
+
+        for (int i = 0; i < deleted_size; i++)
+        {
+            assert(deleted[i] != NULL);
+            free(deleted[i]);
+        }
+
+        free(deleted);
+        assert(bp_tree_set_concurrent(tree, 0) == -1);
+        bp_tree_free(tree, free_bp_tree_node);
+        free(tree);
+    }
+
+    return 0;
+}
+
+struct test_pinned_reader
+{
+    struct bp_tree *tree;
+    struct epoch *domain;
+    int n;
+    int stop;
+};
+
+static void free_retired_node(void *node)
+{
+    free(node);
+}
+
+static void *lookup_odd_keys_pinned(void *context)
+{
+    struct test_pinned_reader *reader = (struct test_pinned_reader *)context;
+    struct epoch_thread thread;
+    struct test_node key;
+
+    epoch_register(reader->domain, &thread);
+
+    do
+    {
+        for (int i = 0; i < reader->n; i++)
+        {
+            key.value = i;
+            epoch_enter(&thread);
+            struct test_node *found = (struct test_node *)bp_tree_lookup(reader->tree, &key.core);
+            assert(i % 2 == 0 || (found != NULL && found->value == i));
+            assert(found == NULL || found->value == i);
+            epoch_exit(&thread);
+        }
+    } while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE));
+
+    epoch_unregister(&thread);
+    return NULL;
+}
+
+int bp_tree_test_19(void *unused)
+{
+    struct epoch domain;
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    epoch_init(&domain);
+    epoch_start_drain(&domain, 1);
+    bp_tree_init(tree, 4, node_cmp);
+    assert(bp_tree_set_concurrent(tree, 1) == 0);
+    assert(bp_tree_set_epoch(tree, &domain) == 0);
+    int n = 2000;
+
+    for (int i = 1; i < n; i += 2)
+    {
+        insert_int_bp_tree(tree, i);
+    }
+
+    assert(bp_tree_set_epoch(tree, NULL) == -1);
+
+    struct test_pinned_reader readers[4];
+    pthread_t threads[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        readers[i].tree = tree;
+        readers[i].domain = &domain;
+        readers[i].n = n;
+        readers[i].stop = 0;
+        pthread_create(&threads[i], NULL, lookup_odd_keys_pinned, &readers[i]);
+    }
+
+    /* Deleted keys and merged nodes are freed while readers run */
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < n; i += 2)
+        {
+            insert_int_bp_tree(tree, i);
+        }
+
+        for (int i = 0; i < n; i += 2)
+        {
+            struct test_node key = {.value = i};
+            epoch_retire(&domain, bp_tree_delete(tree, &key.core), free_retired_node);
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        __atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELEASE);
+        pthread_join(threads[i], NULL);
+    }
+
+    assert(tree->size == n / 2);
+    assert(domain.reclaimed > 0);
+
+    bp_tree_free(tree, free_bp_tree_node);
+    assert(tree->reclaim == NULL);
+    epoch_free(&domain);
+    free(tree);
+    return 0;
+}
+
+static const void *string_node_bytes(struct bp_tree_node *node, size_t *size)
+{
+    *size = ((struct test_string_node *)node)->size;
+    return ((struct test_string_node *)node)->key;
+}
+
+static int string_node_cmp(struct bp_tree_node *first, struct bp_tree_node *second)
+{
+    struct test_string_node *first_node = (struct test_string_node *)first;
+    struct test_string_node *second_node = (struct test_string_node *)second;
+    size_t size = first_node->size < second_node->size ? first_node->size : second_node->size;
+    int cmp = memcmp(first_node->key, second_node->key, size);
+
+    if (cmp == 0)
+    {
+        return first_node->size < second_node->size ? -1 : first_node->size > second_node->size ? 1 : 0;
+    }
+
+    return cmp < 0 ? -1 : 1;
+}
+
+static struct test_string_node *string_node(int value)
+{
+    struct test_string_node *node = (struct test_string_node *)malloc(sizeof(struct test_string_node));
+
+    /* Long common prefix, keys have different lengths */
+    node->size = snprintf(node->key, sizeof(node->key), "https://example.com/users/%d/profile", value);
+    return node;
+}
+
+static void assert_separators(struct bp_tree *tree, struct bp_tree_struct_node *node)
+{
+    if (node->leaf)
+    {
+        return;
+    }
+
+    assert(node->skip >= 0);
+
+    for (int i = 0; i < node->size; i++)
+    {
+        struct test_string_node *first = (struct test_string_node *)node->keys[0];
+        struct test_string_node *key = (struct test_string_node *)node->keys[i];
+        assert(key->size >= (size_t)node->skip && memcmp(first->key, key->key, node->skip) == 0);
+        assert(node->prefixes[i] == bp_tree_bytes_prefix(key->key + node->skip, key->size - node->skip));
+    }
+
+    for (int i = 0; i <= node->size; i++)
+    {
+        assert_separators(tree, ((struct bp_tree_non_leaf_node *)node)->children[i]);
+    }
+}
+
+int bp_tree_test_20(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 16, string_node_cmp);
+    assert(-1 == bp_tree_set_key_mode(tree, BP_TREE_KEY_BYTES, NULL));
+    assert(0 == bp_tree_set_key_bytes(tree, string_node_bytes));
+    int n = 20000;
+
+    for (int i = 0; i < n; i += 2)
+    {
+        assert(NULL == bp_tree_insert(tree, &string_node((i * 7919) % n)->core));
+    }
+
+    /* Odd keys are inserted by batch */
+    struct bp_tree_node **nodes = (struct bp_tree_node **)malloc(n / 2 * sizeof(struct bp_tree_node *));
+    struct bp_tree_batch batch = {nodes, n / 2};
+
+    for (int i = 0; i < n / 2; i++)
+    {
+        nodes[i] = &string_node(i * 2 + 1)->core;
+    }
+
+    struct bp_tree_batch *result = bp_tree_insert_batch(tree, &batch);
+    assert(result->size == 0);
+    free(result->nodes);
+    free(result);
+
+    assert_tree(tree);
+    assert_separators(tree, tree->root);
+    assert(tree->root->skip >= (int)strlen("https://example.com/users/"));
+
+    for (int i = 0; i < n; i++)
+    {
+        struct test_string_node *key = string_node(i);
+        struct test_string_node *found = (struct test_string_node *)bp_tree_lookup(tree, &key->core);
+        assert(found != NULL && string_node_cmp(&found->core, &key->core) == 0);
+
+        if (i % 3 == 0)
+        {
+            free(bp_tree_delete(tree, &key->core));
+            assert(NULL == bp_tree_lookup(tree, &key->core));
+        }
+
+        free(key);
+    }
+
+    /* Keys out of common prefix of separators */
+    struct test_string_node *key = string_node(0);
+    key->size = 4;
+    assert(NULL == bp_tree_lookup(tree, &key->core));
+    memcpy(key->key, "zzzz", 4);
+    assert(NULL == bp_tree_lookup(tree, &key->core));
+    free(key);
+
+    for (int i = 0; i < n / 2; i++)
+    {
+        nodes[i] = &string_node(i)->core;
+    }
+
+    result = bp_tree_delete_batch(tree, &batch);
+    int result_size = result->size;
+    assert(result_size == n / 2 - (n / 2 + 2) / 3);
+    free_batch(result, 1);
+
+    for (int i = 0; i < n / 2; i++)
+    {
+        free(nodes[i]);
+    }
+
+    free(nodes);
+
+    assert_tree(tree);
+    assert_separators(tree, tree->root);
+    assert(tree->size == n - (n + 2) / 3 - result_size);
+
+    struct test_string_node *previous = NULL;
+    int index = 0;
+    bp_tree_for_each(tree, var, struct test_string_node)
+    {
+        if (previous != NULL)
+        {
+            assert(string_node_cmp(&previous->core, &var->core) == -1);
+        }
+
+        previous = var;
+        index++;
+    }
+
+    assert(index == tree->size);
+
+    print_stat(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+/**
+ * Check rank and select of each key and range counts against sorted keys.
+ */
+static void assert_ranks(struct bp_tree *tree)
+{
+    struct test_node key;
+    int index = 0;
+
+    bp_tree_for_each(tree, var, struct test_node)
+    {
+        assert(bp_tree_select(tree, index) == &var->core);
+        assert(bp_tree_rank(tree, &var->core) == index);
+
+        /* Keys less than value + 1 end at var */
+        key.value = var->value + 1;
+        assert(bp_tree_rank(tree, &key.core) == index + 1);
+        index++;
+    }
+
+    assert(index == tree->size);
+    assert(bp_tree_select(tree, -1) == NULL);
+    assert(bp_tree_select(tree, tree->size) == NULL);
+    assert(bp_tree_range_count(tree, NULL, NULL) == tree->size);
+}
+
+int bp_tree_test_21(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 8, node_cmp);
+    int range = 5000;
+
+    assert(bp_tree_select(tree, 0) == NULL);
+    assert(bp_tree_range_count(tree, NULL, NULL) == 0);
+
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 500; i++)
+        {
+            struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+            node->value = rand() % range;
+
+            if (round % 3 == 2)
+            {
+                free_bp_tree_node(bp_tree_delete(tree, &node->core));
+                free(node);
+            }
+            else
+            {
+                free_bp_tree_node(bp_tree_insert(tree, &node->core));
+            }
+        }
+
+        struct bp_tree_batch *batch = random_batch(rand() % 1000 + 1, range);
+        struct bp_tree_batch *result = NULL;
+
+        if (round % 2 == 0)
+        {
+            result = bp_tree_insert_batch(tree, batch);
+            free_batch(batch, 0);
+        }
+        else
+        {
+            result = bp_tree_delete_batch(tree, batch);
+            free_batch(batch, 1);
+        }
+
+        free_batch(result, 1);
+        assert_tree(tree);
+        assert_ranks(tree);
+    }
+
+    /* Count of range is difference of ranks */
+    for (int i = 0; i < 1000; i++)
+    {
+        struct test_node low;
+        struct test_node high;
+        low.value = rand() % range;
+        high.value = rand() % range;
+        int expected = 0;
+
+        bp_tree_for_each(tree, var, struct test_node)
+        {
+            expected += var->value >= low.value && var->value < high.value;
+        }
+
+        assert(bp_tree_range_count(tree, &low.core, &high.core) == expected);
+    }
+
+    bp_tree_free(tree, free_bp_tree_node);
+
+    /* Counts of bulk loaded tree */
+    int n = 10000;
+    struct test_bulk_input input = {0, n};
+    bp_tree_init(tree, 8, node_cmp);
+    assert(bp_tree_bulk_load_iterator(tree, bulk_next, &input, 0.7f) == 0);
+    assert_tree(tree);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(((struct test_node *)bp_tree_select(tree, i))->value == i * 2);
+    }
+
+    struct test_node key;
+    key.value = n;
+    assert(bp_tree_rank(tree, &key.core) == n / 2);
+    key.value = n + 1;
+    assert(bp_tree_rank(tree, &key.core) == n / 2 + 1);
+
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+static int freed_keys = 0;
+
+static struct test_node *int_node(int value)
+{
+    struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+    node->value = value;
+    return node;
+}
+
+static void count_freed_node(struct bp_tree_node *node)
+{
+    freed_keys++;
+    free(node);
+}
+
+int bp_tree_test_22(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    bp_tree_init(tree, 8, node_cmp);
+    bp_tree_set_concurrent(tree, 1);
+    int n = 50000;
+
+    for (int i = 0; i < n; i++)
+    {
+        free_bp_tree_node(bp_tree_insert(tree, &int_node(i)->core));
+    }
+
+    /* Clear keeps node memory for next inserts */
+    int chunk_count = tree->leaf_slab.chunk_count + tree->non_leaf_slab.chunk_count;
+    freed_keys = 0;
+    assert(bp_tree_clear(tree, count_freed_node) == 0);
+    assert(freed_keys == n);
+    assert(tree->size == 0);
+    assert(tree->leaf_slab.node_count == 1 && tree->non_leaf_slab.node_count == 0);
+    assert(bp_tree_min_key(tree) == NULL);
+
+    for (int i = 0; i < n; i++)
+    {
+        free_bp_tree_node(bp_tree_insert(tree, &int_node(i + 1)->core));
+    }
+
+    assert(tree->leaf_slab.chunk_count + tree->non_leaf_slab.chunk_count == chunk_count);
+    assert_tree(tree);
+    assert(lookup_int_bp_tree(tree, 1) == 1 && lookup_int_bp_tree(tree, 0) == -1);
+
+    /* Free by background thread, tree can be initialized again at once */
+    pthread_t thread;
+    freed_keys = 0;
+    assert(bp_tree_free_async(tree, count_freed_node, &thread) == 0);
+    bp_tree_init(tree, 8, node_cmp);
+    free_bp_tree_node(bp_tree_insert(tree, &int_node(1)->core));
+    pthread_join(thread, NULL);
+    assert(freed_keys == n);
+
+    freed_keys = 0;
+    bp_tree_free(tree, count_freed_node);
+    assert(freed_keys == 1);
+
+    /* Retired nodes are released by background thread, caller stays pinned while it runs */
+    struct epoch domain;
+    struct epoch_thread pinned;
+    epoch_init(&domain);
+    epoch_register(&domain, &pinned);
+    bp_tree_init(tree, 4, node_cmp);
+    assert(bp_tree_set_concurrent(tree, 1) == 0);
+    assert(bp_tree_set_epoch(tree, &domain) == 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        free_bp_tree_node(bp_tree_insert(tree, &int_node(i)->core));
+    }
+
+    epoch_enter(&pinned);
+
+    for (int i = 0; i < n; i += 2)
+    {
+        struct test_node key = {.value = i};
+        epoch_retire(&domain, bp_tree_delete(tree, &key.core), free_retired_node);
+    }
+
+    freed_keys = 0;
+    assert(bp_tree_free_async(tree, count_freed_node, &thread) == 0);
+    assert(tree->reclaim == NULL && tree->domain == NULL);
+    bp_tree_init(tree, 4, node_cmp);
+    epoch_exit(&pinned);
+    pthread_join(thread, NULL);
+    assert(freed_keys == n / 2);
+
+    bp_tree_free(tree, count_freed_node);
+    epoch_unregister(&pinned);
+    epoch_free(&domain);
+    free(tree);
+    return 0;
+}
+
+int bp_tree_test_23(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct bp_tree_stats stats;
+    struct test_node key;
+    int n = 20000;
+
+    bp_tree_init(tree, 16, node_cmp);
+    assert(bp_tree_set_stats(tree, BP_TREE_STATS_ON | BP_TREE_STATS_HARDWARE) == 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        free_bp_tree_node(bp_tree_insert(tree, &int_node((i * 7919) % n)->core));
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        key.value = i * 2;
+        assert((bp_tree_lookup(tree, &key.core) != NULL) == (i * 2 < n));
+    }
+
+    for (int i = 0; i < n; i += 2)
+    {
+        key.value = i;
+        free_bp_tree_node(bp_tree_delete(tree, &key.core));
+    }
+
+    assert(bp_tree_get_stats(tree, &stats) == 0);
+    assert(stats.inserts.count == n && stats.lookups.count == n && stats.deletes.count == n / 2);
+    assert(stats.size == n / 2 && stats.height >= 3);
+
+    /* Each descent visits height nodes, binary search calls comparator at least once per node */
+    assert(stats.lookups.nodes == (long long)n * stats.height);
+    assert(stats.lookups.comparisons >= stats.lookups.nodes);
+    assert(stats.inserts.comparisons > 0 && stats.deletes.comparisons > 0);
+    assert(stats.hardware ? stats.lookups.measured == n : stats.lookups.measured == 0 && stats.lookups.cycles == 0);
+
+    int leaves = 0;
+    int non_leaves = 0;
+
+    for (int i = 0; i < BP_TREE_STATS_FILL_BUCKETS; i++)
+    {
+        leaves += stats.leaf_fill[i];
+        non_leaves += stats.non_leaf_fill[i];
+    }
+
+    assert(leaves == stats.leaf_count && non_leaves == stats.non_leaf_count);
+    assert(stats.leaf_count == tree->leaf_slab.node_count && stats.non_leaf_count == tree->non_leaf_slab.node_count);
+    assert(stats.split_leaf == tree->split_leaf);
+
+    /* Disabled instrumentation keeps only structure */
+    assert(bp_tree_set_stats(tree, 0) == 0);
+    key.value = 1;
+    assert(bp_tree_lookup(tree, &key.core) != NULL);
+    assert(bp_tree_get_stats(tree, &stats) == 0);
+    assert(stats.lookups.count == 0 && stats.leaf_count == leaves);
+
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+static inline int test_node_compare(const struct test_node *first, const struct test_node *second)
+{
+    return first->value < second->value ? -1 : first->value > second->value ? 1 : 0;
+}
+
+BP_TREE_SPECIALIZE(test_tree, struct test_node, core, test_node_compare)
+
+int bp_tree_test_24(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct bp_tree_cursor cursor;
+    struct test_node key;
+    int n = 30000;
+
+    test_tree_init(tree, 16);
+
+    for (int i = 0; i < n; i++)
+    {
+        free(test_tree_insert(tree, int_node(((i * 7919) % n) * 2)));
+    }
+
+    for (int i = 0; i < n; i += 3)
+    {
+        key.value = i * 2;
+        free(test_tree_delete(tree, &key));
+    }
+
+    /* Specialized and generic functions agree */
+    for (int i = -1; i < n * 2 + 1; i++)
+    {
+        key.value = i;
+        struct test_node *found = test_tree_lookup(tree, &key);
+        assert((struct bp_tree_node *)found == bp_tree_lookup(tree, &key.core));
+        assert(found == NULL ? i % 2 != 0 || i < 0 || i >= n * 2 || (i / 2) % 3 == 0 : found->value == i);
+
+        struct test_node *next = test_tree_seek(&cursor, tree, &key);
+        struct bp_tree_cursor generic;
+        assert((struct bp_tree_node *)next == (next == NULL ? NULL : bp_tree_cursor_seek(&generic, tree, &key.core)));
+        assert(next != NULL || bp_tree_cursor_seek(&generic, tree, &key.core) == NULL);
+    }
+
+    /* Cursor set by specialized seek is moved by generic functions */
+    key.value = 1;
+    int count = 0;
+
+    for (struct test_node *node = test_tree_seek(&cursor, tree, &key); node != NULL; node = (struct test_node *)bp_tree_cursor_next(&cursor))
+    {
+        count++;
+    }
+
+    assert(count == tree->size);
+
+    /* Concurrent tree uses generic lookup */
+    bp_tree_free(tree, free_bp_tree_node);
+    test_tree_init(tree, 16);
+    bp_tree_set_concurrent(tree, 1);
+    free(test_tree_insert(tree, int_node(5)));
+    key.value = 5;
+    assert(test_tree_lookup(tree, &key)->value == 5);
+    assert(test_tree_seek(&cursor, tree, &key)->value == 5);
+
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+static int int_key_cmp(const void *key, struct bp_tree_node *node)
+{
+    int key_value = *(const int *)key;
+    int node_value = ((struct test_node *)node)->value;
+    return key_value < node_value ? -1 : key_value > node_value ? 1 : 0;
+}
+
+static int string_key_cmp(const void *key, struct bp_tree_node *node)
+{
+    struct test_string_node *string = (struct test_string_node *)node;
+    size_t key_size = strlen((const char *)key);
+    int cmp = memcmp(key, string->key, key_size < string->size ? key_size : string->size);
+
+    if (cmp == 0)
+    {
+        return key_size < string->size ? -1 : key_size > string->size ? 1 : 0;
+    }
+
+    return cmp < 0 ? -1 : 1;
+}
+
+int bp_tree_test_25(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct bp_tree_stats stats;
+    struct test_node key;
+    int n = 20000;
+
+    /* Pointer keys, inline keys, concurrent mode */
+    for (int mode = 0; mode < 3; mode++)
+    {
+        bp_tree_init(tree, 8, node_cmp);
+
+        if (mode > 0)
+        {
+            assert(0 == bp_tree_set_key_mode(tree, BP_TREE_KEY_INT64, node_prefix));
+        }
+
+        bp_tree_set_concurrent(tree, mode == 2);
+
+        for (int i = 0; i < n; i++)
+        {
+            free(bp_tree_insert(tree, &int_node(((i * 7919) % n) * 2)->core));
+        }
+
+        for (int i = 0; i < n; i += 3)
+        {
+            key.value = i * 2;
+            free(bp_tree_delete(tree, &key.core));
+        }
+
+        for (int i = -1; i < n * 2 + 1; i++)
+        {
+            key.value = i;
+            struct test_node *found = (struct test_node *)bp_tree_lookup_key(tree, &i, int_key_cmp);
+            assert((struct bp_tree_node *)found == bp_tree_lookup(tree, &key.core));
+            assert(found == NULL ? i % 2 != 0 || i < 0 || i >= n * 2 || (i / 2) % 3 == 0 : found->value == i);
+        }
+
+        bp_tree_free(tree, free_bp_tree_node);
+    }
+
+    /* Lookups by key are measured */
+    bp_tree_init(tree, 8, node_cmp);
+    assert(bp_tree_set_stats(tree, BP_TREE_STATS_ON) == 0);
+
+    for (int i = 0; i < 100; i++)
+    {
+        free(bp_tree_insert(tree, &int_node(i)->core));
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        assert(((struct test_node *)bp_tree_lookup_key(tree, &i, int_key_cmp))->value == i);
+    }
+
+    assert(bp_tree_get_stats(tree, &stats) == 0);
+    assert(stats.lookups.count == 100 && stats.lookups.comparisons > 0 && stats.lookups.nodes >= 100 * stats.height);
+    bp_tree_free(tree, free_bp_tree_node);
+
+    /* Binary keys: separators with common prefix are compared by raw comparator */
+    bp_tree_init(tree, 16, string_node_cmp);
+    assert(0 == bp_tree_set_key_bytes(tree, string_node_bytes));
+
+    for (int i = 0; i < n; i += 2)
+    {
+        assert(NULL == bp_tree_insert(tree, &string_node((i * 7919) % n)->core));
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        char raw[48];
+        snprintf(raw, sizeof(raw), "https://example.com/users/%d/profile", i);
+        struct test_string_node *found = (struct test_string_node *)bp_tree_lookup_key(tree, raw, string_key_cmp);
+        assert(i % 2 == 0 ? found != NULL && strcmp(found->key, raw) == 0 : found == NULL);
+    }
+
+    assert(NULL == bp_tree_lookup_key(tree, "https://example.com/", string_key_cmp));
+    assert(NULL == bp_tree_lookup_key(tree, "z", string_key_cmp));
+
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+int bp_tree_test_26(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    struct bp_tree_node *previous;
+    struct test_node key;
+    bp_tree_init(tree, 8, node_cmp);
+    bp_tree_set_concurrent(tree, 1);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        assert(bp_tree_try_insert(tree, &int_node(i)->core, &previous) == 0 && previous == NULL);
+    }
+
+    /* Same key again is replaced, node inserted again is returned as previous key */
+    struct test_node *node = int_node(500);
+    assert(bp_tree_try_insert(tree, &node->core, &previous) == 0);
+    assert(((struct test_node *)previous)->value == 500 && previous != &node->core);
+    free(previous);
+    assert(bp_tree_try_insert(tree, &node->core, &previous) == 0 && previous == &node->core);
+
+    for (int i = 0; i < 1000; i += 2)
+    {
+        key.value = i;
+        assert(bp_tree_try_delete(tree, &key.core, &previous) == 0);
+        assert(((struct test_node *)previous)->value == i);
+        free(previous);
+        assert(bp_tree_try_delete(tree, &key.core, &previous) == 0 && previous == NULL);
+    }
+
+    assert(tree->size == 500 && tree->touched_size == 0);
+    assert_tree(tree);
+    bp_tree_free(tree, free_bp_tree_node);
+    free(tree);
+    return 0;
+}
+
+static void assert_slab(struct bp_tree_slab *slab)
+{
+    assert(slab->block_size % BP_TREE_CACHE_LINE == 0);
+    assert(slab->node_count + slab->free_count <= slab->chunk_count * BP_TREE_SLAB_CHUNK_NODES);
+}
+
+int bp_tree_test_27(void *unused)
+{
+    struct bp_tree *tree = (struct bp_tree *)malloc(sizeof(struct bp_tree));
+    assert(bp_tree_init(tree, 128, node_cmp) == 0);
+    assert(tree->leaf_slab.node_count == 1 && tree->leaf_slab.chunk_count == 1);
+    assert(tree->non_leaf_slab.chunk_count == 0);
+    int n = 100000;
+
+    for (int i = 0; i < n; i++)
+    {
+        insert_int_bp_tree(tree, (i * 7919) % n);
+    }
+
+    for (int i = 0; i < n; i += 2)
+    {
+        delete_int_bp_tree(tree, i);
+    }
+
+    /* Nodes are aligned blocks of chunks, merged nodes are kept in free list for reuse */
+    for (struct bp_tree_struct_node *first = tree->root; first != NULL;)
+    {
+        for (struct bp_tree_struct_node *node = first; node != NULL; node = node->right)
+        {
+            assert((size_t)node % BP_TREE_CACHE_LINE == 0);
+        }
+
+        first = first->leaf ? NULL : ((struct bp_tree_non_leaf_node *)first)->children[0];
+    }
+
+    assert(tree->leaf_slab.free_count > 0);
+    assert_slab(&tree->leaf_slab);
+    assert_slab(&tree->non_leaf_slab);
+
+    /* Freed blocks are taken before new chunk is allocated */
+    int chunk_count = tree->leaf_slab.chunk_count;
+    int free_count = tree->leaf_slab.free_count;
+    int node_count = tree->leaf_slab.node_count;
+
+    for (int i = 0; i < n; i += 2)
+    {
+        insert_int_bp_tree(tree, i);
+
+        if (tree->leaf_slab.node_count - node_count < free_count)
+        {
+            assert(tree->leaf_slab.chunk_count == chunk_count);
+        }
+    }
+
+    assert_slab(&tree->leaf_slab);
+    assert_slab(&tree->non_leaf_slab);
+    assert_tree(tree);
+
+    bp_tree_free(tree, free_bp_tree_node);
+    assert(tree->leaf_slab.chunk_count == 0 && tree->non_leaf_slab.chunk_count == 0);
+    free(tree);
+    return 0;
+}
+
 int main()
 {
     run_test(bp_tree_test_1, (void *)NULL);
@@ -734,5 +2163,22 @@ int main()
     run_test(bp_tree_test_8, (void *)NULL);
     run_test(bp_tree_test_9, (void *)NULL);
     run_test(bp_tree_test_10, (void *)NULL);
+    run_test(bp_tree_test_11, (void *)NULL);
+    run_test(bp_tree_test_12, (void *)NULL);
+    run_test(bp_tree_test_13, (void *)NULL);
+    run_test(bp_tree_test_14, (void *)NULL);
+    run_test(bp_tree_test_15, (void *)NULL);
+    run_test(bp_tree_test_16, (void *)NULL);
+    run_test(bp_tree_test_17, (void *)NULL);
+    run_test(bp_tree_test_18, (void *)NULL);
+    run_test(bp_tree_test_19, (void *)NULL);
+    run_test(bp_tree_test_20, (void *)NULL);
+    run_test(bp_tree_test_21, (void *)NULL);
+    run_test(bp_tree_test_22, (void *)NULL);
+    run_test(bp_tree_test_23, (void *)NULL);
+    run_test(bp_tree_test_24, (void *)NULL);
+    run_test(bp_tree_test_25, (void *)NULL);
+    run_test(bp_tree_test_26, (void *)NULL);
+    run_test(bp_tree_test_27, (void *)NULL);
     return 0;
 }
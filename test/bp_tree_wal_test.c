@@ -0,0 +1,394 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <bp_tree.h>
+#include <bp_tree_snapshot.h>
+#include <bp_tree_wal.h>
+
+struct test_node
+{
+    struct bp_tree_node core;
+    int value;
+};
+
+struct writer_context
+{
+    struct bp_tree *tree;
+    int first;
+    int count;
+};
+
+static void free_bp_tree_node(struct bp_tree_node *node)
+{
+    free(node);
+}
+
+static int node_cmp(struct bp_tree_node *first, struct bp_tree_node *second)
+{
+    int first_value = ((struct test_node *)first)->value;
+    int second_value = ((struct test_node *)second)->value;
+    return first_value < second_value ? -1 : first_value > second_value ? 1 : 0;
+}
+
+static void encode_node(struct bp_tree_node *key, void *record)
+{
+    memcpy(record, &((struct test_node *)key)->value, sizeof(int));
+}
+
+static struct bp_tree_node *decode_node(const void *record)
+{
+    struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+    memcpy(&node->value, record, sizeof(int));
+    return &node->core;
+}
+
+static struct test_node *new_node(int value)
+{
+    struct test_node *node = (struct test_node *)malloc(sizeof(struct test_node));
+    node->value = value;
+    return node;
+}
+
+static void test_paths(char *wal_path, char *snapshot_path, size_t size)
+{
+    snprintf(wal_path, size, "/tmp/bp_tree_wal_test_%d.wal", (int)getpid());
+    snprintf(snapshot_path, size, "/tmp/bp_tree_wal_test_%d.snapshot", (int)getpid());
+    unlink(wal_path);
+    unlink(snapshot_path);
+}
+
+static void *insert_keys(void *context)
+{
+    struct writer_context *writer = (struct writer_context *)context;
+
+    for (int i = writer->first; i < writer->first + writer->count; i++)
+    {
+        bp_tree_insert(writer->tree, &new_node(i)->core);
+    }
+
+    return NULL;
+}
+
+/**
+ * Check that recovered tree contains same keys as tree.
+ */
+static void assert_same_keys(struct bp_tree *tree, struct bp_tree *recovered)
+{
+    assert(tree->size == recovered->size);
+
+    struct bp_tree_cursor cursor;
+    struct bp_tree_node *key = bp_tree_cursor_first(&cursor, tree);
+
+    bp_tree_for_each(recovered, node, struct test_node)
+    {
+        assert(key != NULL && ((struct test_node *)key)->value == node->value);
+        key = bp_tree_cursor_next(&cursor);
+    }
+
+    assert(key == NULL);
+}
+
+int bp_tree_wal_test_1(void *unused)
+{
+    char wal_path[64];
+    char snapshot_path[64];
+    struct bp_tree tree;
+    struct bp_tree recovered;
+    struct bp_tree_wal wal;
+    test_paths(wal_path, snapshot_path, sizeof(wal_path));
+
+    bp_tree_init(&tree, 8, node_cmp);
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    bp_tree_set_wal(&tree, &wal);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        free_bp_tree_node(bp_tree_insert(&tree, &new_node(i % 700)->core));
+    }
+
+    for (int i = 0; i < 700; i += 3)
+    {
+        struct test_node key;
+        key.value = i;
+        free_bp_tree_node(bp_tree_delete(&tree, &key.core));
+    }
+
+    /* Batch is committed by one sync */
+    struct bp_tree_node *nodes[500];
+    struct bp_tree_batch batch = {nodes, 500};
+
+    for (int i = 0; i < 500; i++)
+    {
+        nodes[i] = &new_node(500 + i)->core;
+    }
+
+    long long syncs = wal.syncs;
+    struct bp_tree_batch *replaced = bp_tree_insert_batch(&tree, &batch);
+
+    for (int i = 0; i < replaced->size; i++)
+    {
+        free_bp_tree_node(replaced->nodes[i]);
+    }
+
+    free(replaced->nodes);
+    free(replaced);
+    assert(wal.syncs == syncs + 1);
+    assert(wal.durable == wal.appended);
+    assert(bp_tree_wal_close(&wal) == 0);
+
+    /* Recover from log only */
+    bp_tree_init(&recovered, 8, node_cmp);
+    assert(bp_tree_wal_replay(&recovered, snapshot_path, wal_path, sizeof(int), decode_node, free_bp_tree_node) == 1000 + 234 + 500);
+    assert_same_keys(&tree, &recovered);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    /* Snapshot, truncate and log more changes */
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    assert(bp_tree_snapshot_write(&tree, snapshot_path, sizeof(int), encode_node) == 0);
+    assert(bp_tree_wal_truncate(&wal) == 0);
+
+    for (int i = 0; i < 100; i++)
+    {
+        struct test_node key;
+        key.value = i * 5;
+        free_bp_tree_node(bp_tree_delete(&tree, &key.core));
+        free_bp_tree_node(bp_tree_insert(&tree, &new_node(2000 + i)->core));
+    }
+
+    assert(bp_tree_wal_close(&wal) == 0);
+
+    /* Torn tail is ignored and cut */
+    int fd = open(wal_path, O_WRONLY | O_APPEND);
+    assert(write(fd, "torn", 4) == 4);
+    close(fd);
+
+    bp_tree_init(&recovered, 8, node_cmp);
+    int applied = bp_tree_wal_replay(&recovered, snapshot_path, wal_path, sizeof(int), decode_node, free_bp_tree_node);
+    assert(applied > 100 && applied <= 200);
+    assert_same_keys(&tree, &recovered);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    /* Log can be appended after replay */
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    free_bp_tree_node(bp_tree_insert(&tree, &new_node(5000)->core));
+    assert(bp_tree_wal_close(&wal) == 0);
+
+    bp_tree_init(&recovered, 8, node_cmp);
+    assert(bp_tree_wal_replay(&recovered, snapshot_path, wal_path, sizeof(int), decode_node, free_bp_tree_node) == applied + 1);
+    assert_same_keys(&tree, &recovered);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    bp_tree_free(&tree, free_bp_tree_node);
+    unlink(wal_path);
+    unlink(snapshot_path);
+    return 0;
+}
+
+int bp_tree_wal_test_2(void *unused)
+{
+    char wal_path[64];
+    char snapshot_path[64];
+    struct bp_tree tree;
+    struct bp_tree recovered;
+    struct bp_tree_wal wal;
+    pthread_t threads[8];
+    struct writer_context writers[8];
+    int count = 200;
+    test_paths(wal_path, snapshot_path, sizeof(wal_path));
+
+    /* Concurrent writers share syncs */
+    bp_tree_init(&tree, 16, node_cmp);
+    bp_tree_set_concurrent(&tree, 1);
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    bp_tree_set_wal(&tree, &wal);
+
+    for (int i = 0; i < 8; i++)
+    {
+        writers[i].tree = &tree;
+        writers[i].first = i * count;
+        writers[i].count = count;
+        pthread_create(&threads[i], NULL, insert_keys, &writers[i]);
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    assert(wal.durable == (unsigned long long)(8 * count));
+    assert(wal.syncs < 8 * count);
+    assert(bp_tree_wal_close(&wal) == 0);
+
+    bp_tree_init(&recovered, 16, node_cmp);
+    assert(bp_tree_wal_replay(&recovered, NULL, wal_path, sizeof(int), decode_node, free_bp_tree_node) == 8 * count);
+    assert_same_keys(&tree, &recovered);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    /* Log of other record size is rejected */
+    bp_tree_init(&recovered, 16, node_cmp);
+    assert(bp_tree_wal_replay(&recovered, NULL, wal_path, sizeof(long long), decode_node, free_bp_tree_node) == -1);
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(long long), encode_node) == -1);
+
+    /* Missing log is empty */
+    unlink(wal_path);
+    assert(bp_tree_wal_replay(&recovered, NULL, wal_path, sizeof(int), decode_node, free_bp_tree_node) == 0);
+    assert(recovered.size == 0);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    bp_tree_free(&tree, free_bp_tree_node);
+    return 0;
+}
+
+int bp_tree_wal_test_3(void *unused)
+{
+    char wal_path[64];
+    char snapshot_path[64];
+    char temporary_path[80];
+    struct bp_tree tree;
+    struct bp_tree recovered;
+    struct bp_tree_wal wal;
+    test_paths(wal_path, snapshot_path, sizeof(wal_path));
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", snapshot_path);
+
+    bp_tree_init(&tree, 8, node_cmp);
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    bp_tree_set_wal(&tree, &wal);
+
+    for (int i = 0; i < 3000; i++)
+    {
+        free_bp_tree_node(bp_tree_insert(&tree, &new_node(i)->core));
+    }
+
+    assert(bp_tree_snapshot_write(&tree, snapshot_path, sizeof(int), encode_node) == 0);
+    assert(bp_tree_wal_truncate(&wal) == 0);
+
+    for (int i = 0; i < 3000; i += 2)
+    {
+        struct test_node key;
+        key.value = i;
+        free_bp_tree_node(bp_tree_delete(&tree, &key.core));
+    }
+
+    assert(bp_tree_wal_close(&wal) == 0);
+
+    /* Process stopped while next checkpoint wrote snapshot: torn file is left aside */
+    char page[BP_TREE_SNAPSHOT_PAGE_SIZE];
+    memset(page, 0x5a, sizeof(page));
+    int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(write(fd, page, sizeof(page) / 2) == (ssize_t)(sizeof(page) / 2));
+    close(fd);
+
+    bp_tree_init(&recovered, 8, node_cmp);
+    assert(bp_tree_wal_replay(&recovered, snapshot_path, wal_path, sizeof(int), decode_node, free_bp_tree_node) == 1500);
+    assert_same_keys(&tree, &recovered);
+
+    /* Next checkpoint replaces torn file */
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    bp_tree_set_wal(&recovered, &wal);
+    assert(bp_tree_snapshot_write(&recovered, snapshot_path, sizeof(int), encode_node) == 0);
+    assert(bp_tree_wal_truncate(&wal) == 0);
+    assert(access(temporary_path, F_OK) != 0);
+    assert(bp_tree_wal_close(&wal) == 0);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    bp_tree_init(&recovered, 8, node_cmp);
+    assert(bp_tree_wal_replay(&recovered, snapshot_path, wal_path, sizeof(int), decode_node, free_bp_tree_node) == 0);
+    assert_same_keys(&tree, &recovered);
+    bp_tree_free(&recovered, free_bp_tree_node);
+
+    bp_tree_free(&tree, free_bp_tree_node);
+    unlink(wal_path);
+    unlink(snapshot_path);
+    return 0;
+}
+
+int bp_tree_wal_test_4(void *unused)
+{
+    char wal_path[64];
+    char snapshot_path[64];
+    struct bp_tree tree;
+    struct bp_tree_wal wal;
+    struct test_node key;
+    test_paths(wal_path, snapshot_path, sizeof(wal_path));
+
+    bp_tree_init(&tree, 8, node_cmp);
+    assert(bp_tree_wal_open(&wal, wal_path, sizeof(int), encode_node) == 0);
+    bp_tree_set_wal(&tree, &wal);
+
+    struct bp_tree_node *previous;
+
+    for (int i = 0; i < 100; i++)
+    {
+        assert(bp_tree_try_insert(&tree, &new_node(i)->core, &previous) == 0 && previous == NULL);
+    }
+
+    /* Log file is replaced by read only descriptor, so next write fails */
+    int fd = open(wal_path, O_RDONLY);
+    assert(dup2(fd, wal.fd) == wal.fd);
+    close(fd);
+
+    assert(bp_tree_try_insert(&tree, &new_node(100)->core, &previous) == BP_TREE_ERROR_WAL && wal.failed);
+    assert(previous == NULL);
+    key.value = 100;
+    assert(bp_tree_lookup(&tree, &key.core) != NULL);
+
+    /* Failed log commits nothing after it, change is still applied */
+    key.value = 0;
+    struct bp_tree_node *deleted;
+    assert(bp_tree_try_delete(&tree, &key.core, &deleted) == BP_TREE_ERROR_WAL && deleted != NULL);
+    free_bp_tree_node(deleted);
+
+    /* Delete of missing key logs nothing, so it does not fail */
+    assert(bp_tree_try_delete(&tree, &key.core, &deleted) == 0 && deleted == NULL);
+
+    struct bp_tree_node *nodes[10];
+    struct bp_tree_batch batch = {nodes, 10};
+
+    for (int i = 0; i < 10; i++)
+    {
+        nodes[i] = &new_node(200 + i)->core;
+    }
+
+    struct bp_tree_batch *replaced = bp_tree_insert_batch(&tree, &batch);
+    assert(replaced != NULL && replaced->size == 0 && replaced->error == BP_TREE_ERROR_WAL);
+
+    /* Entries after failure are not kept */
+    assert(wal.buffer == NULL && wal.buffer_size == 0 && wal.appended > wal.durable);
+    free(replaced->nodes);
+    free(replaced);
+
+    /* Lookup batch does not write log */
+    struct bp_tree_batch *found = bp_tree_lookup_batch(&tree, &batch);
+    assert(found != NULL && found->size == 10 && found->error == 0);
+    free(found->nodes);
+    free(found);
+
+    struct bp_tree_batch *removed = bp_tree_delete_batch(&tree, &batch);
+    assert(removed != NULL && removed->size == 10 && removed->error == BP_TREE_ERROR_WAL);
+
+    for (int i = 0; i < removed->size; i++)
+    {
+        free_bp_tree_node(removed->nodes[i]);
+    }
+
+    free(removed->nodes);
+    free(removed);
+
+    assert(bp_tree_clear(&tree, free_bp_tree_node) == BP_TREE_ERROR_WAL);
+    assert(tree.size == 0);
+
+    assert(bp_tree_wal_close(&wal) == -1);
+    bp_tree_free(&tree, free_bp_tree_node);
+    unlink(wal_path);
+    return 0;
+}
+
+int main()
+{
+    run_test(bp_tree_wal_test_1, (void *)NULL);
+    run_test(bp_tree_wal_test_2, (void *)NULL);
+    run_test(bp_tree_wal_test_3, (void *)NULL);
+    run_test(bp_tree_wal_test_4, (void *)NULL);
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <concurrent_hash_map.h>
+#include <epoch.h>
+
+struct test_hash_node
+{
+    struct hash_map_node core;
+    int value;
+};
+
+struct test_thread
+{
+    struct concurrent_hash_map *map;
+    struct epoch *domain;
+    int first;
+    int n;
+    int stop;
+};
+
+static int hash_node_hash(struct hash_map_node *node)
+{
+    int value = ((struct test_hash_node *)node)->value;
+    return value < 0 ? -value : value;
+}
+
+static int hash_node_cmp(struct hash_map_node *first, struct hash_map_node *second)
+{
+    int first_value = ((struct test_hash_node *)first)->value;
+    int second_value = ((struct test_hash_node *)second)->value;
+
+    if (first_value < second_value)
+    {
+        return -1;
+    }
+    else if (first_value > second_value)
+    {
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+static void free_hash_map_node(struct hash_map_node *node)
+{
+    free(node);
+}
+
+static void free_retired_node(void *node)
+{
+    free(node);
+}
+
+int lookup_int_concurrent_hash_map(struct concurrent_hash_map *map, struct epoch_thread *thread, int val)
+{
+    struct test_hash_node node;
+    node.value = val;
+
+    epoch_enter(thread);
+    struct hash_map_node *result = concurrent_hash_map_find(map, &node.core);
+    int res = result == NULL ? -1 : ((struct test_hash_node *)result)->value;
+    epoch_exit(thread);
+
+    return res;
+}
+
+int insert_int_concurrent_hash_map(struct concurrent_hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = concurrent_hash_map_insert(map, &node->core);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        epoch_retire(map->domain, result, free_retired_node);
+        return res;
+    }
+}
+
+int delete_int_concurrent_hash_map(struct concurrent_hash_map *map, int val)
+{
+    struct test_hash_node node;
+    node.value = val;
+
+    struct hash_map_node *result = concurrent_hash_map_delete(map, &node.core);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        epoch_retire(map->domain, result, free_retired_node);
+        return res;
+    }
+}
+
+static void *lookup_stable_keys(void *context)
+{
+    struct test_thread *reader = (struct test_thread *)context;
+    struct epoch_thread thread;
+    epoch_register(reader->domain, &thread);
+
+    do
+    {
+        for (int i = reader->first; i < reader->first + reader->n; i++)
+        {
+            assert(i == lookup_int_concurrent_hash_map(reader->map, &thread, i));
+        }
+    } while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE));
+
+    epoch_unregister(&thread);
+    return NULL;
+}
+
+static void *update_own_keys(void *context)
+{
+    struct test_thread *writer = (struct test_thread *)context;
+
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = writer->first; i < writer->first + writer->n; i++)
+        {
+            assert(-1 == insert_int_concurrent_hash_map(writer->map, i));
+        }
+
+        for (int i = writer->first; i < writer->first + writer->n; i += 2)
+        {
+            assert(i == insert_int_concurrent_hash_map(writer->map, i));
+        }
+
+        for (int i = writer->first; i < writer->first + writer->n; i++)
+        {
+            assert(i == delete_int_concurrent_hash_map(writer->map, i));
+        }
+    }
+
+    return NULL;
+}
+
+int concurrent_hash_map_test_1(void *unused)
+{
+    struct epoch domain;
+    struct epoch_thread thread;
+    struct concurrent_hash_map *map = (struct concurrent_hash_map *)malloc(sizeof(struct concurrent_hash_map));
+    epoch_init(&domain);
+    epoch_register(&domain, &thread);
+    concurrent_hash_map_init(map, hash_node_cmp, hash_node_hash, &domain);
+    int n = 100000;
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(-1 == lookup_int_concurrent_hash_map(map, &thread, i));
+        assert(-1 == insert_int_concurrent_hash_map(map, i));
+        assert(i == lookup_int_concurrent_hash_map(map, &thread, i));
+    }
+
+    assert(map->size == n);
+    assert(map->table->capacity >= n);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == insert_int_concurrent_hash_map(map, i));
+    }
+
+    assert(map->size == n);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == delete_int_concurrent_hash_map(map, i));
+        assert(-1 == lookup_int_concurrent_hash_map(map, &thread, i));
+    }
+
+    assert(map->size == 0);
+    assert(map->table->capacity == CONCURRENT_HASH_MAP_MIN_CAPACITY);
+
+    concurrent_hash_map_free(map, free_hash_map_node);
+    epoch_unregister(&thread);
+    epoch_free(&domain);
+    free(map);
+    return 0;
+}
+
+int concurrent_hash_map_test_2(void *unused)
+{
+    struct epoch domain;
+    struct concurrent_hash_map *map = (struct concurrent_hash_map *)malloc(sizeof(struct concurrent_hash_map));
+    epoch_init(&domain);
+    concurrent_hash_map_init(map, hash_node_cmp, hash_node_hash, &domain);
+    int n = 5000;
+
+    for (int i = 0; i < n; i++)
+    {
+        insert_int_concurrent_hash_map(map, i);
+    }
+
+    /* Writers grow and shrink table under readers of stable keys */
+    struct test_thread contexts[8];
+    pthread_t threads[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        contexts[i].map = map;
+        contexts[i].domain = &domain;
+        contexts[i].first = i < 4 ? 0 : n * (i - 3);
+        contexts[i].n = n;
+        contexts[i].stop = 0;
+        pthread_create(&threads[i], NULL, i < 4 ? lookup_stable_keys : update_own_keys, &contexts[i]);
+    }
+
+    for (int i = 4; i < 8; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        __atomic_store_n(&contexts[i].stop, 1, __ATOMIC_RELEASE);
+        pthread_join(threads[i], NULL);
+    }
+
+    assert(map->size == n);
+
+    concurrent_hash_map_free(map, free_hash_map_node);
+    epoch_free(&domain);
+    free(map);
+    return 0;
+}
+
+int main()
+{
+    run_test(concurrent_hash_map_test_1, (void *)NULL);
+    run_test(concurrent_hash_map_test_2, (void *)NULL);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <sched.h>
+
+#include <epoch.h>
+
+static int freed_count;
+
+static void count_free(void *pointer)
+{
+    freed_count++;
+    free(pointer);
+}
+
+int epoch_test_1(void *unused)
+{
+    struct epoch domain;
+    struct epoch_thread reader;
+    struct epoch_thread writer;
+
+    assert(epoch_init(&domain) == 0);
+    epoch_register(&domain, &reader);
+    epoch_register(&domain, &writer);
+    freed_count = 0;
+
+    /* Pointer retired while reader is pinned is not freed until reader unpins */
+    epoch_enter(&reader);
+    assert(epoch_retire(&domain, malloc(16), count_free) == 0);
+
+    for (int i = 0; i < 10; i++)
+    {
+        assert(epoch_reclaim(&domain) == 0);
+    }
+
+    epoch_exit(&reader);
+
+    int reclaimed = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        reclaimed += epoch_reclaim(&domain);
+    }
+
+    assert(reclaimed == 1);
+    assert(freed_count == 1);
+
+    /* Unpinned threads do not block reclamation */
+    for (int i = 0; i < EPOCH_RECLAIM_THRESHOLD * 10; i++)
+    {
+        epoch_enter(&writer);
+        epoch_exit(&writer);
+        assert(epoch_retire(&domain, malloc(16), count_free) == 0);
+    }
+
+    assert(domain.retired_count < EPOCH_RECLAIM_THRESHOLD * 10);
+
+    epoch_unregister(&reader);
+    epoch_unregister(&writer);
+    epoch_free(&domain);
+    assert(freed_count == EPOCH_RECLAIM_THRESHOLD * 10 + 1);
+    assert(domain.reclaimed == freed_count);
+    return 0;
+}
+
+int epoch_test_2(void *unused)
+{
+    struct epoch domain;
+    struct epoch_thread reader;
+    struct epoch_thread writer;
+
+    assert(epoch_init(&domain) == 0);
+    epoch_register(&domain, &reader);
+    epoch_register(&domain, &writer);
+    freed_count = 0;
+
+    /* Thread list is freed by thread itself when nobody is pinned */
+    for (int i = 0; i < EPOCH_RECLAIM_THRESHOLD * 10; i++)
+    {
+        assert(epoch_thread_retire(&writer, malloc(16), count_free) == 0);
+    }
+
+    assert(freed_count > 0);
+    assert(writer.retired_count < EPOCH_RECLAIM_THRESHOLD * 10);
+
+    /* Pinned reader keeps thread list, unregister passes it to domain */
+    epoch_enter(&reader);
+
+    for (int i = 0; i < EPOCH_RECLAIM_THRESHOLD * 4; i++)
+    {
+        assert(epoch_thread_retire(&writer, malloc(16), count_free) == 0);
+    }
+
+    int kept = writer.retired_count;
+    assert(kept >= EPOCH_RECLAIM_THRESHOLD * 4);
+    epoch_unregister(&writer);
+    assert(domain.retired_count == kept);
+    epoch_reclaim(&domain);
+    assert(domain.retired_count >= EPOCH_RECLAIM_THRESHOLD * 4);
+    epoch_exit(&reader);
+
+    /* Drain thread frees domain list without explicit reclaim */
+    assert(epoch_start_drain(&domain, 1) == 0);
+    assert(epoch_start_drain(&domain, 1) == -1);
+
+    while (__atomic_load_n(&domain.reclaimed, __ATOMIC_ACQUIRE) != EPOCH_RECLAIM_THRESHOLD * 14)
+    {
+        sched_yield();
+    }
+
+    epoch_stop_drain(&domain);
+    assert(freed_count == EPOCH_RECLAIM_THRESHOLD * 14);
+
+    epoch_unregister(&reader);
+    epoch_free(&domain);
+    return 0;
+}
+
+int main()
+{
+    run_test(epoch_test_1, (void *)NULL);
+    run_test(epoch_test_2, (void *)NULL);
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include <hash_map.h>
+#include <flat_hash_map.h>
+
+struct test_hash_node
+{
+    struct hash_map_node core;
+    int value;
+};
+
+static int hash_node_hash(struct hash_map_node *node)
+{
+    int value = ((struct test_hash_node *)node)->value;
+    return value < 0 ? -value : value;
+}
+
+static int hash_node_cmp(struct hash_map_node *first, struct hash_map_node *second)
+{
+    int first_value = ((struct test_hash_node *)first)->value;
+    int second_value = ((struct test_hash_node *)second)->value;
+
+    if (first_value < second_value)
+    {
+        return -1;
+    }
+    else if (first_value > second_value)
+    {
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+static void free_hash_map_node(struct hash_map_node *node)
+{
+    free(node);
+}
+
+int lookup_int_flat_hash_map(struct flat_hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = flat_hash_map_find(map, &node->core);
+    free(node);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        return res;
+    }
+}
+
+int insert_int_flat_hash_map(struct flat_hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = flat_hash_map_insert(map, &node->core);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        free(result);
+        return res;
+    }
+}
+
+int delete_int_flat_hash_map(struct flat_hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = flat_hash_map_delete(map, &node->core);
+    free(node);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        free(result);
+        return res;
+    }
+}
+
+int lookup_int_hash_map(struct hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = hash_map_find(map, &node->core);
+    free(node);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        return res;
+    }
+}
+
+int insert_int_hash_map(struct hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = hash_map_insert(map, &node->core);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        free(result);
+        return res;
+    }
+}
+
+int delete_int_hash_map(struct hash_map *map, int val)
+{
+    struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    node->value = val;
+
+    struct hash_map_node *result = hash_map_delete(map, &node->core);
+    free(node);
+
+    if (result == NULL)
+    {
+        return -1;
+    }
+    else
+    {
+        int res = ((struct test_hash_node *)result)->value;
+        free(result);
+        return res;
+    }
+}
+
+int flat_hash_map_test_1(void *unused)
+{
+    struct flat_hash_map *map = (struct flat_hash_map *)malloc(sizeof(struct flat_hash_map));
+    flat_hash_map_init(map, hash_node_cmp, hash_node_hash);
+    int n = 100000;
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(-1 == lookup_int_flat_hash_map(map, i));
+        assert(-1 == insert_int_flat_hash_map(map, i));
+        assert(i == lookup_int_flat_hash_map(map, i));
+    }
+
+    assert(map->size == n);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == insert_int_flat_hash_map(map, i));
+    }
+
+    assert(map->size == n);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == delete_int_flat_hash_map(map, i));
+        assert(-1 == lookup_int_flat_hash_map(map, i));
+    }
+
+    assert(map->size == 0);
+    assert(map->capacity == FLAT_HASH_MAP_MIN_CAPACITY);
+
+    flat_hash_map_free(map, free_hash_map_node);
+    free(map);
+    return 0;
+}
+
+int flat_hash_map_test_2(void *unused)
+{
+    struct flat_hash_map *flat_map = (struct flat_hash_map *)malloc(sizeof(struct flat_hash_map));
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    flat_hash_map_init(flat_map, hash_node_cmp, hash_node_hash);
+    hash_map_init(map, hash_node_cmp, hash_node_hash);
+    int n = 1000000;
+    int m = 1000;
+
+    for (int i = 0; i < n; i++)
+    {
+        int value = rand() % m;
+        int op = rand() % 3;
+
+        if (op == 0)
+        {
+            assert(lookup_int_hash_map(map, value) == lookup_int_flat_hash_map(flat_map, value));
+        }
+        else if (op == 1)
+        {
+            assert(insert_int_hash_map(map, value) == insert_int_flat_hash_map(flat_map, value));
+        }
+        else if (op == 2)
+        {
+            assert(delete_int_hash_map(map, value) == delete_int_flat_hash_map(flat_map, value));
+        }
+
+        assert(map->size == flat_map->size);
+    }
+
+    flat_hash_map_free(flat_map, free_hash_map_node);
+    hash_map_free(map, free_hash_map_node);
+    free(flat_map);
+    free(map);
+    return 0;
+}
+
+static int compared = 0;
+
+static int counting_node_cmp(struct hash_map_node *first, struct hash_map_node *second)
+{
+    compared++;
+    return hash_node_cmp(first, second);
+}
+
+int flat_hash_map_test_3(void *unused)
+{
+    struct flat_hash_map *map = (struct flat_hash_map *)malloc(sizeof(struct flat_hash_map));
+    struct test_hash_node key;
+    int n = 1000;
+
+    flat_hash_map_init(map, counting_node_cmp, hash_node_hash);
+    compared = 0;
+
+    /* Keys of distinct hashes which share 7 bit tag in probed group are rejected by cached hash */
+    for (int i = 1; i <= n; i++)
+    {
+        struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+        node->value = i;
+        assert(flat_hash_map_insert(map, &node->core) == NULL);
+    }
+
+    long long skipped = map->skipped_comparisons;
+    assert(compared == 0 && skipped > 0);
+
+    /* Lookup calls comparator only for item of same hash and does not write map */
+    for (int i = 1; i <= n; i++)
+    {
+        key.value = i;
+        assert(((struct test_hash_node *)flat_hash_map_find(map, &key.core))->value == i);
+    }
+
+    key.value = n + 1;
+    assert(flat_hash_map_find(map, &key.core) == NULL);
+    assert(compared == n && map->skipped_comparisons == skipped);
+
+    /* Keys of same hash (value and -value) are compared */
+    key.value = -1;
+    assert(flat_hash_map_delete(map, &key.core) == NULL);
+    assert(compared == n + 1);
+
+    for (int i = 1; i <= n; i++)
+    {
+        key.value = i;
+        free(flat_hash_map_delete(map, &key.core));
+    }
+
+    assert(compared == 2 * n + 1 && map->size == 0);
+    assert(map->skipped_comparisons > skipped);
+
+    flat_hash_map_free(map, free_hash_map_node);
+    free(map);
+    return 0;
+}
+
+int main()
+{
+    run_test(flat_hash_map_test_1, (void *)NULL);
+    run_test(flat_hash_map_test_2, (void *)NULL);
+    run_test(flat_hash_map_test_3, (void *)NULL);
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <hash_map.hpp>
+
+/**
+ * Allocator which counts live allocations in shared counter, allocators with same counter are equal.
+ */
+template <class T>
+struct counting_allocator
+{
+    using value_type = T;
+
+    explicit counting_allocator(long *live) : live(live)
+    {
+    }
+
+    template <class U>
+    counting_allocator(const counting_allocator<U> &other) : live(other.live)
+    {
+    }
+
+    T *allocate(std::size_t size)
+    {
+        ++*live;
+        return static_cast<T *>(::operator new(size * sizeof(T)));
+    }
+
+    void deallocate(T *pointer, std::size_t)
+    {
+        --*live;
+        ::operator delete(pointer);
+    }
+
+    template <class U>
+    bool operator==(const counting_allocator<U> &other) const
+    {
+        return live == other.live;
+    }
+
+    template <class U>
+    bool operator!=(const counting_allocator<U> &other) const
+    {
+        return live != other.live;
+    }
+
+    long *live;
+};
+
+/**
+ * FNV-1a hash of std::string and C string, same for equal keys.
+ */
+struct string_hash
+{
+    using is_transparent = void;
+
+    std::size_t operator()(const char *key, std::size_t size) const
+    {
+        std::size_t hash = 2166136261u;
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+        }
+
+        return hash;
+    }
+
+    std::size_t operator()(const std::string &key) const
+    {
+        return (*this)(key.data(), key.size());
+    }
+
+    std::size_t operator()(const char *key) const
+    {
+        return (*this)(key, strlen(key));
+    }
+};
+
+/**
+ * Hash with few values, so chains contain different keys of same hash.
+ */
+struct collide_hash
+{
+    std::size_t operator()(int key) const
+    {
+        return key % 5;
+    }
+};
+
+using int_map = strlib::hash_map<int, int>;
+using collide_map = strlib::hash_map<int, int, collide_hash>;
+using string_map = strlib::hash_map<std::string,
+                                    std::unique_ptr<int>,
+                                    string_hash,
+                                    std::equal_to<>,
+                                    counting_allocator<std::pair<const std::string, std::unique_ptr<int>>>>;
+
+int hash_map_hpp_test_1(void *unused)
+{
+    int_map map;
+
+    assert(map.empty() && map.begin() == map.end() && map.find(1) == map.end());
+
+    for (int i = 0; i < 1000; i++)
+    {
+        assert(map.insert({i, i * 2}).second);
+
+        /* Walk covers both tables while rehash is in progress */
+        if (i % 97 == 0)
+        {
+            int count = 0;
+
+            for (const auto &item : map)
+            {
+                assert(item.second == item.first * 2);
+                count++;
+            }
+
+            assert(count == i + 1);
+        }
+    }
+
+    assert(!map.insert({5, 0}).second && map.at(5) == 10);
+    assert(!map.try_emplace(5, 0).second && map[5] == 10);
+    assert(!map.insert_or_assign(5, 11).second && map.at(5) == 11);
+    assert(map.size() == 1000 && map.native()->size == 1000);
+    assert(map.count(999) == 1 && map.count(1000) == 0 && map.contains(0) && !map.contains(-1));
+
+    bool thrown = false;
+
+    try
+    {
+        map.at(1000);
+    }
+    catch (const std::out_of_range &)
+    {
+        thrown = true;
+    }
+
+    assert(thrown);
+
+    assert(map.erase_if([](const int_map::value_type &item) { return item.first % 3 == 0; }) == 334);
+    assert(map.size() == 666);
+    assert(map.erase(1) == 1 && map.erase(1) == 0 && map.erase(3) == 0);
+    map.erase(map.find(2));
+    assert(map.size() == 664 && !map.contains(2));
+
+    /* Shrink rehash keeps items */
+    for (int i = 0; i < 1000; i += 2)
+    {
+        map.erase(i);
+    }
+
+    int count = 0;
+
+    for (const auto &item : map)
+    {
+        assert(item.first % 2 == 1 && item.first % 3 != 0 && item.first != 1);
+        assert(item.second == (item.first == 5 ? 11 : item.first * 2));
+        assert(map.find(item.first)->second == item.second);
+        count++;
+    }
+
+    assert(count == (int)map.size() && count == 332);
+
+    int_map copy = map;
+    assert(copy.size() == map.size() && copy.at(997) == 1994);
+    copy[-1] = 1;
+    assert(copy.size() == map.size() + 1 && !map.contains(-1));
+
+    map.clear();
+    assert(map.empty() && map.begin() == map.end() && map.bucket_count() == 0);
+    map[7] = 7;
+    assert(map.size() == 1 && map.begin()->second == 7);
+
+    /* Keys of same hash */
+    collide_map collide;
+
+    for (int i = 0; i < 100; i++)
+    {
+        collide[i] = i;
+    }
+
+    for (int i = 0; i < 100; i += 2)
+    {
+        assert(collide.erase(i) == 1);
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        assert(collide.contains(i) == (i % 2 == 1));
+    }
+
+    return 0;
+}
+
+int hash_map_hpp_test_2(void *unused)
+{
+    long live = 0;
+
+    {
+        counting_allocator<std::pair<const std::string, std::unique_ptr<int>>> allocator(&live);
+        string_map map(allocator);
+
+        for (int i = 0; i < 100; i++)
+        {
+            map.try_emplace(std::to_string(i), std::unique_ptr<int>(new int(i)));
+        }
+
+        /* Nodes of items and struct hash_map */
+        assert(live == 101);
+
+        /* Heterogeneous lookup does not construct std::string */
+        assert(*map.find("42")->second == 42);
+        assert(map.find("420") == map.end());
+        assert(map.count("7") == 1 && map.erase("7") == 1 && map.count("7") == 0);
+        assert(live == 100);
+
+        /* Move takes nodes */
+        string_map moved = std::move(map);
+        assert(map.empty() && map.find("42") == map.end() && moved.size() == 99);
+        assert(*moved.at("99") == 99 && live == 100);
+
+        map = std::move(moved);
+        assert(moved.empty() && map.size() == 99);
+
+        map.emplace("100", std::unique_ptr<int>(new int(100)));
+        assert(*map.at("100") == 100 && live == 101);
+    }
+
+    assert(live == 0);
+    return 0;
+}
+
+int main()
+{
+    run_test(hash_map_hpp_test_1, (void *)NULL);
+    run_test(hash_map_hpp_test_2, (void *)NULL);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <hash_map.h>
+#include <hash_map_specialize.h>
 
 struct test_hash_node
 {
@@ -156,8 +157,233 @@ int hash_map_test_1(void *unused)
     return 0;
 }
 
+int hash_map_test_2(void *unused)
+{
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    hash_map_init(map, hash_node_cmp, hash_node_hash);
+    int n = 100000;
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(-1 == insert_int_hash_map(map, i));
+        assert(i == lookup_int_hash_map(map, i));
+    }
+
+    assert(map->size == n);
+    assert(map->capacity >= n / 2);
+    assert(map->skipped_comparisons > 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        assert(i == lookup_int_hash_map(map, i));
+    }
+
+    for (int i = 0; i < n; i += 2)
+    {
+        assert(i == delete_int_hash_map(map, i));
+        assert(-1 == lookup_int_hash_map(map, i));
+    }
+
+    for (int i = 1; i < n; i += 2)
+    {
+        assert(i == lookup_int_hash_map(map, i));
+        assert(i == delete_int_hash_map(map, i));
+    }
+
+    for (int i = 0; i < 2 * HASH_MAP_MIN_CAPACITY * HASH_MAP_REHASH_STEP; i++)
+    {
+        assert(-1 == lookup_int_hash_map(map, i));
+    }
+
+    assert(map->size == 0);
+    assert(map->capacity == HASH_MAP_MIN_CAPACITY);
+    assert(map->old_buckets == NULL);
+
+    hash_map_free(map, free_hash_map_node);
+    free(map);
+    return 0;
+}
+
+static inline int test_hash_node_hash(const struct test_hash_node *node)
+{
+    return node->value < 0 ? -node->value : node->value;
+}
+
+static inline int test_hash_node_compare(const struct test_hash_node *first, const struct test_hash_node *second)
+{
+    return first->value < second->value ? -1 : first->value > second->value ? 1 : 0;
+}
+
+HASH_MAP_SPECIALIZE(test_map, struct test_hash_node, core, test_hash_node_hash, test_hash_node_compare)
+
+int hash_map_test_3(void *unused)
+{
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    struct test_hash_node key;
+    int n = 50000;
+    int rehashing = 0;
+
+    test_map_init(map);
+
+    for (int i = 0; i < n; i++)
+    {
+        struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+        node->value = i - n / 2;
+        assert(test_map_insert(map, node) == NULL);
+
+        /* Keys are found in both tables while rehash is in progress */
+        rehashing += map->old_buckets != NULL;
+        key.value = i - n / 2;
+        assert(test_map_find(map, &key) == node);
+        key.value = i - n / 2 + 1;
+        assert(test_map_find(map, &key) == NULL);
+    }
+
+    assert(rehashing > 0);
+
+    for (int i = 0; i < n; i += 2)
+    {
+        key.value = i - n / 2;
+        free(test_map_delete(map, &key));
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        key.value = i - n / 2;
+        struct test_hash_node *found = test_map_find(map, &key);
+        assert(found == (struct test_hash_node *)hash_map_find(map, &key.core));
+        assert(i % 2 == 0 ? found == NULL : found->value == key.value);
+    }
+
+    hash_map_free(map, free_hash_map_node);
+    free(map);
+    return 0;
+}
+
+static int int_key_cmp(const void *key, struct hash_map_node *node)
+{
+    int key_value = *(const int *)key;
+    int node_value = ((struct test_hash_node *)node)->value;
+    return key_value < node_value ? -1 : key_value > node_value ? 1 : 0;
+}
+
+int hash_map_test_4(void *unused)
+{
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    int n = 50000;
+    int rehashing = 0;
+
+    hash_map_init(map, hash_node_cmp, hash_node_hash);
+
+    for (int i = 0; i < n; i++)
+    {
+        struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+        int value = i - n / 2;
+        node->value = value;
+        assert(hash_map_insert(map, &node->core) == NULL);
+
+        /* Find by key does not migrate buckets and finds keys in both tables */
+        int rehash_index = map->rehash_index;
+        long long skipped = map->skipped_comparisons;
+        rehashing += map->old_buckets != NULL;
+        assert(hash_map_find_key(map, &value, value < 0 ? -value : value, int_key_cmp) == &node->core);
+        value++;
+        assert(hash_map_find_key(map, &value, value < 0 ? -value : value, int_key_cmp) == NULL);
+        assert(map->rehash_index == rehash_index && map->skipped_comparisons == skipped);
+    }
+
+    assert(rehashing > 0);
+
+    for (int i = 0; i < n; i += 2)
+    {
+        struct test_hash_node key;
+        key.value = i - n / 2;
+        free(hash_map_delete(map, &key.core));
+    }
+
+    /* Keys of same hash (value and -value) are ordered by comparator */
+    for (int i = 0; i < n; i++)
+    {
+        int value = i - n / 2;
+        struct test_hash_node *found = (struct test_hash_node *)hash_map_find_key(map, &value, value < 0 ? -value : value, int_key_cmp);
+        assert(i % 2 == 0 ? found == NULL : found->value == value);
+    }
+
+    hash_map_free(map, free_hash_map_node);
+    free(map);
+    return 0;
+}
+
+static int compared = 0;
+
+static int counting_node_cmp(struct hash_map_node *first, struct hash_map_node *second)
+{
+    compared++;
+    return hash_node_cmp(first, second);
+}
+
+static int colliding_node_hash(struct hash_map_node *node)
+{
+    /* Low bits are equal, so all keys fall into one bucket */
+    return hash_node_hash(node) << 12;
+}
+
+int hash_map_test_5(void *unused)
+{
+    struct hash_map *map = (struct hash_map *)malloc(sizeof(struct hash_map));
+    struct test_hash_node key;
+    int n = 8;
+
+    /* Map is not rehashed, so comparator is called only by operations */
+    hash_map_init(map, counting_node_cmp, colliding_node_hash);
+    compared = 0;
+
+    /* Chain is sorted by hash, insert walks all nodes of smaller hash without comparator */
+    for (int i = 1; i <= n; i++)
+    {
+        struct test_hash_node *node = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+        node->value = i;
+        assert(hash_map_insert(map, &node->core) == NULL);
+    }
+
+    assert(compared == 0);
+    assert(map->skipped_comparisons == n * (n - 1) / 2);
+
+    /* Lookup calls comparator only for node of same hash and does not write map */
+    for (int i = 1; i <= n; i++)
+    {
+        key.value = i;
+        assert(((struct test_hash_node *)hash_map_find(map, &key.core))->value == i);
+    }
+
+    key.value = n + 1;
+    assert(hash_map_find(map, &key.core) == NULL);
+    assert(compared == n);
+    assert(map->skipped_comparisons == n * (n - 1) / 2);
+
+    /* Keys of same hash (value and -value) are compared */
+    struct test_hash_node *negative = (struct test_hash_node *)malloc(sizeof(struct test_hash_node));
+    negative->value = -1;
+    assert(hash_map_insert(map, &negative->core) == NULL);
+    assert(compared == n + 1);
+    assert(map->skipped_comparisons == n * (n - 1) / 2);
+
+    key.value = n;
+    free(hash_map_delete(map, &key.core));
+    assert(compared == n + 2);
+    assert(map->skipped_comparisons == n * (n - 1) / 2 + n);
+
+    hash_map_free(map, free_hash_map_node);
+    free(map);
+    return 0;
+}
+
 int main()
 {
     run_test(hash_map_test_1, (void *)NULL);
+    run_test(hash_map_test_2, (void *)NULL);
+    run_test(hash_map_test_3, (void *)NULL);
+    run_test(hash_map_test_4, (void *)NULL);
+    run_test(hash_map_test_5, (void *)NULL);
     return 1;
 }